@@ -0,0 +1,31 @@
+# Runs each of the benchmark executables in turn, and concatenates their output into one file.
+#
+# Usage: cmake -DEXECUTABLES=<list> -DFORMAT=<csv|json> -DOUTPUT=<file> [-DPERF=ON] -P RunAll.cmake
+file(WRITE ${OUTPUT} "")
+
+set(FIRST TRUE)
+foreach(EXECUTABLE IN LISTS EXECUTABLES)
+    set(ARGS --format ${FORMAT})
+    if(PERF)
+        list(APPEND ARGS --perf)
+    endif()
+    # CSV output only gets a header line once
+    if(NOT FIRST)
+        list(APPEND ARGS --no-header)
+    endif()
+    set(FIRST FALSE)
+
+    execute_process(COMMAND ${EXECUTABLE} ${ARGS}
+        OUTPUT_VARIABLE RESULTS
+        RESULT_VARIABLE STATUS
+    )
+    if(NOT STATUS EQUAL 0)
+        message(FATAL_ERROR "Benchmark ${EXECUTABLE} failed: ${STATUS}")
+    endif()
+
+    file(APPEND ${OUTPUT} "${RESULTS}")
+endforeach()
+
+file(READ ${OUTPUT} RESULTS)
+message("${RESULTS}")
+message(STATUS "Benchmark results written to ${OUTPUT}")
@@ -0,0 +1,558 @@
+/*
+ * Benchmark of the lifecycle costs of cothreads, for a single platform implementation: creation,
+ * the first switch into a new cothread, steady state context switches, destruction, and memory
+ * used per cothread. Each platform gets its own copy of this executable; the `benchmark` target
+ * runs all of them.
+ *
+ * Results are written to stdout, one line per measurement, either as CSV or as JSON objects.
+ *
+ * With `--perf`, hardware performance counters are also collected around the context switches,
+ * where the host supports them.
+ *
+ * Steady state context switches are also measured with the cothread saving its floating point
+ * control registers (`switch_fp_control`) and its full extended state (`switch_full`), as selected
+ * by its context profile.
+ *
+ * On platforms that support shared stacks, context switches between cothreads on a shared stack
+ * (which copy their stacks in and out of it) and the memory an idle cothread holds on to are also
+ * measured. These are reported with the stack type `shared`; the stack size column holds the
+ * depth of the cothreads' call stacks instead.
+ */
+#include <libcommunism/Cothread.h>
+#include <libcommunism/PerfCounters.h>
+#include <libcommunism/SharedStack.h>
+#include <libcommunism/StackPool.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+using namespace libcommunism;
+using Clock = std::chrono::steady_clock;
+
+#ifndef BENCH_PLATFORM
+#define BENCH_PLATFORM "unknown"
+#endif
+
+namespace {
+/**
+ * @brief Parameters of a benchmark run
+ */
+struct Options {
+    /// Output results as JSON objects, rather than CSV
+    bool json{false};
+    /// Omit the CSV header line
+    bool noHeader{false};
+    /// Collect hardware performance counters
+    bool perf{false};
+    /// Number of cothreads to create for the lifecycle and memory measurements
+    size_t count{1000};
+    /// Number of round trips for the steady state context switch measurement
+    size_t switches{1'000'000};
+    /// Number of times each measurement is repeated; the median is reported.
+    size_t repetitions{5};
+    /// Stack sizes to measure with, in bytes
+    std::vector<size_t> stackSizes{16 * 1024, 64 * 1024, 256 * 1024};
+    /// Call stack depths of cothreads on a shared stack to measure with, in bytes
+    std::vector<size_t> sharedDepths{256, 1024, 4096};
+};
+
+/**
+ * @brief Lifecycle timings of one repetition, in nanoseconds per cothread
+ */
+struct Lifecycle {
+    double create{0};
+    double firstSwitch{0};
+    double destroy{0};
+
+    /// Counters for the first run slice of each cothread, onto its cold stack
+    PerfCounters::Sample firstSlice;
+    /// Counters for a later run slice of each cothread, cycling through all of them
+    PerfCounters::Sample slice;
+};
+
+/**
+ * @brief Memory usage of the process, in bytes
+ */
+struct Memory {
+    size_t virt{0};
+    size_t resident{0};
+};
+
+/// Cothread that benchmarked cothreads switch back to
+Cothread *gMain{nullptr};
+/// Performance counters, if requested
+PerfCounters *gCounters{nullptr};
+
+/**
+ * Entry point of benchmarked cothreads: switch back to the main cothread forever. The cothread is
+ * deleted while suspended.
+ */
+void BenchEntry() {
+    while(true) {
+        gMain->switchTo();
+    }
+}
+
+/**
+ * Entry point of benchmarked cothreads on a shared stack: recurse until (at least) the given
+ * number of bytes of stack are in use, then switch back to the main cothread for as long as
+ * there is one. The cothread is deleted while suspended.
+ */
+#if defined(_MSC_VER)
+__declspec(noinline)
+#else
+__attribute__((noinline))
+#endif
+void SharedBenchEntry(const size_t depth) {
+    constexpr static const size_t kFrameSize{256};
+    volatile std::byte frame[kFrameSize];
+    frame[0] = std::byte{0};
+
+    if(depth > kFrameSize) {
+        SharedBenchEntry(depth - kFrameSize);
+    } else {
+        while(gMain) {
+            gMain->switchTo();
+        }
+    }
+
+    // keeps the recursion from being turned into a loop
+    frame[kFrameSize - 1] = frame[0];
+}
+
+/**
+ * Reads the memory usage of the process.
+ *
+ * @return Virtual and resident memory, or zero if this isn't supported on the platform.
+ */
+Memory GetMemory() {
+    Memory mem;
+#ifdef __linux__
+    auto file = std::fopen("/proc/self/statm", "r");
+    if(!file) {
+        return mem;
+    }
+
+    size_t virtPages{0}, residentPages{0};
+    if(std::fscanf(file, "%zu %zu", &virtPages, &residentPages) == 2) {
+        const size_t pageSize = sysconf(_SC_PAGESIZE);
+        mem.virt = virtPages * pageSize;
+        mem.resident = residentPages * pageSize;
+    }
+    std::fclose(file);
+#endif
+    return mem;
+}
+
+/**
+ * Switches into each of the cothreads once. If performance counters are enabled, each run slice
+ * is measured individually, and the counts are accumulated.
+ */
+PerfCounters::Sample RunSlices(const std::vector<Cothread *> &threads) {
+    PerfCounters::Sample total;
+
+    if(gCounters) {
+        gCounters->start();
+        for(auto thread : threads) {
+            total += gCounters->measureSlice(thread);
+        }
+        gCounters->stop();
+    } else {
+        for(auto thread : threads) {
+            thread->switchTo();
+        }
+    }
+
+    return total;
+}
+
+const char *GetStackTypeName(const StackType type) {
+    switch(type) {
+        case StackType::Heap:
+            return "heap";
+        case StackType::Mapped:
+            return "mapped";
+        case StackType::Growable:
+            return "growable";
+        default:
+            return "default";
+    }
+}
+
+double NsPer(const Clock::duration elapsed, const size_t count) {
+    return std::chrono::duration<double, std::nano>(elapsed).count() / count;
+}
+
+double Median(std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+/**
+ * Writes a single measurement to stdout.
+ */
+void Report(const Options &opts, const char *stackType, const size_t stackSize,
+        const char *metric, const double value, const char *unit) {
+    if(opts.json) {
+        std::printf("{\"platform\":\"%s\",\"stack_type\":\"%s\",\"stack_size\":%zu,"
+                "\"metric\":\"%s\",\"value\":%.2f,\"unit\":\"%s\"}\n", BENCH_PLATFORM,
+                stackType, stackSize, metric, value, unit);
+    } else {
+        std::printf("%s,%s,%zu,%s,%.2f,%s\n", BENCH_PLATFORM, stackType, stackSize, metric, value,
+                unit);
+    }
+}
+
+void Report(const Options &opts, const StackType type, const size_t stackSize,
+        const char *metric, const double value, const char *unit) {
+    Report(opts, GetStackTypeName(type), stackSize, metric, value, unit);
+}
+
+/**
+ * Creates the requested number of cothreads, switches into each of them once, then destroys them
+ * again; each step is timed separately.
+ *
+ * @param memory If non-null, the memory used per cothread (after the first switch) is written here
+ */
+Lifecycle MeasureLifecycle(const Options &opts, const StackType type, const size_t stackSize,
+        Memory *memory) {
+    Lifecycle result;
+    std::vector<Cothread *> threads(opts.count, nullptr);
+
+    const auto before = GetMemory();
+
+    auto start = Clock::now();
+    for(auto &thread : threads) {
+        thread = new Cothread(&BenchEntry, stackSize, type);
+    }
+    result.create = NsPer(Clock::now() - start, opts.count);
+
+    start = Clock::now();
+    result.firstSlice = RunSlices(threads);
+    result.firstSwitch = NsPer(Clock::now() - start, opts.count);
+
+    if(memory) {
+        const auto after = GetMemory();
+        memory->virt = (after.virt - std::min(after.virt, before.virt)) / opts.count;
+        memory->resident = (after.resident - std::min(after.resident, before.resident))
+            / opts.count;
+    }
+
+    if(gCounters) {
+        result.slice = RunSlices(threads);
+    }
+
+    start = Clock::now();
+    for(auto thread : threads) {
+        delete thread;
+    }
+    result.destroy = NsPer(Clock::now() - start, opts.count);
+
+    return result;
+}
+
+/**
+ * Measures a single context switch, by switching back and forth between the main cothread and an
+ * already running one.
+ *
+ * @param profile Context profile of the cothread; the main cothread uses the minimal profile.
+ * @param counters If non-null, the performance counters for the entire batch are written here
+ *
+ * @return Nanoseconds per context switch (half a round trip)
+ */
+double MeasureSwitch(const Options &opts, const StackType type, const size_t stackSize,
+        const ContextProfile profile, PerfCounters::Sample *counters) {
+    auto thread = std::make_unique<Cothread>(&BenchEntry, stackSize, type);
+    thread->setContextProfile(profile);
+    thread->switchTo();
+
+    const auto batch = [&]() {
+        for(size_t i = 0; i < opts.switches; i++) {
+            thread->switchTo();
+        }
+    };
+
+    const auto start = Clock::now();
+    if(counters) {
+        *counters = gCounters->measure(batch);
+    } else {
+        batch();
+    }
+    return NsPer(Clock::now() - start, opts.switches * 2);
+}
+
+/**
+ * Measures creating and destroying a single cothread at a time; unlike the lifecycle measurement,
+ * the stack is satisfied from the stack pool's cache after the first iteration.
+ */
+double MeasurePooledCreate(const Options &opts, const StackType type, const size_t stackSize) {
+    const auto start = Clock::now();
+    for(size_t i = 0; i < opts.count; i++) {
+        Cothread thread(&BenchEntry, stackSize, type);
+    }
+    return NsPer(Clock::now() - start, opts.count);
+}
+
+/**
+ * Reports the available performance counters of a sample, divided by the number of events that
+ * were measured.
+ */
+void ReportCounters(const Options &opts, const StackType type, const size_t stackSize,
+        const std::string &prefix, const PerfCounters::Sample &sample, const size_t count) {
+    for(size_t i = 0; i < PerfCounters::kNumCounters; i++) {
+        const auto counter = static_cast<PerfCounters::Counter>(i);
+        if(!gCounters->isAvailable(counter)) {
+            continue;
+        }
+
+        const auto metric = prefix + "_" + PerfCounters::GetName(counter);
+        Report(opts, type, stackSize, metric.c_str(), static_cast<double>(sample[counter]) / count,
+                counter == PerfCounters::Counter::TaskClock ? "ns" : "events");
+    }
+}
+
+/**
+ * Runs all measurements for the given stack configuration.
+ */
+void Run(const Options &opts, const StackType type, const size_t stackSize) {
+    std::vector<double> create, firstSwitch, destroy, steady, steadyFpControl, steadyFull, pooled;
+    PerfCounters::Sample firstSlice, slice, batch;
+
+    // the pool is disabled for the lifecycle tests, so each cothread allocates its stack
+    auto config = StackPool::GetConfig();
+    const auto prevConfig = config;
+    config.enabled = false;
+    StackPool::SetConfig(config);
+
+    Memory memory;
+    for(size_t i = 0; i < opts.repetitions; i++) {
+        const auto result = MeasureLifecycle(opts, type, stackSize, i ? nullptr : &memory);
+        create.push_back(result.create);
+        firstSwitch.push_back(result.firstSwitch);
+        destroy.push_back(result.destroy);
+        firstSlice += result.firstSlice;
+        slice += result.slice;
+    }
+
+    StackPool::SetConfig(prevConfig);
+    for(size_t i = 0; i < opts.repetitions; i++) {
+        PerfCounters::Sample counters;
+        steady.push_back(MeasureSwitch(opts, type, stackSize, ContextProfile::Minimal,
+                    gCounters ? &counters : nullptr));
+        batch += counters;
+        steadyFpControl.push_back(MeasureSwitch(opts, type, stackSize, ContextProfile::FpControl,
+                    nullptr));
+        steadyFull.push_back(MeasureSwitch(opts, type, stackSize, ContextProfile::Full, nullptr));
+        pooled.push_back(MeasurePooledCreate(opts, type, stackSize));
+    }
+
+    Report(opts, type, stackSize, "create", Median(create), "ns");
+    Report(opts, type, stackSize, "first_switch", Median(firstSwitch), "ns");
+    Report(opts, type, stackSize, "switch", Median(steady), "ns");
+    Report(opts, type, stackSize, "switch_fp_control", Median(steadyFpControl), "ns");
+    Report(opts, type, stackSize, "switch_full", Median(steadyFull), "ns");
+    Report(opts, type, stackSize, "destroy", Median(destroy), "ns");
+    Report(opts, type, stackSize, "create_destroy_pooled", Median(pooled), "ns");
+    if(memory.virt || memory.resident) {
+        Report(opts, type, stackSize, "memory_virtual", memory.virt, "bytes");
+        Report(opts, type, stackSize, "memory_resident", memory.resident, "bytes");
+    }
+    if(gCounters) {
+        // counts are per cothread (one run slice is two context switches) or per switch
+        const auto slices = opts.count * opts.repetitions;
+        ReportCounters(opts, type, stackSize, "first_slice", firstSlice, slices);
+        ReportCounters(opts, type, stackSize, "slice", slice, slices);
+        ReportCounters(opts, type, stackSize, "switch", batch, opts.switches * 2 * opts.repetitions);
+    }
+    std::fflush(stdout);
+}
+
+/**
+ * Measures context switches into cothreads on a shared stack, by alternating between two of them;
+ * so each switch into one of them copies the other's stack out, and its own back in.
+ *
+ * @return Nanoseconds per context switch (half a round trip)
+ */
+double MeasureSharedSwitch(const Options &opts, const size_t depth) {
+    SharedStack stack;
+    Cothread first(stack, &SharedBenchEntry, depth), second(stack, &SharedBenchEntry, depth);
+    first.switchTo();
+    second.switchTo();
+
+    const auto rounds = std::max<size_t>(opts.switches / 2, 1);
+    const auto start = Clock::now();
+    for(size_t i = 0; i < rounds; i++) {
+        first.switchTo();
+        second.switchTo();
+    }
+    return NsPer(Clock::now() - start, rounds * 4);
+}
+
+/**
+ * Creates the requested number of cothreads on a shared stack, and switches into each of them
+ * once, so that all but the last one have their stacks copied out.
+ *
+ * @param memory Resident memory used per cothread is written here
+ *
+ * @return Size of the saved stack of an idle cothread, in bytes
+ */
+double MeasureSharedMemory(const Options &opts, const size_t depth, Memory &memory) {
+    SharedStack stack;
+    std::vector<std::unique_ptr<Cothread>> threads;
+    threads.reserve(opts.count);
+
+    const auto before = GetMemory();
+    for(size_t i = 0; i < opts.count; i++) {
+        threads.emplace_back(std::make_unique<Cothread>(stack, &SharedBenchEntry, depth));
+        threads.back()->switchTo();
+    }
+    const auto after = GetMemory();
+
+    memory.virt = (after.virt - std::min(after.virt, before.virt)) / opts.count;
+    memory.resident = (after.resident - std::min(after.resident, before.resident)) / opts.count;
+
+    const auto &stats = stack.getStats();
+    return static_cast<double>(stats.savedBytes) / std::max<size_t>(stats.numCothreads - 1, 1);
+}
+
+/**
+ * Runs the shared stack measurements for cothreads with the given call stack depth.
+ */
+void RunShared(const Options &opts, const size_t depth) {
+    std::vector<double> steady, saved;
+    Memory memory;
+
+    for(size_t i = 0; i < opts.repetitions; i++) {
+        steady.push_back(MeasureSharedSwitch(opts, depth));
+        saved.push_back(MeasureSharedMemory(opts, depth, memory));
+    }
+
+    Report(opts, "shared", depth, "switch", Median(steady), "ns");
+    Report(opts, "shared", depth, "memory_saved_stack", Median(saved), "bytes");
+    if(memory.resident) {
+        Report(opts, "shared", depth, "memory_resident", memory.resident, "bytes");
+    }
+    std::fflush(stdout);
+}
+
+/**
+ * Parses a comma separated list of sizes; each may have a `k` or `m` suffix.
+ */
+std::vector<size_t> ParseSizes(const std::string_view list) {
+    std::vector<size_t> sizes;
+    size_t pos{0};
+
+    while(pos < list.size()) {
+        auto end = list.find(',', pos);
+        if(end == std::string_view::npos) {
+            end = list.size();
+        }
+
+        const std::string item(list.substr(pos, end - pos));
+        char *suffix{nullptr};
+        auto size = std::strtoull(item.c_str(), &suffix, 10);
+        if(suffix == item.c_str()) {
+            throw std::invalid_argument("invalid stack size '" + item + "'");
+        } else if(*suffix == 'k' || *suffix == 'K') {
+            size *= 1024;
+        } else if(*suffix == 'm' || *suffix == 'M') {
+            size *= 1024 * 1024;
+        }
+        sizes.push_back(size);
+
+        pos = end + 1;
+    }
+
+    return sizes;
+}
+
+Options ParseOptions(const int argc, char **argv) {
+    Options opts;
+
+    for(int i = 1; i < argc; i++) {
+        const std::string_view arg(argv[i]);
+        const auto hasValue = i + 1 < argc;
+
+        if(arg == "--format" && hasValue) {
+            const std::string_view format(argv[++i]);
+            if(format != "json" && format != "csv") {
+                throw std::invalid_argument("unknown format '" + std::string(format) + "'");
+            }
+            opts.json = (format == "json");
+        } else if(arg == "--no-header") {
+            opts.noHeader = true;
+        } else if(arg == "--perf") {
+            opts.perf = true;
+        } else if(arg == "--count" && hasValue) {
+            opts.count = std::max(1ULL, std::strtoull(argv[++i], nullptr, 10));
+        } else if(arg == "--switches" && hasValue) {
+            opts.switches = std::max(1ULL, std::strtoull(argv[++i], nullptr, 10));
+        } else if(arg == "--repetitions" && hasValue) {
+            opts.repetitions = std::max(1ULL, std::strtoull(argv[++i], nullptr, 10));
+        } else if(arg == "--stack-sizes" && hasValue) {
+            opts.stackSizes = ParseSizes(argv[++i]);
+        } else if(arg == "--shared-depths" && hasValue) {
+            opts.sharedDepths = ParseSizes(argv[++i]);
+        } else if(arg == "--help") {
+            throw std::invalid_argument("cothread lifecycle benchmarks for " BENCH_PLATFORM);
+        } else {
+            throw std::invalid_argument("unknown argument '" + std::string(arg) + "'");
+        }
+    }
+
+    return opts;
+}
+}
+
+int main(int argc, char **argv) {
+    Options opts;
+    try {
+        opts = ParseOptions(argc, argv);
+    } catch(const std::exception &e) {
+        std::fprintf(stderr, "%s\n\nusage: %s [--format csv|json] [--no-header] [--perf] "
+                "[--count n] [--switches n] [--repetitions n] [--stack-sizes 16k,64k,...] "
+                "[--shared-depths 256,1k,...]\n",
+                e.what(), argv[0]);
+        return 1;
+    }
+
+    gMain = Cothread::Current();
+
+    PerfCounters counters;
+    if(opts.perf) {
+        if(counters.isSupported()) {
+            gCounters = &counters;
+        } else {
+            std::fprintf(stderr, "performance counters are not supported on this host\n");
+        }
+    }
+
+    if(!opts.json && !opts.noHeader) {
+        std::printf("platform,stack_type,stack_size,metric,value,unit\n");
+    }
+
+    for(const auto type : {StackType::Heap, StackType::Mapped, StackType::Growable}) {
+        for(const auto stackSize : opts.stackSizes) {
+            Run(opts, type, stackSize);
+        }
+    }
+
+    if(SharedStack::IsSupported()) {
+        for(const auto depth : opts.sharedDepths) {
+            RunShared(opts, depth);
+        }
+    }
+}
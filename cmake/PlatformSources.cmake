@@ -0,0 +1,92 @@
+# Adds the architecture/platform specific sources of libcommunism to a target, and defines the
+# corresponding LIBCOMMUNISM_BACKEND_* macro for it, and its users. Several platforms may be added
+# to the same target; the one marked as DEFAULT (which also gets its PLATFORM_* macro defined) is
+# the one used by Cothread.
+#
+# Usage: libcommunism_platform_sources(<target> <platform> [DEFAULT])
+#   where <platform> is one of the values of PLATFORM_LIBCOMMUNISM (other than Auto)
+#
+# This is a macro rather than a function, since languages can't be enabled from function scope.
+macro(libcommunism_platform_sources TARGET PLATFORM)
+    set(LIBCOMMUNISM_ARCH_SOURCES ${libcommunism_SOURCE_DIR}/src/arch)
+    set(LIBCOMMUNISM_ARCH_DEFAULT "${ARGN}")
+
+    if("amd64-win" STREQUAL ${PLATFORM})
+        enable_language(ASM_MASM)
+
+        target_sources(${TARGET} PRIVATE
+            ${LIBCOMMUNISM_ARCH_SOURCES}/amd64/Common.cpp
+            ${LIBCOMMUNISM_ARCH_SOURCES}/Amd64/Windows.cpp
+            ${LIBCOMMUNISM_ARCH_SOURCES}/Amd64/Windows.asm
+        )
+        target_compile_definitions(${TARGET} PUBLIC -DLIBCOMMUNISM_BACKEND_AMD64)
+        if(LIBCOMMUNISM_ARCH_DEFAULT STREQUAL "DEFAULT")
+            target_compile_definitions(${TARGET} PRIVATE -DPLATFORM_AMD64_WINDOWS)
+        endif()
+    elseif("amd64-sysv" STREQUAL ${PLATFORM})
+        enable_language(ASM)
+
+        target_sources(${TARGET} PRIVATE
+            ${LIBCOMMUNISM_ARCH_SOURCES}/amd64/Common.cpp
+            ${LIBCOMMUNISM_ARCH_SOURCES}/amd64/SysV.cpp
+            ${LIBCOMMUNISM_ARCH_SOURCES}/amd64/SysV.S
+        )
+        target_compile_definitions(${TARGET} PUBLIC -DLIBCOMMUNISM_BACKEND_AMD64)
+        if(LIBCOMMUNISM_ARCH_DEFAULT STREQUAL "DEFAULT")
+            target_compile_definitions(${TARGET} PRIVATE -DPLATFORM_AMD64_SYSV)
+        endif()
+    elseif("aarch64-aapcs" STREQUAL ${PLATFORM})
+        enable_language(ASM)
+
+        target_sources(${TARGET} PRIVATE
+            ${LIBCOMMUNISM_ARCH_SOURCES}/aarch64/Common.cpp
+            ${LIBCOMMUNISM_ARCH_SOURCES}/aarch64/AAPCS.cpp
+            ${LIBCOMMUNISM_ARCH_SOURCES}/aarch64/AAPCS.S
+        )
+        target_compile_definitions(${TARGET} PUBLIC -DLIBCOMMUNISM_BACKEND_AARCH64)
+        if(LIBCOMMUNISM_ARCH_DEFAULT STREQUAL "DEFAULT")
+            target_compile_definitions(${TARGET} PRIVATE -DPLATFORM_AARCH64_AAPCS)
+        endif()
+    elseif("x86-fastcall" STREQUAL ${PLATFORM})
+        # compiled sources are always the same as fastcall calling convention is identical
+        target_sources(${TARGET} PRIVATE
+            ${LIBCOMMUNISM_ARCH_SOURCES}/x86/Common.cpp
+        )
+
+        # for MSVC toolchain, use the MASM formatted assembler
+        if ("${CMAKE_CXX_COMPILER_ID}" STREQUAL "MSVC")
+            enable_language(ASM_MASM)
+            target_sources(${TARGET} PRIVATE
+                ${LIBCOMMUNISM_ARCH_SOURCES}/x86/Fastcall.asm
+            )
+        # otherwise, use the GNU AS style
+        else()
+            enable_language(ASM)
+            target_sources(${TARGET} PRIVATE
+                ${LIBCOMMUNISM_ARCH_SOURCES}/x86/Fastcall.S
+            )
+        endif()
+        target_compile_definitions(${TARGET} PUBLIC -DLIBCOMMUNISM_BACKEND_X86)
+        if(LIBCOMMUNISM_ARCH_DEFAULT STREQUAL "DEFAULT")
+            target_compile_definitions(${TARGET} PRIVATE -DPLATFORM_X86_FASTCALL)
+        endif()
+    elseif("setjmp" STREQUAL ${PLATFORM})
+        target_sources(${TARGET} PRIVATE
+            ${LIBCOMMUNISM_ARCH_SOURCES}/setjmp/SetJmp.cpp
+        )
+        target_compile_definitions(${TARGET} PUBLIC -DLIBCOMMUNISM_BACKEND_SETJMP)
+        if(LIBCOMMUNISM_ARCH_DEFAULT STREQUAL "DEFAULT")
+            target_compile_definitions(${TARGET} PRIVATE -DPLATFORM_SETJMP)
+        endif()
+    elseif("ucontext" STREQUAL ${PLATFORM})
+        target_sources(${TARGET} PRIVATE
+            ${LIBCOMMUNISM_ARCH_SOURCES}/ucontext/UContext.cpp
+        )
+        target_compile_definitions(${TARGET} PUBLIC -DLIBCOMMUNISM_BACKEND_UCONTEXT)
+        if(LIBCOMMUNISM_ARCH_DEFAULT STREQUAL "DEFAULT")
+            target_compile_definitions(${TARGET} PRIVATE -DPLATFORM_UCONTEXT)
+        endif()
+    else()
+        message(SEND_ERROR "don't know what arch specific sources are needed for '${PLATFORM}'!")
+    endif()
+endmacro()
@@ -0,0 +1,269 @@
+#ifndef LIBCOMMUNISM_BASICCOTHREAD_H
+#define LIBCOMMUNISM_BASICCOTHREAD_H
+
+#include <libcommunism/Cothread.h>
+#include <libcommunism/StackPool.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <span>
+#include <type_traits>
+#include <utility>
+
+namespace libcommunism {
+namespace internal {
+class Aarch64;
+class Amd64;
+class SetJmp;
+class UContext;
+class x86;
+
+/**
+ * Invoked when the entry point of a BasicCothread returns. This calls the cothread return handler
+ * (with a `nullptr` cothread) and then terminates the program.
+ */
+[[noreturn]] void BasicCothreadReturned();
+
+/**
+ * @brief Entry record for a BasicCothread
+ *
+ * The platform code reports cothreads that return from their entry point as the current
+ * `Cothread`, which is not meaningful for a BasicCothread; so instead, the record never returns.
+ */
+template<class F, class... Args>
+struct BasicCallableRecord: CallableRecordFor<F, Args...> {
+    template<class CallF, class... CallArgs>
+    explicit BasicCallableRecord(CallF &&f, CallArgs &&...args) :
+        CallableRecordFor<F, Args...>(std::forward<CallF>(f), std::forward<CallArgs>(args)...) {
+        this->invoke = &BasicCallableRecord::Invoke;
+    }
+
+    static void Invoke(EntryRecord *record) {
+        CallableRecordFor<F, Args...>::Invoke(record);
+        BasicCothreadReturned();
+    }
+};
+}
+
+/**
+ * Platform implementations that can be selected explicitly, through BasicCothread. Which of them
+ * are available depends on the platform and build configuration: the `LIBCOMMUNISM_BACKEND_*`
+ * macro corresponding to each is defined if it was built into the library.
+ *
+ * The assembly implementation for the architecture is always built (if there is one) along with
+ * the generic ones that the platform supports, unless `LIBCOMMUNISM_GENERIC_BACKENDS` was turned
+ * off in the build configuration.
+ */
+namespace backend {
+/// Hand written assembly for amd64, with either the System V or Windows ABI
+struct Amd64 {
+    using Impl = internal::Amd64;
+    static constexpr const char *kName{"amd64"};
+};
+
+/// Hand written assembly for aarch64, with the AAPCS ABI
+struct Aarch64 {
+    using Impl = internal::Aarch64;
+    static constexpr const char *kName{"aarch64"};
+};
+
+/// Hand written assembly for 32-bit x86, with the fastcall calling convention
+struct X86 {
+    using Impl = internal::x86;
+    static constexpr const char *kName{"x86"};
+};
+
+/// Portable implementation based on `sigsetjmp()` and `siglongjmp()`
+struct SetJmp {
+    using Impl = internal::SetJmp;
+    static constexpr const char *kName{"setjmp"};
+};
+
+/// Portable implementation based on `swapcontext()`
+struct UContext {
+    using Impl = internal::UContext;
+    static constexpr const char *kName{"ucontext"};
+};
+}
+
+/**
+ * Cothreads whose platform implementation is selected at compile time, through the `Backend`
+ * policy, rather than by the build configuration. Context switches are direct calls into that
+ * implementation; so several implementations can be used side by side in one binary, for example
+ * to compare the assembly implementations against the generic ones, or to fall back to a generic
+ * one.
+ *
+ * This is a lower level interface than Cothread: it supports only plain context switches, and
+ * BasicCothreads can't be used with the Scheduler or Runtime.
+ *
+ * Each backend keeps track of its own current cothread on each kernel thread. Whatever is running
+ * before the first switch to a cothread of a backend (the kernel thread itself, or a cothread of
+ * a different backend) is represented by that backend's Current() cothread; switching to it
+ * resumes that context. Cothreads must only be switched to using cothreads of the same backend.
+ *
+ * @remark Only the backends that were built into the library (see `libcommunism::backend`) may be
+ *         used; others fail to link.
+ *
+ * @tparam Backend Platform implementation to use, such as `backend::SetJmp`. It provides the
+ *         implementation class as `Impl`, and its name as `kName`.
+ *
+ * @brief Cothread with a compile time selected platform implementation
+ */
+template<class Backend>
+class BasicCothread {
+    public:
+        /// Platform implementation of the cothread
+        using Impl = typename Backend::Impl;
+
+        /**
+         * Returns the cothread of this backend that's currently executing on the calling kernel
+         * thread.
+         *
+         * If no cothread of this backend was switched to yet, this returns a cothread that
+         * represents whatever is currently executing.
+         */
+        [[nodiscard]] static BasicCothread *Current();
+
+        /**
+         * Allocates a new cothread that executes an arbitrary callable, allocating its stack. This
+         * behaves like the equivalent Cothread constructor.
+         *
+         * @note If the callable returns, the cothread return handler is invoked with a `nullptr`
+         *       cothread, then the program is terminated.
+         *
+         * @param stackSize Size of the stack to be allocated, in bytes; or zero to use the platform
+         *        default.
+         * @param stackType Kind of memory to allocate for the stack
+         * @param entry Callable to execute on entry to this cothread
+         * @param args Arguments to pass to the callable
+         *
+         * @throw std::runtime_error If the memory for the cothread could not be allocated.
+         * @throw std::runtime_error If the provided stack size is invalid
+         */
+        template<class F, class... Args>
+            requires std::invocable<std::decay_t<F>, std::decay_t<Args>...>
+        BasicCothread(const size_t stackSize, const StackType stackType, F &&entry,
+                Args &&...args) {
+            this->allocImpl(stackSize, stackType);
+            this->emplaceEntry(std::forward<F>(entry), std::forward<Args>(args)...);
+        }
+
+        /**
+         * Allocates a new cothread that executes an arbitrary callable, using an existing buffer to
+         * store its stack. The same requirements apply to the buffer as for Cothread.
+         *
+         * @param stack Buffer to use as the stack of the cothread
+         * @param entry Callable to execute on entry to this cothread
+         * @param args Arguments to pass to the callable
+         *
+         * @throw std::runtime_error If the provided stack is invalid, or too small to hold the
+         *        callable and its arguments.
+         */
+        template<class F, class... Args>
+            requires std::invocable<std::decay_t<F>, std::decay_t<Args>...>
+        BasicCothread(std::span<uintptr_t> stack, F &&entry, Args &&...args) {
+            this->allocImpl(stack);
+            this->emplaceEntry(std::forward<F>(entry), std::forward<Args>(args)...);
+        }
+
+        /**
+         * Destroys the cothread, including its callable (if it's still alive) and its stack, if
+         * it was allocated by the cothread. It must not be currently executing.
+         */
+        ~BasicCothread();
+
+        BasicCothread(const BasicCothread &) = delete;
+        BasicCothread &operator=(const BasicCothread &) = delete;
+
+        /**
+         * Performs a context switch to this cothread; the context of the calling cothread of the
+         * same backend is saved, and resumed when it is next switched to.
+         */
+        void switchTo() noexcept;
+
+        /**
+         * Gets the size of the cothread's stack, in bytes.
+         */
+        size_t getStackSize() const;
+
+        /**
+         * Gets the top of the stack of the cothread; see Cothread::getStack().
+         */
+        void *getStack() const;
+
+        /**
+         * Gets the name of the backend, for diagnostics.
+         */
+        static constexpr const char *GetBackendName() {
+            return Backend::kName;
+        }
+
+    private:
+        /**
+         * Create an empty cothread. This is used to wrap the kernel thread; its implementation is
+         * allocated separately.
+         */
+        BasicCothread() = default;
+
+        static BasicCothread *AllocKernelThreadCothread();
+
+        void allocImpl(const size_t stackSize, const StackType stackType);
+        void allocImpl(std::span<uintptr_t> stack);
+        void releaseImpl();
+        void *reserveEntry(const size_t size, const size_t alignment);
+        void prepareEntry(internal::EntryRecord *record);
+
+        /**
+         * Constructs the entry record at the high end of the cothread's stack, then prepares the
+         * cothread to invoke it. The implementation is released again if this fails.
+         */
+        template<class F, class... Args>
+        void emplaceEntry(F &&entry, Args &&...args) {
+            using Record = internal::BasicCallableRecord<std::decay_t<F>, std::decay_t<Args>...>;
+
+            try {
+                auto mem = this->reserveEntry(sizeof(Record), alignof(Record));
+                this->prepareEntry(new(mem) Record(std::forward<F>(entry),
+                            std::forward<Args>(args)...));
+            } catch(...) {
+                this->releaseImpl();
+                throw;
+            }
+        }
+
+    private:
+        /// Platform implementation of the cothread
+        Impl *impl{nullptr};
+
+        /// Buffer into which the implementation is allocated, if it fits
+        std::array<uintptr_t, 32> implBuffer;
+        /// When set, the implementation buffer is used.
+        bool implBufferUsed{false};
+
+        /// Entry record of the cothread, which lives at the high end of its stack
+        internal::EntryRecord *entry{nullptr};
+
+        /// Cothread of this backend executing on the calling kernel thread
+        static thread_local BasicCothread *gCurrent;
+};
+
+#if defined(LIBCOMMUNISM_BACKEND_AMD64)
+extern template class BasicCothread<backend::Amd64>;
+#endif
+#if defined(LIBCOMMUNISM_BACKEND_AARCH64)
+extern template class BasicCothread<backend::Aarch64>;
+#endif
+#if defined(LIBCOMMUNISM_BACKEND_X86)
+extern template class BasicCothread<backend::X86>;
+#endif
+#if defined(LIBCOMMUNISM_BACKEND_SETJMP)
+extern template class BasicCothread<backend::SetJmp>;
+#endif
+#if defined(LIBCOMMUNISM_BACKEND_UCONTEXT)
+extern template class BasicCothread<backend::UContext>;
+#endif
+}
+
+#endif
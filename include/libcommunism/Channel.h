@@ -0,0 +1,551 @@
+#ifndef LIBCOMMUNISM_CHANNEL_H
+#define LIBCOMMUNISM_CHANNEL_H
+
+#include <libcommunism/WaitQueue.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <span>
+#include <type_traits>
+#include <utility>
+
+namespace libcommunism {
+/**
+ * Channels pass values between cothreads, which may be executing on different kernel threads. A
+ * cothread that sends to a full channel, or receives from an empty one, is blocked until it can
+ * continue; see WaitQueue for how this happens for the different kinds of cothreads. A cothread
+ * spawned through the Scheduler that's woken by another kernel thread resumes on its own.
+ *
+ * There are three kinds of channel, chosen by their capacity:
+ *
+ * - Bounded channels buffer up to a fixed number of values in a lock-free ring. As long as the
+ *   ring is neither full nor empty, sending and receiving never take a lock.
+ * - Unbounded channels buffer any number of values. Their buffer is protected by a lock.
+ * - Rendezvous channels (with a capacity of zero) have no buffer; each send blocks until a
+ *   receiver takes the value directly from the sender, and vice versa.
+ *
+ * Once a channel is closed, sending to it fails. Receivers still get all values that were
+ * buffered before it was closed, after which receiving fails as well.
+ *
+ * @remark Destroying a channel while cothreads are blocked on it results in undefined behavior.
+ *
+ * @brief Typed multi-producer, multi-consumer channel
+ *
+ * @tparam T Type of values passed through the channel
+ */
+template<class T>
+class Channel {
+    static_assert(std::is_nothrow_move_constructible_v<T>,
+            "channel values must be nothrow move constructible");
+
+    /// Slot in the ring of a bounded channel
+    struct Cell {
+        /**
+         * Sequence number: twice the position of the next value to be written to the cell while
+         * it's empty, plus one once that value was written.
+         */
+        std::atomic_size_t sequence{0};
+        /// Storage for a value
+        alignas(T) std::byte storage[sizeof(T)];
+
+        T *get() {
+            return std::launder(reinterpret_cast<T *>(this->storage));
+        }
+    };
+
+    /// Waiter blocked on the channel
+    struct ChannelWaiter: WaitQueue::Waiter {
+        /**
+         * For rendezvous with a waiting sender, the value it's sending; for a waiting receiver, a
+         * `std::optional<T>` to place the received value into.
+         */
+        void *slot{nullptr};
+        /// Set when a value was handed to or taken from the waiter
+        bool completed{false};
+    };
+
+    public:
+        /// Capacity of an unbounded channel
+        static constexpr const size_t kUnbounded{SIZE_MAX};
+
+        /**
+         * Creates a new channel.
+         *
+         * @param capacity Number of values the channel can buffer: `kUnbounded` for an unbounded
+         *        channel, or zero for a rendezvous channel.
+         */
+        explicit Channel(const size_t capacity = kUnbounded) : capacity(capacity) {
+            if(this->isBounded()) {
+                this->cells = std::make_unique<Cell[]>(capacity);
+                for(size_t i = 0; i < capacity; i++) {
+                    this->cells[i].sequence.store(i * 2, std::memory_order_relaxed);
+                }
+            }
+        }
+
+        /**
+         * Destroys the channel, and any values still buffered in it.
+         */
+        ~Channel() {
+            if(this->isBounded()) {
+                std::optional<T> value;
+                while(this->tryPopRing(value)) {
+                    value.reset();
+                }
+            }
+        }
+
+        Channel(const Channel &) = delete;
+        Channel &operator=(const Channel &) = delete;
+
+        /**
+         * Sends a value, blocking while the channel is full (or, for a rendezvous channel, until a
+         * receiver takes it.)
+         *
+         * @param value Value to send
+         *
+         * @return Whether the value was sent; this fails only if the channel was closed.
+         */
+        bool send(T value) {
+            return this->sendValue(value, true);
+        }
+
+        /**
+         * Sends a value, if that's possible without blocking.
+         *
+         * @param value Value to send. It's only moved from if it was sent.
+         *
+         * @return Whether the value was sent
+         */
+        bool trySend(T &&value) {
+            return this->sendValue(value, false);
+        }
+
+        /**
+         * Sends a batch of values, blocking as needed, until all of them were sent or the channel
+         * is closed.
+         *
+         * @param values Values to send; the ones that were sent are moved from.
+         *
+         * @return Number of values that were sent, starting with the first.
+         */
+        size_t sendBatch(std::span<T> values) {
+            if(this->isUnbounded()) {
+                std::lock_guard<std::mutex> lg(this->lock);
+                if(this->closed.load(std::memory_order_relaxed)) {
+                    return 0;
+                }
+                for(auto &value : values) {
+                    if(!this->handOff(value)) {
+                        this->items.emplace_back(std::move(value));
+                    }
+                }
+                return values.size();
+            }
+
+            size_t sent{0};
+            for(auto &value : values) {
+                if(!this->sendValue(value, true)) {
+                    break;
+                }
+                sent++;
+            }
+            return sent;
+        }
+
+        /**
+         * Receives a value, blocking while the channel is empty.
+         *
+         * @return The received value, or an empty optional if the channel was closed and there
+         *         are no more values to receive.
+         */
+        std::optional<T> receive() {
+            return this->receiveValue(true);
+        }
+
+        /**
+         * Receives a value, if one is available without blocking.
+         *
+         * @return The received value, or an empty optional if none was available
+         */
+        std::optional<T> tryReceive() {
+            return this->receiveValue(false);
+        }
+
+        /**
+         * Receives a batch of values. This blocks until at least one value is available, then
+         * takes as many more as are available without blocking.
+         *
+         * @param out Output iterator to write received values to
+         * @param max Maximum number of values to receive
+         *
+         * @return Number of values received; zero if the channel was closed and there are no more
+         *         values to receive.
+         */
+        template<class OutputIt>
+        size_t receiveBatch(OutputIt out, const size_t max) {
+            if(!max) {
+                return 0;
+            }
+
+            auto first = this->receive();
+            if(!first) {
+                return 0;
+            }
+            *out++ = std::move(*first);
+            size_t received{1};
+
+            if(this->isUnbounded()) {
+                std::lock_guard<std::mutex> lg(this->lock);
+                while(received < max && !this->items.empty()) {
+                    *out++ = std::move(this->items.front());
+                    this->items.pop_front();
+                    received++;
+                }
+                return received;
+            }
+
+            while(received < max) {
+                auto value = this->tryReceive();
+                if(!value) {
+                    break;
+                }
+                *out++ = std::move(*value);
+                received++;
+            }
+            return received;
+        }
+
+        /**
+         * Closes the channel, and wakes up all cothreads that are blocked on it. Closing a channel
+         * that's already closed has no effect.
+         *
+         * @remark Sends that race with closing the channel may either succeed or fail.
+         */
+        void close() {
+            std::lock_guard<std::mutex> lg(this->lock);
+            this->closed.store(true, std::memory_order_release);
+
+            while(auto waiter = this->senders.pop()) {
+                WaitQueue::Wake(waiter);
+            }
+            while(auto waiter = this->receivers.pop()) {
+                WaitQueue::Wake(waiter);
+            }
+        }
+
+        /**
+         * Checks whether the channel was closed.
+         */
+        bool isClosed() const {
+            return this->closed.load(std::memory_order_acquire);
+        }
+
+        /**
+         * Gets the capacity of the channel.
+         *
+         * @return Maximum number of buffered values; `kUnbounded` for unbounded channels, or zero
+         *         for rendezvous channels.
+         */
+        constexpr size_t getCapacity() const {
+            return this->capacity;
+        }
+
+    private:
+        constexpr bool isBounded() const {
+            return this->capacity && !this->isUnbounded();
+        }
+        constexpr bool isUnbounded() const {
+            return this->capacity == kUnbounded;
+        }
+
+        /**
+         * Sends a value, optionally blocking until that's possible.
+         *
+         * @param value Value to send; it's only moved from if it was sent.
+         * @param block Whether to block if the value can't be sent immediately
+         *
+         * @return Whether the value was sent
+         */
+        bool sendValue(T &value, const bool block) {
+            if(this->closed.load(std::memory_order_acquire)) {
+                return false;
+            }
+
+            if(this->isBounded()) {
+                if(this->tryPushRing(value)) {
+                    this->wake(this->receivers, this->numReceivers);
+                    return true;
+                }
+                return block && this->sendBounded(value);
+            }
+
+            std::unique_lock<std::mutex> lock(this->lock);
+            if(this->closed.load(std::memory_order_relaxed)) {
+                return false;
+            }
+            if(this->handOff(value)) {
+                return true;
+            } else if(this->isUnbounded()) {
+                this->items.emplace_back(std::move(value));
+                return true;
+            } else if(!block) {
+                return false;
+            }
+
+            // rendezvous: wait for a receiver to take the value (or the channel to be closed)
+            ChannelWaiter waiter;
+            WaitQueue::Prepare(waiter);
+            waiter.slot = &value;
+
+            this->senders.push(&waiter);
+            WaitQueue::Block(waiter, lock);
+            return waiter.completed;
+        }
+
+        /**
+         * Sends a value to a bounded channel whose ring was full, blocking until there's space.
+         */
+        bool sendBounded(T &value) {
+            std::unique_lock<std::mutex> lock(this->lock);
+
+            while(true) {
+                ChannelWaiter waiter;
+                WaitQueue::Prepare(waiter);
+
+                const auto isClosed = this->closed.load(std::memory_order_acquire);
+                if(isClosed) {
+                    return false;
+                }
+
+                // announce that we're about to wait, then check again for space
+                this->numSenders.fetch_add(1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+
+                if(this->tryPushRing(value)) {
+                    this->numSenders.fetch_sub(1, std::memory_order_relaxed);
+                    lock.unlock();
+                    this->wake(this->receivers, this->numReceivers);
+                    return true;
+                }
+
+                this->senders.push(&waiter);
+                WaitQueue::Block(waiter, lock);
+
+                this->numSenders.fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+
+        /**
+         * Receives a value, optionally blocking until one is available.
+         */
+        std::optional<T> receiveValue(const bool block) {
+            std::optional<T> value;
+
+            if(this->isBounded()) {
+                const auto isClosed = this->closed.load(std::memory_order_acquire);
+                if(this->tryPopRing(value)) {
+                    this->wake(this->senders, this->numSenders);
+                    return value;
+                }
+                if(!block || isClosed) {
+                    return value;
+                }
+                return this->receiveBounded();
+            }
+
+            std::unique_lock<std::mutex> lock(this->lock);
+            while(true) {
+                if(!this->items.empty()) {
+                    value.emplace(std::move(this->items.front()));
+                    this->items.pop_front();
+                    return value;
+                }
+                if(auto sender = static_cast<ChannelWaiter *>(this->senders.pop())) {
+                    value.emplace(std::move(*static_cast<T *>(sender->slot)));
+                    sender->completed = true;
+                    WaitQueue::Wake(sender);
+                    return value;
+                }
+                if(!block || this->closed.load(std::memory_order_relaxed)) {
+                    return value;
+                }
+
+                ChannelWaiter waiter;
+                WaitQueue::Prepare(waiter);
+                waiter.slot = &value;
+
+                this->receivers.push(&waiter);
+                WaitQueue::Block(waiter, lock);
+                if(waiter.completed) {
+                    return value;
+                }
+            }
+        }
+
+        /**
+         * Receives a value from a bounded channel whose ring was empty, blocking until one is
+         * available or the channel is closed.
+         */
+        std::optional<T> receiveBounded() {
+            std::optional<T> value;
+            std::unique_lock<std::mutex> lock(this->lock);
+
+            while(true) {
+                ChannelWaiter waiter;
+                WaitQueue::Prepare(waiter);
+
+                // anything sent before the channel was closed must be received first
+                const auto isClosed = this->closed.load(std::memory_order_acquire);
+
+                this->numReceivers.fetch_add(1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+
+                if(this->tryPopRing(value)) {
+                    this->numReceivers.fetch_sub(1, std::memory_order_relaxed);
+                    lock.unlock();
+                    this->wake(this->senders, this->numSenders);
+                    return value;
+                } else if(isClosed) {
+                    this->numReceivers.fetch_sub(1, std::memory_order_relaxed);
+                    return value;
+                }
+
+                this->receivers.push(&waiter);
+                WaitQueue::Block(waiter, lock);
+
+                this->numReceivers.fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+
+        /**
+         * Hands a value directly to a waiting receiver, if there is one. The lock must be held.
+         *
+         * @return Whether the value was handed off (and moved from)
+         */
+        bool handOff(T &value) {
+            auto receiver = static_cast<ChannelWaiter *>(this->receivers.pop());
+            if(!receiver) {
+                return false;
+            }
+
+            static_cast<std::optional<T> *>(receiver->slot)->emplace(std::move(value));
+            receiver->completed = true;
+            WaitQueue::Wake(receiver);
+            return true;
+        }
+
+        /**
+         * Wakes up one waiter of a bounded channel after a value was pushed to or popped from the
+         * ring, if there are any.
+         *
+         * @param queue Queue of waiters to wake from
+         * @param count Number of cothreads that are about to wait, or are waiting, on the queue
+         */
+        void wake(WaitQueue &queue, std::atomic_size_t &count) {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if(!count.load(std::memory_order_relaxed)) {
+                return;
+            }
+
+            std::lock_guard<std::mutex> lg(this->lock);
+            if(auto waiter = queue.pop()) {
+                WaitQueue::Wake(waiter);
+            }
+        }
+
+        /**
+         * Attempts to push a value to the ring of a bounded channel.
+         *
+         * @return Whether the value was pushed (and moved from); this fails if the ring is full.
+         */
+        bool tryPushRing(T &value) {
+            auto pos = this->enqueuePos.load(std::memory_order_relaxed);
+            while(true) {
+                auto &cell = this->cells[pos % this->capacity];
+                const auto seq = cell.sequence.load(std::memory_order_acquire);
+                const auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos * 2);
+
+                if(!diff) {
+                    if(this->enqueuePos.compare_exchange_weak(pos, pos + 1,
+                                std::memory_order_relaxed)) {
+                        new(cell.storage) T(std::move(value));
+                        cell.sequence.store(pos * 2 + 1, std::memory_order_release);
+                        return true;
+                    }
+                } else if(diff < 0) {
+                    return false;
+                } else {
+                    pos = this->enqueuePos.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        /**
+         * Attempts to pop a value from the ring of a bounded channel.
+         *
+         * @param out Receives the value
+         *
+         * @return Whether a value was popped; this fails if the ring is empty.
+         */
+        bool tryPopRing(std::optional<T> &out) {
+            auto pos = this->dequeuePos.load(std::memory_order_relaxed);
+            while(true) {
+                auto &cell = this->cells[pos % this->capacity];
+                const auto seq = cell.sequence.load(std::memory_order_acquire);
+                const auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos * 2 + 1);
+
+                if(!diff) {
+                    if(this->dequeuePos.compare_exchange_weak(pos, pos + 1,
+                                std::memory_order_relaxed)) {
+                        auto item = cell.get();
+                        out.emplace(std::move(*item));
+                        std::destroy_at(item);
+                        cell.sequence.store((pos + this->capacity) * 2, std::memory_order_release);
+                        return true;
+                    }
+                } else if(diff < 0) {
+                    return false;
+                } else {
+                    pos = this->dequeuePos.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+    private:
+        /// Maximum number of buffered values
+        const size_t capacity;
+
+        /// Ring of a bounded channel
+        std::unique_ptr<Cell[]> cells;
+        /// Position at which the next value is pushed to the ring
+        alignas(64) std::atomic_size_t enqueuePos{0};
+        /// Position from which the next value is popped from the ring
+        alignas(64) std::atomic_size_t dequeuePos{0};
+
+        /// Set once the channel is closed
+        alignas(64) std::atomic_bool closed{false};
+        /// Number of senders that are waiting (or about to) on a bounded channel
+        std::atomic_size_t numSenders{0};
+        /// Number of receivers that are waiting (or about to) on a bounded channel
+        std::atomic_size_t numReceivers{0};
+
+        /// Protects the wait queues, and the buffer of an unbounded channel
+        std::mutex lock;
+        /// Cothreads waiting to send
+        WaitQueue senders;
+        /// Cothreads waiting to receive
+        WaitQueue receivers;
+
+        /// Buffer of an unbounded channel
+        std::deque<T> items;
+};
+}
+
+#endif
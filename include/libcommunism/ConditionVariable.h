@@ -0,0 +1,79 @@
+#ifndef LIBCOMMUNISM_CONDITIONVARIABLE_H
+#define LIBCOMMUNISM_CONDITIONVARIABLE_H
+
+#include <libcommunism/Mutex.h>
+#include <libcommunism/WaitQueue.h>
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+
+namespace libcommunism {
+/**
+ * Condition variables allow cothreads to wait until they're notified, atomically releasing a
+ * Mutex while they wait. Waiters are notified in FIFO order. Notifying a condition variable that
+ * nobody is waiting on is a single atomic load.
+ *
+ * @brief Condition variable for cothreads
+ */
+class ConditionVariable {
+    public:
+        ConditionVariable() = default;
+
+        ConditionVariable(const ConditionVariable &) = delete;
+        ConditionVariable &operator=(const ConditionVariable &) = delete;
+
+        /**
+         * Releases the mutex and blocks the calling cothread until it's notified; the mutex is
+         * reacquired before returning. Like `std::condition_variable`, this may wake spuriously.
+         *
+         * @param lock Lock holding the mutex
+         */
+        void wait(std::unique_lock<Mutex> &lock);
+
+        /**
+         * Blocks the calling cothread until the predicate is satisfied.
+         *
+         * @param lock Lock holding the mutex, which protects the state the predicate checks
+         * @param pred Predicate to check after each wakeup
+         */
+        template<class Predicate>
+        void wait(std::unique_lock<Mutex> &lock, Predicate pred) {
+            while(!pred()) {
+                this->wait(lock);
+            }
+        }
+
+        /**
+         * Wakes up the longest waiting cothread, if any.
+         */
+        void notifyOne() {
+            if(this->numWaiters.load(std::memory_order_seq_cst)) {
+                this->notify(1);
+            }
+        }
+
+        /**
+         * Wakes up all waiting cothreads.
+         */
+        void notifyAll() {
+            if(this->numWaiters.load(std::memory_order_seq_cst)) {
+                this->notify(SIZE_MAX);
+            }
+        }
+
+    private:
+        void notify(size_t count);
+
+    private:
+        /// Number of waiting cothreads
+        std::atomic_size_t numWaiters{0};
+
+        /// Protects the wait queue
+        std::mutex queueLock;
+        /// Cothreads waiting to be notified
+        WaitQueue waiters;
+};
+}
+
+#endif
@@ -0,0 +1,422 @@
+#ifndef LIBCOMMUNISM_COROUTINE_H
+#define LIBCOMMUNISM_COROUTINE_H
+
+#include <libcommunism/Cothread.h>
+#include <libcommunism/Scheduler.h>
+
+#include <concepts>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+namespace libcommunism {
+template<class T> class Task;
+
+namespace internal {
+/**
+ * @brief Outcome of an operation that's awaited across the two execution models: either the
+ *        value it produced, or the exception it threw
+ *
+ * @tparam T Type of value produced by the operation
+ */
+template<class T>
+class AwaitResult {
+    public:
+        /**
+         * Invokes the callable, and stores its return value or the exception it threw.
+         */
+        template<class F>
+        void capture(F &&func) noexcept {
+            try {
+                this->value.template emplace<1>(std::invoke(std::forward<F>(func)));
+            } catch(...) {
+                this->value.template emplace<2>(std::current_exception());
+            }
+        }
+
+        /// Stores the value produced by the operation.
+        template<class U>
+        void setValue(U &&result) {
+            this->value.template emplace<1>(std::forward<U>(result));
+        }
+
+        /// Stores the exception thrown by the operation.
+        void setException(std::exception_ptr exception) noexcept {
+            this->value.template emplace<2>(std::move(exception));
+        }
+
+        /**
+         * Takes the value produced by the operation, or rethrows its exception.
+         */
+        T get() {
+            if(auto exception = std::get_if<2>(&this->value)) {
+                std::rethrow_exception(*exception);
+            }
+            return std::move(std::get<1>(this->value));
+        }
+
+    private:
+        std::variant<std::monostate, T, std::exception_ptr> value;
+};
+
+/**
+ * @brief Outcome of an operation that doesn't produce a value: whether it threw an exception
+ */
+template<>
+class AwaitResult<void> {
+    public:
+        template<class F>
+        void capture(F &&func) noexcept {
+            try {
+                std::invoke(std::forward<F>(func));
+            } catch(...) {
+                this->exception = std::current_exception();
+            }
+        }
+
+        void setException(std::exception_ptr exception) noexcept {
+            this->exception = std::move(exception);
+        }
+
+        void get() {
+            if(this->exception) {
+                std::rethrow_exception(this->exception);
+            }
+        }
+
+    private:
+        std::exception_ptr exception;
+};
+
+/**
+ * @brief Parts of the promise of a Task that don't depend on its result type
+ *
+ * Tasks start suspended. When they complete, whoever is waiting for them continues: a coroutine
+ * that awaits the task is resumed directly (by symmetric transfer), while a cothread that waits
+ * for it is unparked.
+ */
+struct TaskPromiseBase {
+    /**
+     * @brief Awaiter for the final suspension point of a task, which continues its waiter
+     */
+    struct FinalAwaiter {
+        bool await_ready() const noexcept {
+            return false;
+        }
+
+        template<class Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+            auto &promise = handle.promise();
+            if(promise.continuation) {
+                return promise.continuation;
+            }
+
+            // a waiting cothread that started the task and is still running doesn't need a wakeup
+            if(promise.waiter && promise.waiter != Cothread::Current()) {
+                Scheduler::Unpark(promise.waiter);
+            }
+            return std::noop_coroutine();
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+    std::suspend_always initial_suspend() const noexcept {
+        return {};
+    }
+
+    FinalAwaiter final_suspend() const noexcept {
+        return {};
+    }
+
+    /// Coroutine awaiting the task, if any
+    std::coroutine_handle<> continuation;
+    /// Cothread waiting for the task, if any
+    Cothread *waiter{nullptr};
+};
+
+/**
+ * @brief Promise of a task that produces a value
+ */
+template<class T>
+struct TaskPromise: TaskPromiseBase {
+    Task<T> get_return_object() noexcept;
+
+    template<class U>
+        requires std::convertible_to<U, T>
+    void return_value(U &&value) {
+        this->result.setValue(std::forward<U>(value));
+    }
+
+    void unhandled_exception() noexcept {
+        this->result.setException(std::current_exception());
+    }
+
+    /// Value returned by the task, or the exception that escaped from it
+    AwaitResult<T> result;
+};
+
+/**
+ * @brief Promise of a task that doesn't produce a value
+ */
+template<>
+struct TaskPromise<void>: TaskPromiseBase {
+    Task<void> get_return_object() noexcept;
+
+    void return_void() noexcept {}
+
+    void unhandled_exception() noexcept {
+        this->result.setException(std::current_exception());
+    }
+
+    /// Exception that escaped from the task, if any
+    AwaitResult<void> result;
+};
+}
+
+/**
+ * A task is a stackless (C++20) coroutine that produces a value. It doesn't start executing when
+ * it's created, but when it's first awaited: either by a coroutine that uses `co_await` on it, or
+ * by a cothread that invokes wait().
+ *
+ * While it's suspended, whoever resumes it next (usually the scheduler of the kernel thread, see
+ * Scheduler::Resume()) determines what it runs on. When it completes, an awaiting coroutine is
+ * resumed right away; a waiting cothread is unparked.
+ *
+ * @remark A task must not be destroyed while it's suspended anywhere other than at its start or
+ *         end, since whatever is going to resume it still refers to it.
+ *
+ * @brief Coroutine that can be awaited by coroutines and cothreads alike
+ *
+ * @tparam T Type of value produced by the task
+ */
+template<class T = void>
+class [[nodiscard]] Task {
+    friend struct internal::TaskPromise<T>;
+
+    /**
+     * @brief Awaiter of a task: it starts the task, and is resumed once it completes
+     */
+    struct Awaiter {
+        bool await_ready() const noexcept {
+            return false;
+        }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+            this->handle.promise().continuation = awaiting;
+            return this->handle;
+        }
+
+        T await_resume() {
+            return this->handle.promise().result.get();
+        }
+
+        /// Task being awaited
+        std::coroutine_handle<internal::TaskPromise<T>> handle;
+    };
+
+    public:
+        using promise_type = internal::TaskPromise<T>;
+
+        Task(Task &&other) noexcept : handle(std::exchange(other.handle, {})) {}
+
+        Task &operator=(Task &&other) noexcept {
+            if(this != &other) {
+                if(this->handle) {
+                    this->handle.destroy();
+                }
+                this->handle = std::exchange(other.handle, {});
+            }
+            return *this;
+        }
+
+        Task(const Task &) = delete;
+        Task &operator=(const Task &) = delete;
+
+        /**
+         * Destroys the coroutine, along with its result.
+         */
+        ~Task() {
+            if(this->handle) {
+                this->handle.destroy();
+            }
+        }
+
+        /**
+         * Checks whether the task has completed.
+         */
+        bool isDone() const {
+            return this->handle.done();
+        }
+
+        /**
+         * Starts the task, and suspends the awaiting coroutine until it completes.
+         *
+         * @return Awaiter that produces the task's result, or rethrows its exception
+         */
+        Awaiter operator co_await() noexcept {
+            return Awaiter{this->handle};
+        }
+
+        /**
+         * Starts the task on the calling cothread, and blocks it until the task completes. The
+         * task executes on the cothread's stack until it first suspends; the cothread is then
+         * parked until the task completes.
+         *
+         * @remark This must be invoked from a cothread spawned through the Scheduler; and not from
+         *         a coroutine, which would block the helper cothread that resumes all coroutines.
+         *
+         * @return Value returned by the task
+         *
+         * @throw Any exception that escaped from the task
+         */
+        T wait() {
+            auto &promise = this->handle.promise();
+            promise.waiter = Cothread::Current();
+
+            this->handle.resume();
+            while(!this->handle.done()) {
+                Scheduler::Park();
+            }
+
+            return promise.result.get();
+        }
+
+    private:
+        explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+    private:
+        /// Coroutine of the task
+        std::coroutine_handle<promise_type> handle;
+};
+
+template<class T>
+Task<T> internal::TaskPromise<T>::get_return_object() noexcept {
+    return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> internal::TaskPromise<void>::get_return_object() noexcept {
+    return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+/**
+ * Awaiting this suspends the coroutine and queues it on the scheduler of the calling kernel
+ * thread, behind any cothreads that are already runnable; it's the coroutine equivalent of
+ * Scheduler::Yield().
+ *
+ * @brief Awaitable that reschedules a coroutine
+ */
+class Reschedule {
+    public:
+        bool await_ready() const noexcept {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> awaiting) noexcept {
+            this->hook.handle = awaiting;
+            Scheduler::Resume(this->hook);
+        }
+
+        void await_resume() const noexcept {}
+
+    private:
+        /// Links the coroutine into the scheduler's queue
+        internal::CoroutineHook hook;
+};
+
+/**
+ * Awaiting this spawns a cothread on the scheduler of the calling kernel thread, which invokes
+ * the callable; the coroutine is suspended until it returns, then resumed through the scheduler.
+ *
+ * The callable may do anything a cothread can do, such as blocking on a channel or a mutex,
+ * without blocking any other coroutines. Exceptions it throws are rethrown in the coroutine.
+ *
+ * @brief Awaitable that executes a callable on a cothread of its own
+ *
+ * @tparam F Type of callable
+ * @tparam Args Types of arguments to the callable
+ */
+template<class F, class... Args>
+class CothreadAwaiter {
+    /// Type of value returned by the callable
+    using Result = std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>;
+
+    public:
+        /**
+         * Stores the callable and its arguments until the awaiter is awaited.
+         *
+         * @param stackSize Size of the cothread's stack, in bytes; or zero for the platform default
+         * @param func Callable to execute on the cothread
+         * @param args Arguments to pass to the callable
+         */
+        template<class G, class... GArgs>
+        explicit CothreadAwaiter(const size_t stackSize, G &&func, GArgs &&...args) :
+            stackSize(stackSize), call(std::forward<G>(func), std::forward<GArgs>(args)...) {}
+
+        CothreadAwaiter(const CothreadAwaiter &) = delete;
+        CothreadAwaiter &operator=(const CothreadAwaiter &) = delete;
+
+        bool await_ready() const noexcept {
+            return false;
+        }
+
+        /**
+         * Spawns the cothread. Once the callable returns, the cothread queues the awaiting
+         * coroutine to be resumed; it lives in the coroutine's frame until then, as does the
+         * awaiter.
+         *
+         * @throw std::runtime_error If the cothread could not be allocated
+         */
+        void await_suspend(std::coroutine_handle<> awaiting) {
+            this->hook.handle = awaiting;
+
+            Scheduler::Spawn(this->stackSize, StackType::Default, [this]() noexcept {
+                this->result.capture([this]() -> Result {
+                    return std::apply([](auto &func, auto &...args) -> Result {
+                        return std::invoke(std::move(func), std::move(args)...);
+                    }, this->call);
+                });
+                Scheduler::Resume(this->hook);
+            });
+        }
+
+        /**
+         * Returns the value returned by the callable, or rethrows its exception.
+         */
+        Result await_resume() {
+            return this->result.get();
+        }
+
+    private:
+        /// Size of the cothread's stack
+        size_t stackSize;
+        /// Callable to invoke on the cothread, and its arguments
+        std::tuple<std::decay_t<F>, std::decay_t<Args>...> call;
+        /// Result of the callable
+        internal::AwaitResult<Result> result;
+        /// Links the coroutine into the scheduler's queue, once the callable returned
+        internal::CoroutineHook hook;
+};
+
+/**
+ * Creates an awaitable that executes the callable on a new cothread, with a default sized stack,
+ * and resumes the awaiting coroutine with its result.
+ *
+ * @param func Callable to execute on the cothread
+ * @param args Arguments to pass to the callable
+ *
+ * @return Awaitable producing the callable's return value
+ */
+template<class F, class... Args>
+    requires std::invocable<std::decay_t<F>, std::decay_t<Args>...>
+CothreadAwaiter<F, Args...> RunOnCothread(F &&func, Args &&...args) {
+    return CothreadAwaiter<F, Args...>(0, std::forward<F>(func), std::forward<Args>(args)...);
+}
+}
+
+#endif
@@ -1,18 +1,282 @@
 #ifndef LIBCOMMUNISM_COTHREAD_H
 #define LIBCOMMUNISM_COTHREAD_H
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <bit>
+#include <concepts>
 #include <cstddef>
 #include <cstdint>
 #include <functional>
+#include <memory>
+#include <new>
 #include <span>
 #include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <libcommunism/StackPool.h>
 
 /**
  * @brief Main namespace for the libcommunism library.
  */
 namespace libcommunism {
+template<class Backend> class BasicCothread;
+class Cothread;
 struct CothreadImpl;
+class Runtime;
+class Scheduler;
+class SharedStack;
+class StackProfile;
+class WaitQueue;
+
+namespace internal {
+class RuntimeWorker;
+struct FpState;
+struct SchedulerState;
+struct SharedStackState;
+
+bool HandleStackFault(void *address) noexcept;
+
+/**
+ * @brief Type erased entry point of a cothread
+ *
+ * Entry records are constructed in place at the high end of the cothread's stack, and hold the
+ * callable (and any arguments bound to it) that the cothread executes. The platform code invokes
+ * the record exactly once, when the cothread is first switched to.
+ */
+struct EntryRecord {
+    /// Invokes the callable with its bound arguments, then destroys them.
+    void (*invoke)(EntryRecord *record){nullptr};
+    /// Destroys the callable and its arguments without invoking it.
+    void (*destroy)(EntryRecord *record){nullptr};
+    /// Set once the callable and its arguments have been destroyed
+    bool finished{false};
+};
+
+/**
+ * @brief Entry record for a callable of a particular type, and the arguments bound to it
+ *
+ * The callable is held in an anonymous union so that it can be destroyed independently of the
+ * record itself, which stays valid for as long as the cothread's stack does.
+ */
+template<class F, class... Args>
+struct CallableRecord: EntryRecord {
+    template<class CallF, class... CallArgs>
+    explicit CallableRecord(CallF &&f, CallArgs &&...args) :
+        callable(std::forward<CallF>(f), std::forward<CallArgs>(args)...) {
+        this->invoke = &CallableRecord::Invoke;
+        this->destroy = &CallableRecord::Destroy;
+    }
+    CallableRecord(CallableRecord &&other) : callable(std::move(other.callable)) {
+        this->invoke = &CallableRecord::Invoke;
+        this->destroy = &CallableRecord::Destroy;
+    }
+    ~CallableRecord() {}
+
+    static void Invoke(EntryRecord *record) {
+        auto self = static_cast<CallableRecord *>(record);
+        std::apply([](auto &&...call) {
+            std::invoke(std::forward<decltype(call)>(call)...);
+        }, std::move(self->callable));
+        Destroy(record);
+    }
+
+    static void Destroy(EntryRecord *record) {
+        auto self = static_cast<CallableRecord *>(record);
+        std::destroy_at(&self->callable);
+        self->finished = true;
+    }
+
+    union {
+        /// Callable to invoke, followed by its arguments
+        std::tuple<F, Args...> callable;
+    };
+};
+
+/// Entry record type used for a callable and its arguments, as passed to a `Cothread`
+template<class F, class... Args>
+using CallableRecordFor = CallableRecord<std::decay_t<F>, std::decay_t<Args>...>;
+
+/**
+ * @brief State kept in each cothread by the scheduler
+ *
+ * This links the cothread into the run queue of a scheduler, so enqueueing it never allocates.
+ * The state and wakeup permit are atomic, since cothreads may be unparked from any kernel thread.
+ */
+struct SchedulerHook {
+    /// Scheduling state of a cothread
+    enum class State: uint8_t {
+        /// Executing, or not known to the scheduler
+        Idle,
+        /// Waiting in a run queue
+        Runnable,
+        /// Suspended until it's unparked
+        Parked,
+        /// Returned from its entry point, and waiting to be deallocated
+        Exited,
+    };
+
+    /// Next cothread in the run queue
+    Cothread *next{nullptr};
+    /// Current scheduling state
+    std::atomic<State> state{State::Idle};
+    /// Set when the cothread was unparked while not parked; its next park returns immediately.
+    std::atomic_bool permit{false};
+    /// Set for cothreads that were spawned through a Scheduler
+    bool spawned{false};
+    /// Scheduler of the kernel thread the cothread was spawned on, if any
+    SchedulerState *scheduler{nullptr};
+};
+
+#ifdef LIBCOMMUNISM_STATS
+/**
+ * @brief Runtime statistics kept in each cothread, if enabled in the build configuration
+ *
+ * Each field is only ever written by the kernel thread the cothread is executing on (or was last
+ * switched away from) so they're updated with plain relaxed loads and stores, rather than atomic
+ * read-modify-write operations; they're atomic only so that snapshots may be taken from other
+ * kernel threads.
+ */
+struct StatsHook {
+    /// Number of times the cothread was switched to
+    std::atomic<uint64_t> switches{0};
+    /// Timestamp at which the cothread was last switched to
+    std::atomic<uint64_t> lastRun{0};
+    /// Total time the cothread was executing, in timestamp ticks
+    std::atomic<uint64_t> cpuTime{0};
+    /// Number of times the cothread voluntarily yielded
+    std::atomic<uint64_t> yields{0};
+
+    /// Previous cothread in the list of live cothreads
+    Cothread *prev{nullptr};
+    /// Next cothread in the list of live cothreads
+    Cothread *next{nullptr};
+
+    /// Records that the cothread is being switched to, at the given timestamp.
+    void switchedIn(const uint64_t now) noexcept {
+        this->switches.store(this->switches.load(std::memory_order_relaxed) + 1,
+                std::memory_order_relaxed);
+        this->lastRun.store(now, std::memory_order_relaxed);
+    }
+
+    /// Records that the cothread is being switched away from, at the given timestamp.
+    void switchedOut(const uint64_t now) noexcept {
+        const auto ran = now - this->lastRun.load(std::memory_order_relaxed);
+        this->cpuTime.store(this->cpuTime.load(std::memory_order_relaxed) + ran,
+                std::memory_order_relaxed);
+    }
+
+    /// Records a voluntary yield of the cothread.
+    void yielded() noexcept {
+        this->yields.store(this->yields.load(std::memory_order_relaxed) + 1,
+                std::memory_order_relaxed);
+    }
+};
+#endif
+}
+
+/**
+ * @brief Runtime statistics of a cothread
+ *
+ * Statistics are only collected if the library was built with the `LIBCOMMUNISM_STATS` option;
+ * otherwise, all fields are always zero. Times are measured with the processor's timestamp
+ * counter where available (see Cothread::GetStatsFrequency()) and sampled on each context switch.
+ */
+struct CothreadStats {
+    /// Number of times the cothread was switched to
+    uint64_t switches{0};
+    /**
+     * Total time the cothread was executing, in timestamp ticks. This is the time between being
+     * switched to and switching away, which includes any time the kernel thread was preempted;
+     * the time since the cothread was last switched to isn't included while it's executing.
+     */
+    uint64_t cpuTime{0};
+    /// Timestamp (in ticks) at which the cothread was last switched to, or 0 if it never was
+    uint64_t lastRun{0};
+    /// Number of times the cothread voluntarily yielded, through a Scheduler, Runtime or Yield()
+    uint64_t yields{0};
+};
+
+/**
+ * Describes how much of the processor's floating point and vector state is saved and restored along
+ * with a cothread's context.
+ *
+ * The platform code only saves the registers that the calling convention requires a function to
+ * preserve; anything else that's part of the floating point environment (such as the rounding
+ * mode) is shared between all cothreads on a kernel thread, so changes made by one cothread are
+ * visible in whatever cothread runs next. Cothreads that change it can opt into saving it, at an
+ * additional cost on each context switch to or from them.
+ *
+ * @brief Floating point state that's switched along with a cothread
+ */
+enum class ContextProfile: uint8_t {
+    /**
+     * Only the registers preserved by the calling convention are saved; the floating point
+     * environment is shared with the other cothreads on the kernel thread. This is the default.
+     */
+    Minimal,
+
+    /**
+     * Additionally, the floating point control registers are saved: MXCSR and the x87 control word
+     * on x86, or the floating point environment on other platforms. This covers rounding modes,
+     * exception masks and flush-to-zero settings.
+     */
+    FpControl,
+
+    /**
+     * The entire extended processor state that's enabled by the operating system is saved, using
+     * `XSAVEOPT`; this includes all vector registers, the x87 status and tags, and the like. The
+     * protection key register and AMX tile state are left alone. It's only available on amd64
+     * (other than Windows) with processor support; elsewhere, it behaves like FpControl.
+     */
+    Full,
+};
+
+/**
+ * @brief Statistics of a single cothread, as taken by Cothread::GetAllStats()
+ */
+struct CothreadStatsEntry {
+    /// Cothread the statistics belong to; it may have been destroyed since.
+    Cothread *thread{nullptr};
+    /// Debug label of the cothread at the time of the snapshot
+    std::string label;
+    /// Statistics of the cothread
+    CothreadStats stats;
+};
+
+/**
+ * @brief Types of values that can be passed between cothreads by `Cothread::resume()` and
+ *        `Cothread::Yield()`
+ *
+ * These are trivially copyable types no larger than a machine word, so they can be carried in a
+ * register across the context switch.
+ */
+template<class T>
+concept Transferable = std::is_trivially_copyable_v<T> && (sizeof(T) <= sizeof(uintptr_t));
+
+namespace internal {
+/// Converts a transferable value to the machine word carried across a context switch.
+template<Transferable T>
+constexpr uintptr_t ToWord(const T value) {
+    std::array<std::byte, sizeof(uintptr_t)> word{};
+    const auto bytes = std::bit_cast<std::array<std::byte, sizeof(T)>>(value);
+    std::copy(bytes.begin(), bytes.end(), word.begin());
+    return std::bit_cast<uintptr_t>(word);
+}
+
+/// Converts a machine word carried across a context switch back to a transferable value.
+template<Transferable T>
+constexpr T FromWord(const uintptr_t value) {
+    std::array<std::byte, sizeof(T)> bytes;
+    const auto word = std::bit_cast<std::array<std::byte, sizeof(uintptr_t)>>(value);
+    std::copy_n(word.begin(), sizeof(T), bytes.begin());
+    return std::bit_cast<T>(bytes);
+}
+}
 
 /**
  * Cooperative threads are threads that perform context switching in userspace, rather than relying
@@ -20,8 +284,20 @@ struct CothreadImpl;
  * avoided, which costs a significant amount of clock cycles.
  *
  * @brief Instance of a single cooperative thread
+ *
+ * @remark Cothread objects are aligned to a cache line, so the pointer to the implementation and
+ *         the fields of the implementation that are accessed during a context switch (such as the
+ *         saved stack pointer) all reside in the same cache line.
  */
-class Cothread {
+class alignas(64) Cothread {
+    template<class Backend> friend class BasicCothread;
+    friend class Runtime;
+    friend class Scheduler;
+    friend class SharedStack;
+    friend class WaitQueue;
+    friend class internal::RuntimeWorker;
+    friend bool internal::HandleStackFault(void *address) noexcept;
+
     public:
         /// Type alias for an entry point of a cothread
         using Entry = std::function<void()>;
@@ -76,13 +352,15 @@ class Cothread {
          * @param entry Method to execute on entry to this cothread
          * @param stackSize Size of the stack to be allocated, in bytes. it should be a multiple of
          *        the machine word size, or specify zero to use the platform default.
+         * @param stackType Kind of memory to allocate for the stack
          *
          * @throw std::runtime_error If the memory for the cothread could not be allocated.
          * @throw std::runtime_error If the provided stack size is invalid
          *
          * @return An initialized cothread object
          */
-        Cothread(const Entry &entry, const size_t stackSize = 0);
+        Cothread(const Entry &entry, const size_t stackSize = 0,
+                const StackType stackType = StackType::Default);
 
         /**
          * Allocates a new cothread, using an existing buffer to store its stack.
@@ -109,6 +387,164 @@ class Cothread {
          */
         Cothread(const Entry &entry, std::span<uintptr_t> stack);
 
+        /**
+         * Allocates a new cothread that executes an arbitrary callable, using an existing buffer to
+         * store its stack.
+         *
+         * The callable and its arguments are decay-copied (or moved, if passed as rvalues) into an
+         * entry record constructed in place at the high end of the stack, so creating a cothread in
+         * this way does not allocate any memory. Once the cothread starts, the callable is invoked
+         * with its arguments as rvalues; they're destroyed when it returns, or when the cothread
+         * is destroyed, whichever happens first.
+         *
+         * @remark The same requirements apply to the stack buffer as for the constructor taking an
+         *         `Entry` and a stack.
+         *
+         * @param stack Buffer to use as the stack of the cothread
+         * @param entry Callable to execute on entry to this cothread
+         * @param args Arguments to pass to the callable
+         *
+         * @throw std::runtime_error If the provided stack is invalid, or too small to hold the
+         *        callable and its arguments. They may take up at most half of the stack.
+         * @throw Any exception thrown by the copy or move constructors of the callable and its
+         *        arguments
+         */
+        template<class F, class... Args>
+            requires std::invocable<std::decay_t<F>, std::decay_t<Args>...>
+        Cothread(std::span<uintptr_t> stack, F &&entry, Args &&...args) {
+            this->allocImpl(stack);
+            this->emplaceEntry(std::forward<F>(entry), std::forward<Args>(args)...);
+        }
+
+        /**
+         * Allocates a new cothread that executes an arbitrary callable, allocating its stack.
+         *
+         * This behaves as the variant that takes a stack buffer, except the stack is allocated
+         * as described in the constructor that takes an `Entry` and stack size. When the stack is
+         * satisfied from the calling thread's stack pool, this does not allocate any memory.
+         *
+         * @param stackSize Size of the stack to be allocated, in bytes; or zero to use the platform
+         *        default.
+         * @param stackType Kind of memory to allocate for the stack
+         * @param entry Callable to execute on entry to this cothread
+         * @param args Arguments to pass to the callable
+         *
+         * @throw std::runtime_error If the memory for the cothread could not be allocated.
+         * @throw std::runtime_error If the provided stack size is invalid
+         * @throw Any exception thrown by the copy or move constructors of the callable and its
+         *        arguments
+         */
+        template<class F, class... Args>
+            requires std::invocable<std::decay_t<F>, std::decay_t<Args>...>
+        Cothread(const size_t stackSize, const StackType stackType, F &&entry, Args &&...args) {
+            this->allocImpl(stackSize, stackType);
+            this->emplaceEntry(std::forward<F>(entry), std::forward<Args>(args)...);
+        }
+
+        /**
+         * Allocates a new cothread that executes an arbitrary callable, allocating its stack from
+         * the default kind of memory.
+         *
+         * @param stackSize Size of the stack to be allocated, in bytes; or zero to use the platform
+         *        default.
+         * @param entry Callable to execute on entry to this cothread
+         * @param args Arguments to pass to the callable
+         */
+        template<class F, class... Args>
+            requires std::invocable<std::decay_t<F>, std::decay_t<Args>...>
+        Cothread(const size_t stackSize, F &&entry, Args &&...args) :
+            Cothread(stackSize, StackType::Default, std::forward<F>(entry),
+                    std::forward<Args>(args)...) {}
+
+        /**
+         * Allocates a new cothread that executes an arbitrary callable, with a stack of the size
+         * recommended by a stack profile. The stack is painted, and its high water mark is
+         * recorded in the profile when the cothread is destroyed.
+         *
+         * If the profile has a name, it's assigned as the cothread's label.
+         *
+         * @param profile Stack profile for this kind of cothread; it must outlive the cothread.
+         * @param entry Callable to execute on entry to this cothread
+         * @param args Arguments to pass to the callable
+         *
+         * @throw std::runtime_error If the memory for the cothread could not be allocated.
+         */
+        template<class F, class... Args>
+            requires std::invocable<std::decay_t<F>, std::decay_t<Args>...>
+        Cothread(StackProfile &profile, F &&entry, Args &&...args) {
+            this->allocImpl(profile);
+            this->emplaceEntry(std::forward<F>(entry), std::forward<Args>(args)...);
+        }
+
+        /**
+         * Allocates a new cothread that executes an arbitrary callable on a shared stack. Rather
+         * than a stack of its own, it only holds a copy of the live part of its stack while it's
+         * suspended; see SharedStack for the details and restrictions.
+         *
+         * The callable and its arguments are stored in a separate heap allocation, rather than at
+         * the high end of the stack. getStack() and getStackSize() describe the shared stack.
+         *
+         * @param stack Shared stack to execute on; it must outlive the cothread.
+         * @param entry Callable to execute on entry to this cothread
+         * @param args Arguments to pass to the callable
+         *
+         * @throw std::runtime_error If the memory for the cothread could not be allocated.
+         * @throw Any exception thrown by the copy or move constructors of the callable and its
+         *        arguments
+         */
+        template<class F, class... Args>
+            requires std::invocable<std::decay_t<F>, std::decay_t<Args>...>
+        Cothread(SharedStack &stack, F &&entry, Args &&...args) {
+            this->allocImpl(stack);
+            this->emplaceEntry(std::forward<F>(entry), std::forward<Args>(args)...);
+        }
+
+        /**
+         * Re-arms the cothread with a new entry point, so that it starts executing it the next time
+         * it's switched to. The stack and implementation are reused; only the entry record and the
+         * initial context are rebuilt, so this does not allocate any memory.
+         *
+         * The cothread may have returned from its entry point, never have run, or be suspended in
+         * the middle of its entry point. In the latter case, its previous call stack is discarded
+         * without unwinding it; the previous callable and its arguments are destroyed, but any
+         * other objects on the stack are not.
+         *
+         * This may also be invoked on the currently executing cothread; typically from the return
+         * handler, to recycle a cothread once its entry point returned. In this case, the call
+         * does not return: instead, the cothread immediately restarts at the new entry point. To
+         * do this, the new entry record is built on the stack of a helper cothread, which is
+         * allocated the first time this is done on a particular kernel thread. The callable and
+         * its arguments must be move constructible without throwing.
+         *
+         * @remark Do not re-arm a cothread that is executing on a different kernel thread, or the
+         *         cothread returned by Current() before any cothread was switched to.
+         *
+         * @param entry Callable to execute on entry to this cothread
+         * @param args Arguments to pass to the callable
+         *
+         * @throw std::runtime_error If the callable and its arguments don't fit in the stack
+         * @throw Any exception thrown by the copy or move constructors of the callable and its
+         *        arguments. If the cothread isn't currently executing, it's left without an entry
+         *        point and must be re-armed before it is switched to again; otherwise, it remains
+         *        unchanged.
+         */
+        template<class F, class... Args>
+            requires std::invocable<std::decay_t<F>, std::decay_t<Args>...>
+        void reset(F &&entry, Args &&...args) {
+            using Record = internal::CallableRecordFor<F, Args...>;
+
+            if(this == gCurrent) {
+                auto refs = std::forward_as_tuple(std::forward<F>(entry),
+                        std::forward<Args>(args)...);
+                this->restart(&refs, &Cothread::RestartStage<Record, decltype(refs)>);
+            }
+
+            this->rearm<Record>(std::forward<F>(entry), std::forward<Args>(args)...);
+        }
+
+        Cothread(const Cothread &) = delete;
+        Cothread &operator=(const Cothread &) = delete;
+
         /**
          * Destroys a previously allocated cothread, and deallocates any underlying buffer memory
          * used by it.
@@ -128,8 +564,91 @@ class Cothread {
          * @note Do not attempt to switch to a currently executing cothread, whether it is on the
          *       same physical thread or not. This will corrupt both cothreads' stacks and result
          *       in undefined behavior.
+         *
+         * @remark The platform's context switch routine is invoked directly; this never allocates
+         *         memory, including the first time it's invoked on a kernel thread.
+         */
+        void switchTo() noexcept {
+            const auto from = gCurrent;
+            if(kStatsEnabled || !from || from->growableStack || from->fpState || this->fpState ||
+                    this->shared) [[unlikely]] {
+                this->switchToSlow(from);
+                return;
+            }
+
+            gCurrent = this;
+            PlatformSwitch(from->impl, this->impl);
+        }
+
+        /**
+         * Resumes this cothread, passing a value to it, and returns once it yields back.
+         *
+         * The calling cothread is recorded as the resumer of this cothread, so that a subsequent
+         * call to Yield() on it returns control (and a value) to the caller. Values are carried
+         * in registers across the context switch where the platform supports it, so this costs
+         * no more than switchTo().
+         *
+         * @remark The value is returned from the call to Yield() that this cothread is suspended
+         *         in. If it's not suspended in Yield() (for example, because it hasn't started
+         *         yet, or it's suspended in switchTo()) the value is discarded.
+         *
+         * @param value Value to pass to this cothread
+         *
+         * @return Value this cothread passed to Yield(); or an unspecified value if control was
+         *         returned to the caller by some other means, such as switchTo().
          */
-        void switchTo();
+        template<Transferable R = void *, Transferable T = void *>
+        R resume(const T value = {}) noexcept {
+            return internal::FromWord<R>(this->resumeWith(internal::ToWord(value)));
+        }
+
+        /**
+         * Yields control of the currently executing cothread back to the cothread that last
+         * resumed it, passing a value to it.
+         *
+         * @remark This must only be called from a cothread that was started or resumed with
+         *         resume(); otherwise, the program is terminated.
+         *
+         * @param value Value to return from the call to resume() the resumer is suspended in
+         *
+         * @return Value passed to resume() when this cothread is next resumed; or an unspecified
+         *         value if it's next switched to by some other means, such as switchTo().
+         */
+        template<Transferable R = void *, Transferable T = void *>
+        static R Yield(const T value = {}) noexcept {
+            return internal::FromWord<R>(YieldWith(internal::ToWord(value)));
+        }
+
+        /**
+         * Resumes this cothread, passing a machine word to it.
+         *
+         * @param value Value to pass to the cothread
+         *
+         * @return Value passed to Yield() by this cothread
+         *
+         * @see resume()
+         */
+        uintptr_t resumeWith(const uintptr_t value) noexcept;
+
+        /**
+         * Yields the currently executing cothread to its resumer, passing a machine word to it.
+         *
+         * @param value Value to pass to the resumer
+         *
+         * @return Value passed to resume() when the cothread is next resumed
+         *
+         * @see Yield()
+         */
+        static uintptr_t YieldWith(const uintptr_t value) noexcept;
+
+        /**
+         * Gets the cothread that last resumed this one; this is where Yield() returns control to.
+         *
+         * @return Cothread that last called resume() on this cothread, if any
+         */
+        constexpr auto getResumer() const {
+            return this->resumer;
+        }
 
         /**
          * Gets the debug label (name) associated with this cothread.
@@ -140,6 +659,79 @@ class Cothread {
             return this->label;
         }
 
+        /**
+         * Checks whether the cothread executes on a shared stack; see SharedStack.
+         */
+        constexpr bool isOnSharedStack() const {
+            return this->shared;
+        }
+
+        /**
+         * Gets the runtime statistics of this cothread. If statistics are disabled in the build
+         * configuration, all fields are zero.
+         *
+         * @return A snapshot of the cothread's statistics
+         */
+        CothreadStats getStats() const;
+
+        /**
+         * Takes a snapshot of the statistics of all live cothreads, on all kernel threads; the
+         * cothreads that represent kernel threads (see Current()) aren't included.
+         *
+         * @remark Statistics of cothreads executing on other kernel threads may be slightly out
+         *         of date. Labels must not be changed while a snapshot is taken.
+         *
+         * @return Statistics of each live cothread; or an empty list if statistics are disabled
+         *         in the build configuration.
+         */
+        static std::vector<CothreadStatsEntry> GetAllStats();
+
+        /**
+         * Gets the frequency of the timestamps used for cothread statistics.
+         *
+         * @remark On some platforms, this is calibrated against the system clock the first time
+         *         it's invoked, which takes a few milliseconds.
+         *
+         * @return Timestamp ticks per second
+         */
+        static uint64_t GetStatsFrequency();
+
+        /// Whether the library was built to collect cothread statistics
+#ifdef LIBCOMMUNISM_STATS
+        constexpr static const bool kStatsEnabled{true};
+#else
+        constexpr static const bool kStatsEnabled{false};
+#endif
+
+        /**
+         * Gets the floating point state that's saved with this cothread's context.
+         *
+         * @return The cothread's context profile; ContextProfile::Minimal unless it was changed
+         */
+        ContextProfile getContextProfile() const;
+
+        /**
+         * Changes how much floating point state is saved with this cothread's context. The state
+         * is saved whenever the cothread is switched away from, and restored whenever it's switched
+         * to; cothreads with the minimal profile share the floating point state of the kernel
+         * thread they execute on, which is restored when switching from a cothread with a larger
+         * profile to one of them.
+         *
+         * The cothread initially runs with the floating point state that's current when this is
+         * invoked.
+         *
+         * @remark Switches to and from cothreads with the minimal profile (which is the default)
+         *         don't pay for any of this, other than a check of the profiles.
+         *
+         * @remark The profile is only honored by context switches between Cothread instances;
+         *         BasicCothread never saves more than the minimal state.
+         *
+         * @param profile Floating point state to save with the cothread's context
+         *
+         * @throw std::bad_alloc If memory for the saved state couldn't be allocated
+         */
+        void setContextProfile(const ContextProfile profile);
+
         /**
          * Changes the debug label (name) associated with this cothread.
          *
@@ -171,23 +763,122 @@ class Cothread {
          */
         void *getStack() const;
 
-    private:
         /**
-         * Create a cothread with an already initialized cothread implementation, which will be
-         * transferred into the cothread.
+         * Gets the maximum number of bytes of stack the cothread has used so far.
+         *
+         * This requires the stack to have been painted with a known pattern when the cothread was
+         * created: either because it was created with a StackProfile, or because stack painting
+         * was enabled in the stack pool configuration. The stack is then scanned from its low end
+         * up to the first word that no longer holds the pattern, so this takes time proportional
+         * to the unused part of the stack.
          *
-         * @param impl An initialized CothreadImpl object
+         * @remark The cothread must not be executing on a different kernel thread.
+         *
+         * @return Number of bytes of stack used, including the entry point and initial stack
+         *         frame; or zero if the stack wasn't painted.
          */
-        Cothread(CothreadImpl *impl) : impl(impl) {}
+        size_t getStackHighWaterMark() const;
 
     private:
-        /// Optional label attached to the cothread (for debugging purposes only)
-        std::string label{""};
+        /**
+         * Create an empty cothread. This is used to wrap the kernel thread; its implementation is
+         * allocated separately.
+         */
+        Cothread() = default;
+
+        static Cothread *AllocKernelThreadCothread();
+
+        static Cothread *GetResetHelper();
+        static Cothread *GetSwapHelper();
+        static uintptr_t SwitchShared(Cothread *from, Cothread *to, const uintptr_t value) noexcept;
+        static void PrepareSwitch(Cothread *from, Cothread *to) noexcept;
+        static void PlatformSwitch(CothreadImpl *from, CothreadImpl *to) noexcept;
+        void switchToSlow(Cothread *from) noexcept;
+
+        void allocImpl(const size_t stackSize, const StackType stackType);
+        void allocImpl(std::span<uintptr_t> stack);
+        void allocImpl(StackProfile &profile);
+        void allocImpl(SharedStack &stack);
+        void prepareShared();
+        void paintStack();
+        size_t getInaccessibleStackSize() const;
+        void releaseImpl();
+        void *reserveEntry(const size_t size, const size_t alignment);
+        void prepareEntry(internal::EntryRecord *record);
+        void disarm() noexcept;
+        void registerStats();
+        void unregisterStats();
+        [[noreturn]] void restart(void *refs, void (*stage)(Cothread *, void *));
+
+        /**
+         * Replaces the entry record of the cothread (which must not be currently executing) with
+         * a new one, constructed from the given arguments, and prepares the cothread to invoke it.
+         *
+         * @tparam Record Type of entry record to construct
+         *
+         * @param args Arguments to the constructor of the entry record
+         */
+        template<class Record, class... RecordArgs>
+        void rearm(RecordArgs &&...args) {
+            auto mem = this->reserveEntry(sizeof(Record), alignof(Record));
+            this->disarm();
+            this->prepareEntry(new(mem) Record(std::forward<RecordArgs>(args)...));
+        }
+
+        /**
+         * Re-arms a cothread that was executing when reset() was invoked. This runs on the reset
+         * helper cothread: the entry record is first built on its stack, while the cothread's
+         * own stack is still intact; only then is it moved to the top of that stack.
+         *
+         * @param thread Cothread to re-arm
+         * @param refs Tuple of references to the callable and its arguments
+         */
+        template<class Record, class Refs>
+        static void RestartStage(Cothread *thread, void *refs) {
+            auto mem = thread->reserveEntry(sizeof(Record), alignof(Record));
+            auto temp = std::make_from_tuple<Record>(std::move(*static_cast<Refs *>(refs)));
+
+            [&]() noexcept {
+                thread->disarm();
+                thread->prepareEntry(new(mem) Record(std::move(temp)));
+            }();
+            temp.destroy(&temp);
+        }
+
+        /**
+         * Constructs the entry record for the given callable and arguments at the high end of the
+         * cothread's stack, then prepares the cothread to invoke it. The implementation must have
+         * been allocated already; it's released again if this fails.
+         *
+         * @param entry Callable to execute on entry to this cothread
+         * @param args Arguments to pass to the callable
+         */
+        template<class F, class... Args>
+        void emplaceEntry(F &&entry, Args &&...args) {
+            using Record = internal::CallableRecordFor<F, Args...>;
+
+            try {
+                this->rearm<Record>(std::forward<F>(entry), std::forward<Args>(args)...);
+            } catch(...) {
+                this->releaseImpl();
+                throw;
+            }
+        }
 
     private:
         CothreadImpl *impl{nullptr};
 
-        static thread_local Cothread *gCurrent;
+        /**
+         * Currently executing cothread. It's constant initialized, so that inline code (such as
+         * switchTo()) accesses it directly rather than through a thread local init wrapper.
+         */
+        static constinit thread_local Cothread *gCurrent;
+
+        /**
+         * Scheduler state of the cothread. It sits next to the implementation pointer, so that
+         * taking the cothread off the run queue touches the same cache line as switching to it.
+         */
+        internal::SchedulerHook hook;
 
         /**
          * Buffer into which the implementation is allocated.
@@ -195,10 +886,53 @@ class Cothread {
          * This is part of the cothread so we can avoid an extra heap allocation for the
          * implementation object. This means it must be large enough to accomodate all of the
          * built-in implementations to take advantage of this optimization.
+         *
+         * It closely follows the implementation pointer, so that the start of the implementation
+         * (including the saved stack pointer) shares a cache line with it.
          */
         std::array<uintptr_t, 32> implBuffer;
         /// When set, the implementation buffer is used.
         bool implBufferUsed{false};
+
+        /// Entry record of the cothread, which lives at the high end of its stack
+        internal::EntryRecord *entry{nullptr};
+
+        /// Cothread that last resumed this one
+        Cothread *resumer{nullptr};
+
+        /// M:N runtime the cothread was spawned on, if any
+        Runtime *runtime{nullptr};
+
+        /// Stack profile to record the stack high water mark in, if any
+        StackProfile *stackProfile{nullptr};
+        /// When set, the stack was painted with kStackPaint when it was allocated.
+        bool stackPainted{false};
+        /// Set if the stack is growable, and is extended when the cothread faults on it
+        bool growableStack{false};
+        /// Saved floating point state, if the cothread's context profile isn't the minimal one
+        internal::FpState *fpState{nullptr};
+
+        /// State of the cothread if it executes on a shared stack
+        internal::SharedStackState *shared{nullptr};
+
+        /// Pattern that stacks are painted with, to measure their high water mark
+        static constexpr const uintptr_t kStackPaint{static_cast<uintptr_t>(0xC07C07C0C07C07C0ULL)};
+
+#ifdef LIBCOMMUNISM_STATS
+        /// Runtime statistics of the cothread
+        internal::StatsHook stats;
+#endif
+
+        /**
+         * Minimum alignment of entry records. The record marks the upper bound of the stack that
+         * is available to the platform code, so this is chosen to satisfy any platform's stack
+         * alignment requirements.
+         */
+        static constexpr const size_t kEntryAlignment{64};
+
+    private:
+        /// Optional label attached to the cothread (for debugging purposes only)
+        std::string label{""};
 };
 }
 
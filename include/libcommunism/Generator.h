@@ -0,0 +1,299 @@
+#ifndef LIBCOMMUNISM_GENERATOR_H
+#define LIBCOMMUNISM_GENERATOR_H
+
+#include <libcommunism/Cothread.h>
+
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+namespace libcommunism {
+/**
+ * Thrown from Generator::Yield() in the body of a generator that's destroyed before its body
+ * returned, to unwind the body's stack. It doesn't derive from std::exception.
+ *
+ * @remark Bodies that catch all exceptions (with `catch(...)`) must rethrow this one; if the body
+ *         yields again instead, it's resumed with another GeneratorExit until it returns.
+ *
+ * @brief Exception that unwinds the body of a generator that's terminated early
+ */
+struct GeneratorExit {};
+
+namespace internal {
+/**
+ * Values passed to the cothread of a generator when it's resumed from a call to Yield()
+ */
+enum class GeneratorRequest: uintptr_t {
+    /// Produce the next value
+    Continue                            = 0,
+    /// Throw GeneratorExit, to unwind the body
+    Cancel                              = 1,
+};
+
+/**
+ * @brief Body of a generator, which is invoked on one of the kernel thread's generator cothreads
+ */
+class GeneratorBody {
+    public:
+        virtual ~GeneratorBody() = default;
+
+        void run() noexcept;
+
+        /// Exception that escaped from the body, if any
+        std::exception_ptr exception;
+
+    protected:
+        /// Invokes the body's callable.
+        virtual void invoke() = 0;
+};
+
+/**
+ * @brief Body of a generator that invokes a callable of a particular type
+ *
+ * @tparam F Type of callable
+ */
+template<class F>
+class GeneratorBodyFor final: public GeneratorBody {
+    public:
+        template<class G>
+        explicit GeneratorBodyFor(G &&func) : func(std::forward<G>(func)) {}
+
+    protected:
+        void invoke() override {
+            std::invoke(this->func);
+        }
+
+    private:
+        /// Callable to invoke
+        F func;
+};
+
+std::unique_ptr<Cothread> AcquireGeneratorThread(const size_t stackSize);
+void ReleaseGeneratorThread(std::unique_ptr<Cothread> thread, const size_t stackSize) noexcept;
+}
+
+/**
+ * A generator runs its body on a cothread, which passes values to the consumer with Yield(). Since
+ * the body has a stack of its own, it may yield from nested (and recursive) calls, such as when
+ * walking a tree; unlike stackless coroutines, which can only suspend in their outermost frame.
+ *
+ * Values aren't copied: the consumer receives a reference to the object passed to Yield(), which
+ * typically lives on the body's stack. It remains valid until the consumer advances the generator.
+ *
+ * The body starts executing when begin() is first invoked. When it returns, its cothread is put
+ * back into a small per kernel thread cache, from which the next generator with the same stack
+ * size takes it; so creating many short-lived generators costs little more than allocating their
+ * bodies. If a generator is destroyed while its body is suspended in Yield(), the body's stack is
+ * unwound by throwing GeneratorExit from that call.
+ *
+ * @remark A generator must be consumed and destroyed on the kernel thread that started it.
+ *
+ * @brief Range of values produced by a callable executing on a cothread
+ *
+ * @tparam T Type of the values produced; it may be const qualified
+ */
+template<class T>
+    requires (!std::is_reference_v<T>)
+class [[nodiscard]] Generator {
+    public:
+        /**
+         * @brief Input iterator over the values produced by a generator
+         *
+         * Incrementing it resumes the generator's body until it yields the next value, or
+         * returns; it then compares equal to `std::default_sentinel`.
+         */
+        class Iterator {
+            friend class Generator;
+
+            public:
+                using iterator_concept = std::input_iterator_tag;
+                using difference_type = std::ptrdiff_t;
+                using value_type = std::remove_cv_t<T>;
+
+                Iterator() = default;
+
+                T &operator*() const noexcept {
+                    return *this->generator->current;
+                }
+                T *operator->() const noexcept {
+                    return this->generator->current;
+                }
+
+                /**
+                 * Resumes the body to produce the next value.
+                 *
+                 * @throw Any exception that escaped from the body
+                 */
+                Iterator &operator++() {
+                    this->generator->advance(internal::GeneratorRequest::Continue);
+                    return *this;
+                }
+                void operator++(int) {
+                    ++*this;
+                }
+
+                bool operator==(std::default_sentinel_t) const noexcept {
+                    return !this->generator->current;
+                }
+
+            private:
+                explicit Iterator(Generator *generator) : generator(generator) {}
+
+            private:
+                /// Generator whose values are iterated
+                Generator *generator{nullptr};
+        };
+
+        /**
+         * Creates a generator whose body invokes the given callable. The body isn't started until
+         * begin() is invoked.
+         *
+         * @param body Callable that produces values by invoking Yield()
+         * @param stackSize Size of the stack of the body's cothread, in bytes; or zero to use the
+         *        platform default.
+         *
+         * @throw Any exception thrown by the copy or move constructor of the callable
+         */
+        template<class F>
+            requires (!std::same_as<std::remove_cvref_t<F>, Generator> &&
+                    std::invocable<std::decay_t<F> &>)
+        explicit Generator(F &&body, const size_t stackSize = 0) : stackSize(stackSize),
+            body(std::make_unique<internal::GeneratorBodyFor<std::decay_t<F>>>(
+                        std::forward<F>(body))) {}
+
+        Generator(Generator &&other) noexcept : stackSize(other.stackSize),
+            body(std::move(other.body)), thread(std::move(other.thread)),
+            current(std::exchange(other.current, nullptr)) {}
+
+        Generator &operator=(Generator &&other) noexcept {
+            if(this != &other) {
+                this->terminate();
+                this->stackSize = other.stackSize;
+                this->body = std::move(other.body);
+                this->thread = std::move(other.thread);
+                this->current = std::exchange(other.current, nullptr);
+            }
+            return *this;
+        }
+
+        Generator(const Generator &) = delete;
+        Generator &operator=(const Generator &) = delete;
+
+        /**
+         * Destroys the generator. If its body is suspended in Yield(), it's unwound first.
+         */
+        ~Generator() {
+            this->terminate();
+        }
+
+        /**
+         * Starts the generator's body, if it hasn't been started yet, and returns an iterator at
+         * the value it's currently suspended at.
+         *
+         * @throw std::runtime_error If the body's cothread could not be allocated
+         * @throw Any exception that escaped from the body
+         */
+        Iterator begin() {
+            if(this->body && !this->thread) {
+                this->thread = internal::AcquireGeneratorThread(this->stackSize);
+                this->advance(static_cast<internal::GeneratorBody *>(this->body.get()));
+            }
+            return Iterator(this);
+        }
+
+        /**
+         * Returns the sentinel that an iterator compares equal to once the body returned.
+         */
+        constexpr std::default_sentinel_t end() const noexcept {
+            return std::default_sentinel;
+        }
+
+        /**
+         * Passes a value to the consumer of the generator whose body is executing on the calling
+         * cothread, and suspends the body until the consumer advances the generator.
+         *
+         * @remark This must be invoked from the body of a generator of this type (possibly from
+         *         a nested call;) otherwise, the program is terminated.
+         *
+         * @param value Object that the consumer receives a reference to
+         *
+         * @throw GeneratorExit If the generator was destroyed while the body was suspended
+         */
+        static void Yield(T &value) {
+            YieldAddress(std::addressof(value));
+        }
+
+        /**
+         * Passes a temporary to the consumer. It's destroyed at the end of the full expression that
+         * invoked this; that is, after the consumer advanced the generator.
+         *
+         * @param value Object that the consumer receives a reference to
+         *
+         * @throw GeneratorExit If the generator was destroyed while the body was suspended
+         */
+        static void Yield(T &&value) {
+            YieldAddress(std::addressof(value));
+        }
+
+    private:
+        static void YieldAddress(T *value) {
+            const auto request = Cothread::Yield<internal::GeneratorRequest>(value);
+            if(request == internal::GeneratorRequest::Cancel) [[unlikely]] {
+                throw GeneratorExit();
+            }
+        }
+
+        /**
+         * Resumes the body, and records the address of the next value it yields. If it returned
+         * instead, its cothread is released, and any exception that escaped from it is rethrown.
+         */
+        template<class R>
+        void advance(const R request) {
+            this->current = this->thread->template resume<T *>(request);
+            if(this->current) {
+                return;
+            }
+
+            internal::ReleaseGeneratorThread(std::move(this->thread), this->stackSize);
+            const auto exception = std::exchange(this->body->exception, nullptr);
+            this->body.reset();
+
+            if(exception) {
+                std::rethrow_exception(exception);
+            }
+        }
+
+        /**
+         * Unwinds the body, if it's suspended in Yield(), and releases its cothread.
+         */
+        void terminate() noexcept {
+            if(this->thread) {
+                do {
+                    this->current = this->thread->template resume<T *>(
+                            internal::GeneratorRequest::Cancel);
+                } while(this->current);
+
+                internal::ReleaseGeneratorThread(std::move(this->thread), this->stackSize);
+            }
+            this->body.reset();
+        }
+
+    private:
+        /// Size of the stack of the body's cothread
+        size_t stackSize;
+        /// Callable producing the values; released once it returned
+        std::unique_ptr<internal::GeneratorBody> body;
+        /// Cothread the body is executing on, while it's started and hasn't returned
+        std::unique_ptr<Cothread> thread;
+        /// Value the body is suspended at, if any
+        T *current{nullptr};
+};
+}
+
+#endif
@@ -0,0 +1,190 @@
+#ifndef LIBCOMMUNISM_IORING_H
+#define LIBCOMMUNISM_IORING_H
+
+#include <libcommunism/WaitQueue.h>
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <cstdint>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace libcommunism {
+/**
+ * An I/O ring performs I/O for the cothreads of a kernel thread through io_uring. Rather than
+ * each cothread issuing its own system calls, operations are queued in the submission ring, and
+ * the cothread parks. Once per scheduling round, all queued operations are submitted with a single
+ * `io_uring_enter` call, which also waits for completions if no cothreads are runnable; each
+ * completed operation's cothread is then resumed with its result.
+ *
+ * Cothreads must be spawned through the Scheduler, and executed via run(). Operations issued by
+ * anything else (for example, the kernel thread itself) are submitted immediately, and the caller
+ * waits for them to complete. Cothreads on a shared stack can't park while their request is
+ * pending, so they perform operations directly, with a regular system call.
+ *
+ * If io_uring isn't available, the ring falls back to performing each operation directly, with a
+ * regular system call. Such operations block the kernel thread until they complete.
+ *
+ * @remark An I/O ring may only be used from a single kernel thread.
+ *
+ * @brief Batched asynchronous I/O for cothreads through io_uring
+ */
+class IoRing {
+    /// An operation waiting for its completion
+    struct Request: WaitQueue::Waiter {
+        /// Result of the operation: either a byte count, or a negated error code
+        int32_t result{0};
+    };
+
+    public:
+        /// Default number of entries in the submission ring
+        constexpr static const size_t kDefaultEntries{256};
+
+        /**
+         * Creates a new I/O ring.
+         *
+         * @param entries Number of entries in the submission ring; this limits how many operations
+         *        can be queued before they have to be submitted.
+         * @param forceFallback Use the fallback, even if io_uring is available
+         *
+         * @throw std::system_error If the ring was created, but could not be mapped
+         */
+        explicit IoRing(const size_t entries = kDefaultEntries, const bool forceFallback = false);
+
+        /**
+         * Releases the ring. No operations may be in flight.
+         */
+        ~IoRing();
+
+        IoRing(const IoRing &) = delete;
+        IoRing &operator=(const IoRing &) = delete;
+
+        /**
+         * Reads from a file descriptor, blocking the calling cothread until the read completes.
+         *
+         * @param offset Offset in the file to read from, or -1 to use (and update) the file
+         *        position; this must be -1 for pipes and sockets.
+         *
+         * @return Number of bytes read, or -1 on error, with `errno` set.
+         */
+        ssize_t read(const int fd, void *buf, const size_t count, const off_t offset = -1);
+
+        /**
+         * Writes to a file descriptor, blocking the calling cothread until the write completes.
+         *
+         * @param offset Offset in the file to write to, or -1 to use (and update) the file
+         *        position; this must be -1 for pipes and sockets.
+         *
+         * @return Number of bytes written, or -1 on error, with `errno` set.
+         */
+        ssize_t write(const int fd, const void *buf, const size_t count, const off_t offset = -1);
+
+        /**
+         * Submits all queued operations, and resumes the cothreads of any operations that have
+         * completed. This makes at most one system call.
+         *
+         * @param wait Whether to wait for at least one operation to complete, if any are in
+         *        flight and none have completed yet
+         *
+         * @return Number of operations that completed
+         *
+         * @throw std::system_error If submitting operations failed
+         */
+        size_t submit(const bool wait = false);
+
+        /**
+         * Executes the calling kernel thread's scheduler. Queued operations are submitted once
+         * all runnable cothreads have had a chance to execute, and the ring waits for completions
+         * whenever no cothreads are runnable.
+         *
+         * @return Number of cothreads that are still alive, but blocked on something other than
+         *         the ring.
+         */
+        size_t run();
+
+        /**
+         * Checks whether the ring performs operations directly, rather than through io_uring.
+         */
+        constexpr bool isFallback() const {
+            return this->ringFd == -1;
+        }
+
+        /**
+         * Gets the number of operations that have been queued or are in flight.
+         */
+        constexpr size_t getNumPending() const {
+            return this->numQueued + this->numInFlight;
+        }
+
+        /**
+         * Gets the total number of operations performed through the ring.
+         */
+        constexpr size_t getNumOperations() const {
+            return this->numOperations;
+        }
+
+        /**
+         * Gets the total number of system calls made to perform operations, including calls to
+         * `io_uring_enter`.
+         */
+        constexpr size_t getNumSyscalls() const {
+            return this->numSyscalls;
+        }
+
+    private:
+        struct io_uring_sqe *getSqe();
+        ssize_t execute(Request &request);
+        int enter(const unsigned int toSubmit, const unsigned int minComplete,
+                const unsigned int flags);
+        size_t reap();
+
+    private:
+        /// File descriptor of the io_uring instance, or -1 if using the fallback
+        int ringFd{-1};
+
+        /// Mapping of the submission ring
+        void *sqRing{nullptr};
+        /// Size of the submission ring mapping
+        size_t sqRingSize{0};
+        /// Mapping of the completion ring; may be the same as the submission ring mapping
+        void *cqRing{nullptr};
+        /// Size of the completion ring mapping
+        size_t cqRingSize{0};
+        /// Submission queue entries
+        struct io_uring_sqe *sqes{nullptr};
+        /// Number of submission queue entries
+        uint32_t numSqes{0};
+
+        /// Index of the first submission ring entry that the kernel hasn't consumed yet
+        uint32_t *sqHead{nullptr};
+        /// Index of the next submission ring entry to fill
+        uint32_t *sqTail{nullptr};
+        /// Mask to apply to submission ring indices
+        uint32_t sqMask{0};
+        /// Submission ring, which holds indices into the submission queue entries
+        uint32_t *sqArray{nullptr};
+
+        /// Index of the first completion that we haven't processed yet
+        uint32_t *cqHead{nullptr};
+        /// Index after the last completion posted by the kernel
+        uint32_t *cqTail{nullptr};
+        /// Mask to apply to completion ring indices
+        uint32_t cqMask{0};
+        /// Completion ring
+        struct io_uring_cqe *cqes{nullptr};
+
+        /// Number of operations queued, but not yet submitted
+        size_t numQueued{0};
+        /// Number of operations submitted, but not yet completed
+        size_t numInFlight{0};
+
+        /// Total number of operations performed
+        size_t numOperations{0};
+        /// Total number of system calls made
+        size_t numSyscalls{0};
+};
+}
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef LIBCOMMUNISM_LATCH_H
+#define LIBCOMMUNISM_LATCH_H
+
+#include <libcommunism/WaitQueue.h>
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+
+namespace libcommunism {
+/**
+ * A latch is a single-use counter that cothreads can wait on until it reaches zero. Counting down
+ * (other than to zero) and checking a latch that has already been released are a single atomic
+ * operation.
+ *
+ * @brief Single-use countdown for cothreads
+ */
+class Latch {
+    public:
+        /**
+         * Creates a new latch.
+         *
+         * @param count Number of times the latch has to be counted down before it's released
+         */
+        explicit Latch(const size_t count) : count(count) {}
+
+        Latch(const Latch &) = delete;
+        Latch &operator=(const Latch &) = delete;
+
+        /**
+         * Counts the latch down, and releases all waiting cothreads if it reached zero.
+         *
+         * @param n Amount to count down by; this may not exceed the remaining count.
+         */
+        void countDown(const size_t n = 1) {
+            if(this->count.fetch_sub(n, std::memory_order_acq_rel) == n) [[unlikely]] {
+                this->release();
+            }
+        }
+
+        /**
+         * Checks whether the latch has reached zero.
+         */
+        bool tryWait() const {
+            return !this->count.load(std::memory_order_acquire);
+        }
+
+        /**
+         * Blocks the calling cothread until the latch reaches zero.
+         */
+        void wait() {
+            if(!this->tryWait()) [[unlikely]] {
+                this->waitSlow();
+            }
+        }
+
+        /**
+         * Counts the latch down, then waits for it to reach zero.
+         */
+        void arriveAndWait(const size_t n = 1) {
+            this->countDown(n);
+            this->wait();
+        }
+
+    private:
+        void release();
+        void waitSlow();
+
+    private:
+        /// Remaining count
+        std::atomic_size_t count;
+
+        /// Protects the wait queue
+        std::mutex queueLock;
+        /// Cothreads waiting for the latch to be released
+        WaitQueue waiters;
+};
+
+/**
+ * A barrier blocks a fixed number of cothreads until all of them have arrived at it, then
+ * releases them together and resets itself for the next phase.
+ *
+ * @brief Reusable thread barrier for cothreads
+ */
+class Barrier {
+    public:
+        /**
+         * Creates a new barrier.
+         *
+         * @param count Number of cothreads that need to arrive in each phase
+         */
+        explicit Barrier(const size_t count) : expected(count), remaining(count) {}
+
+        Barrier(const Barrier &) = delete;
+        Barrier &operator=(const Barrier &) = delete;
+
+        /**
+         * Arrives at the barrier, and blocks the calling cothread until all others have as well.
+         */
+        void arriveAndWait();
+
+        /**
+         * Arrives at the barrier, and removes the calling cothread from all further phases
+         * without waiting.
+         */
+        void arriveAndDrop();
+
+    private:
+        bool arrive();
+
+    private:
+        /// Number of cothreads that need to arrive in each phase
+        size_t expected;
+        /// Number of cothreads that still need to arrive in this phase
+        size_t remaining;
+
+        /// Protects the barrier state and wait queue
+        std::mutex queueLock;
+        /// Cothreads waiting for the current phase to complete
+        WaitQueue waiters;
+};
+}
+
+#endif
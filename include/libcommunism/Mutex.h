@@ -0,0 +1,200 @@
+#ifndef LIBCOMMUNISM_MUTEX_H
+#define LIBCOMMUNISM_MUTEX_H
+
+#include <libcommunism/WaitQueue.h>
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+namespace libcommunism {
+/**
+ * Mutexes that block the calling cothread (through a WaitQueue) rather than its kernel thread
+ * while they're contended, so that other cothreads can keep running; including the one holding
+ * the mutex. Locking and unlocking an uncontended mutex is a single atomic operation.
+ *
+ * By default, a cothread that's woken has to compete for the mutex again, and may lose it to one
+ * that didn't have to wait; this maximizes throughput. Fair mutexes instead hand ownership
+ * directly to the longest waiting cothread on unlock.
+ *
+ * The method names match those of `std::mutex`, so it may be used with `std::unique_lock` and
+ * friends.
+ *
+ * @brief Mutual exclusion lock for cothreads
+ */
+class Mutex {
+    friend class ConditionVariable;
+
+    public:
+        /**
+         * Creates a new, unlocked mutex.
+         *
+         * @param fair Whether ownership is handed to waiters in FIFO order
+         */
+        explicit Mutex(const bool fair = false) : fair(fair) {}
+
+        Mutex(const Mutex &) = delete;
+        Mutex &operator=(const Mutex &) = delete;
+
+        /**
+         * Acquires the mutex, blocking the calling cothread until it's available.
+         */
+        void lock() {
+            uint32_t expected{kUnlocked};
+            if(!this->state.compare_exchange_strong(expected, kLocked, std::memory_order_acquire,
+                        std::memory_order_relaxed)) [[unlikely]] {
+                this->lockSlow();
+            }
+        }
+
+        /**
+         * Acquires the mutex, if it's available.
+         *
+         * @return Whether the mutex was acquired
+         */
+        bool try_lock() {
+            uint32_t expected{kUnlocked};
+            return this->state.compare_exchange_strong(expected, kLocked,
+                    std::memory_order_acquire, std::memory_order_relaxed);
+        }
+
+        /**
+         * Releases the mutex, waking up a waiting cothread, if any.
+         */
+        void unlock() {
+            uint32_t expected{kLocked};
+            if(!this->state.compare_exchange_strong(expected, kUnlocked,
+                        std::memory_order_release, std::memory_order_relaxed)) [[unlikely]] {
+                this->unlockSlow();
+            }
+        }
+
+    private:
+        void lockSlow();
+        void unlockSlow();
+
+    private:
+        /// The mutex isn't held
+        constexpr static const uint32_t kUnlocked{0};
+        /// The mutex is held, and nobody is waiting for it
+        constexpr static const uint32_t kLocked{1};
+        /// The mutex is held, and there may be waiters; unlocking has to check.
+        constexpr static const uint32_t kContended{2};
+
+        /// Lock state
+        std::atomic_uint32_t state{kUnlocked};
+        /// Whether ownership is handed off to waiters
+        const bool fair;
+
+        /// Protects the wait queue
+        std::mutex queueLock;
+        /// Cothreads waiting to acquire the mutex
+        WaitQueue waiters;
+};
+
+/**
+ * A reader-writer lock for cothreads: it may be held either by a single writer, or by any number
+ * of readers. Acquiring or releasing an uncontended lock is a single atomic operation.
+ *
+ * Once a writer is waiting, new readers wait as well, so writers can't be starved. When the lock
+ * is released, ownership alternates between the waiting readers (which are all admitted at once)
+ * and the waiting writers, in FIFO order.
+ *
+ * The method names match those of `std::shared_mutex`.
+ *
+ * @brief Reader-writer lock for cothreads
+ */
+class SharedMutex {
+    public:
+        SharedMutex() = default;
+
+        SharedMutex(const SharedMutex &) = delete;
+        SharedMutex &operator=(const SharedMutex &) = delete;
+
+        /**
+         * Acquires the lock exclusively, blocking the calling cothread until it's available.
+         */
+        void lock() {
+            uint32_t expected{0};
+            if(!this->state.compare_exchange_strong(expected, kWriter, std::memory_order_acquire,
+                        std::memory_order_relaxed)) [[unlikely]] {
+                this->lockSlow();
+            }
+        }
+
+        /**
+         * Acquires the lock exclusively, if it's available.
+         */
+        bool try_lock() {
+            uint32_t expected{0};
+            return this->state.compare_exchange_strong(expected, kWriter,
+                    std::memory_order_acquire, std::memory_order_relaxed);
+        }
+
+        /**
+         * Releases the exclusively held lock.
+         */
+        void unlock() {
+            uint32_t expected{kWriter};
+            if(!this->state.compare_exchange_strong(expected, 0, std::memory_order_release,
+                        std::memory_order_relaxed)) [[unlikely]] {
+                this->unlockSlow();
+            }
+        }
+
+        /**
+         * Acquires the lock shared, blocking the calling cothread while it's held exclusively (or
+         * a writer is waiting for it.)
+         */
+        void lock_shared() {
+            if(!this->try_lock_shared()) [[unlikely]] {
+                this->lockSharedSlow();
+            }
+        }
+
+        /**
+         * Acquires the lock shared, if that's possible without waiting.
+         */
+        bool try_lock_shared() {
+            auto current = this->state.load(std::memory_order_relaxed);
+            return !(current & (kWriter | kWaiting)) &&
+                this->state.compare_exchange_strong(current, current + 1,
+                        std::memory_order_acquire, std::memory_order_relaxed);
+        }
+
+        /**
+         * Releases the shared lock.
+         */
+        void unlock_shared() {
+            const auto previous = this->state.fetch_sub(1, std::memory_order_release);
+            if(previous == (kWaiting | 1)) [[unlikely]] {
+                this->unlockSharedSlow();
+            }
+        }
+
+    private:
+        void lockSlow();
+        void unlockSlow();
+        void lockSharedSlow();
+        void unlockSharedSlow();
+        void handOff(bool preferReaders);
+
+    private:
+        /// Set while a writer holds the lock
+        constexpr static const uint32_t kWriter{1U << 31};
+        /// Set while there are waiters; releasing the lock has to check.
+        constexpr static const uint32_t kWaiting{1U << 30};
+
+        /// Lock state: writer and waiter flags, plus the number of readers holding the lock
+        std::atomic_uint32_t state{0};
+
+        /// Protects the wait queues
+        std::mutex queueLock;
+        /// Cothreads waiting for exclusive access
+        WaitQueue writers;
+        /// Cothreads waiting for shared access
+        WaitQueue readers;
+};
+}
+
+#endif
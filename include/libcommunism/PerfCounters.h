@@ -0,0 +1,188 @@
+#ifndef LIBCOMMUNISM_PERFCOUNTERS_H
+#define LIBCOMMUNISM_PERFCOUNTERS_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+namespace libcommunism {
+class Cothread;
+
+/**
+ * A group of hardware performance counters for the calling kernel thread, read through
+ * `perf_event_open`. They are used to attribute the cost of context switches: for example, to
+ * tell whether a slower switch is caused by branch mispredictions (such as return stack buffer
+ * misses, since the platform code returns to a different address than it was called from) or by
+ * cache misses on the cold stacks of new cothreads.
+ *
+ * Since all cothreads on a kernel thread share its counters, the counts for a single cothread are
+ * taken by sampling the counters around its run slice; see measureSlice().
+ *
+ * Only user space events are counted. Counters that the CPU, kernel or virtual machine don't
+ * support (or that the process lacks permission for, see `perf_event_paranoid`) are unavailable,
+ * and always read as zero; if none are available, the group is unsupported. This is always the
+ * case on platforms other than Linux.
+ *
+ * @remark A counter group may only be used from the kernel thread that created it.
+ *
+ * @brief Hardware performance counters for instrumenting context switches
+ */
+class PerfCounters {
+    public:
+        /**
+         * @brief Events counted by the group
+         */
+        enum class Counter: size_t {
+            /// CPU cycles
+            Cycles,
+            /// Retired instructions
+            Instructions,
+            /// Mispredicted branches, including returns
+            BranchMisses,
+            /// Level 1 data cache read misses
+            L1dMisses,
+            /// Last level cache read misses
+            LlcMisses,
+            /// Time the kernel thread spent on the CPU, in nanoseconds (a software event)
+            TaskClock,
+        };
+
+        /// Number of counters in a group
+        constexpr static const size_t kNumCounters{6};
+
+        /**
+         * @brief Values of all counters in the group at one point in time, or the difference
+         *        between two such points
+         *
+         * If the kernel had to multiplex the counters (because more were requested than the CPU
+         * has), the values are scaled by the fraction of time each counter was actually running.
+         */
+        struct Sample {
+            /// Value of each counter, indexed by Counter
+            std::array<uint64_t, kNumCounters> values{};
+
+            constexpr uint64_t operator[](const Counter counter) const {
+                return this->values[static_cast<size_t>(counter)];
+            }
+            constexpr uint64_t &operator[](const Counter counter) {
+                return this->values[static_cast<size_t>(counter)];
+            }
+
+            /// Gets the counts between an earlier sample and this one
+            constexpr Sample operator-(const Sample &earlier) const {
+                Sample out;
+                for(size_t i = 0; i < kNumCounters; i++) {
+                    out.values[i] = this->values[i] - earlier.values[i];
+                }
+                return out;
+            }
+
+            /// Accumulates the counts of another sample (usually a difference) into this one
+            constexpr Sample &operator+=(const Sample &other) {
+                for(size_t i = 0; i < kNumCounters; i++) {
+                    this->values[i] += other.values[i];
+                }
+                return *this;
+            }
+        };
+
+        /**
+         * Opens the counter group for the calling kernel thread. The counters are initially
+         * stopped.
+         *
+         * Counters that can't be opened are marked unavailable; this never fails.
+         */
+        PerfCounters();
+
+        /**
+         * Closes all counters of the group.
+         */
+        ~PerfCounters();
+
+        PerfCounters(const PerfCounters &) = delete;
+        PerfCounters &operator=(const PerfCounters &) = delete;
+
+        /**
+         * Checks whether any counters are available.
+         */
+        constexpr bool isSupported() const {
+            return this->leaderFd != -1;
+        }
+
+        /**
+         * Checks whether the given counter is available.
+         */
+        constexpr bool isAvailable(const Counter counter) const {
+            return this->fds[static_cast<size_t>(counter)] != -1;
+        }
+
+        /**
+         * Starts all counters of the group; they continue from their previous values.
+         *
+         * @throw std::system_error If the counters could not be started
+         */
+        void start();
+
+        /**
+         * Stops all counters of the group.
+         *
+         * @throw std::system_error If the counters could not be stopped
+         */
+        void stop();
+
+        /**
+         * Reads the current values of all counters in the group, with a single system call.
+         * Unavailable counters read as zero.
+         *
+         * @throw std::system_error If the counters could not be read
+         */
+        Sample read() const;
+
+        /**
+         * Counts the events caused by executing the given callable on the calling cothread. The
+         * counters are started before and stopped after it executes.
+         *
+         * @return Counts of events while the callable executed
+         */
+        template<class F>
+        Sample measure(F &&f) {
+            this->start();
+            const auto before = this->read();
+            std::forward<F>(f)();
+            const auto after = this->read();
+            this->stop();
+            return after - before;
+        }
+
+        /**
+         * Counts the events during a single run slice of a cothread: it is switched to, and
+         * executes until it switches back to the calling cothread. This includes the cost of both
+         * context switches.
+         *
+         * The counters must have been started.
+         *
+         * @param thread Cothread to execute; it must switch back to the caller.
+         *
+         * @return Counts of events during the run slice
+         */
+        Sample measureSlice(Cothread *thread);
+
+        /**
+         * Gets a short name for a counter, for use in reports.
+         */
+        static const char *GetName(const Counter counter);
+
+    private:
+        /// File descriptor of the group leader, the first counter that could be opened
+        int leaderFd{-1};
+        /// File descriptor of each counter, or -1 if it's unavailable
+        std::array<int, kNumCounters> fds;
+        /// Index of each counter in the values read from the group
+        std::array<size_t, kNumCounters> readIndex{};
+        /// Number of counters that are available
+        size_t numOpen{0};
+};
+}
+
+#endif
@@ -0,0 +1,179 @@
+#ifndef LIBCOMMUNISM_REACTOR_H
+#define LIBCOMMUNISM_REACTOR_H
+
+#include <libcommunism/WaitQueue.h>
+
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace libcommunism {
+/**
+ * The reactor allows cothreads to perform I/O on nonblocking file descriptors with blocking-style
+ * code: whenever an operation would block, the calling cothread is blocked (through a WaitQueue)
+ * until the file descriptor becomes ready, rather than blocking the kernel thread.
+ *
+ * File descriptors are registered with an edge-triggered epoll instance once, when they're added
+ * to the reactor; there are no further system calls to arm or disarm them when cothreads wait.
+ * Readiness is only discovered when the reactor is polled. The simplest way to do this is to
+ * spawn cothreads through the Scheduler and execute them with run(), which polls whenever all of
+ * them are blocked.
+ *
+ * @remark Cothreads spawned through the Scheduler may only wait on a reactor that's polled on
+ *         their own kernel thread. While other cothreads on that kernel thread are blocked on
+ *         primitives that are released from elsewhere, Scheduler::Run() waits for them rather
+ *         than returning to run(); so the reactor isn't polled in the meantime.
+ *
+ * @remark This is only available on platforms with epoll.
+ *
+ * @brief Blocks cothreads until file descriptors are ready for I/O
+ */
+class Reactor {
+    /// State of a file descriptor registered with the reactor
+    struct Descriptor {
+        /// Cothreads waiting for the descriptor to become readable
+        WaitQueue readers;
+        /// Cothreads waiting for the descriptor to become writable
+        WaitQueue writers;
+
+        /// Set when the descriptor became readable, and no waiter was around to consume it
+        bool readable{false};
+        /// Set when the descriptor became writable, and no waiter was around to consume it
+        bool writable{false};
+    };
+
+    public:
+        /**
+         * Creates a new reactor.
+         *
+         * @throw std::system_error If the epoll instance could not be created
+         */
+        Reactor();
+
+        /**
+         * Releases the epoll instance. No cothreads may be waiting on the reactor.
+         */
+        ~Reactor();
+
+        Reactor(const Reactor &) = delete;
+        Reactor &operator=(const Reactor &) = delete;
+
+        /**
+         * Registers a file descriptor with the reactor, and puts it into nonblocking mode.
+         *
+         * @param fd File descriptor to add
+         *
+         * @throw std::system_error If the descriptor could not be registered
+         * @throw std::runtime_error If the descriptor was already added
+         */
+        void add(const int fd);
+
+        /**
+         * Removes a file descriptor from the reactor. This must be done before it's closed. Any
+         * cothreads still waiting on it are woken up, and their operation fails with `EBADF`.
+         *
+         * @param fd File descriptor to remove
+         */
+        void remove(const int fd);
+
+        /**
+         * Reads from a file descriptor, blocking the calling cothread until data is available.
+         *
+         * @return Number of bytes read (zero at end of file), or -1 on error, with `errno` set.
+         */
+        ssize_t read(const int fd, void *buf, const size_t count);
+
+        /**
+         * Writes to a file descriptor, blocking the calling cothread until it can accept data.
+         * Like write(2), this may write fewer bytes than requested.
+         *
+         * @return Number of bytes written, or -1 on error, with `errno` set.
+         */
+        ssize_t write(const int fd, const void *buf, const size_t count);
+
+        /**
+         * Accepts a connection on a listening socket, blocking the calling cothread until one is
+         * available. The new socket is nonblocking, and already added to the reactor.
+         *
+         * @return File descriptor of the accepted socket, or -1 on error, with `errno` set.
+         */
+        int accept(const int fd, struct sockaddr *addr, socklen_t *addrLen);
+
+        /**
+         * Connects a socket, blocking the calling cothread until the connection is established.
+         *
+         * @return Zero on success, or -1 on error, with `errno` set.
+         */
+        int connect(const int fd, const struct sockaddr *addr, const socklen_t addrLen);
+
+        /**
+         * Blocks the calling cothread until the file descriptor is readable.
+         *
+         * @return Whether the descriptor may be readable; this fails if it isn't registered.
+         */
+        bool waitReadable(const int fd) {
+            return this->wait(fd, false);
+        }
+
+        /**
+         * Blocks the calling cothread until the file descriptor is writable.
+         *
+         * @return Whether the descriptor may be writable; this fails if it isn't registered.
+         */
+        bool waitWritable(const int fd) {
+            return this->wait(fd, true);
+        }
+
+        /**
+         * Waits for file descriptors to become ready, and wakes up any cothreads waiting on them.
+         * It's safe to call this from multiple kernel threads at once.
+         *
+         * @param timeout Maximum time to wait, in milliseconds, or -1 to wait indefinitely
+         *
+         * @return Number of cothreads that were woken
+         *
+         * @throw std::system_error If waiting for events failed
+         */
+        size_t poll(const int timeout = -1);
+
+        /**
+         * Executes the calling kernel thread's scheduler; whenever none of its cothreads are
+         * runnable, but some are waiting on the reactor, it's polled to wake them.
+         *
+         * @return Number of cothreads that are still alive, but blocked on something other than
+         *         the reactor.
+         */
+        size_t run();
+
+        /**
+         * Gets the number of cothreads currently waiting on the reactor.
+         */
+        size_t getNumWaiting() const {
+            return this->numWaiting.load(std::memory_order_relaxed);
+        }
+
+    private:
+        bool wait(const int fd, const bool write);
+
+    private:
+        /// Maximum number of events to process per poll
+        constexpr static const size_t kMaxEvents{64};
+
+        /// epoll instance all descriptors are registered with
+        int epollFd{-1};
+
+        /// Protects the registered descriptors, and their wait queues
+        std::mutex lock;
+        /// All registered file descriptors
+        std::unordered_map<int, std::unique_ptr<Descriptor>> descriptors;
+        /// Number of cothreads waiting on the reactor
+        std::atomic_size_t numWaiting{0};
+};
+}
+
+#endif
@@ -0,0 +1,185 @@
+#ifndef LIBCOMMUNISM_RUNTIME_H
+#define LIBCOMMUNISM_RUNTIME_H
+
+#include <libcommunism/Cothread.h>
+
+#include <atomic>
+#include <concepts>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace libcommunism {
+namespace internal {
+class RuntimeWorker;
+}
+
+/**
+ * An M:N runtime multiplexes any number of cothreads onto a fixed pool of worker kernel threads.
+ * Each worker owns a work stealing deque of runnable cothreads; a worker that runs out of work
+ * steals a batch of cothreads from another, so cothreads may resume on a different worker than
+ * the one they were suspended on.
+ *
+ * Cothreads are executed until they yield, park or return from their entry point; control then
+ * returns to the worker, which decides what to run next. Cothreads that return from their entry
+ * point are deallocated automatically.
+ *
+ * @remark Since cothreads migrate between kernel threads, code running on the runtime must not
+ *         cache pointers to (or the addresses of) thread local variables across a call to
+ *         Yield() or Park(). Likewise, it must not hold locks that must be released on the same
+ *         kernel thread they were acquired on.
+ *
+ * @remark Cothreads on a runtime must not use the per kernel thread Scheduler, nor switch to
+ *         other cothreads directly. Yield() and Park() may only be invoked from cothreads on a
+ *         runtime.
+ *
+ * @brief Work stealing M:N cothread runtime
+ */
+class Runtime {
+    friend class internal::RuntimeWorker;
+
+    public:
+        /**
+         * Creates a runtime, and starts its worker threads.
+         *
+         * @param numWorkers Number of worker kernel threads to create, or zero to create one for
+         *        each hardware thread.
+         * @param stackSize Size of the stack of spawned cothreads, in bytes; or zero to use the
+         *        platform default.
+         *
+         * @throw std::runtime_error If the worker threads could not be created
+         */
+        explicit Runtime(const size_t numWorkers = 0, const size_t stackSize = 0);
+
+        /**
+         * Waits for all cothreads on the runtime to exit, then stops its worker threads.
+         *
+         * @remark If any cothreads remain parked forever, this never returns.
+         */
+        ~Runtime();
+
+        Runtime(const Runtime &) = delete;
+        Runtime &operator=(const Runtime &) = delete;
+
+        /**
+         * Allocates a new cothread that executes the given callable with its arguments, and makes
+         * it runnable. When invoked from a cothread on this runtime, it's queued on the current
+         * worker; otherwise it's handed to the runtime through a shared queue.
+         *
+         * @remark The callable must not throw; an exception escaping from it terminates the
+         *         program.
+         *
+         * @param entry Callable to execute on entry to the cothread
+         * @param args Arguments to pass to the callable
+         *
+         * @throw std::runtime_error If the cothread could not be allocated
+         *
+         * @return The new cothread. It remains valid until its entry point returns.
+         */
+        template<class F, class... Args>
+            requires std::invocable<std::decay_t<F>, std::decay_t<Args>...>
+        Cothread *spawn(F &&entry, Args &&...args) {
+            auto thread = new Cothread(this->stackSize, StackType::Default,
+                    [](auto &&func, auto &&...funcArgs) noexcept -> void {
+                std::invoke(std::forward<decltype(func)>(func),
+                        std::forward<decltype(funcArgs)>(funcArgs)...);
+                Exit();
+            }, std::forward<F>(entry), std::forward<Args>(args)...);
+
+            this->adopt(thread);
+            return thread;
+        }
+
+        /**
+         * Blocks the calling kernel thread until all cothreads spawned on the runtime have exited.
+         *
+         * @remark This must not be invoked from a cothread on the runtime.
+         */
+        void wait();
+
+        /**
+         * Gets the number of worker threads of the runtime.
+         *
+         * @return Number of worker kernel threads
+         */
+        size_t getNumWorkers() const {
+            return this->workers.size();
+        }
+
+        /**
+         * Returns the runtime that the calling cothread is executing on.
+         *
+         * @return Runtime of the calling cothread, or `nullptr` if it's not executing on a runtime
+         */
+        static Runtime *Current();
+
+        /**
+         * Suspends the calling cothread, and allows the worker to execute other runnable
+         * cothreads before resuming it. If the worker has no other work, this returns
+         * immediately.
+         */
+        static void Yield() noexcept;
+
+        /**
+         * Suspends the calling cothread until it's unparked. If it was unparked since it last
+         * parked, this consumes the wakeup and returns immediately.
+         *
+         * @remark Spurious wakeups are possible; callers should check the condition they waited
+         *         for again after this returns.
+         */
+        static void Park() noexcept;
+
+        /**
+         * Makes a parked cothread runnable again. If it's not currently parked, the wakeup is
+         * remembered instead, and its next call to Park() returns immediately. This may be invoked
+         * from any kernel thread, including ones that aren't part of the runtime.
+         *
+         * @param thread Cothread to unpark; it must have been spawned on a runtime, and not have
+         *        exited yet.
+         */
+        static void Unpark(Cothread *thread) noexcept;
+
+    private:
+        void adopt(Cothread *thread);
+        void submit(Cothread *thread);
+        void inject(Cothread *thread);
+        Cothread *takeInjected(internal::RuntimeWorker *worker);
+        bool hasWork() const;
+        void notify();
+        void exited();
+
+        [[noreturn]] static void Exit() noexcept;
+
+    private:
+        /// Size of the stack of spawned cothreads
+        size_t stackSize{0};
+
+        /// All worker threads
+        std::vector<std::unique_ptr<internal::RuntimeWorker>> workers;
+
+        /// Protects the queue of cothreads submitted from outside the runtime
+        std::mutex injectLock;
+        /// First cothread submitted from outside the runtime, linked through their hooks
+        Cothread *injectHead{nullptr};
+        /// Last cothread submitted from outside the runtime
+        Cothread *injectTail{nullptr};
+        /// Number of cothreads in the injection queue
+        std::atomic_size_t numInjected{0};
+
+        /// Incremented whenever sleeping workers should look for work again
+        std::atomic_uint32_t epoch{0};
+        /// Number of workers that are about to go to sleep, or are sleeping
+        std::atomic_size_t numSleeping{0};
+        /// Set when the workers should exit
+        std::atomic_bool shutdown{false};
+
+        /// Number of spawned cothreads that haven't exited yet
+        std::atomic_size_t numLive{0};
+};
+}
+
+#endif
@@ -0,0 +1,251 @@
+#ifndef LIBCOMMUNISM_SCHEDULER_H
+#define LIBCOMMUNISM_SCHEDULER_H
+
+#include <libcommunism/Cothread.h>
+
+#include <concepts>
+#include <coroutine>
+#include <cstddef>
+#include <functional>
+#include <type_traits>
+#include <utility>
+
+namespace libcommunism {
+namespace internal {
+/**
+ * @brief Links a suspended coroutine into its scheduler's queue of coroutines to resume
+ *
+ * It's part of the awaiter the coroutine is suspended on, so that queueing the coroutine doesn't
+ * allocate memory.
+ */
+struct CoroutineHook {
+    /// Coroutine to resume
+    std::coroutine_handle<> handle;
+    /// Next coroutine in the queue
+    CoroutineHook *next{nullptr};
+};
+}
+
+/**
+ * Each kernel thread has its own scheduler, which runs cothreads spawned on that thread in round
+ * robin order. Scheduling is entirely cooperative: a cothread runs until it yields, parks or
+ * returns from its entry point, at which point control passes directly to the next runnable
+ * cothread, without going through an intermediate scheduler context.
+ *
+ * Runnable cothreads are kept in an intrusive queue, linked through the cothreads themselves, so
+ * that none of the scheduler operations allocate memory (aside from spawning, which allocates the
+ * cothread and its stack.)
+ *
+ * Cothreads created with Spawn() are owned by the scheduler: when their entry point returns, they
+ * are deallocated automatically, rather than invoking the cothread return handler.
+ *
+ * Stackless (C++20) coroutines are scheduled alongside cothreads: a suspended coroutine that's
+ * queued with Resume() is resumed by a helper cothread, which sits in the run queue like any other
+ * cothread while coroutines are waiting; so cothreads and coroutines take turns in the same order.
+ * See Coroutine.h for awaitables that bridge between the two.
+ *
+ * Spawned cothreads may be unparked from any kernel thread: those unparked from elsewhere are
+ * pushed onto a lock-free queue of the scheduler they were spawned on, which is moved into the run
+ * queue the next time a cothread is dequeued. They always execute on their own kernel thread.
+ *
+ * @remark All other operations act on the scheduler of the calling kernel thread. Cothreads that
+ *         are still parked when their kernel thread exits are never deallocated; and they must not
+ *         be unparked after it exited.
+ *
+ * @brief Per kernel thread cooperative scheduler
+ */
+class Scheduler {
+    public:
+        /**
+         * Allocates a new cothread that executes the given callable with its arguments, and adds it
+         * to the end of the calling kernel thread's run queue. It starts executing the next time
+         * the scheduler gets to it.
+         *
+         * @remark The callable must not throw; an exception escaping from it terminates the
+         *         program.
+         *
+         * @param stackSize Size of the stack to be allocated, in bytes; or zero to use the platform
+         *        default.
+         * @param stackType Kind of memory to allocate for the stack
+         * @param entry Callable to execute on entry to the cothread
+         * @param args Arguments to pass to the callable
+         *
+         * @throw std::runtime_error If the cothread could not be allocated
+         *
+         * @return The new cothread. It remains valid until its entry point returns.
+         */
+        template<class F, class... Args>
+            requires std::invocable<std::decay_t<F>, std::decay_t<Args>...>
+        static Cothread *Spawn(const size_t stackSize, const StackType stackType, F &&entry,
+                Args &&...args) {
+            auto thread = new Cothread(stackSize, stackType, EntryWrapper{},
+                    std::forward<F>(entry), std::forward<Args>(args)...);
+
+            Adopt(thread);
+            return thread;
+        }
+
+        /**
+         * Allocates a new cothread with a stack sized by a stack profile, and adds it to the end
+         * of the calling kernel thread's run queue. When it exits, its stack high water mark is
+         * recorded in the profile.
+         *
+         * @param profile Stack profile for this kind of cothread
+         * @param entry Callable to execute on entry to the cothread
+         * @param args Arguments to pass to the callable
+         *
+         * @return The new cothread. It remains valid until its entry point returns.
+         */
+        template<class F, class... Args>
+            requires std::invocable<std::decay_t<F>, std::decay_t<Args>...>
+        static Cothread *Spawn(StackProfile &profile, F &&entry, Args &&...args) {
+            auto thread = new Cothread(profile, EntryWrapper{},
+                    std::forward<F>(entry), std::forward<Args>(args)...);
+
+            Adopt(thread);
+            return thread;
+        }
+
+        /**
+         * Allocates a new cothread that executes on a shared stack, and adds it to the end of the
+         * calling kernel thread's run queue. While it's suspended, it only holds a copy of the
+         * live part of its stack; see SharedStack.
+         *
+         * @param stack Shared stack to execute on, for example SharedStack::ForThread()
+         * @param entry Callable to execute on entry to the cothread
+         * @param args Arguments to pass to the callable
+         *
+         * @return The new cothread. It remains valid until its entry point returns.
+         */
+        template<class F, class... Args>
+            requires std::invocable<std::decay_t<F>, std::decay_t<Args>...>
+        static Cothread *Spawn(SharedStack &stack, F &&entry, Args &&...args) {
+            auto thread = new Cothread(stack, EntryWrapper{},
+                    std::forward<F>(entry), std::forward<Args>(args)...);
+
+            Adopt(thread);
+            return thread;
+        }
+
+        /**
+         * Allocates a new cothread with a default sized stack, and adds it to the end of the
+         * calling kernel thread's run queue.
+         *
+         * @param entry Callable to execute on entry to the cothread
+         * @param args Arguments to pass to the callable
+         *
+         * @return The new cothread. It remains valid until its entry point returns.
+         */
+        template<class F, class... Args>
+            requires std::invocable<std::decay_t<F>, std::decay_t<Args>...>
+        static Cothread *Spawn(F &&entry, Args &&...args) {
+            return Spawn(0, StackType::Default, std::forward<F>(entry),
+                    std::forward<Args>(args)...);
+        }
+
+        /**
+         * Runs cothreads on the calling kernel thread until none are runnable; that is, until all
+         * of them have either exited, or are parked.
+         *
+         * The caller serves as the scheduler's fallback: whenever a cothread parks or exits while
+         * the run queue is empty, control returns here. If any cothreads are blocked in a wait
+         * queue (for example, on a Mutex or Channel) the kernel thread sleeps until one of them is
+         * woken by another kernel thread, rather than returning; so like blocking a kernel thread
+         * on a `std::mutex`, a cothread that's never woken keeps this from returning.
+         *
+         * @throw std::runtime_error If the scheduler is already running on this kernel thread
+         *
+         * @return Number of spawned cothreads that haven't exited yet (i.e. that are parked)
+         */
+        static size_t Run();
+
+        /**
+         * Moves the calling cothread to the end of the run queue, and switches to the next
+         * runnable cothread. If there are no other runnable cothreads, this returns immediately.
+         *
+         * @remark Any cothread may yield, including ones that weren't spawned through the
+         *         scheduler; it's added to the run queue like any other cothread.
+         */
+        static void Yield() noexcept;
+
+        /**
+         * Suspends the calling cothread until it's unparked, and switches to the next runnable
+         * cothread (or to the caller of Run() if there are none.)
+         *
+         * If the calling cothread was unparked since it last parked, this consumes the wakeup and
+         * returns immediately.
+         *
+         * @remark The program is terminated if no cothread could be switched to; for example,
+         *         because the only cothread parks while the scheduler isn't running.
+         */
+        static void Park() noexcept;
+
+        /**
+         * Makes a parked cothread runnable again, by adding it to the end of the run queue. If
+         * it's not currently parked, the wakeup is remembered instead, and its next call to
+         * Park() returns immediately.
+         *
+         * This may be invoked from any kernel thread; the cothread is added to the run queue of
+         * the kernel thread it was spawned on.
+         *
+         * @param thread Cothread to unpark. It must not have exited.
+         */
+        static void Unpark(Cothread *thread) noexcept;
+
+        /**
+         * Checks whether any cothreads on the calling kernel thread are waiting to run; that is,
+         * whether Yield() would switch to another cothread.
+         */
+        static bool HasRunnable() noexcept;
+
+        /**
+         * Queues a suspended coroutine to be resumed on the calling kernel thread. Coroutines are
+         * resumed in the order they were queued, by a helper cothread that's added to the end of
+         * the run queue if it isn't already waiting in it; it resumes all coroutines that were
+         * queued when it started running, then yields to the other cothreads.
+         *
+         * @remark The helper cothread is allocated the first time a coroutine is queued on a
+         *         kernel thread; the program is terminated if that fails.
+         *
+         * @remark Coroutines must not block the helper cothread, for example by parking it or by
+         *         waiting on a Task; they should `co_await` instead.
+         *
+         * @param hook Hook of the coroutine, with its handle set. It must remain valid until the
+         *        coroutine is resumed; usually, it's part of the awaiter it's suspended on.
+         */
+        static void Resume(internal::CoroutineHook &hook) noexcept;
+
+    private:
+        friend class WaitQueue;
+
+        static void Adopt(Cothread *thread) noexcept;
+        static void Enqueue(Cothread *thread) noexcept;
+        static Cothread *Dequeue() noexcept;
+        static void TakeRemote() noexcept;
+        static void UnparkRemote(internal::SchedulerState *owner, Cothread *thread) noexcept;
+        static void ParkWaiting() noexcept;
+        static void SwitchNext() noexcept;
+        static void Reap() noexcept;
+        static Cothread *GetCoroutineHelper() noexcept;
+        static void RunCoroutines() noexcept;
+
+        static void Started() noexcept;
+        [[noreturn]] static void Exit() noexcept;
+
+        /**
+         * @brief Entry point of spawned cothreads
+         *
+         * Marks the cothread as started, invokes its callable, and exits it once that returns.
+         */
+        struct EntryWrapper {
+            template<class F, class... Args>
+            void operator()(F &&func, Args &&...args) const noexcept {
+                Started();
+                std::invoke(std::forward<F>(func), std::forward<Args>(args)...);
+                Exit();
+            }
+        };
+};
+}
+
+#endif
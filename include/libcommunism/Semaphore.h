@@ -0,0 +1,101 @@
+#ifndef LIBCOMMUNISM_SEMAPHORE_H
+#define LIBCOMMUNISM_SEMAPHORE_H
+
+#include <libcommunism/WaitQueue.h>
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+
+namespace libcommunism {
+/**
+ * Counting semaphores hold a number of permits; acquiring one blocks the calling cothread (rather
+ * than its kernel thread) until a permit is available. Acquiring an available permit, or releasing
+ * permits while nobody is waiting, is a single atomic operation.
+ *
+ * Fair semaphores hand released permits directly to waiting cothreads, in FIFO order; otherwise,
+ * woken cothreads compete for permits with any other cothreads trying to acquire them. (Even fair
+ * semaphores don't stop a cothread from taking a permit that was just released, before the
+ * waiters are serviced.)
+ *
+ * @brief Counting semaphore for cothreads
+ */
+class Semaphore {
+    public:
+        /**
+         * Creates a new semaphore.
+         *
+         * @param permits Number of initially available permits
+         * @param fair Whether released permits are handed to waiters in FIFO order
+         */
+        explicit Semaphore(const size_t permits = 0, const bool fair = false) :
+            permits(permits), fair(fair) {}
+
+        Semaphore(const Semaphore &) = delete;
+        Semaphore &operator=(const Semaphore &) = delete;
+
+        /**
+         * Acquires a permit, blocking the calling cothread until one is available.
+         */
+        void acquire() {
+            if(!this->tryAcquire()) [[unlikely]] {
+                this->acquireSlow();
+            }
+        }
+
+        /**
+         * Acquires a permit, if one is available.
+         *
+         * @return Whether a permit was acquired
+         */
+        bool tryAcquire() {
+            auto available = this->permits.load(std::memory_order_relaxed);
+            while(available) {
+                if(this->permits.compare_exchange_weak(available, available - 1,
+                            std::memory_order_acquire, std::memory_order_relaxed)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        /**
+         * Releases permits, waking up waiting cothreads as needed.
+         *
+         * @param count Number of permits to release
+         */
+        void release(const size_t count = 1) {
+            // sequentially consistent, so that either we see the waiter, or it sees the permits
+            this->permits.fetch_add(count, std::memory_order_seq_cst);
+            if(this->numWaiters.load(std::memory_order_seq_cst)) [[unlikely]] {
+                this->releaseSlow(count);
+            }
+        }
+
+        /**
+         * Gets the number of currently available permits.
+         */
+        size_t getAvailable() const {
+            return this->permits.load(std::memory_order_relaxed);
+        }
+
+    private:
+        void acquireSlow();
+        void releaseSlow(size_t count);
+
+    private:
+        /// Number of available permits
+        std::atomic_size_t permits;
+        /// Number of cothreads that are waiting (or about to) for a permit
+        std::atomic_size_t numWaiters{0};
+        /// Whether permits are handed off to waiters
+        const bool fair;
+
+        /// Protects the wait queue
+        std::mutex queueLock;
+        /// Cothreads waiting for a permit
+        WaitQueue waiters;
+};
+}
+
+#endif
@@ -0,0 +1,149 @@
+#ifndef LIBCOMMUNISM_SHAREDSTACK_H
+#define LIBCOMMUNISM_SHAREDSTACK_H
+
+#include <libcommunism/StackPool.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+namespace libcommunism {
+class Cothread;
+
+namespace internal {
+struct SharedStackState;
+}
+
+/**
+ * A shared stack is a single run stack that any number of cothreads execute on, one at a time.
+ * Only the cothread that last ran on it (its occupant) actually has its stack frames there; the
+ * live part of every other cothread's stack (from its saved stack pointer up to the base of the
+ * stack) is copied out into a heap buffer of just the right size, and copied back in when it's
+ * switched to again.
+ *
+ * Copying only happens when a cothread is switched to while a different cothread occupies the
+ * stack, so switching back and forth between one cothread on a shared stack and cothreads with
+ * their own stack (such as the kernel thread, or the caller of Scheduler::Run()) costs the same as
+ * an ordinary context switch. Otherwise, each switch copies both the outgoing and the incoming
+ * cothread's live stack; this is cheap for shallow stacks, but gets more expensive the deeper the
+ * cothreads' call stacks are when they're suspended.
+ *
+ * In exchange, an idle cothread only holds on to as much memory as it's actually using, which is
+ * typically a few hundred bytes; this makes it feasible to keep millions of them around.
+ *
+ * @remark Since stack frames hold pointers into the stack, a cothread is always restored at the
+ *         same address, and can thus only ever run on the shared stack it was created with. For
+ *         the same reason, pointers to objects on a cothread's stack must never be handed to
+ *         another cothread on the same shared stack: while one is running, the other's stack is
+ *         not where its pointers expect it to be.
+ *
+ * @remark A shared stack, and all cothreads using it, must only be used from one kernel thread at
+ *         a time; in particular, they can't be spawned on an M:N Runtime, which migrates cothreads
+ *         between kernel threads.
+ *
+ * @remark Shared stacks require the platform code to save all of a cothread's context on its
+ *         stack. They are currently only supported on amd64; see IsSupported().
+ *
+ * @brief Run stack that's shared by many cothreads, whose stacks are copied in and out of it
+ */
+class SharedStack {
+    friend class Cothread;
+    friend struct internal::SharedStackState;
+
+    public:
+        /**
+         * @brief Counters describing how a shared stack is used
+         */
+        struct Stats {
+            /// Number of times a cothread's live stack was copied out of the shared stack
+            uint64_t saves{0};
+            /// Number of times a cothread's live stack was copied back into the shared stack
+            uint64_t restores{0};
+            /// Total number of bytes copied in either direction
+            uint64_t bytesCopied{0};
+
+            /// Number of cothreads currently created on the stack
+            size_t numCothreads{0};
+            /// Total size of the buffers that hold the stacks of suspended cothreads, in bytes
+            size_t savedBytes{0};
+        };
+
+        /**
+         * Checks whether the platform implementation supports shared stacks.
+         */
+        static bool IsSupported();
+
+        /**
+         * Gets the shared stack of the calling kernel thread, allocating it with the platform
+         * default stack size on first use. It's deallocated when the kernel thread exits; all
+         * cothreads created on it must have been deallocated by then.
+         *
+         * @throw std::runtime_error If shared stacks aren't supported, or allocating it failed
+         */
+        static SharedStack &ForThread();
+
+        /**
+         * Allocates a new shared stack.
+         *
+         * @param size Size of the stack, in bytes; or zero to use the platform default. It must be
+         *        large enough to fit the deepest call stack of any of the cothreads that use it.
+         * @param type Kind of memory to allocate for the stack
+         *
+         * @throw std::runtime_error If shared stacks aren't supported, or allocating it failed
+         */
+        explicit SharedStack(const size_t size = 0, const StackType type = StackType::Default);
+
+        /**
+         * Releases the stack. All cothreads created on it must have been deallocated already.
+         */
+        ~SharedStack();
+
+        SharedStack(const SharedStack &) = delete;
+        SharedStack &operator=(const SharedStack &) = delete;
+
+        /**
+         * Gets the size of the stack, in bytes.
+         */
+        size_t getSize() const {
+            return this->stack.size() * sizeof(uintptr_t);
+        }
+
+        /**
+         * Gets the lowest address of the stack.
+         */
+        void *getStack() const {
+            return this->stack.data();
+        }
+
+        /**
+         * Gets the cothread whose stack frames currently reside on the shared stack, if any.
+         */
+        constexpr Cothread *getOccupant() const {
+            return this->occupant;
+        }
+
+        /**
+         * Gets the counters of the stack.
+         */
+        constexpr const Stats &getStats() const {
+            return this->stats;
+        }
+
+    private:
+        void activate(Cothread *thread);
+        void save(Cothread *thread);
+        void restore(Cothread *thread);
+        void release(Cothread *thread);
+
+    private:
+        /// Memory of the shared stack
+        std::span<uintptr_t> stack;
+        /// Cothread whose stack frames are currently on the stack
+        Cothread *occupant{nullptr};
+
+        /// Usage counters
+        Stats stats;
+};
+}
+
+#endif
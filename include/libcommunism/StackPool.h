@@ -0,0 +1,184 @@
+#ifndef LIBCOMMUNISM_STACKPOOL_H
+#define LIBCOMMUNISM_STACKPOOL_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace libcommunism {
+/**
+ * @brief Selects how the memory backing a cothread's stack is obtained
+ */
+enum class StackType: uint8_t {
+    /// Use the process wide default, as set in the stack pool configuration
+    Default,
+
+    /**
+     * Stack is allocated from the heap. There is no protection against overflowing the stack,
+     * which will silently corrupt neighboring heap allocations.
+     */
+    Heap,
+
+    /**
+     * Stack is mapped directly from the system as anonymous memory that is not reserved up front,
+     * so that its pages only become resident once they're touched. An inaccessible guard page is
+     * placed below the stack, so an overflow faults rather than corrupting memory.
+     *
+     * @remark Each mapped stack uses two memory mappings; when creating a very large number of
+     *         cothreads with mapped stacks on Linux, `vm.max_map_count` may need to be raised.
+     *
+     * @note On platforms without `mmap()`, this is identical to `Heap`.
+     */
+    Mapped,
+
+    /**
+     * Stack is mapped like `Mapped` stacks, but only its topmost part (as set in the stack pool
+     * configuration) is initially accessible; the requested stack size is just the most it can
+     * grow to. When the cothread touches the inaccessible part, the fault is handled by
+     * making more of it accessible, then resuming the cothread. The stack is shrunk back to its
+     * initial size when it's returned to the pool.
+     *
+     * Faults are handled on an alternate signal stack, which is set up for kernel threads that
+     * allocate growable stacks, and for the workers of a Runtime. Cothreads with a growable stack
+     * must not run on other kernel threads.
+     *
+     * @remark The stack only grows while the Cothread that owns it is executing; other code that
+     *         accesses its inaccessible part (including a BasicCothread using the stack) still
+     *         faults.
+     *
+     * @remark Faults are handled by a `SIGSEGV` and `SIGBUS` handler, which is (re)installed
+     *         whenever a growable stack is mapped, and passes faults that aren't on a growable
+     *         stack on to the handler it replaced. Handlers installed afterwards must do the same.
+     *
+     * @note On platforms without `mmap()` and signals, this is identical to `Heap`.
+     */
+    Growable,
+};
+
+/**
+ * Cothreads that allocate their own stack draw it from this pool, rather than going to the system
+ * allocator each time. Each kernel thread keeps its own cache of released stacks, bucketed by
+ * size class, so that creating and destroying cothreads of the same size in a loop reuses the same
+ * handful of stacks without taking any locks.
+ *
+ * Stacks that are released on a different kernel thread than the one that allocated them are
+ * handed back to their owning thread through a lock-free list, which the owner drains the next
+ * time it misses in its cache. If the owning thread has since exited, the stack is released to
+ * the system directly.
+ *
+ * @brief Per kernel thread cache of cothread stacks
+ */
+class StackPool {
+    public:
+        /**
+         * @brief Tunables for the stack pool
+         *
+         * Caps are applied per kernel thread. A stack that is released while the cache is at its
+         * cap is returned to the system immediately.
+         */
+        struct Config {
+            /// When clear, stacks are always allocated from and released to the system.
+            bool enabled{true};
+            /// Maximum number of stacks cached per size class
+            size_t maxCachedPerClass{16};
+            /// Maximum total number of bytes of stack cached
+            size_t maxCachedBytes{16 * 1024 * 1024};
+
+            /// Type of stack allocated for cothreads that request `StackType::Default`
+            StackType defaultType{StackType::Heap};
+            /**
+             * When set, the pages of mapped stacks are returned to the system as the stack is
+             * cached, so that cached stacks don't hold on to resident memory. This costs a system
+             * call for each released stack.
+             */
+            bool decommitMapped{false};
+            /**
+             * When set, the stacks of all new cothreads are filled with a known pattern, so that
+             * their high water mark can be measured with Cothread::getStackHighWaterMark(). This
+             * writes the entire stack, which makes all pages of mapped stacks resident.
+             */
+            bool paintStacks{false};
+            /**
+             * Number of bytes of growable stacks that are initially accessible, including some
+             * bookkeeping data; it's rounded up to a multiple of the page size.
+             */
+            size_t growableInitialSize{16 * 1024};
+        };
+
+        /**
+         * @brief Counters describing the behavior of the pool
+         */
+        struct Stats {
+            /// Number of allocations satisfied from a cache
+            uint64_t hits{0};
+            /// Number of allocations that had to go to the system allocator
+            uint64_t misses{0};
+            /// Number of stacks returned to the cache of the thread that released them
+            uint64_t localFrees{0};
+            /// Number of stacks handed back to their owning thread from another thread
+            uint64_t remoteFrees{0};
+            /// Number of stacks released to the system (because of caps, trimming or exiting)
+            uint64_t released{0};
+            /// Number of times a growable stack was extended, counted by the thread that allocated it
+            uint64_t grown{0};
+
+            /// Number of stacks currently cached
+            size_t cachedStacks{0};
+            /// Total size of all currently cached stacks, in bytes
+            size_t cachedBytes{0};
+        };
+
+        /**
+         * Granularity of stack size classes, in bytes. Requested stack sizes (plus a small amount
+         * of bookkeeping data) are rounded up to a multiple of this value, or of the system page
+         * size if that is larger.
+         */
+        static constexpr const size_t kSizeClassGranularity{0x1000};
+
+        /**
+         * Maximum number of distinct size classes cached per kernel thread. Stacks of any other
+         * size are still allocated through the pool, but are never cached.
+         */
+        static constexpr const size_t kMaxSizeClasses{8};
+
+        /**
+         * Updates the pool configuration. New caps take effect the next time a stack is released;
+         * already cached stacks are not trimmed until then, or until Trim() is invoked.
+         *
+         * @param config New configuration to apply
+         */
+        static void SetConfig(const Config &config);
+
+        /**
+         * Gets the currently active pool configuration.
+         *
+         * @return Pool configuration
+         */
+        static Config GetConfig();
+
+        /**
+         * Returns the aggregate statistics of all kernel threads that have used the pool, including
+         * those that have since exited.
+         *
+         * @return Counters summed over all threads
+         */
+        static Stats GetStats();
+
+        /**
+         * Returns the statistics for the calling kernel thread only.
+         *
+         * @return Counters of the calling thread's cache
+         */
+        static Stats GetThreadStats();
+
+        /**
+         * Releases cached stacks of the calling kernel thread back to the system, until at most
+         * the given number of bytes remain cached. This also drains any stacks that were handed
+         * back from other threads.
+         *
+         * @param keepBytes Number of bytes worth of stacks that may remain cached
+         */
+        static void Trim(const size_t keepBytes = 0);
+};
+}
+
+#endif
@@ -0,0 +1,165 @@
+#ifndef LIBCOMMUNISM_STACKPROFILE_H
+#define LIBCOMMUNISM_STACKPROFILE_H
+
+#include <libcommunism/StackPool.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <source_location>
+#include <string>
+
+namespace libcommunism {
+/**
+ * A stack profile learns how large the stacks of a particular kind of cothread need to be, so that
+ * they don't all have to be allocated with the (large) platform default size.
+ *
+ * Cothreads created with a profile get a stack of the size the profile currently recommends; it's
+ * painted with a known pattern when it's allocated. When the cothread is destroyed, its stack high
+ * water mark (see Cothread::getStackHighWaterMark()) is recorded in the profile. Once it has seen
+ * at least one cothread, the profile recommends the largest high water mark it has observed,
+ * multiplied by a safety margin; so the stacks of later cothreads shrink to match their actual
+ * use.
+ *
+ * Profiles are identified by name: typically the label of the cothreads, or the location in the
+ * source where they are created. They're never deallocated, so references to them may be cached.
+ *
+ * @remark The recommendation is only as good as the cothreads observed so far: a cothread that
+ *         goes much deeper than all its predecessors may overflow its stack. Use mapped stacks
+ *         (which have a guard page) for profiled cothreads where this is a concern, and a larger
+ *         margin for cothreads whose stack use varies widely.
+ *
+ * @remark Profiles may be shared between kernel threads.
+ *
+ * @brief Learns the stack size to allocate for a kind of cothread
+ */
+class StackProfile {
+    public:
+        /**
+         * @brief Parameters of a stack profile
+         */
+        struct Config {
+            /// Stack size to use until a cothread has been observed; zero for the platform default
+            size_t initialSize{0};
+            /// Smallest stack size that's ever recommended, in bytes
+            size_t minSize{16 * 1024};
+            /// Largest stack size that's ever recommended, in bytes; zero for no limit
+            size_t maxSize{0};
+            /// Factor by which the observed high water mark is multiplied
+            double margin{2.0};
+            /// Type of stack to allocate
+            StackType stackType{StackType::Default};
+        };
+
+        /**
+         * Gets the profile for cothreads with the given label, creating it (with the default
+         * configuration) if needed. Cothreads created with it are assigned the label.
+         *
+         * @param label Label of the cothreads
+         *
+         * @return Profile for cothreads with that label
+         */
+        static StackProfile &ForLabel(const std::string &label);
+
+        /**
+         * Gets the profile for cothreads that are created at a particular location in the source,
+         * creating it if needed. Its name is of the form `file:line`.
+         *
+         * @param site Location where the cothreads are created; by default, the caller
+         *
+         * @return Profile for cothreads created there
+         */
+        static StackProfile &ForSite(const std::source_location site =
+                std::source_location::current());
+
+        /**
+         * Creates a standalone profile, which isn't registered by name.
+         *
+         * @param name Name of the profile; if not empty, it's used as the label of the cothreads
+         *        created with it.
+         * @param config Parameters of the profile
+         */
+        StackProfile(const std::string &name, const Config &config) : name(name),
+            config(config) {}
+
+        /**
+         * Creates a standalone profile with the default configuration.
+         *
+         * @param name Name of the profile; if not empty, it's used as the label of the cothreads
+         *        created with it.
+         */
+        explicit StackProfile(const std::string &name = "") : StackProfile(name, Config()) {}
+
+        StackProfile(const StackProfile &) = delete;
+        StackProfile &operator=(const StackProfile &) = delete;
+
+        /**
+         * Gets the size of stack to allocate for the next cothread, based on the high water marks
+         * observed so far.
+         *
+         * @return Stack size in bytes, or zero for the platform default
+         */
+        size_t getStackSize() const;
+
+        /**
+         * Records the high water mark of a cothread's stack.
+         *
+         * @param highWaterMark Number of bytes of stack the cothread used
+         */
+        void record(const size_t highWaterMark);
+
+        /**
+         * Gets the largest high water mark recorded so far.
+         */
+        size_t getMaxHighWaterMark() const {
+            return this->maxHighWaterMark.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Gets the number of cothreads whose high water mark was recorded.
+         */
+        size_t getNumSamples() const {
+            return this->numSamples.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Gets the name of the profile.
+         */
+        constexpr auto &getName() const {
+            return this->name;
+        }
+
+        /**
+         * Gets the configuration of the profile.
+         */
+        constexpr auto &getConfig() const {
+            return this->config;
+        }
+
+        /**
+         * Updates the configuration of the profile. This must not be done while cothreads are
+         * being created with it.
+         */
+        void setConfig(const Config &newConfig) {
+            this->config = newConfig;
+        }
+
+        /**
+         * Forgets all high water marks recorded so far, so that the initial size is used again.
+         */
+        void reset();
+
+    private:
+        /// Name of the profile; used as the label of cothreads
+        std::string name;
+        /// Parameters of the profile
+        Config config;
+
+        /// Largest high water mark recorded
+        std::atomic<size_t> maxHighWaterMark{0};
+        /// Number of high water marks recorded
+        std::atomic<size_t> numSamples{0};
+};
+}
+
+#endif
@@ -0,0 +1,203 @@
+#ifndef LIBCOMMUNISM_TIMERWHEEL_H
+#define LIBCOMMUNISM_TIMERWHEEL_H
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+namespace libcommunism {
+/**
+ * Timer wheels keep track of timers for the cothreads on a kernel thread, allowing them to sleep
+ * or wait with a deadline without blocking the kernel thread.
+ *
+ * Time is divided into ticks of a fixed resolution; all timers expiring within the same tick are
+ * expired together, which coalesces nearby expirations into a single wakeup. Timers are stored in
+ * a hierarchy of wheels, each of which has 64 slots: the first covers one tick per slot, the next
+ * 64 ticks per slot, and so on. As time advances, the timers in a slot of a higher level are
+ * moved down into the lower levels, until they expire from the lowest one.
+ *
+ * Timers are intrusive, so scheduling one doesn't allocate any memory; both scheduling and
+ * cancelling are constant time. Advancing the wheel skips directly from one non-empty slot to the
+ * next, so the cost of an idle period doesn't depend on its length.
+ *
+ * @remark A timer wheel may only be used from a single kernel thread.
+ *
+ * @brief Hierarchical timer wheel
+ */
+class TimerWheel {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        /**
+         * @brief A timer that can be scheduled on a wheel
+         *
+         * Timers are embedded into the structure that needs them. They must remain valid until
+         * they expired or were cancelled.
+         */
+        struct Timer {
+            /// Next timer in the same slot
+            Timer *next{nullptr};
+            /// Previous timer in the same slot
+            Timer *prev{nullptr};
+            /// Tick at which the timer expires
+            uint64_t expiry{0};
+            /// Invoked when the timer expires; it's no longer scheduled at that point.
+            void (*callback)(Timer *){nullptr};
+
+            /**
+             * Checks whether the timer is scheduled on a wheel.
+             */
+            constexpr bool isPending() const {
+                return this->next;
+            }
+        };
+
+        /// Default resolution of the wheel
+        constexpr static const Clock::duration kDefaultResolution{std::chrono::milliseconds(1)};
+
+        /**
+         * Creates a new timer wheel.
+         *
+         * @param resolution Duration of a single tick. Timers expire at most this long after
+         *        their deadline (once the wheel is advanced.)
+         * @param epoch Point in time at which the first tick begins
+         */
+        explicit TimerWheel(const Clock::duration resolution = kDefaultResolution,
+                const Clock::time_point epoch = Clock::now());
+
+        /**
+         * Destroys the wheel. Any timers that are still scheduled are cancelled.
+         */
+        ~TimerWheel();
+
+        TimerWheel(const TimerWheel &) = delete;
+        TimerWheel &operator=(const TimerWheel &) = delete;
+
+        /**
+         * Schedules a timer. If its deadline has already passed, it expires once the wheel is
+         * advanced to the next tick.
+         *
+         * @param timer Timer to schedule. If it's already scheduled, it's rescheduled.
+         * @param deadline Point in time at which the timer expires
+         */
+        void schedule(Timer &timer, const Clock::time_point deadline);
+
+        /**
+         * Cancels a timer, if it's scheduled.
+         *
+         * @return Whether the timer was scheduled
+         */
+        bool cancel(Timer &timer);
+
+        /**
+         * Expires all timers whose deadline has passed, and invokes their callbacks.
+         *
+         * @param now Current time
+         *
+         * @return Number of timers that expired
+         */
+        size_t advance(const Clock::time_point now = Clock::now());
+
+        /**
+         * Gets the point in time at which the wheel next needs to be advanced. No timers will
+         * expire before then, though none may expire at that point, either.
+         *
+         * @return Next deadline, or an empty optional if no timers are scheduled.
+         */
+        std::optional<Clock::time_point> getNextDeadline() const;
+
+        /**
+         * Gets the number of scheduled timers.
+         */
+        constexpr size_t getNumPending() const {
+            return this->numPending;
+        }
+
+        /**
+         * Suspends the calling cothread until the deadline has passed. Cothreads spawned through
+         * the Scheduler park until the wheel expires their timer; anything else (including
+         * cothreads on a shared stack) blocks its kernel thread instead.
+         *
+         * @param deadline Point in time until which to sleep
+         */
+        void sleepUntil(const Clock::time_point deadline);
+
+        /**
+         * Suspends the calling cothread for (at least) the given duration.
+         *
+         * @param duration Duration to sleep for
+         */
+        template<class Rep, class Period>
+        void sleepFor(const std::chrono::duration<Rep, Period> &duration) {
+            this->sleepUntil(Clock::now() + std::chrono::ceil<Clock::duration>(duration));
+        }
+
+        /**
+         * Parks the calling cothread, which must have been spawned through the Scheduler, until
+         * it's unparked or the deadline has passed. This is the building block for operations
+         * with a timeout. Like Scheduler::Park(), this may return early, so callers should check
+         * whatever condition they're waiting for.
+         *
+         * @param deadline Point in time at which to stop waiting
+         *
+         * @throw std::runtime_error If the calling cothread wasn't spawned through the Scheduler,
+         *        or executes on a shared stack
+         *
+         * @return Whether the cothread was unparked (rather than the deadline passing)
+         */
+        bool parkUntil(const Clock::time_point deadline);
+
+        /**
+         * Executes the calling kernel thread's scheduler, advancing the wheel once per scheduling
+         * round. When no cothreads are runnable, the kernel thread sleeps until the next deadline.
+         *
+         * @return Number of cothreads that are still alive, but blocked on something other than
+         *         the wheel.
+         */
+        size_t run();
+
+    private:
+        /// Number of bits of the expiry tick that select the slot in each level
+        constexpr static const size_t kSlotBits{6};
+        /// Number of slots per level
+        constexpr static const size_t kNumSlots{1 << kSlotBits};
+        /// Number of levels; timers too far in the future are put on the overflow list.
+        constexpr static const size_t kNumLevels{6};
+
+        /// A level of the wheel
+        struct Level {
+            /// Sentinels of the circular list of timers in each slot
+            std::array<Timer, kNumSlots> slots;
+            /// Bit mask indicating which slots contain timers
+            uint64_t occupied{0};
+        };
+
+        void insert(Timer &timer);
+        void unlink(Timer &timer);
+        void cascade(Timer &list);
+        uint64_t getNextEvent() const;
+
+        uint64_t getTick(const Clock::time_point time) const;
+        uint64_t getExpiry(const Clock::time_point deadline) const;
+
+    private:
+        /// Duration of a single tick, in clock units
+        Clock::rep resolution;
+        /// Point in time at which tick 0 began
+        Clock::time_point epoch;
+        /// Last tick that was processed
+        uint64_t current{0};
+
+        /// Levels of the wheel
+        std::array<Level, kNumLevels> levels;
+        /// Sentinel of the list of timers that expire beyond the last level
+        Timer overflow;
+
+        /// Number of scheduled timers
+        size_t numPending{0};
+};
+}
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef LIBCOMMUNISM_WAITQUEUE_H
+#define LIBCOMMUNISM_WAITQUEUE_H
+
+#include <libcommunism/Cothread.h>
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+namespace libcommunism {
+/**
+ * Wait queues are the building block of blocking primitives, such as channels. They hold a FIFO
+ * of waiters, each of which represents a blocked cothread, and are protected by a lock that's
+ * owned by the primitive.
+ *
+ * How a waiter blocks depends on what it is: cothreads on an M:N runtime park through the
+ * runtime, and cothreads spawned through the Scheduler park through their kernel thread's
+ * scheduler. Anything else (such as a kernel thread that isn't executing any cothreads) blocks its
+ * kernel thread until it's woken. Waiters of any kind may be woken from any kernel thread.
+ *
+ * @remark Cothreads on a shared stack can't block: while they're suspended, other cothreads'
+ *         frames occupy the memory their waiter lives in. Blocking operations throw instead.
+ *
+ * @brief FIFO of blocked cothreads
+ */
+class WaitQueue {
+    public:
+        /**
+         * @brief A blocked cothread, waiting to be woken
+         *
+         * Waiters typically live on the stack of the blocked cothread. Primitives may derive from
+         * this to exchange additional data between the waiter and the one waking it.
+         */
+        struct Waiter {
+            /// How the waiter blocks
+            enum class Mode: uint8_t {
+                /// Block the kernel thread
+                Kernel,
+                /// Park through the scheduler of the kernel thread
+                Scheduler,
+                /// Park through the M:N runtime
+                Runtime,
+            };
+
+            /// Blocked cothread
+            Cothread *thread{nullptr};
+            /// Next waiter in the queue
+            Waiter *next{nullptr};
+            /// Set once the waiter was woken
+            std::atomic_uint32_t woken{0};
+            /// How to block and wake the waiter
+            Mode mode{Mode::Kernel};
+            /**
+             * Set if the waiter is only ever woken from the kernel thread it's blocked on, such
+             * as by polling a reactor; Scheduler::Run() then returns while it's blocked, rather
+             * than waiting for it to be woken.
+             */
+            bool local{false};
+        };
+
+        /**
+         * Adds a waiter to the end of the queue.
+         *
+         * @param waiter Waiter to add; it must not be on any queue
+         */
+        void push(Waiter *waiter) {
+            waiter->next = nullptr;
+            if(this->tail) {
+                this->tail->next = waiter;
+            } else {
+                this->head = waiter;
+            }
+            this->tail = waiter;
+        }
+
+        /**
+         * Removes the waiter at the head of the queue.
+         *
+         * @return Longest waiting waiter, or `nullptr` if the queue is empty
+         */
+        Waiter *pop() {
+            auto waiter = this->head;
+            if(waiter) {
+                this->head = waiter->next;
+                if(!this->head) {
+                    this->tail = nullptr;
+                }
+            }
+            return waiter;
+        }
+
+        /**
+         * Checks whether there are any waiters.
+         */
+        bool empty() const {
+            return !this->head;
+        }
+
+        /**
+         * Blocks the calling cothread until the waiter is woken. The lock is released while
+         * blocked, and acquired again before returning; so once this returns, whoever woke the
+         * waiter is done accessing it.
+         *
+         * @param waiter Waiter to block on; it should already have been added to a queue.
+         * @param lock Lock protecting the queue, which must be held by the caller
+         */
+        static void Block(Waiter &waiter, std::unique_lock<std::mutex> &lock);
+
+        /**
+         * Wakes a waiter that was removed from its queue. The lock protecting the queue must be
+         * held by the caller.
+         *
+         * @param waiter Waiter to wake
+         */
+        static void Wake(Waiter *waiter);
+
+        /**
+         * Initializes a waiter for the calling cothread, picking how it blocks. Primitives must
+         * do this before changing any of their state in preparation for blocking, so that they're
+         * left unchanged if it throws.
+         *
+         * @param waiter Waiter to initialize
+         *
+         * @throw std::runtime_error If the calling cothread executes on a shared stack
+         */
+        static void Prepare(Waiter &waiter);
+
+    private:
+        /// First waiter in the queue
+        Waiter *head{nullptr};
+        /// Last waiter in the queue
+        Waiter *tail{nullptr};
+};
+}
+
+#endif
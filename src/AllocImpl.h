@@ -17,6 +17,26 @@
 #include "arch/ucontext/UContext.h"
 #endif
 
+namespace libcommunism::internal {
+/**
+ * Platform implementation selected by the build configuration. Context switches are dispatched
+ * directly to its `Switch()` method, rather than through the `CothreadImpl` interface.
+ */
+#if defined(PLATFORM_AMD64_SYSV) || defined(PLATFORM_AMD64_WINDOWS)
+using PlatformImpl = Amd64;
+#elif defined(PLATFORM_X86_FASTCALL)
+using PlatformImpl = x86;
+#elif defined(PLATFORM_AARCH64_AAPCS)
+using PlatformImpl = Aarch64;
+#elif defined(PLATFORM_SETJMP)
+using PlatformImpl = SetJmp;
+#elif defined(PLATFORM_UCONTEXT)
+using PlatformImpl = UContext;
+#else
+#error Do not know the implementation for current platform!
+#endif
+}
+
 template <class ImplClass, typename ...Args>
 static constexpr auto AllocImplHelper(std::span<uintptr_t> buffer, bool &bufferUsed, Args && ...args) {
     const auto bytes{buffer.size() * sizeof(uintptr_t)};
@@ -36,21 +56,8 @@ static constexpr auto AllocImplHelper(std::span<uintptr_t> buffer, bool &bufferU
  */
 template <typename ...Args>
 static constexpr auto AllocImpl(std::span<uintptr_t> buffer, bool &bufferUsed, Args && ...args) {
-    using namespace libcommunism::internal;
-
-#if defined(PLATFORM_AMD64_SYSV) || defined(PLATFORM_AMD64_WINDOWS)
-    return AllocImplHelper<Amd64>(buffer, bufferUsed, std::forward<Args>(args)...);
-#elif defined(PLATFORM_X86_FASTCALL)
-    return AllocImplHelper<x86>(buffer, bufferUsed, std::forward<Args>(args)...);
-#elif defined(PLATFORM_AARCH64_AAPCS)
-    return AllocImplHelper<Aarch64>(buffer, bufferUsed, std::forward<Args>(args)...);
-#elif defined(PLATFORM_SETJMP)
-    return AllocImplHelper<SetJmp>(buffer, bufferUsed, std::forward<Args>(args)...);
-#elif defined(PLATFORM_UCONTEXT)
-    return AllocImplHelper<UContext>(buffer, bufferUsed, std::forward<Args>(args)...);
-#else
-#error Do not know how to allocate implementation for current platform!
-#endif
+    return AllocImplHelper<libcommunism::internal::PlatformImpl>(buffer, bufferUsed,
+            std::forward<Args>(args)...);
 }
 
 #endif
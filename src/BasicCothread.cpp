@@ -0,0 +1,192 @@
+#include <libcommunism/BasicCothread.h>
+
+#include "AllocImpl.h"
+#include "CothreadImpl.h"
+#include "CothreadPrivate.h"
+
+#if defined(LIBCOMMUNISM_BACKEND_AMD64)
+#include "arch/amd64/Common.h"
+#endif
+#if defined(LIBCOMMUNISM_BACKEND_AARCH64)
+#include "arch/aarch64/Common.h"
+#endif
+#if defined(LIBCOMMUNISM_BACKEND_X86)
+#include "arch/x86/Common.h"
+#endif
+#if defined(LIBCOMMUNISM_BACKEND_SETJMP)
+#include "arch/setjmp/SetJmp.h"
+#endif
+#if defined(LIBCOMMUNISM_BACKEND_UCONTEXT)
+#include "arch/ucontext/UContext.h"
+#endif
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <exception>
+#include <iostream>
+#include <new>
+#include <stdexcept>
+
+using namespace libcommunism;
+using namespace libcommunism::internal;
+
+namespace {
+/**
+ * @brief Per kernel thread storage for the kernel thread cothread of a backend
+ *
+ * This represents whatever is executing before a cothread of the backend is first switched to.
+ * The platform code's own main stack isn't used, since the kernel thread cothread of `Cothread`
+ * already uses it if the backend is the one selected by the build configuration.
+ */
+template<class Backend>
+struct KernelThread {
+    /// Storage for the cothread object
+    alignas(BasicCothread<Backend>) static thread_local std::array<std::byte,
+        sizeof(BasicCothread<Backend>)> cothread;
+    /// Buffer that the platform code saves the kernel thread's context into
+    static thread_local std::array<uintptr_t, Backend::Impl::kMainStackSize> mainStack;
+};
+
+template<class Backend>
+alignas(BasicCothread<Backend>) thread_local std::array<std::byte, sizeof(BasicCothread<Backend>)>
+    KernelThread<Backend>::cothread;
+template<class Backend>
+thread_local std::array<uintptr_t, Backend::Impl::kMainStackSize> KernelThread<Backend>::mainStack;
+}
+
+template<class Backend>
+thread_local BasicCothread<Backend> *BasicCothread<Backend>::gCurrent{nullptr};
+
+/**
+ * Invokes the return handler for a BasicCothread that returned from its entry point.
+ */
+void internal::BasicCothreadReturned() {
+    gReturnHandler(nullptr);
+    std::terminate();
+}
+
+
+
+template<class Backend>
+BasicCothread<Backend> *BasicCothread<Backend>::Current() {
+    if(!gCurrent) [[unlikely]] {
+        gCurrent = AllocKernelThreadCothread();
+    }
+    return gCurrent;
+}
+
+/**
+ * Sets up the cothread that represents whatever is executing on the calling kernel thread, before
+ * a cothread of this backend is first switched to. This does not allocate memory.
+ */
+template<class Backend>
+BasicCothread<Backend> *BasicCothread<Backend>::AllocKernelThreadCothread() {
+    auto thread = new(KernelThread<Backend>::cothread.data()) BasicCothread;
+    thread->impl = AllocImplHelper<Impl>(thread->implBuffer, thread->implBufferUsed,
+            std::span<uintptr_t>(KernelThread<Backend>::mainStack));
+    return thread;
+}
+
+template<class Backend>
+BasicCothread<Backend>::~BasicCothread() {
+    if(this->entry && !this->entry->finished) {
+        this->entry->destroy(this->entry);
+    }
+    this->releaseImpl();
+}
+
+template<class Backend>
+void BasicCothread<Backend>::allocImpl(const size_t stackSize, const StackType stackType) {
+    this->impl = AllocImplHelper<Impl>(this->implBuffer, this->implBufferUsed, stackSize,
+            stackType);
+}
+
+template<class Backend>
+void BasicCothread<Backend>::allocImpl(std::span<uintptr_t> stack) {
+    this->impl = AllocImplHelper<Impl>(this->implBuffer, this->implBufferUsed, stack);
+}
+
+template<class Backend>
+void BasicCothread<Backend>::releaseImpl() {
+    if(this->implBufferUsed) {
+        this->impl->~Impl();
+    } else {
+        delete this->impl;
+    }
+    this->impl = nullptr;
+}
+
+/**
+ * Reserves space for the entry record at the high end of the cothread's stack; see
+ * Cothread::reserveEntry().
+ */
+template<class Backend>
+void *BasicCothread<Backend>::reserveEntry(const size_t size, const size_t alignment) {
+    const auto base = reinterpret_cast<uintptr_t>(this->impl->getStack());
+    const auto bytes = this->impl->getStackSize();
+
+    if(size > bytes / 2) {
+        throw std::runtime_error("Entry point too large for stack");
+    }
+
+    const auto align = std::max(alignment, Cothread::kEntryAlignment);
+    return reinterpret_cast<void *>((base + bytes - size) & ~(align - 1));
+}
+
+/**
+ * Prepares the platform specific state of the cothread so that it invokes the given entry record.
+ * The record is destroyed if this fails.
+ */
+template<class Backend>
+void BasicCothread<Backend>::prepareEntry(EntryRecord *record) {
+    try {
+        Impl::Prepare(this->impl, record);
+    } catch(...) {
+        record->destroy(record);
+        throw;
+    }
+    this->entry = record;
+}
+
+template<class Backend>
+void BasicCothread<Backend>::switchTo() noexcept {
+    auto from = gCurrent;
+    if(!from) [[unlikely]] {
+        from = AllocKernelThreadCothread();
+    }
+
+    gCurrent = this;
+    Impl::Switch(from->impl, this->impl);
+}
+
+template<class Backend>
+size_t BasicCothread<Backend>::getStackSize() const {
+    return this->impl->getStackSize();
+}
+
+template<class Backend>
+void *BasicCothread<Backend>::getStack() const {
+    return this->impl->getStack();
+}
+
+
+
+/*
+ * Instantiate the cothreads for all backends built into the library.
+ */
+#if defined(LIBCOMMUNISM_BACKEND_AMD64)
+template class libcommunism::BasicCothread<backend::Amd64>;
+#endif
+#if defined(LIBCOMMUNISM_BACKEND_AARCH64)
+template class libcommunism::BasicCothread<backend::Aarch64>;
+#endif
+#if defined(LIBCOMMUNISM_BACKEND_X86)
+template class libcommunism::BasicCothread<backend::X86>;
+#endif
+#if defined(LIBCOMMUNISM_BACKEND_SETJMP)
+template class libcommunism::BasicCothread<backend::SetJmp>;
+#endif
+#if defined(LIBCOMMUNISM_BACKEND_UCONTEXT)
+template class libcommunism::BasicCothread<backend::UContext>;
+#endif
@@ -0,0 +1,206 @@
+#ifndef CHASELEVDEQUE_H
+#define CHASELEVDEQUE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace libcommunism::internal {
+/**
+ * @brief Lock-free work stealing deque of pointers
+ *
+ * The deque has a single owner, which pushes and pops items at the bottom; any other thread may
+ * steal items from the top. This is the algorithm of Chase and Lev ("Dynamic Circular Work-Stealing
+ * Deque", SPAA 2005) with the memory orderings given by Lê et al. ("Correct and Efficient
+ * Work-Stealing for Weak Memory Models", PPoPP 2013.)
+ *
+ * The backing array grows as needed. Arrays that are replaced are kept around until the deque is
+ * destroyed, since a concurrent thief may still be reading from them.
+ *
+ * @tparam T Pointer type of the items
+ */
+template<class T>
+class ChaseLevDeque {
+    static_assert(std::is_pointer_v<T>, "deque items must be pointers");
+
+    /// Circular array of items, whose size is a power of two
+    struct Array {
+        explicit Array(const size_t capacity) : mask(capacity - 1),
+            items(std::make_unique<std::atomic<T>[]>(capacity)) {}
+
+        size_t capacity() const {
+            return this->mask + 1;
+        }
+        T get(const int64_t index) const {
+            return this->items[index & this->mask].load(std::memory_order_relaxed);
+        }
+        void put(const int64_t index, T item) {
+            this->items[index & this->mask].store(item, std::memory_order_relaxed);
+        }
+
+        const size_t mask;
+        std::unique_ptr<std::atomic<T>[]> items;
+    };
+
+    public:
+        /**
+         * Creates an empty deque.
+         *
+         * @param capacity Initial capacity; must be a power of two
+         */
+        explicit ChaseLevDeque(const size_t capacity = 256) {
+            this->arrays.emplace_back(std::make_unique<Array>(capacity));
+            this->array.store(this->arrays.back().get(), std::memory_order_relaxed);
+        }
+
+        ChaseLevDeque(const ChaseLevDeque &) = delete;
+        ChaseLevDeque &operator=(const ChaseLevDeque &) = delete;
+
+        /**
+         * Pushes an item to the bottom of the deque. Only the owner may invoke this.
+         *
+         * @param item Item to push
+         */
+        void push(T item) {
+            const auto b = this->bottom.load(std::memory_order_relaxed);
+            const auto t = this->top.load(std::memory_order_acquire);
+            auto a = this->array.load(std::memory_order_relaxed);
+
+            if(b - t > static_cast<int64_t>(a->capacity()) - 1) [[unlikely]] {
+                a = this->grow(a, t, b);
+            }
+
+            a->put(b, item);
+            std::atomic_thread_fence(std::memory_order_release);
+            this->bottom.store(b + 1, std::memory_order_relaxed);
+        }
+
+        /**
+         * Pops the item most recently pushed to the bottom of the deque. Only the owner may invoke
+         * this.
+         *
+         * @return The item, or `nullptr` if the deque is empty
+         */
+        T pop() {
+            const auto b = this->bottom.load(std::memory_order_relaxed) - 1;
+            auto a = this->array.load(std::memory_order_relaxed);
+            this->bottom.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            auto t = this->top.load(std::memory_order_relaxed);
+
+            if(t > b) {
+                this->bottom.store(b + 1, std::memory_order_relaxed);
+                return nullptr;
+            }
+
+            auto item = a->get(b);
+            if(t == b) {
+                // last item: race against thieves for it
+                if(!this->top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                            std::memory_order_relaxed)) {
+                    item = nullptr;
+                }
+                this->bottom.store(b + 1, std::memory_order_relaxed);
+            }
+            return item;
+        }
+
+        /**
+         * Steals the item at the top of the deque, i.e. the oldest one. Any thread may invoke this.
+         *
+         * @return The item, or `nullptr` if the deque was empty or another thread won the race
+         */
+        T steal() {
+            auto t = this->top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            const auto b = this->bottom.load(std::memory_order_acquire);
+
+            if(t >= b) {
+                return nullptr;
+            }
+
+            auto a = this->array.load(std::memory_order_acquire);
+            auto item = a->get(t);
+            if(!this->top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                        std::memory_order_relaxed)) {
+                return nullptr;
+            }
+            return item;
+        }
+
+        /**
+         * Steals up to half of the items in the deque, oldest first. The first one is returned,
+         * the remainder are pushed to the given deque, which must be owned by the caller.
+         *
+         * @param into Deque to receive all but the first stolen item
+         * @param max Maximum number of items to steal
+         *
+         * @return The first stolen item, or `nullptr` if none could be stolen
+         */
+        T stealBatch(ChaseLevDeque &into, const size_t max) {
+            auto first = this->steal();
+            if(!first) {
+                return nullptr;
+            }
+
+            // the size is only an estimate; each further item is stolen individually
+            const auto remaining = std::min(this->size() / 2, max - 1);
+            for(size_t i = 0; i < remaining; i++) {
+                auto item = this->steal();
+                if(!item) {
+                    break;
+                }
+                into.push(item);
+            }
+            return first;
+        }
+
+        /**
+         * Returns an estimate of the number of items in the deque. This is exact only when invoked
+         * by the owner while no thieves are active.
+         */
+        size_t size() const {
+            const auto b = this->bottom.load(std::memory_order_relaxed);
+            const auto t = this->top.load(std::memory_order_relaxed);
+            return (b > t) ? static_cast<size_t>(b - t) : 0;
+        }
+
+        /// Whether the deque (most likely) is empty
+        bool empty() const {
+            return !this->size();
+        }
+
+    private:
+        /**
+         * Replaces the backing array with one twice its size, and copies all items over.
+         */
+        Array *grow(Array *old, const int64_t t, const int64_t b) {
+            auto bigger = std::make_unique<Array>(old->capacity() * 2);
+            for(auto i = t; i < b; i++) {
+                bigger->put(i, old->get(i));
+            }
+
+            auto a = bigger.get();
+            this->arrays.emplace_back(std::move(bigger));
+            this->array.store(a, std::memory_order_release);
+            return a;
+        }
+
+    private:
+        /// Index of the oldest item; thieves take items from here
+        alignas(64) std::atomic<int64_t> top{0};
+        /// Index one past the newest item; the owner pushes and pops here
+        alignas(64) std::atomic<int64_t> bottom{0};
+        /// Current backing array
+        std::atomic<Array *> array{nullptr};
+
+        /// All arrays ever allocated, including the current one
+        std::vector<std::unique_ptr<Array>> arrays;
+};
+}
+
+#endif
@@ -3,10 +3,23 @@
 #include "AllocImpl.h"
 #include "CothreadImpl.h"
 #include "CothreadPrivate.h"
+#include "FpState.h"
+#include "SharedStackPrivate.h"
+#include "StackPoolPrivate.h"
+#include "Timestamp.h"
 
+#include <libcommunism/StackProfile.h>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
 #include <exception>
 #include <iomanip>
 #include <iostream>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <utility>
 
 /**
  * \mainpage libcommunism Documentation
@@ -50,8 +63,10 @@
  *
  * Supporting other architectures and platforms should be relatively trivial. See the
  * \link libcommunism::CothreadImpl cothread implementation class\endlink for an example of the
- * required interaces. In addition, the active platform in use must provide a method to initialize
- * the initial cothread for a given kernel thread.
+ * required interaces; in addition to these, the implementation must provide a static `Prepare()`
+ * method that sets up a new cothread to invoke its entry record, and static `Switch()` and
+ * `Transfer()` methods that perform the actual context switch. The active platform in use must also provide a
+ * method to initialize the initial cothread for a given kernel thread.
  *
  * \section more More Information
  *
@@ -74,7 +89,38 @@ std::function<void(Cothread *)> internal::gReturnHandler{DefaultCothreadReturned
 /**
  * Pointer to the cothread instance that's currently executing on this thread.
  */
-thread_local Cothread *Cothread::gCurrent{nullptr};
+constinit thread_local Cothread *Cothread::gCurrent{nullptr};
+
+/**
+ * Storage for the cothread that represents the kernel thread itself, i.e. the one returned by
+ * Current() before any cothread has been switched to. It's never deallocated.
+ */
+alignas(Cothread) static thread_local std::array<std::byte, sizeof(Cothread)> gKernelThreadCothread;
+
+/**
+ * @brief Describes a pending re-arm of the currently executing cothread
+ */
+struct RestartRequest {
+    /// Cothread to re-arm
+    Cothread *thread{nullptr};
+    /// Tuple of references to the new callable and its arguments
+    void *refs{nullptr};
+    /// Method to invoke on the reset helper to re-arm the cothread
+    void (*stage)(Cothread *, void *){nullptr};
+    /// Exception thrown by the stage method, if any
+    std::exception_ptr error;
+};
+
+/**
+ * Re-arm request that the reset helper of this kernel thread processes when it's switched to.
+ */
+static thread_local RestartRequest gRestartRequest;
+
+/**
+ * Cothread used to re-arm the currently executing cothread, since its stack can't be rebuilt while
+ * it's executing on it. It's allocated on first use.
+ */
+static thread_local std::unique_ptr<Cothread> gResetHelper;
 
 
 
@@ -96,16 +142,111 @@ static void libcommunism::internal::DefaultCothreadReturnedHandler(Cothread *thr
     std::terminate();
 }
 
-Cothread::Cothread(const Entry &entry, const size_t stackSize) {
-    this->impl = AllocImpl(this->implBuffer, this->implBufferUsed, entry, stackSize);
+Cothread::Cothread(const Entry &entry, const size_t stackSize, const StackType stackType) :
+    Cothread(stackSize, stackType, entry) {}
+
+Cothread::Cothread(const Entry &entry, std::span<uintptr_t> stack) : Cothread(stack, entry) {}
+
+/**
+ * Destroys the entry point of the cothread, if it hasn't already returned, and then releases the
+ * implementation (and with it, the stack.)
+ */
+Cothread::~Cothread() {
+    if(this->stackProfile) {
+        this->stackProfile->record(this->getStackHighWaterMark());
+    }
+
+    this->disarm();
+    this->releaseImpl();
+    delete this->fpState;
 }
 
-Cothread::Cothread(const Entry &entry, std::span<uintptr_t> stack) {
-    this->impl = AllocImpl(this->implBuffer, this->implBufferUsed, entry, stack);
+/**
+ * Allocates the implementation of a cothread, including a stack of the given size. Its entry
+ * point is installed separately.
+ */
+void Cothread::allocImpl(const size_t stackSize, const StackType stackType) {
+    this->impl = AllocImpl(this->implBuffer, this->implBufferUsed, stackSize, stackType);
+    if(stackType == StackType::Growable) {
+        this->growableStack = IsGrowableStack(this->impl->getStack(), this->impl->getStackSize());
+    }
+    if(ShouldPaintStacks()) {
+        this->paintStack();
+    }
+#ifdef LIBCOMMUNISM_STATS
+    this->registerStats();
+#endif
 }
 
+/**
+ * Allocates the implementation of a cothread that runs on the given stack. Its entry point is
+ * installed separately.
+ */
+void Cothread::allocImpl(std::span<uintptr_t> stack) {
+    this->impl = AllocImpl(this->implBuffer, this->implBufferUsed, stack);
+    if(ShouldPaintStacks()) {
+        this->paintStack();
+    }
+#ifdef LIBCOMMUNISM_STATS
+    this->registerStats();
+#endif
+}
+
+/**
+ * Allocates the implementation of a cothread with a stack of the size recommended by the given
+ * profile, and paints the stack, so that its high water mark can be recorded in the profile.
+ */
+void Cothread::allocImpl(StackProfile &profile) {
+    const auto &config = profile.getConfig();
+    this->allocImpl(profile.getStackSize(), config.stackType);
+    if(!this->stackPainted) {
+        this->paintStack();
+    }
+
+    this->stackProfile = &profile;
+    if(!profile.getName().empty()) {
+        this->label = profile.getName();
+    }
+}
+
+/**
+ * Fills the entire stack of the cothread with the paint pattern. This must happen before the entry
+ * record is constructed. Any context the platform code keeps at the low end of the stack is left
+ * alone, and the inaccessible part of a growable stack is painted as it's grown.
+ */
+void Cothread::paintStack() {
+    const auto skip = std::max(this->impl->getContextSize(), this->getInaccessibleStackSize());
+    auto words = reinterpret_cast<uintptr_t *>(
+            static_cast<std::byte *>(this->impl->getStack()) + skip);
+    std::fill_n(words, (this->impl->getStackSize() - skip) / sizeof(uintptr_t), kStackPaint);
+    this->stackPainted = true;
+}
+
+/**
+ * Gets the number of bytes at the low end of the stack that currently can't be accessed: that is,
+ * the part of a growable stack that it hasn't been grown into yet.
+ */
+size_t Cothread::getInaccessibleStackSize() const {
+    if(!this->growableStack) {
+        return 0;
+    }
+    return GetUncommittedStackSize(this->impl->getStack(), this->impl->getStackSize());
+}
+
+/**
+ * Destroys the implementation of the cothread.
+ */
+void Cothread::releaseImpl() {
+#ifdef LIBCOMMUNISM_STATS
+    this->unregisterStats();
+#endif
+
+    if(this->shared) {
+        this->shared->stack->release(this);
+        this->shared->stack->stats.numCothreads--;
+        delete std::exchange(this->shared, nullptr);
+    }
 
-Cothread::~Cothread() {
     if(this->implBufferUsed) {
         reinterpret_cast<CothreadImpl *>(this->implBuffer.data())->~CothreadImpl();
     } else {
@@ -114,19 +255,138 @@ Cothread::~Cothread() {
     this->impl = nullptr;
 }
 
-Cothread *Cothread::Current() {
-    if(!gCurrent) {
-        auto impl = AllocKernelThreadWrapper();
-        if(!impl) {
-            std::cerr << "failed to allocate kernel cothread wrapper!" << std::endl;
-            std::terminate();
-        }
+/**
+ * Reserves space for the entry record at the high end of the cothread's stack; or, for cothreads
+ * on a shared stack, in a separate heap allocation.
+ *
+ * @param size Size of the entry record, in bytes
+ * @param alignment Required alignment of the entry record
+ *
+ * @throw std::runtime_error If the record would take up more than half of the stack
+ *
+ * @return Location at which the entry record is to be constructed
+ */
+void *Cothread::reserveEntry(const size_t size, const size_t alignment) {
+    if(reinterpret_cast<std::byte *>(this) == gKernelThreadCothread.data()) {
+        throw std::runtime_error("Kernel thread cothread has no stack");
+    }
+
+    const auto align = std::max(alignment, kEntryAlignment);
+    if(this->shared) {
+        return this->shared->reserveEntry(size, align);
+    }
+
+    auto impl = static_cast<PlatformImpl *>(this->impl);
+    const auto base = reinterpret_cast<uintptr_t>(impl->getStack());
+    const auto bytes = impl->getStackSize();
+
+    if(size > bytes / 2) {
+        throw std::runtime_error("Entry point too large for stack");
+    }
+
+    return reinterpret_cast<void *>((base + bytes - size) & ~(align - 1));
+}
+
+/**
+ * Prepares the platform specific state of the cothread so that it invokes the given entry record
+ * when first switched to. The record is destroyed if this fails.
+ *
+ * Cothreads on a shared stack are instead prepared when they're next switched to, since the
+ * shared stack is usually in use by another cothread.
+ *
+ * @param record Entry record, which was constructed at the location returned by reserveEntry()
+ */
+void Cothread::prepareEntry(EntryRecord *record) {
+    if(this->shared) {
+        this->shared->commitEntry();
+        this->shared->stack->release(this);
+        this->entry = record;
+        return;
+    }
+
+    try {
+        PlatformImpl::Prepare(static_cast<PlatformImpl *>(this->impl), record);
+    } catch(...) {
+        record->destroy(record);
+        throw;
+    }
+    this->entry = record;
+}
+
+/**
+ * Destroys the callable of the cothread's entry record, unless it has already been destroyed.
+ */
+void Cothread::disarm() noexcept {
+    if(this->entry && !this->entry->finished) {
+        this->entry->destroy(this->entry);
+    }
+    this->entry = nullptr;
+}
 
-        gCurrent = new Cothread(impl);
+/**
+ * Re-arms the currently executing cothread, by switching to the reset helper, which rebuilds this
+ * cothread's entry record and initial context, then switches to it. This does not return, unless
+ * the helper failed before it modified this cothread's stack; in that case, the exception it
+ * raised is rethrown here.
+ *
+ * @param refs Tuple of references to the callable and its arguments
+ * @param stage Method to invoke on the reset helper to re-arm the cothread
+ */
+void Cothread::restart(void *refs, void (*stage)(Cothread *, void *)) {
+    auto helper = GetResetHelper();
+    gRestartRequest = {this, refs, stage, nullptr};
+    helper->switchTo();
+
+    auto error = std::exchange(gRestartRequest.error, nullptr);
+    std::rethrow_exception(error);
+}
+
+/**
+ * Returns the reset helper of the calling kernel thread, allocating it if needed. It processes one
+ * re-arm request each time it's switched to, then switches to the re-armed cothread.
+ */
+Cothread *Cothread::GetResetHelper() {
+    if(!gResetHelper) [[unlikely]] {
+        gResetHelper = std::make_unique<Cothread>(0, []() {
+            while(true) {
+                auto &request = gRestartRequest;
+                try {
+                    request.stage(request.thread, request.refs);
+                } catch(...) {
+                    request.error = std::current_exception();
+                }
+                request.thread->switchTo();
+            }
+        });
+        gResetHelper->setLabel("reset helper");
+    }
+    return gResetHelper.get();
+}
+
+Cothread *Cothread::Current() {
+    if(!gCurrent) [[unlikely]] {
+        gCurrent = AllocKernelThreadCothread();
     }
     return gCurrent;
 }
 
+/**
+ * Sets up the cothread object that represents the calling kernel thread. Both it and its
+ * implementation are placed in static per thread storage, so this does not allocate memory.
+ */
+Cothread *Cothread::AllocKernelThreadCothread() {
+    auto thread = new(gKernelThreadCothread.data()) Cothread;
+    thread->impl = PlatformImpl::AllocKernelThread(thread->implBuffer, thread->implBufferUsed);
+    if(!thread->impl) {
+        std::cerr << "failed to allocate kernel cothread wrapper!" << std::endl;
+        std::terminate();
+    }
+#ifdef LIBCOMMUNISM_STATS
+    thread->stats.switchedIn(ReadTimestamp());
+#endif
+    return thread;
+}
+
 void Cothread::SetReturnHandler(const std::function<void (Cothread *)> &handler) {
     gReturnHandler = handler;
 }
@@ -135,10 +395,112 @@ void Cothread::ResetReturnHandler() {
     gReturnHandler = DefaultCothreadReturnedHandler;
 }
 
-void Cothread::switchTo() {
-    auto from = Current()->impl;
+/**
+ * Performs the work that has to be done before switching between two cothreads, at least one of
+ * which has a growable stack or a context profile other than the minimal one. This is kept out of
+ * line, so that the common case only costs a check of the flags.
+ *
+ * A growable stack is extended before switching away from it if needed, so that the platform code
+ * never faults on it; the fault handler can't tell which cothread's stack it's on otherwise.
+ */
+COTHREAD_NOINLINE void Cothread::PrepareSwitch(Cothread *from, Cothread *to) noexcept {
+    if(from->growableStack) {
+        ProbeStack();
+    }
+    if(from->fpState || to->fpState) {
+        SwitchFpState(from->fpState, to->fpState);
+    }
+}
+
+/**
+ * Invokes the platform's context switch routine. The inline part of switchTo() can't name the
+ * platform implementation, so it calls this instead; it compiles to a tail call.
+ */
+void Cothread::PlatformSwitch(CothreadImpl *from, CothreadImpl *to) noexcept {
+    PlatformImpl::Switch(static_cast<PlatformImpl *>(from), static_cast<PlatformImpl *>(to));
+}
+
+/**
+ * Switches to this cothread when the inline fast path in switchTo() can't: on the first switch on
+ * a kernel thread, when statistics are collected, or when either cothread has a growable stack,
+ * a context profile other than the minimal one, or runs on a shared stack.
+ *
+ * @param from Currently executing cothread, or `nullptr` if there isn't one yet
+ */
+COTHREAD_NOINLINE void Cothread::switchToSlow(Cothread *from) noexcept {
+    if(!from) {
+        from = AllocKernelThreadCothread();
+    }
+
+#ifdef LIBCOMMUNISM_STATS
+    const auto now = ReadTimestamp();
+    from->stats.switchedOut(now);
+    this->stats.switchedIn(now);
+#endif
+
+    if(from->growableStack || from->fpState || this->fpState) {
+        PrepareSwitch(from, this);
+    }
+
     gCurrent = this;
-    this->impl->switchTo(from);
+    if(this->shared) {
+        SwitchShared(from, this, 0);
+        return;
+    }
+    PlatformImpl::Switch(static_cast<PlatformImpl *>(from->impl),
+            static_cast<PlatformImpl *>(this->impl));
+}
+
+uintptr_t Cothread::resumeWith(const uintptr_t value) noexcept {
+    auto from = gCurrent;
+    if(!from) [[unlikely]] {
+        from = AllocKernelThreadCothread();
+    }
+
+#ifdef LIBCOMMUNISM_STATS
+    const auto now = ReadTimestamp();
+    from->stats.switchedOut(now);
+    this->stats.switchedIn(now);
+#endif
+
+    this->resumer = from;
+    if(from->growableStack || from->fpState || this->fpState) [[unlikely]] {
+        PrepareSwitch(from, this);
+    }
+
+    gCurrent = this;
+    if(this->shared) [[unlikely]] {
+        return SwitchShared(from, this, value);
+    }
+    return PlatformImpl::Transfer(static_cast<PlatformImpl *>(from->impl),
+            static_cast<PlatformImpl *>(this->impl), value);
+}
+
+uintptr_t Cothread::YieldWith(const uintptr_t value) noexcept {
+    auto from = gCurrent;
+    if(!from || !from->resumer) [[unlikely]] {
+        std::cerr << "[libcommunism] Yield() from a cothread that wasn't resumed!" << std::endl;
+        std::terminate();
+    }
+
+    auto to = from->resumer;
+#ifdef LIBCOMMUNISM_STATS
+    const auto now = ReadTimestamp();
+    from->stats.yielded();
+    from->stats.switchedOut(now);
+    to->stats.switchedIn(now);
+#endif
+
+    if(from->growableStack || from->fpState || to->fpState) [[unlikely]] {
+        PrepareSwitch(from, to);
+    }
+
+    gCurrent = to;
+    if(to->shared) [[unlikely]] {
+        return SwitchShared(from, to, value);
+    }
+    return PlatformImpl::Transfer(static_cast<PlatformImpl *>(from->impl),
+            static_cast<PlatformImpl *>(to->impl), value);
 }
 
 void *Cothread::getStack() const {
@@ -148,3 +510,24 @@ void *Cothread::getStack() const {
 size_t Cothread::getStackSize() const {
     return this->impl->getStackSize();
 }
+
+/**
+ * Scans the stack from its low end (stacks grow down on all supported platforms) for the first
+ * word that was overwritten. Any context the platform code stores there isn't part of the stack,
+ * and neither is the part of a growable stack that it hasn't grown into.
+ */
+size_t Cothread::getStackHighWaterMark() const {
+    if(!this->stackPainted) {
+        return 0;
+    }
+
+    const auto context = std::max(this->impl->getContextSize(), this->getInaccessibleStackSize());
+    const auto words = reinterpret_cast<const uintptr_t *>(
+            static_cast<const std::byte *>(this->impl->getStack()) + context);
+    const auto numWords = (this->impl->getStackSize() - context) / sizeof(uintptr_t);
+
+    const auto used = std::find_if(words, words + numWords, [](const auto word) {
+        return word != kStackPaint;
+    });
+    return (words + numWords - used) * sizeof(uintptr_t);
+}
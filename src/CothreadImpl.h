@@ -1,6 +1,7 @@
 #ifndef LIBCOMMUNISM_COTHREADIMPL_H
 #define LIBCOMMUNISM_COTHREADIMPL_H
 
+#include <libcommunism/BasicCothread.h>
 #include <libcommunism/Cothread.h>
 
 #include <cstddef>
@@ -14,39 +15,51 @@ namespace libcommunism {
  * Each platform implementation derives from this base class, meaning that the cothread API that we
  * expose to callers is just a thin shim over an instance of this class. The concrete instances of
  * this class will end up holding the actual state of the cothread.
+ *
+ * Cothreads are created in two steps: first, the implementation is constructed with its stack;
+ * then the entry record is constructed at the high end of that stack, and the platform code is
+ * asked to prepare the cothread to invoke it. The stack available to the platform code thus ends
+ * at the entry record.
+ *
+ * Neither preparation nor context switching are part of this interface, to keep them off the
+ * virtual dispatch path. The platform implementation selected at compile time (see
+ * `PlatformImpl`) must instead provide the following static methods:
+ *
+ * - `Prepare(Impl *thread, internal::EntryRecord *entry)`: Sets up the context of the cothread
+ *   such that it invokes the entry record when first switched to. It may throw if the stack is
+ *   not suitable.
+ * - `Switch(Impl *from, Impl *to)`: Saves the current context into `from`, and restores the
+ *   context of `to`.
+ * - `Transfer(Impl *from, Impl *to, uintptr_t value)`: Performs a context switch as `Switch()`
+ *   does, but also passes a value to `to`: if it is suspended in `Transfer()`, that call returns
+ *   `value`. Platforms should carry the value in a register if possible.
+ * - `AllocKernelThread(std::span<uintptr_t> buffer, bool &bufferUsed)`: Allocates the
+ *   implementation for the cothread that represents the calling kernel thread, which holds its
+ *   state on entry to the first cothread, so it can be "resumed" later.
+ *
+ * Several platform implementations may be built into the library at once; besides the one used
+ * by `Cothread`, they're available through `BasicCothread`. They must thus not define any symbols
+ * outside of their class.
  */
 struct CothreadImpl {
-    using Entry = Cothread::Entry;
-
     /**
-     * Initialize a cothread that begins execution at the given entry point, allocating a stack
-     * for it.
+     * Initialize a cothread, allocating a stack for it.
      *
-     * @param entry Method to execute on entry to this cothread
      * @param stackSize Size of the stack to be allocated, in bytes. it should be a multiple of
      *        the machine word size, or specify zero to use the platform default.
+     * @param stackType Kind of memory to allocate for the stack
      */
-    CothreadImpl(const Cothread::Entry &entry, const size_t stackSize = 0) {
-        (void) entry, (void) stackSize;
+    CothreadImpl(const size_t stackSize = 0, const StackType stackType = StackType::Default) {
+        (void) stackSize, (void) stackType;
     }
 
     /**
-     * Initialize the implementation to start execution at the given point with an already
-     * allocated stack.
+     * Create a cothread that uses an already allocated stack. This is also used to create the
+     * "skeleton" cothread for a kernel thread, in which case the buffer only holds its context.
      *
      * @remark This method should not take ownership of the stack buffer; it's expected that the
      *         caller handles this, and ensures it's valid until the cothread is deallocated.
      *
-     * @param entry Method to execute on entry to this cothread
-     * @param stack Buffer to use as the stack of the cothread
-     */
-    CothreadImpl(const Cothread::Entry &entry, std::span<uintptr_t> stack) : stack(stack) {
-        (void) entry;
-    }
-
-    /**
-     * Create a "skeleton" cothread that has only an associated stack.
-     *
      * @param stack Buffer to use as the stack of the cothread
      */
     CothreadImpl(std::span<uintptr_t> stack) : stack(stack) {}
@@ -56,14 +69,6 @@ struct CothreadImpl {
      */
     virtual ~CothreadImpl() = default;
 
-    /**
-     * Perform a context switch to this cothread.
-     *
-     * The currently executing cothread's state is saved to its buffer, then this cothread's state
-     * is restored.
-     */
-    virtual void switchTo(CothreadImpl *from) = 0;
-
     /**
      * Get the stack size of this cothread
      *
@@ -83,21 +88,38 @@ struct CothreadImpl {
         return this->stack.data();
     }
 
+    /**
+     * Get the number of bytes at the top of the stack (its lowest address) that the platform code
+     * uses to store the cothread's context, rather than as stack.
+     *
+     * @return Size of the context region, in bytes
+     */
+    virtual size_t getContextSize() const {
+        return 0;
+    }
+
+    /**
+     * Get the stack pointer of the cothread, as saved when it was last switched away from. This
+     * is required for shared stacks: everything between it and the high end of the stack is
+     * copied out when another cothread runs on the shared stack.
+     *
+     * @return Saved stack pointer, or `nullptr` if the platform keeps its context elsewhere
+     */
+    virtual void *getStackPointer() const {
+        return nullptr;
+    }
+
+    /**
+     * Set by platform implementations that save all of a cothread's context on its stack, below
+     * the stack pointer returned by getStackPointer(), so its stack can be copied in and out of a
+     * shared stack.
+     */
+    static constexpr const bool kSupportsSharedStacks{false};
+
     protected:
         /// Stack used by this cothread, if any.
         std::span<uintptr_t> stack;
 };
-
-/**
- * Allocate the cothread implementation for the currently executing kernel thread.
- *
- * This is invoked when no cothread is running on the kernel thread, and is only used to hold the
- * state of the kernel thread on entry to the first cothread, so it can "resume" the kernel thread.
- *
- * @remark Only one definition of this method is allowed; it's typically provided by the platform
- *         code selected via build configuration.
- */
-CothreadImpl *AllocKernelThreadWrapper();
 }
 
 #endif
@@ -5,6 +5,20 @@
 
 #include <functional>
 
+/**
+ * Prevents a function from being inlined.
+ *
+ * A cothread may be suspended on one kernel thread and resumed on another; but compilers assume
+ * the address of a thread local variable never changes within a function, and will reuse an
+ * address computed before a context switch after it. Thread locals that are accessed once a
+ * context switch returns must therefore be accessed through a function marked with this.
+ */
+#if defined(_MSC_VER)
+#define COTHREAD_NOINLINE __declspec(noinline)
+#else
+#define COTHREAD_NOINLINE __attribute__((noinline))
+#endif
+
 /// Implementation details (including architecture/platform specific code) for the library
 namespace libcommunism::internal {
 extern std::function<void(libcommunism::Cothread *)> gReturnHandler;
@@ -0,0 +1,283 @@
+#include <libcommunism/Cothread.h>
+
+#include "FpState.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <utility>
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#define LIBCOMMUNISM_FPSTATE_XSAVE
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+using namespace libcommunism;
+using namespace libcommunism::internal;
+
+namespace {
+/**
+ * @brief Floating point state of a kernel thread
+ *
+ * Cothreads with the minimal context profile share this state. It's saved when switching from one
+ * of them to a cothread with a larger profile, and restored when switching back.
+ */
+struct AmbientState {
+    /// Storage for the saved state
+    std::unique_ptr<FpState> state;
+    /// Profile that the state was last saved with, or ContextProfile::Minimal if it never was
+    ContextProfile level{ContextProfile::Minimal};
+};
+
+#ifdef LIBCOMMUNISM_FPSTATE_XSAVE
+/**
+ * @brief Extended state support of the processor
+ */
+struct XsaveInfo {
+    /// Whether the processor (and operating system) support XSAVEOPT
+    bool supported{false};
+    /// Size of the XSAVE area for all state components enabled by the operating system, in bytes
+    size_t size{0};
+    /// State components to save
+    uint64_t mask{0};
+};
+
+/**
+ * Required alignment of XSAVE areas
+ */
+constexpr const size_t kXsaveAlignment{64};
+
+/**
+ * State components that are never saved: the protection key register (bit 9) is process-wide in
+ * spirit, and restoring a stale value would undo pkey_set() calls made from another cothread; and
+ * the AMX tile configuration and data (bits 17 and 18) are large, and must be enabled per thread.
+ */
+constexpr const uint64_t kXsaveExcludedMask{(1ULL << 9) | (1ULL << 17) | (1ULL << 18)};
+#endif
+}
+
+/**
+ * Floating point state of the calling kernel thread
+ */
+static thread_local AmbientState gAmbient;
+
+#ifdef LIBCOMMUNISM_FPSTATE_XSAVE
+__attribute__((target("xsave")))
+static uint64_t ReadXcr0() {
+    return _xgetbv(0);
+}
+
+/**
+ * Determines whether XSAVEOPT can be used, and how large the save area is. This requires the
+ * operating system to have enabled XSAVE (CPUID leaf 1, ECX bit 27) and the processor to implement
+ * XSAVEOPT (leaf 0xD, subleaf 1, EAX bit 0).
+ */
+static const XsaveInfo &GetXsaveInfo() {
+    static const XsaveInfo gInfo = []() {
+        XsaveInfo info;
+        unsigned int eax, ebx, ecx, edx;
+
+        if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_OSXSAVE)) {
+            return info;
+        }
+        if(!__get_cpuid_count(0xD, 1, &eax, &ebx, &ecx, &edx) || !(eax & bit_XSAVEOPT)) {
+            return info;
+        }
+        if(!__get_cpuid_count(0xD, 0, &eax, &ebx, &ecx, &edx) || !ebx) {
+            return info;
+        }
+
+        info.supported = true;
+        info.size = ebx;
+        info.mask = ReadXcr0() & ~kXsaveExcludedMask;
+        return info;
+    }();
+    return gInfo;
+}
+
+__attribute__((target("xsave,xsaveopt")))
+static void SaveExtended(void *area, const uint64_t mask) noexcept {
+    _xsaveopt64(area, mask);
+}
+
+/**
+ * Restores the extended state. This clobbers all vector registers, so it's not inlined; the
+ * compiler assumes that the caller-saved ones are clobbered by any call anyway.
+ */
+__attribute__((target("xsave"), noinline))
+static void RestoreExtended(const void *area, const uint64_t mask) noexcept {
+    _xrstor64(const_cast<void *>(area), mask);
+}
+#endif
+
+
+
+/**
+ * Determines the profile that's actually used in place of the given one, which is smaller if the
+ * processor doesn't support saving the state it calls for.
+ */
+ContextProfile FpState::GetSupportedProfile(const ContextProfile profile) {
+#ifdef LIBCOMMUNISM_FPSTATE_XSAVE
+    if(profile == ContextProfile::Full && !GetXsaveInfo().supported) {
+        return ContextProfile::FpControl;
+    }
+    return profile;
+#else
+    return (profile == ContextProfile::Full) ? ContextProfile::FpControl : profile;
+#endif
+}
+
+/**
+ * Allocates storage for the state of the given profile. For the full profile, the XSAVE area is
+ * zeroed, since the restore instruction checks that its reserved header fields are zero.
+ */
+FpState::FpState(const ContextProfile profile) : profile(GetSupportedProfile(profile)) {
+#ifdef LIBCOMMUNISM_FPSTATE_XSAVE
+    if(this->profile == ContextProfile::Full) {
+        const auto &info = GetXsaveInfo();
+
+        this->extended = ::operator new(info.size, std::align_val_t{kXsaveAlignment});
+        std::memset(this->extended, 0, info.size);
+        this->extendedMask = info.mask;
+    }
+#endif
+}
+
+FpState::~FpState() {
+#ifdef LIBCOMMUNISM_FPSTATE_XSAVE
+    if(this->extended) {
+        ::operator delete(this->extended, std::align_val_t{kXsaveAlignment});
+    }
+#endif
+}
+
+/**
+ * Saves the floating point state of the calling kernel thread.
+ *
+ * @param level Profile to save the state for; if it's larger than that of this object, only the
+ *        state for this object's profile is saved.
+ */
+void FpState::save(const ContextProfile level) noexcept {
+#if defined(__x86_64__)
+#ifdef LIBCOMMUNISM_FPSTATE_XSAVE
+    if(level == ContextProfile::Full && this->extended) {
+        SaveExtended(this->extended, this->extendedMask);
+        return;
+    }
+#endif
+    asm volatile("stmxcsr %0" : "=m"(this->mxcsr));
+    asm volatile("fnstcw %0" : "=m"(this->fpcw));
+#else
+    static_cast<void>(level);
+    std::fegetenv(&this->env);
+#endif
+}
+
+/**
+ * Restores floating point state previously saved with save(), for the same profile.
+ */
+void FpState::restore(const ContextProfile level) noexcept {
+#if defined(__x86_64__)
+#ifdef LIBCOMMUNISM_FPSTATE_XSAVE
+    if(level == ContextProfile::Full && this->extended) {
+        RestoreExtended(this->extended, this->extendedMask);
+        return;
+    }
+#endif
+    asm volatile("ldmxcsr %0" :: "m"(this->mxcsr));
+    asm volatile("fldcw %0" :: "m"(this->fpcw));
+#else
+    static_cast<void>(level);
+    std::fesetenv(&this->env);
+#endif
+}
+
+
+
+/**
+ * Ensures the calling kernel thread has storage for the state shared by cothreads with the minimal
+ * profile. It's always large enough for the full profile, so it never has to be reallocated (and
+ * the state saved in it discarded) once a cothread with a larger profile shows up.
+ *
+ * @throw std::bad_alloc If memory for the state couldn't be allocated
+ */
+static FpState &ReserveAmbientFpState() {
+    auto &ambient = gAmbient;
+    if(!ambient.state) [[unlikely]] {
+        ambient.state = std::make_unique<FpState>(ContextProfile::Full);
+    }
+    return *ambient.state;
+}
+
+/**
+ * Saves the floating point state of the calling kernel thread as the state shared by cothreads
+ * with the minimal profile.
+ *
+ * @param level Profile to save the state for
+ *
+ * @throw std::bad_alloc If memory for the state couldn't be allocated
+ */
+static void SaveAmbientFpState(const ContextProfile level) {
+    ReserveAmbientFpState().save(level);
+    gAmbient.level = level;
+}
+
+/**
+ * Switches the floating point state from that of one cothread to another, either of which has
+ * a context profile other than the minimal one. A cothread with the minimal profile takes its
+ * state from (and leaves it to) the kernel thread's shared state.
+ *
+ * @param from State of the cothread being switched away from, or `nullptr` for the minimal profile
+ * @param to State of the cothread being switched to, or `nullptr` for the minimal profile
+ */
+void internal::SwitchFpState(FpState *from, FpState *to) noexcept {
+    if(from) {
+        from->save(from->profile);
+    } else {
+        // memory is usually allocated by setContextProfile(); unless a cothread was migrated here
+        try {
+            SaveAmbientFpState(to->profile);
+        } catch(const std::bad_alloc &) {
+            gAmbient.level = ContextProfile::Minimal;
+        }
+    }
+
+    if(to) {
+        to->restore(to->profile);
+    } else if(gAmbient.level != ContextProfile::Minimal) {
+        gAmbient.state->restore(gAmbient.level);
+    }
+}
+
+
+
+ContextProfile Cothread::getContextProfile() const {
+    return this->fpState ? this->fpState->profile : ContextProfile::Minimal;
+}
+
+/**
+ * Allocates storage for the new profile's state, and fills it with the current state; storage for
+ * the calling kernel thread's shared state is allocated as well, so that switching to the cothread
+ * doesn't have to. If this is the current cothread, and it previously used the minimal profile,
+ * the current state is also what the kernel thread's other cothreads share, so it's saved as such.
+ */
+void Cothread::setContextProfile(const ContextProfile profile) {
+    if(profile == ContextProfile::Minimal) {
+        delete std::exchange(this->fpState, nullptr);
+        return;
+    }
+
+    auto state = std::make_unique<FpState>(profile);
+    state->save(state->profile);
+
+    if(!this->fpState && gCurrent == this) {
+        SaveAmbientFpState(state->profile);
+    } else {
+        ReserveAmbientFpState();
+    }
+
+    delete std::exchange(this->fpState, state.release());
+}
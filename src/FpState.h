@@ -0,0 +1,53 @@
+#ifndef FPSTATE_H
+#define FPSTATE_H
+
+#include <libcommunism/Cothread.h>
+
+#include <cstdint>
+
+#if !defined(__x86_64__)
+#include <cfenv>
+#endif
+
+namespace libcommunism::internal {
+/**
+ * @brief Floating point state saved with the context of a cothread
+ *
+ * It holds the state for the profile it was created with; the state for any smaller profile can
+ * be saved and restored as well.
+ */
+struct FpState {
+    explicit FpState(const ContextProfile profile);
+    ~FpState();
+
+    FpState(const FpState &) = delete;
+    FpState &operator=(const FpState &) = delete;
+
+    static ContextProfile GetSupportedProfile(const ContextProfile profile);
+
+    void save(const ContextProfile level) noexcept;
+    void restore(const ContextProfile level) noexcept;
+
+    /// Largest profile whose state can be held; never ContextProfile::Minimal
+    ContextProfile profile;
+
+#if defined(__x86_64__)
+    /// SSE control and status register
+    uint32_t mxcsr{0};
+    /// x87 FPU control word
+    uint16_t fpcw{0};
+#else
+    /// Floating point environment
+    std::fenv_t env{};
+#endif
+
+    /// XSAVE area that holds the full extended state, if the profile is ContextProfile::Full
+    void *extended{nullptr};
+    /// State components saved in the XSAVE area
+    uint64_t extendedMask{0};
+};
+
+void SwitchFpState(FpState *from, FpState *to) noexcept;
+}
+
+#endif
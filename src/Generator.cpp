@@ -0,0 +1,106 @@
+#include <libcommunism/Generator.h>
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+using namespace libcommunism;
+using namespace libcommunism::internal;
+
+namespace {
+/**
+ * @brief Cothread that's waiting for the body of a generator to execute
+ */
+struct IdleGeneratorThread {
+    /// Stack size the cothread was requested with
+    size_t stackSize;
+    /// Cothread, suspended at the start of its loop
+    std::unique_ptr<Cothread> thread;
+};
+
+/**
+ * Maximum number of idle generator cothreads kept per kernel thread
+ */
+constexpr const size_t kMaxIdleGeneratorThreads{16};
+}
+
+/**
+ * Generator cothreads of the calling kernel thread whose bodies returned, most recently released
+ * last. They're destroyed along with the kernel thread.
+ */
+static thread_local std::vector<IdleGeneratorThread> gIdleThreads;
+
+/**
+ * Entry point of generator cothreads: it yields to signal that it's ready for a body, which is
+ * passed to it by the next resume; and once the body returns, yields a null value to the consumer
+ * to indicate that it's done, which also readies it for the next one. Nothing is left on the
+ * stack across bodies, so destroying the cothread while it's waiting doesn't need to unwind it.
+ */
+static void GeneratorMain() {
+    while(true) {
+        const auto body = Cothread::Yield<GeneratorBody *, void *>(nullptr);
+        body->run();
+    }
+}
+
+/**
+ * Invokes the body's callable. An exception escaping from it is recorded, so that it can be
+ * rethrown in the consumer; the one that terminates the generator is not.
+ */
+void GeneratorBody::run() noexcept {
+    try {
+        this->invoke();
+    } catch(const GeneratorExit &) {
+        // the generator is being destroyed
+    } catch(...) {
+        this->exception = std::current_exception();
+    }
+}
+
+/**
+ * Gets a cothread to execute the body of a generator on: the most recently released idle cothread
+ * with the same stack size, if any; otherwise, a new one is allocated and started, so that it's
+ * waiting for a body.
+ *
+ * @param stackSize Size of the cothread's stack, in bytes; or zero to use the platform default
+ *
+ * @throw std::runtime_error If the cothread could not be allocated
+ */
+std::unique_ptr<Cothread> internal::AcquireGeneratorThread(const size_t stackSize) {
+    auto &idle = gIdleThreads;
+    for(auto it = idle.rbegin(); it != idle.rend(); ++it) {
+        if(it->stackSize == stackSize) {
+            auto thread = std::move(it->thread);
+            idle.erase(std::next(it).base());
+            return thread;
+        }
+    }
+
+    auto thread = std::make_unique<Cothread>(stackSize, &GeneratorMain);
+    thread->setLabel("generator");
+    thread->resume();
+    return thread;
+}
+
+/**
+ * Puts the cothread of a generator whose body returned back into the cache of idle cothreads. If
+ * the cache is full, the cothread is destroyed instead.
+ *
+ * @param thread Cothread that's waiting for a body
+ * @param stackSize Stack size the cothread was acquired with
+ */
+void internal::ReleaseGeneratorThread(std::unique_ptr<Cothread> thread,
+        const size_t stackSize) noexcept {
+    auto &idle = gIdleThreads;
+    if(idle.size() >= kMaxIdleGeneratorThreads) {
+        return;
+    }
+
+    try {
+        idle.push_back({stackSize, std::move(thread)});
+    } catch(const std::bad_alloc &) {
+        // the cothread was moved into the entry, and is destroyed along with it
+    }
+}
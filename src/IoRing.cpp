@@ -0,0 +1,324 @@
+#include <libcommunism/IoRing.h>
+#include <libcommunism/Scheduler.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+
+#include <unistd.h>
+
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+using namespace libcommunism;
+
+#ifdef HAVE_IO_URING
+/**
+ * Reads a ring index that's written by the kernel.
+ */
+static inline uint32_t LoadAcquire(uint32_t *ptr) {
+    return std::atomic_ref<uint32_t>(*ptr).load(std::memory_order_acquire);
+}
+
+/**
+ * Publishes a ring index to the kernel.
+ */
+static inline void StoreRelease(uint32_t *ptr, const uint32_t value) {
+    std::atomic_ref<uint32_t>(*ptr).store(value, std::memory_order_release);
+}
+
+/**
+ * Gets a pointer at the given byte offset into a ring mapping.
+ */
+template<class T>
+static inline T *RingOffset(void *base, const size_t offset) {
+    return reinterpret_cast<T *>(reinterpret_cast<std::byte *>(base) + offset);
+}
+#endif
+
+IoRing::IoRing(const size_t entries, const bool forceFallback) {
+#ifdef HAVE_IO_URING
+    if(forceFallback) {
+        return;
+    }
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    // if io_uring is unavailable (not supported, or forbidden) use the fallback
+    const int fd = syscall(__NR_io_uring_setup, static_cast<unsigned int>(entries), &params);
+    if(fd == -1) {
+        return;
+    }
+
+    // map the submission and completion rings, which may share a single mapping
+    this->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    this->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        this->sqRingSize = this->cqRingSize = std::max(this->sqRingSize, this->cqRingSize);
+    }
+
+    this->sqRing = mmap(nullptr, this->sqRingSize, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if(this->sqRing == MAP_FAILED) {
+        const auto err = errno;
+        ::close(fd);
+        throw std::system_error(err, std::generic_category(), "mmap sq ring");
+    }
+
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        this->cqRing = this->sqRing;
+    } else {
+        this->cqRing = mmap(nullptr, this->cqRingSize, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if(this->cqRing == MAP_FAILED) {
+            const auto err = errno;
+            munmap(this->sqRing, this->sqRingSize);
+            ::close(fd);
+            throw std::system_error(err, std::generic_category(), "mmap cq ring");
+        }
+    }
+
+    this->numSqes = params.sq_entries;
+    auto sqes = mmap(nullptr, this->numSqes * sizeof(struct io_uring_sqe),
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if(sqes == MAP_FAILED) {
+        const auto err = errno;
+        if(this->cqRing != this->sqRing) {
+            munmap(this->cqRing, this->cqRingSize);
+        }
+        munmap(this->sqRing, this->sqRingSize);
+        ::close(fd);
+        throw std::system_error(err, std::generic_category(), "mmap sqes");
+    }
+    this->sqes = reinterpret_cast<struct io_uring_sqe *>(sqes);
+
+    this->sqHead = RingOffset<uint32_t>(this->sqRing, params.sq_off.head);
+    this->sqTail = RingOffset<uint32_t>(this->sqRing, params.sq_off.tail);
+    this->sqMask = *RingOffset<uint32_t>(this->sqRing, params.sq_off.ring_mask);
+    this->sqArray = RingOffset<uint32_t>(this->sqRing, params.sq_off.array);
+
+    this->cqHead = RingOffset<uint32_t>(this->cqRing, params.cq_off.head);
+    this->cqTail = RingOffset<uint32_t>(this->cqRing, params.cq_off.tail);
+    this->cqMask = *RingOffset<uint32_t>(this->cqRing, params.cq_off.ring_mask);
+    this->cqes = RingOffset<struct io_uring_cqe>(this->cqRing, params.cq_off.cqes);
+
+    this->ringFd = fd;
+#else
+    (void) entries;
+    (void) forceFallback;
+#endif
+}
+
+IoRing::~IoRing() {
+#ifdef HAVE_IO_URING
+    if(this->isFallback()) {
+        return;
+    }
+
+    munmap(this->sqes, this->numSqes * sizeof(struct io_uring_sqe));
+    if(this->cqRing != this->sqRing) {
+        munmap(this->cqRing, this->cqRingSize);
+    }
+    munmap(this->sqRing, this->sqRingSize);
+    ::close(this->ringFd);
+#endif
+}
+
+ssize_t IoRing::read(const int fd, void *buf, const size_t count, const off_t offset) {
+    this->numOperations++;
+
+#ifdef HAVE_IO_URING
+    if(!this->isFallback() && !Cothread::Current()->isOnSharedStack()) {
+        auto sqe = this->getSqe();
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = fd;
+        sqe->addr = reinterpret_cast<uintptr_t>(buf);
+        sqe->len = static_cast<uint32_t>(std::min<size_t>(count, UINT32_MAX));
+        sqe->off = static_cast<uint64_t>(offset);
+
+        Request request;
+        sqe->user_data = reinterpret_cast<uintptr_t>(&request);
+        return this->execute(request);
+    }
+#endif
+
+    this->numSyscalls++;
+    return (offset == -1) ? ::read(fd, buf, count) : ::pread(fd, buf, count, offset);
+}
+
+ssize_t IoRing::write(const int fd, const void *buf, const size_t count, const off_t offset) {
+    this->numOperations++;
+
+#ifdef HAVE_IO_URING
+    if(!this->isFallback() && !Cothread::Current()->isOnSharedStack()) {
+        auto sqe = this->getSqe();
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->fd = fd;
+        sqe->addr = reinterpret_cast<uintptr_t>(buf);
+        sqe->len = static_cast<uint32_t>(std::min<size_t>(count, UINT32_MAX));
+        sqe->off = static_cast<uint64_t>(offset);
+
+        Request request;
+        sqe->user_data = reinterpret_cast<uintptr_t>(&request);
+        return this->execute(request);
+    }
+#endif
+
+    this->numSyscalls++;
+    return (offset == -1) ? ::write(fd, buf, count) : ::pwrite(fd, buf, count, offset);
+}
+
+/**
+ * Waits for a queued operation to complete. Cothreads spawned through the scheduler park until
+ * the ring resumes them; anything else submits the operation and waits for it right away.
+ *
+ * @param request Request whose submission queue entry was just filled
+ *
+ * @return Result of the operation, converted to system call conventions
+ */
+ssize_t IoRing::execute(Request &request) {
+    WaitQueue::Prepare(request);
+
+    if(request.mode == WaitQueue::Waiter::Mode::Scheduler) {
+        while(!request.woken.load(std::memory_order_relaxed)) {
+            Scheduler::Park();
+        }
+    } else {
+        while(!request.woken.load(std::memory_order_relaxed)) {
+            this->submit(true);
+        }
+    }
+
+    if(request.result < 0) {
+        errno = -request.result;
+        return -1;
+    }
+    return request.result;
+}
+
+size_t IoRing::submit(const bool wait) {
+#ifdef HAVE_IO_URING
+    if(this->isFallback()) {
+        return 0;
+    }
+
+    auto completed = this->reap();
+
+    const bool block = wait && !completed && this->getNumPending();
+    if(this->numQueued || block) {
+        this->enter(this->numQueued, block ? 1 : 0, block ? IORING_ENTER_GETEVENTS : 0);
+        completed += this->reap();
+    }
+
+    return completed;
+#else
+    (void) wait;
+    return 0;
+#endif
+}
+
+size_t IoRing::run() {
+    if(this->isFallback()) {
+        return Scheduler::Run();
+    }
+
+    /*
+     * This cothread goes to the back of the run queue every time it submits, so that all runnable
+     * cothreads get to queue their operations first. It only blocks when nothing else could run.
+     */
+    Scheduler::Spawn([this]() {
+        while(true) {
+            const bool idle = !Scheduler::HasRunnable();
+            if(idle && !this->getNumPending()) {
+                break;
+            }
+
+            this->submit(idle);
+            Scheduler::Yield();
+        }
+    });
+
+    return Scheduler::Run();
+}
+
+#ifdef HAVE_IO_URING
+/**
+ * Gets the next free submission queue entry, and marks it as queued. If the submission ring is
+ * full, the queued operations are submitted first.
+ */
+struct io_uring_sqe *IoRing::getSqe() {
+    while(*this->sqTail - LoadAcquire(this->sqHead) == this->numSqes) {
+        this->submit(false);
+    }
+
+    const auto tail = *this->sqTail;
+    const auto index = tail & this->sqMask;
+
+    auto sqe = &this->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+
+    this->sqArray[index] = index;
+    StoreRelease(this->sqTail, tail + 1);
+    this->numQueued++;
+
+    return sqe;
+}
+
+/**
+ * Submits queued operations, and optionally waits for completions.
+ *
+ * @return Number of operations submitted
+ *
+ * @throw std::system_error If the system call failed for a reason other than being interrupted,
+ *        or the completion ring being full.
+ */
+int IoRing::enter(const unsigned int toSubmit, const unsigned int minComplete,
+        const unsigned int flags) {
+    this->numSyscalls++;
+
+    const int ret = syscall(__NR_io_uring_enter, this->ringFd, toSubmit, minComplete, flags,
+            nullptr, 0);
+    if(ret == -1) {
+        if(errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+            return 0;
+        }
+        throw std::system_error(errno, std::generic_category(), "io_uring_enter");
+    }
+
+    this->numQueued -= ret;
+    this->numInFlight += ret;
+    return ret;
+}
+
+/**
+ * Processes all posted completions, and wakes the cothreads that are waiting for them.
+ *
+ * @return Number of completions processed
+ */
+size_t IoRing::reap() {
+    auto head = *this->cqHead;
+    const auto tail = LoadAcquire(this->cqTail);
+    if(head == tail) {
+        return 0;
+    }
+
+    size_t completed{0};
+    for(; head != tail; head++, completed++) {
+        const auto &cqe = this->cqes[head & this->cqMask];
+        auto request = reinterpret_cast<Request *>(cqe.user_data);
+
+        request->result = cqe.res;
+        WaitQueue::Wake(request);
+    }
+
+    StoreRelease(this->cqHead, head);
+    this->numInFlight -= completed;
+    return completed;
+}
+#endif
@@ -0,0 +1,170 @@
+#include <libcommunism/Cothread.h>
+#include <libcommunism/PerfCounters.h>
+
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+
+#ifdef HAVE_PERF_EVENT
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace libcommunism;
+
+#ifdef HAVE_PERF_EVENT
+/**
+ * Describes the event to count for each counter, as its `perf_event_attr` type and config.
+ */
+static constexpr const std::array<std::pair<uint32_t, uint64_t>, PerfCounters::kNumCounters>
+        kEvents{{
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+        | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+        | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+}};
+
+/**
+ * Layout of the data read from a counter group, with `PERF_FORMAT_GROUP` and both time fields.
+ */
+struct GroupReadFormat {
+    uint64_t nr;
+    uint64_t timeEnabled;
+    uint64_t timeRunning;
+    uint64_t values[PerfCounters::kNumCounters];
+};
+#endif
+
+/**
+ * Opens each counter; the first one that can be opened becomes the group leader, and all others
+ * are added to its group, so they are started, stopped and read together.
+ */
+PerfCounters::PerfCounters() {
+    this->fds.fill(-1);
+
+#ifdef HAVE_PERF_EVENT
+    for(size_t i = 0; i < kNumCounters; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+
+        attr.size = sizeof(attr);
+        attr.type = kEvents[i].first;
+        attr.config = kEvents[i].second;
+        attr.disabled = (this->leaderFd == -1);
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED
+            | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        const int fd = syscall(__NR_perf_event_open, &attr, 0, -1, this->leaderFd,
+                PERF_FLAG_FD_CLOEXEC);
+        if(fd == -1) {
+            continue;
+        }
+
+        if(this->leaderFd == -1) {
+            this->leaderFd = fd;
+        }
+        this->fds[i] = fd;
+        this->readIndex[i] = this->numOpen++;
+    }
+#endif
+}
+
+PerfCounters::~PerfCounters() {
+#ifdef HAVE_PERF_EVENT
+    for(const auto fd : this->fds) {
+        if(fd != -1) {
+            ::close(fd);
+        }
+    }
+#endif
+}
+
+void PerfCounters::start() {
+#ifdef HAVE_PERF_EVENT
+    if(!this->isSupported()) {
+        return;
+    }
+
+    if(ioctl(this->leaderFd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP) == -1) {
+        throw std::system_error(errno, std::generic_category(), "PERF_EVENT_IOC_ENABLE");
+    }
+#endif
+}
+
+void PerfCounters::stop() {
+#ifdef HAVE_PERF_EVENT
+    if(!this->isSupported()) {
+        return;
+    }
+
+    if(ioctl(this->leaderFd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP) == -1) {
+        throw std::system_error(errno, std::generic_category(), "PERF_EVENT_IOC_DISABLE");
+    }
+#endif
+}
+
+/**
+ * Reads the entire group from its leader, then scales the values if the group was multiplexed
+ * with other events.
+ */
+PerfCounters::Sample PerfCounters::read() const {
+    Sample sample;
+
+#ifdef HAVE_PERF_EVENT
+    if(!this->isSupported()) {
+        return sample;
+    }
+
+    GroupReadFormat data;
+    if(::read(this->leaderFd, &data, sizeof(data)) == -1) {
+        throw std::system_error(errno, std::generic_category(), "read perf counters");
+    }
+
+    for(size_t i = 0; i < kNumCounters; i++) {
+        if(this->fds[i] == -1 || this->readIndex[i] >= data.nr) {
+            continue;
+        }
+
+        auto value = data.values[this->readIndex[i]];
+        if(data.timeRunning && data.timeRunning < data.timeEnabled) {
+            value = static_cast<uint64_t>(static_cast<double>(value) * data.timeEnabled
+                    / data.timeRunning);
+        }
+        sample.values[i] = value;
+    }
+#endif
+
+    return sample;
+}
+
+PerfCounters::Sample PerfCounters::measureSlice(Cothread *thread) {
+    const auto before = this->read();
+    thread->switchTo();
+    return this->read() - before;
+}
+
+const char *PerfCounters::GetName(const Counter counter) {
+    switch(counter) {
+        case Counter::Cycles:
+            return "cycles";
+        case Counter::Instructions:
+            return "instructions";
+        case Counter::BranchMisses:
+            return "branch_misses";
+        case Counter::L1dMisses:
+            return "l1d_misses";
+        case Counter::LlcMisses:
+            return "llc_misses";
+        case Counter::TaskClock:
+            return "task_clock";
+    }
+    return "unknown";
+}
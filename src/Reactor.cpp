@@ -0,0 +1,252 @@
+#include <libcommunism/Reactor.h>
+#include <libcommunism/Scheduler.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <stdexcept>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+using namespace libcommunism;
+
+/**
+ * Events any registered descriptor is interested in. Since they're edge triggered, descriptors
+ * never need to be re-armed, even though they're always registered for reading and writing.
+ */
+constexpr static const uint32_t kEvents{EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET};
+
+/**
+ * Checks whether an operation failed because it would have blocked.
+ */
+static inline bool WouldBlock(const int err) {
+    return err == EAGAIN || err == EWOULDBLOCK;
+}
+
+Reactor::Reactor() {
+    this->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if(this->epollFd == -1) {
+        throw std::system_error(errno, std::generic_category(), "epoll_create1");
+    }
+}
+
+Reactor::~Reactor() {
+    ::close(this->epollFd);
+}
+
+void Reactor::add(const int fd) {
+    const auto flags = fcntl(fd, F_GETFL);
+    if(flags == -1) {
+        throw std::system_error(errno, std::generic_category(), "fcntl");
+    } else if(!(flags & O_NONBLOCK) && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        throw std::system_error(errno, std::generic_category(), "fcntl");
+    }
+
+    std::lock_guard<std::mutex> lg(this->lock);
+    if(this->descriptors.contains(fd)) {
+        throw std::runtime_error("File descriptor is already registered");
+    }
+
+    struct epoll_event event{};
+    event.events = kEvents;
+    event.data.fd = fd;
+
+    if(epoll_ctl(this->epollFd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        throw std::system_error(errno, std::generic_category(), "epoll_ctl");
+    }
+
+    this->descriptors.emplace(fd, std::make_unique<Descriptor>());
+}
+
+void Reactor::remove(const int fd) {
+    std::lock_guard<std::mutex> lg(this->lock);
+    auto it = this->descriptors.find(fd);
+    if(it == this->descriptors.end()) {
+        return;
+    }
+
+    // this fails if the descriptor was already closed, which removes it from the epoll instance
+    epoll_ctl(this->epollFd, EPOLL_CTL_DEL, fd, nullptr);
+
+    auto &desc = *it->second;
+    while(auto waiter = desc.readers.pop()) {
+        WaitQueue::Wake(waiter);
+    }
+    while(auto waiter = desc.writers.pop()) {
+        WaitQueue::Wake(waiter);
+    }
+
+    this->descriptors.erase(it);
+}
+
+/**
+ * Blocks until the descriptor is ready for reading or writing, unless it became ready since the
+ * last time a waiter checked. An operation that failed with `EAGAIN` can't miss the readiness
+ * event: it's edge triggered, so it will only be reported after that operation.
+ *
+ * @param fd Descriptor to wait on
+ * @param write Whether to wait for the descriptor to become writable, rather than readable
+ *
+ * @return Whether the descriptor may be ready; if it's not registered, `errno` is set.
+ */
+bool Reactor::wait(const int fd, const bool write) {
+    std::unique_lock<std::mutex> lock(this->lock);
+    auto it = this->descriptors.find(fd);
+    if(it == this->descriptors.end()) {
+        errno = EBADF;
+        return false;
+    }
+
+    auto &desc = *it->second;
+    auto &ready = write ? desc.writable : desc.readable;
+    if(ready) {
+        ready = false;
+        return true;
+    }
+
+    WaitQueue::Waiter waiter;
+    WaitQueue::Prepare(waiter);
+    waiter.local = true;
+    (write ? desc.writers : desc.readers).push(&waiter);
+
+    // the descriptor may be removed while we're blocked, so don't access it afterwards
+    this->numWaiting.fetch_add(1, std::memory_order_relaxed);
+    WaitQueue::Block(waiter, lock);
+    this->numWaiting.fetch_sub(1, std::memory_order_relaxed);
+
+    return true;
+}
+
+size_t Reactor::poll(const int timeout) {
+    struct epoll_event events[kMaxEvents];
+
+    const auto numEvents = epoll_wait(this->epollFd, events, kMaxEvents, timeout);
+    if(numEvents == -1) {
+        if(errno == EINTR) {
+            return 0;
+        }
+        throw std::system_error(errno, std::generic_category(), "epoll_wait");
+    }
+
+    size_t woken{0};
+    std::lock_guard<std::mutex> lg(this->lock);
+
+    for(int i = 0; i < numEvents; i++) {
+        const auto &event = events[i];
+
+        // the descriptor may have been removed since the event was retrieved
+        auto it = this->descriptors.find(event.data.fd);
+        if(it == this->descriptors.end()) {
+            continue;
+        }
+        auto &desc = *it->second;
+
+        if(event.events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+            desc.readable = true;
+            while(auto waiter = desc.readers.pop()) {
+                WaitQueue::Wake(waiter);
+                woken++;
+            }
+        }
+        if(event.events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) {
+            desc.writable = true;
+            while(auto waiter = desc.writers.pop()) {
+                WaitQueue::Wake(waiter);
+                woken++;
+            }
+        }
+    }
+
+    return woken;
+}
+
+size_t Reactor::run() {
+    while(true) {
+        const auto numLeft = Scheduler::Run();
+        if(!numLeft || !this->getNumWaiting()) {
+            return numLeft;
+        }
+        this->poll();
+    }
+}
+
+ssize_t Reactor::read(const int fd, void *buf, const size_t count) {
+    while(true) {
+        const auto ret = ::read(fd, buf, count);
+        if(ret != -1) {
+            return ret;
+        } else if(errno == EINTR) {
+            continue;
+        } else if(!WouldBlock(errno) || !this->waitReadable(fd)) {
+            return -1;
+        }
+    }
+}
+
+ssize_t Reactor::write(const int fd, const void *buf, const size_t count) {
+    while(true) {
+        const auto ret = ::write(fd, buf, count);
+        if(ret != -1) {
+            return ret;
+        } else if(errno == EINTR) {
+            continue;
+        } else if(!WouldBlock(errno) || !this->waitWritable(fd)) {
+            return -1;
+        }
+    }
+}
+
+int Reactor::accept(const int fd, struct sockaddr *addr, socklen_t *addrLen) {
+    while(true) {
+        const auto client = ::accept4(fd, addr, addrLen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(client != -1) {
+            try {
+                this->add(client);
+            } catch(const std::exception &) {
+                ::close(client);
+                throw;
+            }
+            return client;
+        } else if(errno == EINTR) {
+            continue;
+        } else if(!WouldBlock(errno) || !this->waitReadable(fd)) {
+            return -1;
+        }
+    }
+}
+
+int Reactor::connect(const int fd, const struct sockaddr *addr, const socklen_t addrLen) {
+    if(!::connect(fd, addr, addrLen)) {
+        return 0;
+    }
+    // if interrupted, the connection is still established asynchronously
+    else if(errno != EINPROGRESS && errno != EINTR) {
+        return -1;
+    }
+
+    // the socket may have been reported as writable before connecting, so check it's connected
+    while(true) {
+        if(!this->waitWritable(fd)) {
+            return -1;
+        }
+
+        int error{0};
+        socklen_t errorLen{sizeof(error)};
+        if(getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &errorLen) == -1) {
+            return -1;
+        } else if(error) {
+            errno = error;
+            return -1;
+        }
+
+        struct sockaddr_storage peer;
+        socklen_t peerLen{sizeof(peer)};
+        if(!getpeername(fd, reinterpret_cast<struct sockaddr *>(&peer), &peerLen)) {
+            return 0;
+        } else if(errno != ENOTCONN) {
+            return -1;
+        }
+    }
+}
@@ -0,0 +1,523 @@
+#include <libcommunism/Runtime.h>
+
+#include "ChaseLevDeque.h"
+#include "CothreadPrivate.h"
+#include "StackPoolPrivate.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+
+using namespace libcommunism;
+using namespace libcommunism::internal;
+
+namespace libcommunism::internal {
+/**
+ * @brief A worker kernel thread of an M:N runtime
+ *
+ * Workers execute cothreads from the native stack of their kernel thread. When a cothread yields,
+ * parks or exits, it records what it wants to happen in the worker and switches back to it; the
+ * worker then carries that out, now that the cothread's context has been saved. This way, a
+ * cothread never becomes visible to other workers while it's still executing.
+ */
+class RuntimeWorker {
+    public:
+        /// What the most recently executed cothread asked the worker to do with it
+        enum class Action: uint8_t {
+            /// Make it runnable again, after other runnable cothreads
+            Yield,
+            /// Suspend it until it's unparked
+            Park,
+            /// Deallocate it; its entry point returned
+            Exit,
+        };
+
+        RuntimeWorker(Runtime *runtime, const size_t index) : runtime(runtime), index(index),
+            rng(static_cast<uint32_t>(index) * 0x9E3779B9u + 1) {}
+
+        void start() {
+            this->thread = std::thread(&RuntimeWorker::main, this);
+        }
+        void join() {
+            if(this->thread.joinable()) {
+                this->thread.join();
+            }
+        }
+
+        void push(Cothread *thread) {
+            this->deque.push(thread);
+        }
+        bool hasWork() const {
+            return !this->deque.empty();
+        }
+        bool hasRunnable() const {
+            return this->hasWork() || this->deferredHead;
+        }
+
+        static RuntimeWorker *Current();
+
+    private:
+        void main();
+        Cothread *findWork();
+        Cothread *steal();
+        bool sleep();
+        void execute(Cothread *thread);
+        void park(Cothread *thread);
+        void flushDeferred();
+
+    public:
+        /// Runtime this worker belongs to
+        Runtime *runtime{nullptr};
+        /// Cothread representing the worker's kernel thread; cothreads switch back to it.
+        Cothread *home{nullptr};
+        /// Action requested by the cothread that just switched back to the worker
+        Action action{Action::Yield};
+
+    private:
+        /// Maximum number of cothreads stolen from another worker at once
+        constexpr static const size_t kMaxStealBatch{32};
+        /// Number of cothreads executed between checks of the injection queue
+        constexpr static const size_t kInjectInterval{61};
+        /// Number of rounds of looking for work before going to sleep
+        constexpr static const size_t kSpinRounds{16};
+
+        /// Index of the worker in the runtime
+        size_t index;
+        /// State of the random number generator used to pick a victim to steal from
+        uint32_t rng;
+        /// Number of cothreads executed
+        size_t ticks{0};
+
+        /// Runnable cothreads, which other workers may steal from
+        ChaseLevDeque<Cothread *> deque;
+
+        /**
+         * Cothreads that yielded. They're held back until the deque drained, so that yielding
+         * gives every other runnable cothread on this worker a chance to run first.
+         */
+        Cothread *deferredHead{nullptr}, *deferredTail{nullptr};
+
+        /// The worker's kernel thread
+        std::thread thread;
+
+        /// Worker that's executing on the calling kernel thread, if any
+        static thread_local RuntimeWorker *gCurrent;
+};
+}
+
+thread_local RuntimeWorker *RuntimeWorker::gCurrent{nullptr};
+
+/**
+ * Returns the worker of the calling kernel thread. Cothreads on the runtime may migrate between
+ * kernel threads, so this must not be inlined.
+ */
+COTHREAD_NOINLINE RuntimeWorker *RuntimeWorker::Current() {
+    return gCurrent;
+}
+
+/**
+ * Main loop of a worker thread: execute cothreads until the runtime shuts down.
+ */
+void RuntimeWorker::main() {
+    gCurrent = this;
+    InstallSignalStack();
+    this->home = Cothread::Current();
+
+    while(auto thread = this->findWork()) {
+        this->execute(thread);
+    }
+
+    gCurrent = nullptr;
+}
+
+/**
+ * Finds the next cothread to execute: first from the worker's own deque, then from its yielded
+ * cothreads, the injection queue and finally other workers. If there's no work anywhere, the
+ * worker goes to sleep until there is.
+ *
+ * @return Cothread to execute, or `nullptr` if the runtime is shutting down
+ */
+Cothread *RuntimeWorker::findWork() {
+    size_t rounds{0};
+
+    while(true) {
+        // check the injection queue every so often, so it can't be starved by local work
+        if(!(++this->ticks % kInjectInterval)) {
+            if(auto thread = this->runtime->takeInjected(this)) {
+                return thread;
+            }
+        }
+
+        if(auto thread = this->deque.pop()) {
+            return thread;
+        }
+        if(this->deferredHead) {
+            this->flushDeferred();
+            continue;
+        }
+        if(auto thread = this->runtime->takeInjected(this)) {
+            return thread;
+        }
+        if(auto thread = this->steal()) {
+            return thread;
+        }
+
+        if(++rounds < kSpinRounds) {
+            std::this_thread::yield();
+            continue;
+        }
+        rounds = 0;
+
+        if(!this->sleep()) {
+            return nullptr;
+        }
+    }
+}
+
+/**
+ * Attempts to steal a batch of cothreads from another worker, starting at a random one.
+ *
+ * @return First stolen cothread; any others were pushed to this worker's deque.
+ */
+Cothread *RuntimeWorker::steal() {
+    const auto &workers = this->runtime->workers;
+    const auto numWorkers = workers.size();
+    if(numWorkers < 2) {
+        return nullptr;
+    }
+
+    // xorshift32
+    this->rng ^= this->rng << 13;
+    this->rng ^= this->rng >> 17;
+    this->rng ^= this->rng << 5;
+
+    const auto start = this->rng % numWorkers;
+    for(size_t i = 0; i < numWorkers; i++) {
+        auto victim = workers[(start + i) % numWorkers].get();
+        if(victim == this) {
+            continue;
+        }
+
+        if(auto thread = victim->deque.stealBatch(this->deque, kMaxStealBatch)) {
+            // we got more than we can handle: get some help
+            if(!this->deque.empty()) {
+                this->runtime->notify();
+            }
+            return thread;
+        }
+    }
+
+    return nullptr;
+}
+
+/**
+ * Puts the worker to sleep until there may be work for it.
+ *
+ * @return Whether the worker should keep running
+ */
+bool RuntimeWorker::sleep() {
+    auto rt = this->runtime;
+    const auto epoch = rt->epoch.load(std::memory_order_acquire);
+    rt->numSleeping.fetch_add(1, std::memory_order_seq_cst);
+
+    // check again, in case work was submitted before the sleeper count was incremented
+    if(!rt->shutdown.load() && !rt->hasWork()) {
+        rt->epoch.wait(epoch, std::memory_order_acquire);
+    }
+
+    rt->numSleeping.fetch_sub(1, std::memory_order_relaxed);
+    return !rt->shutdown.load();
+}
+
+/**
+ * Executes a cothread until it switches back to the worker, then carries out the action it
+ * requested.
+ */
+void RuntimeWorker::execute(Cothread *thread) {
+    thread->hook.state.store(SchedulerHook::State::Idle, std::memory_order_relaxed);
+    this->action = Action::Yield;
+
+    thread->switchTo();
+
+    switch(this->action) {
+        case Action::Yield:
+            thread->hook.state.store(SchedulerHook::State::Runnable, std::memory_order_relaxed);
+            thread->hook.next = nullptr;
+            if(this->deferredTail) {
+                this->deferredTail->hook.next = thread;
+            } else {
+                this->deferredHead = thread;
+            }
+            this->deferredTail = thread;
+            break;
+        case Action::Park:
+            this->park(thread);
+            break;
+        case Action::Exit:
+            delete thread;
+            this->runtime->exited();
+            break;
+    }
+}
+
+/**
+ * Marks a cothread that requested to be parked as such. If it was unparked in the meantime, it's
+ * made runnable again immediately; the permit is left set, for the cothread to consume once it
+ * resumes.
+ */
+void RuntimeWorker::park(Cothread *thread) {
+    auto &hook = thread->hook;
+    hook.state.store(SchedulerHook::State::Parked, std::memory_order_seq_cst);
+
+    if(hook.permit.load(std::memory_order_seq_cst)) {
+        auto expected = SchedulerHook::State::Parked;
+        if(hook.state.compare_exchange_strong(expected, SchedulerHook::State::Runnable)) {
+            this->deque.push(thread);
+        }
+    }
+}
+
+/**
+ * Moves all cothreads that yielded to the deque, in the order they yielded.
+ */
+void RuntimeWorker::flushDeferred() {
+    size_t count{0};
+    for(auto thread = this->deferredHead; thread; count++) {
+        auto next = thread->hook.next;
+        this->deque.push(thread);
+        thread = next;
+    }
+    this->deferredHead = this->deferredTail = nullptr;
+
+    if(count > 1) {
+        this->runtime->notify();
+    }
+}
+
+
+
+Runtime::Runtime(const size_t numWorkers, const size_t stackSize) : stackSize(stackSize) {
+    auto count = numWorkers ? numWorkers : std::thread::hardware_concurrency();
+    count = std::max<size_t>(count, 1);
+
+    this->workers.reserve(count);
+    for(size_t i = 0; i < count; i++) {
+        this->workers.emplace_back(std::make_unique<RuntimeWorker>(this, i));
+    }
+
+    try {
+        for(auto &worker : this->workers) {
+            worker->start();
+        }
+    } catch(const std::system_error &e) {
+        this->shutdown = true;
+        this->epoch.fetch_add(1);
+        this->epoch.notify_all();
+        for(auto &worker : this->workers) {
+            worker->join();
+        }
+        throw std::runtime_error(std::string("Failed to start runtime workers: ") + e.what());
+    }
+}
+
+Runtime::~Runtime() {
+    this->wait();
+
+    this->shutdown = true;
+    this->epoch.fetch_add(1, std::memory_order_release);
+    this->epoch.notify_all();
+
+    for(auto &worker : this->workers) {
+        worker->join();
+    }
+}
+
+void Runtime::wait() {
+    auto live = this->numLive.load();
+    while(live) {
+        this->numLive.wait(live);
+        live = this->numLive.load();
+    }
+}
+
+/**
+ * Takes ownership of a newly spawned cothread and makes it runnable.
+ */
+void Runtime::adopt(Cothread *thread) {
+    thread->runtime = this;
+    this->numLive++;
+    this->submit(thread);
+}
+
+/**
+ * Makes a cothread runnable. If the caller is a worker of this runtime, it's pushed to its deque;
+ * otherwise, it's added to the injection queue.
+ */
+void Runtime::submit(Cothread *thread) {
+    auto worker = RuntimeWorker::Current();
+    if(worker && worker->runtime == this) {
+        thread->hook.state.store(SchedulerHook::State::Runnable, std::memory_order_relaxed);
+        worker->push(thread);
+    } else {
+        this->inject(thread);
+    }
+
+    this->notify();
+}
+
+/**
+ * Adds a cothread to the injection queue, from which workers take it the next time they look for
+ * work.
+ */
+void Runtime::inject(Cothread *thread) {
+    std::lock_guard<std::mutex> lg(this->injectLock);
+
+    thread->hook.state.store(SchedulerHook::State::Runnable, std::memory_order_relaxed);
+    thread->hook.next = nullptr;
+    if(this->injectTail) {
+        this->injectTail->hook.next = thread;
+    } else {
+        this->injectHead = thread;
+    }
+    this->injectTail = thread;
+
+    this->numInjected.fetch_add(1, std::memory_order_release);
+}
+
+/**
+ * Takes a fair share of the cothreads in the injection queue. The first one is returned, the rest
+ * are pushed to the worker's deque.
+ *
+ * @param worker Worker that's taking cothreads; it must be executing on the calling thread.
+ *
+ * @return Cothread to execute, or `nullptr` if the injection queue is empty
+ */
+Cothread *Runtime::takeInjected(RuntimeWorker *worker) {
+    if(!this->numInjected.load(std::memory_order_acquire)) {
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lg(this->injectLock);
+    const auto available = this->numInjected.load(std::memory_order_relaxed);
+    const auto count = std::min(available, (available / this->workers.size()) + 1);
+
+    Cothread *first{nullptr};
+    for(size_t i = 0; i < count && this->injectHead; i++) {
+        auto thread = this->injectHead;
+        this->injectHead = thread->hook.next;
+
+        if(!first) {
+            first = thread;
+        } else {
+            worker->push(thread);
+        }
+    }
+    if(!this->injectHead) {
+        this->injectTail = nullptr;
+    }
+
+    this->numInjected.fetch_sub(count, std::memory_order_relaxed);
+    return first;
+}
+
+/**
+ * Checks whether any worker has work that may be stolen, or there are injected cothreads.
+ */
+bool Runtime::hasWork() const {
+    if(this->numInjected.load()) {
+        return true;
+    }
+    return std::any_of(this->workers.begin(), this->workers.end(), [](const auto &worker) {
+        return worker->hasWork();
+    });
+}
+
+/**
+ * Wakes up a sleeping worker, if there is one, since new work was made available.
+ */
+void Runtime::notify() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(this->numSleeping.load(std::memory_order_relaxed)) {
+        this->epoch.fetch_add(1, std::memory_order_release);
+        this->epoch.notify_one();
+    }
+}
+
+/**
+ * A cothread on the runtime exited; it has been deallocated already.
+ */
+void Runtime::exited() {
+    if(this->numLive.fetch_sub(1) == 1) {
+        this->numLive.notify_all();
+    }
+}
+
+Runtime *Runtime::Current() {
+    auto worker = RuntimeWorker::Current();
+    return worker ? worker->runtime : nullptr;
+}
+
+void Runtime::Yield() noexcept {
+    auto worker = RuntimeWorker::Current();
+    if(!worker->hasRunnable() && !worker->runtime->numInjected.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+#ifdef LIBCOMMUNISM_STATS
+    Cothread::Current()->stats.yielded();
+#endif
+
+    worker->action = RuntimeWorker::Action::Yield;
+    worker->home->switchTo();
+}
+
+void Runtime::Park() noexcept {
+    auto thread = Cothread::Current();
+    if(thread->hook.permit.exchange(false)) {
+        return;
+    }
+
+    auto worker = RuntimeWorker::Current();
+    worker->action = RuntimeWorker::Action::Park;
+    worker->home->switchTo();
+
+    /*
+     * Consume the permit of the unpark that woke us up. Only the parked cothread ever clears it:
+     * an unpark racing with this one either sets it before this exchange (and its wakeup is
+     * covered by the caller checking its condition again) or after, in which case the next park
+     * returns immediately.
+     */
+    thread->hook.permit.exchange(false, std::memory_order_acq_rel);
+}
+
+void Runtime::Unpark(Cothread *thread) noexcept {
+    auto &hook = thread->hook;
+    hook.permit.store(true, std::memory_order_seq_cst);
+
+    auto expected = SchedulerHook::State::Parked;
+    if(hook.state.load(std::memory_order_seq_cst) == expected &&
+            hook.state.compare_exchange_strong(expected, SchedulerHook::State::Runnable)) {
+        thread->runtime->submit(thread);
+    }
+}
+
+/**
+ * Invoked by a spawned cothread after its entry point returned. The worker deallocates it, once
+ * it switched back to it.
+ */
+void Runtime::Exit() noexcept {
+    auto worker = RuntimeWorker::Current();
+    worker->action = RuntimeWorker::Action::Exit;
+    worker->home->switchTo();
+
+    // we should never get here, since the cothread was deallocated
+    std::cerr << "[libcommunism] Exited cothread was resumed!" << std::endl;
+    std::terminate();
+}
@@ -0,0 +1,377 @@
+#include <libcommunism/Scheduler.h>
+
+#include <atomic>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+using namespace libcommunism;
+using namespace libcommunism::internal;
+
+/**
+ * @brief Scheduler state of a single kernel thread
+ *
+ * This is trivially destructible, so that accessing it doesn't go through a thread local
+ * initialization wrapper.
+ */
+struct internal::SchedulerState {
+    /// First cothread in the run queue, i.e. the one to execute next
+    Cothread *head{nullptr};
+    /// Last cothread in the run queue
+    Cothread *tail{nullptr};
+
+    /**
+     * Cothreads that were unparked by other kernel threads, most recently unparked first. They're
+     * linked through their scheduler hook, like the run queue, and moved to the end of it the
+     * next time a cothread is dequeued.
+     */
+    std::atomic<Cothread *> remote{nullptr};
+
+    /// Cothread that invoked Run(), which is switched to when the run queue is empty
+    Cothread *home{nullptr};
+    /// Cothread that exited and is waiting to be deallocated, once we're off its stack
+    Cothread *zombie{nullptr};
+
+    /// Number of cothreads spawned on this kernel thread that haven't exited yet
+    size_t numThreads{0};
+    /// Number of cothreads that are blocked in a wait queue, and may be woken by another thread
+    size_t numWaiting{0};
+
+    /// First coroutine waiting to be resumed
+    CoroutineHook *coroutineHead{nullptr};
+    /// Last coroutine waiting to be resumed
+    CoroutineHook *coroutineTail{nullptr};
+};
+
+/**
+ * Scheduler of the calling kernel thread
+ */
+static thread_local SchedulerState gState;
+
+/**
+ * Cothread that resumes the coroutines queued on the calling kernel thread. It's allocated when
+ * the first coroutine is queued.
+ */
+static thread_local std::unique_ptr<Cothread> gCoroutineHelper;
+
+/**
+ * Takes ownership of a newly spawned cothread and makes it runnable.
+ */
+void Scheduler::Adopt(Cothread *thread) noexcept {
+    thread->hook.spawned = true;
+    thread->hook.scheduler = &gState;
+    gState.numThreads++;
+    Enqueue(thread);
+}
+
+/**
+ * Adds a cothread to the end of the run queue.
+ */
+void Scheduler::Enqueue(Cothread *thread) noexcept {
+    auto &state = gState;
+
+    thread->hook.state.store(SchedulerHook::State::Runnable, std::memory_order_relaxed);
+    thread->hook.next = nullptr;
+
+    if(state.tail) {
+        state.tail->hook.next = thread;
+    } else {
+        state.head = thread;
+    }
+    state.tail = thread;
+}
+
+/**
+ * Removes the cothread at the head of the run queue.
+ *
+ * @return Next cothread to execute, or `nullptr` if the run queue is empty
+ */
+Cothread *Scheduler::Dequeue() noexcept {
+    auto &state = gState;
+    if(state.remote.load(std::memory_order_relaxed)) [[unlikely]] {
+        TakeRemote();
+    }
+
+    auto thread = state.head;
+    if(thread) {
+        state.head = thread->hook.next;
+        if(!state.head) {
+            state.tail = nullptr;
+        }
+        thread->hook.state.store(SchedulerHook::State::Idle, std::memory_order_relaxed);
+    }
+    return thread;
+}
+
+/**
+ * Moves all cothreads that were unparked by other kernel threads to the end of the run queue, in
+ * the order they were unparked.
+ */
+void Scheduler::TakeRemote() noexcept {
+    auto thread = gState.remote.exchange(nullptr, std::memory_order_acquire);
+
+    Cothread *reversed{nullptr};
+    while(thread) {
+        auto next = thread->hook.next;
+        thread->hook.next = reversed;
+        reversed = thread;
+        thread = next;
+    }
+
+    while(reversed) {
+        auto next = reversed->hook.next;
+        Enqueue(reversed);
+        reversed = next;
+    }
+}
+
+/**
+ * Makes a parked cothread spawned on another kernel thread runnable, by pushing it on that
+ * scheduler's remote queue. If the queue was empty, the kernel thread is woken up, in case it's
+ * idle in Run().
+ *
+ * As with the M:N runtime, the permit is set before checking whether the cothread is parked, so
+ * that either this sees it parked, or the cothread sees the permit before switching away.
+ *
+ * @param owner Scheduler the cothread was spawned on
+ * @param thread Cothread to unpark
+ */
+void Scheduler::UnparkRemote(SchedulerState *owner, Cothread *thread) noexcept {
+    auto &hook = thread->hook;
+    hook.permit.store(true, std::memory_order_seq_cst);
+
+    auto expected = SchedulerHook::State::Parked;
+    if(hook.state.load(std::memory_order_seq_cst) != expected ||
+            !hook.state.compare_exchange_strong(expected, SchedulerHook::State::Runnable)) {
+        return;
+    }
+
+    // the cothread may run (and exit) as soon as it's pushed, so it mustn't be touched after
+    auto head = owner->remote.load(std::memory_order_relaxed);
+    do {
+        hook.next = head;
+    } while(!owner->remote.compare_exchange_weak(head, thread, std::memory_order_release,
+                std::memory_order_relaxed));
+
+    if(!head) {
+        owner->remote.notify_one();
+    }
+}
+
+/**
+ * Switches from the calling cothread to the next runnable cothread, or to the caller of Run() if
+ * there is none. The caller must already have updated its own scheduling state.
+ */
+void Scheduler::SwitchNext() noexcept {
+    auto next = Dequeue();
+    if(!next) {
+        next = gState.home;
+    }
+
+    if(!next) [[unlikely]] {
+        std::cerr << "[libcommunism] No runnable cothreads, and scheduler isn't running!"
+            << std::endl;
+        std::terminate();
+    }
+
+    next->switchTo();
+    Reap();
+}
+
+/**
+ * Deallocates the most recently exited cothread, if any. This must be invoked whenever a cothread
+ * resumes execution through the scheduler, as it may have been switched to by the exiting one.
+ */
+void Scheduler::Reap() noexcept {
+    if(auto zombie = std::exchange(gState.zombie, nullptr)) {
+        delete zombie;
+    }
+}
+
+/**
+ * Invoked by a spawned cothread when it's first switched to.
+ */
+void Scheduler::Started() noexcept {
+    Reap();
+}
+
+/**
+ * Invoked by a spawned cothread after its entry point returned. It's marked to be deallocated by
+ * the next cothread to run.
+ */
+void Scheduler::Exit() noexcept {
+    auto thread = Cothread::Current();
+    thread->hook.state.store(SchedulerHook::State::Exited, std::memory_order_relaxed);
+
+    gState.zombie = thread;
+    gState.numThreads--;
+
+    SwitchNext();
+
+    // we should never get here, since the cothread was deallocated
+    std::cerr << "[libcommunism] Exited cothread was resumed!" << std::endl;
+    std::terminate();
+}
+
+size_t Scheduler::Run() {
+    auto &state = gState;
+    if(state.home) {
+        throw std::runtime_error("Scheduler is already running");
+    }
+    state.home = Cothread::Current();
+
+    while(true) {
+        while(auto next = Dequeue()) {
+            next->switchTo();
+            Reap();
+        }
+
+        // cothreads blocked in wait queues may be woken from other kernel threads
+        if(!state.numWaiting) {
+            break;
+        }
+        state.remote.wait(nullptr, std::memory_order_relaxed);
+    }
+
+    state.home = nullptr;
+    return state.numThreads;
+}
+
+void Scheduler::Yield() noexcept {
+    if(!HasRunnable()) {
+        return;
+    }
+
+    auto thread = Cothread::Current();
+#ifdef LIBCOMMUNISM_STATS
+    thread->stats.yielded();
+#endif
+
+    Enqueue(thread);
+    SwitchNext();
+}
+
+bool Scheduler::HasRunnable() noexcept {
+    return gState.head || gState.remote.load(std::memory_order_relaxed);
+}
+
+void Scheduler::Park() noexcept {
+    auto &hook = Cothread::Current()->hook;
+    if(hook.permit.load(std::memory_order_relaxed) &&
+            hook.permit.exchange(false, std::memory_order_acquire)) {
+        return;
+    }
+
+    // pairs with UnparkRemote(): re-check the permit once we're visibly parked
+    hook.state.store(SchedulerHook::State::Parked, std::memory_order_seq_cst);
+    if(hook.permit.load(std::memory_order_seq_cst)) [[unlikely]] {
+        auto expected = SchedulerHook::State::Parked;
+        if(hook.state.compare_exchange_strong(expected, SchedulerHook::State::Idle)) {
+            hook.permit.exchange(false, std::memory_order_acquire);
+            return;
+        }
+        // otherwise, it's already being pushed on our remote queue
+    }
+
+    SwitchNext();
+
+    // consume the permit of a remote unpark that woke us up; only the parked cothread clears it
+    if(hook.permit.load(std::memory_order_relaxed)) [[unlikely]] {
+        hook.permit.exchange(false, std::memory_order_acquire);
+    }
+}
+
+/**
+ * Parks the calling cothread while it's blocked in a wait queue. Until it's woken, Run() waits
+ * for cothreads to be unparked from other kernel threads rather than returning.
+ */
+void Scheduler::ParkWaiting() noexcept {
+    auto &state = gState;
+    state.numWaiting++;
+    Park();
+    state.numWaiting--;
+}
+
+void Scheduler::Unpark(Cothread *thread) noexcept {
+    auto &hook = thread->hook;
+    if(const auto owner = hook.scheduler; owner && owner != &gState) [[unlikely]] {
+        UnparkRemote(owner, thread);
+        return;
+    }
+
+    // an unpark from another kernel thread may race with this one, but not a park
+    auto expected = SchedulerHook::State::Parked;
+    if(hook.state.compare_exchange_strong(expected, SchedulerHook::State::Runnable,
+                std::memory_order_relaxed)) {
+        Enqueue(thread);
+    } else {
+        hook.permit.store(true, std::memory_order_relaxed);
+    }
+}
+
+void Scheduler::Resume(CoroutineHook &hook) noexcept {
+    auto &state = gState;
+
+    hook.next = nullptr;
+    if(state.coroutineTail) {
+        state.coroutineTail->next = &hook;
+    } else {
+        state.coroutineHead = &hook;
+    }
+    state.coroutineTail = &hook;
+
+    Unpark(GetCoroutineHelper());
+}
+
+/**
+ * Returns the coroutine helper of the calling kernel thread, allocating it if needed. It's created
+ * in the parked state, so that unparking it adds it to the run queue.
+ */
+Cothread *Scheduler::GetCoroutineHelper() noexcept {
+    if(!gCoroutineHelper) [[unlikely]] {
+        try {
+            gCoroutineHelper = std::make_unique<Cothread>([]() {
+                Started();
+                while(true) {
+                    RunCoroutines();
+                    if(gState.coroutineHead) {
+                        Yield();
+                    } else {
+                        Park();
+                    }
+                }
+            });
+        } catch(const std::exception &e) {
+            std::cerr << "[libcommunism] Failed to allocate coroutine helper: " << e.what()
+                << std::endl;
+            std::terminate();
+        }
+
+        gCoroutineHelper->setLabel("coroutine helper");
+        gCoroutineHelper->hook.scheduler = &gState;
+        gCoroutineHelper->hook.state.store(SchedulerHook::State::Parked,
+                std::memory_order_relaxed);
+    }
+    return gCoroutineHelper.get();
+}
+
+/**
+ * Resumes all coroutines that are currently queued. Coroutines queued while doing so (such as
+ * those that reschedule themselves) are left for the next time the helper runs, so that they
+ * can't starve the cothreads in the run queue.
+ */
+void Scheduler::RunCoroutines() noexcept {
+    auto &state = gState;
+
+    auto hook = std::exchange(state.coroutineHead, nullptr);
+    state.coroutineTail = nullptr;
+
+    while(hook) {
+        // the hook may be gone once the coroutine was resumed
+        auto next = hook->next;
+        hook->handle.resume();
+        hook = next;
+    }
+}
@@ -0,0 +1,327 @@
+#include <libcommunism/Cothread.h>
+#include <libcommunism/SharedStack.h>
+
+#include "AllocImpl.h"
+#include "CothreadImpl.h"
+#include "SharedStackPrivate.h"
+#include "StackPoolPrivate.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <utility>
+
+using namespace libcommunism;
+using namespace libcommunism::internal;
+
+namespace {
+/**
+ * @brief Entry record placed on the shared stack when a cothread first runs on it
+ *
+ * It invokes the cothread's actual entry record, which lives in a separate heap allocation.
+ */
+struct SharedEntryRecord: EntryRecord {
+    explicit SharedEntryRecord(EntryRecord *record) : record(record) {
+        this->invoke = &SharedEntryRecord::Invoke;
+        this->destroy = &SharedEntryRecord::Destroy;
+    }
+
+    static void Invoke(EntryRecord *trampoline) {
+        auto record = static_cast<SharedEntryRecord *>(trampoline)->record;
+        record->invoke(record);
+    }
+
+    static void Destroy(EntryRecord *) {}
+
+    /// Entry record of the cothread
+    EntryRecord *record;
+};
+
+/**
+ * @brief Pending switch to a cothread on a shared stack, which the swap helper performs
+ */
+struct SwapRequest {
+    /// Cothread to switch to
+    Cothread *thread{nullptr};
+    /// Value to pass to the cothread
+    uintptr_t value{0};
+};
+
+/**
+ * Granularity of the buffers that hold the stacks of suspended cothreads, in bytes
+ */
+constexpr const size_t kImageGranularity{64};
+
+/**
+ * Size of the stack of the swap helper cothread. It only copies stacks around, so it doesn't need
+ * much.
+ */
+constexpr const size_t kSwapHelperStackSize{16 * 1024};
+}
+
+/**
+ * Switch that the swap helper of this kernel thread performs when it's switched to.
+ */
+static thread_local SwapRequest gSwapRequest;
+
+/**
+ * Cothread that switches between two cothreads on the same shared stack: the outgoing cothread's
+ * stack can't be copied out (and the incoming one's copied in) while it's executing on it. It's
+ * allocated when the first cothread on a shared stack is created on a kernel thread.
+ */
+static thread_local std::unique_ptr<Cothread> gSwapHelper;
+
+/**
+ * Shared stack of this kernel thread, as returned by SharedStack::ForThread()
+ */
+static thread_local std::unique_ptr<SharedStack> gThreadStack;
+
+
+
+bool SharedStack::IsSupported() {
+    return PlatformImpl::kSupportsSharedStacks;
+}
+
+SharedStack &SharedStack::ForThread() {
+    if(!gThreadStack) [[unlikely]] {
+        gThreadStack = std::make_unique<SharedStack>();
+    }
+    return *gThreadStack;
+}
+
+/**
+ * Allocates the stack memory from the stack pool.
+ */
+SharedStack::SharedStack(const size_t size, const StackType type) {
+    if(!IsSupported()) {
+        throw std::runtime_error("Shared stacks are not supported on this platform");
+    }
+
+    auto allocSize = size & ~(kPooledStackAlignment - 1);
+    allocSize = allocSize ? allocSize : PlatformImpl::kDefaultStackSize;
+
+    auto buf = AllocPooledStack(allocSize, type);
+    this->stack = {static_cast<uintptr_t *>(buf), allocSize / sizeof(uintptr_t)};
+}
+
+SharedStack::~SharedStack() {
+    FreePooledStack(this->stack.data(), this->getSize());
+}
+
+/**
+ * Makes the given cothread the occupant of the shared stack, so that it can be switched to. The
+ * live stack of the previous occupant is saved, then that of the cothread is restored; if it has
+ * never run, its initial context is built instead.
+ *
+ * @remark This must not be invoked on the shared stack itself.
+ */
+void SharedStack::activate(Cothread *thread) {
+    if(this->occupant) {
+        this->save(this->occupant);
+    }
+    this->occupant = thread;
+
+    if(thread->shared->started) {
+        this->restore(thread);
+    } else {
+        thread->prepareShared();
+    }
+}
+
+/**
+ * Copies the live part of a suspended cothread's stack (everything from its saved stack pointer
+ * to the high end of the stack) into its image buffer.
+ */
+void SharedStack::save(Cothread *thread) {
+    auto state = thread->shared;
+
+    const auto top = static_cast<std::byte *>(thread->impl->getStackPointer());
+    const auto base = reinterpret_cast<std::byte *>(this->stack.data() + this->stack.size());
+    const size_t bytes = base - top;
+
+    state->resizeImage(bytes);
+    std::memcpy(state->image.get(), top, bytes);
+
+    this->stats.saves++;
+    this->stats.bytesCopied += bytes;
+}
+
+/**
+ * Copies the saved stack of a cothread back onto the shared stack, at the same address it was
+ * copied from.
+ */
+void SharedStack::restore(Cothread *thread) {
+    auto state = thread->shared;
+
+    const auto top = static_cast<std::byte *>(thread->impl->getStackPointer());
+    std::memcpy(top, state->image.get(), state->imageSize);
+
+    this->stats.restores++;
+    this->stats.bytesCopied += state->imageSize;
+}
+
+/**
+ * Discards the stack frames of a cothread on the shared stack, if it's the occupant: it's being
+ * deallocated, or re-armed.
+ */
+void SharedStack::release(Cothread *thread) {
+    if(this->occupant == thread) {
+        this->occupant = nullptr;
+    }
+}
+
+
+
+/**
+ * Releases the image buffer and entry record memory.
+ */
+SharedStackState::~SharedStackState() {
+    this->resizeImage(0);
+
+    if(this->entryMem) {
+        ::operator delete(this->entryMem, std::align_val_t{this->entryAlignment});
+    }
+    if(this->pendingMem) {
+        ::operator delete(this->pendingMem, std::align_val_t{this->pendingAlignment});
+    }
+}
+
+/**
+ * Allocates memory for a new entry record. The current record's memory remains allocated until
+ * commitEntry() is invoked, since it must be destroyed first.
+ */
+void *SharedStackState::reserveEntry(const size_t size, const size_t alignment) {
+    if(this->pendingMem) {
+        ::operator delete(this->pendingMem, std::align_val_t{this->pendingAlignment});
+        this->pendingMem = nullptr;
+    }
+
+    this->pendingMem = ::operator new(size, std::align_val_t{alignment});
+    this->pendingAlignment = alignment;
+    return this->pendingMem;
+}
+
+/**
+ * Releases the memory of the previous entry record, which has been destroyed, in favor of the
+ * one that was just constructed; the cothread's initial context is built on the shared stack the
+ * next time it's switched to.
+ */
+void SharedStackState::commitEntry() {
+    if(this->entryMem) {
+        ::operator delete(this->entryMem, std::align_val_t{this->entryAlignment});
+    }
+
+    this->entryMem = std::exchange(this->pendingMem, nullptr);
+    this->entryAlignment = this->pendingAlignment;
+    this->started = false;
+}
+
+/**
+ * Ensures the image buffer can hold the given number of bytes. It's reallocated if it's too small,
+ * or if it's much larger than needed, so that an idle cothread doesn't hold on to the memory of a
+ * deep call stack it had in the past.
+ *
+ * @param size Number of bytes of stack to store; zero releases the buffer.
+ */
+void SharedStackState::resizeImage(const size_t size) {
+    auto &stats = this->stack->stats;
+
+    if(size > this->imageCapacity || size < this->imageCapacity / 4) {
+        const auto capacity = (size + kImageGranularity - 1) & ~(kImageGranularity - 1);
+
+        stats.savedBytes -= this->imageCapacity;
+        this->image.reset(capacity ? new std::byte[capacity] : nullptr);
+        this->imageCapacity = capacity;
+        stats.savedBytes += capacity;
+    }
+
+    this->imageSize = size;
+}
+
+
+
+/**
+ * Allocates the implementation of a cothread that executes on a shared stack. It doesn't own the
+ * stack; and since the shared stack is usually occupied by another cothread at this point, it's
+ * not painted, and its entry record is allocated separately.
+ */
+void Cothread::allocImpl(SharedStack &stack) {
+    auto state = std::make_unique<SharedStackState>(stack);
+    GetSwapHelper();
+
+    this->impl = AllocImpl(this->implBuffer, this->implBufferUsed, stack.stack);
+    this->shared = state.release();
+    this->growableStack = IsGrowableStack(stack.getStack(), stack.getSize());
+    stack.stats.numCothreads++;
+#ifdef LIBCOMMUNISM_STATS
+    this->registerStats();
+#endif
+}
+
+/**
+ * Builds the initial context of a cothread on its shared stack, which it must occupy: a trampoline
+ * that invokes its actual entry record is placed at the high end of the stack, below which the
+ * platform code sets up the initial stack frame.
+ */
+void Cothread::prepareShared() {
+    const auto base = reinterpret_cast<uintptr_t>(this->impl->getStack()) +
+        this->impl->getStackSize();
+    auto mem = reinterpret_cast<void *>((base - sizeof(SharedEntryRecord)) &
+            ~(kEntryAlignment - 1));
+    auto trampoline = new(mem) SharedEntryRecord(this->entry);
+
+    PlatformImpl::Prepare(static_cast<PlatformImpl *>(this->impl), trampoline);
+    this->shared->started = true;
+}
+
+/**
+ * Performs a context switch to a cothread on a shared stack. If it doesn't occupy the stack, its
+ * stack is copied in first; when switching from a cothread on the same shared stack, this is done
+ * by the swap helper cothread, which runs on a stack of its own.
+ *
+ * @param from Cothread that is currently executing
+ * @param to Cothread on a shared stack to switch to; the current cothread must already be set.
+ * @param value Value to pass to the destination cothread
+ *
+ * @return Value passed by the cothread that switches back to `from`
+ */
+uintptr_t Cothread::SwitchShared(Cothread *from, Cothread *to, const uintptr_t value) noexcept {
+    auto stack = to->shared->stack;
+
+    if(stack->occupant != to) {
+        if(from->shared && from->shared->stack == stack) {
+            gSwapRequest = {to, value};
+            return PlatformImpl::Transfer(static_cast<PlatformImpl *>(from->impl),
+                    static_cast<PlatformImpl *>(GetSwapHelper()->impl), 0);
+        }
+
+        stack->activate(to);
+    }
+
+    return PlatformImpl::Transfer(static_cast<PlatformImpl *>(from->impl),
+            static_cast<PlatformImpl *>(to->impl), value);
+}
+
+/**
+ * Returns the swap helper of the calling kernel thread, allocating it if needed. Each time it's
+ * switched to, it makes the requested cothread the occupant of its shared stack and switches to
+ * it; the current cothread has already been updated at that point.
+ */
+Cothread *Cothread::GetSwapHelper() {
+    if(!gSwapHelper) [[unlikely]] {
+        gSwapHelper = std::make_unique<Cothread>(kSwapHelperStackSize, []() {
+            while(true) {
+                const auto request = gSwapRequest;
+                request.thread->shared->stack->activate(request.thread);
+
+                PlatformImpl::Transfer(static_cast<PlatformImpl *>(gSwapHelper->impl),
+                        static_cast<PlatformImpl *>(request.thread->impl), request.value);
+            }
+        });
+        gSwapHelper->setLabel("shared stack helper");
+    }
+    return gSwapHelper.get();
+}
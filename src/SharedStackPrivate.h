@@ -0,0 +1,54 @@
+#ifndef SHAREDSTACKPRIVATE_H
+#define SHAREDSTACKPRIVATE_H
+
+#include <libcommunism/Cothread.h>
+#include <libcommunism/SharedStack.h>
+
+#include <cstddef>
+#include <memory>
+
+namespace libcommunism::internal {
+/**
+ * @brief State of a cothread that executes on a shared stack
+ *
+ * While the cothread doesn't occupy the shared stack, the live part of its stack is kept in a heap
+ * buffer. Its entry record can't be placed on the stack either, since the stack is usually
+ * occupied by another cothread when it's created; so it's allocated separately, and only a small
+ * trampoline record that refers to it is placed on the shared stack when the cothread first runs.
+ */
+struct SharedStackState {
+    explicit SharedStackState(SharedStack &stack) : stack(&stack) {}
+    ~SharedStackState();
+
+    SharedStackState(const SharedStackState &) = delete;
+    SharedStackState &operator=(const SharedStackState &) = delete;
+
+    void *reserveEntry(const size_t size, const size_t alignment);
+    void commitEntry();
+    void resizeImage(const size_t size);
+
+    /// Shared stack the cothread executes on
+    SharedStack *stack;
+
+    /// Copy of the live part of the cothread's stack
+    std::unique_ptr<std::byte[]> image;
+    /// Number of bytes of stack in the image
+    size_t imageSize{0};
+    /// Size of the image buffer, in bytes
+    size_t imageCapacity{0};
+
+    /// Set once the initial context of the cothread was built on the shared stack
+    bool started{false};
+
+    /// Memory holding the entry record
+    void *entryMem{nullptr};
+    /// Alignment the entry record memory was allocated with
+    size_t entryAlignment{0};
+    /// Memory for an entry record that's being constructed, but hasn't been prepared yet
+    void *pendingMem{nullptr};
+    /// Alignment the pending entry record memory was allocated with
+    size_t pendingAlignment{0};
+};
+}
+
+#endif
@@ -0,0 +1,237 @@
+#include <libcommunism/Cothread.h>
+
+#include "CothreadImpl.h"
+#include "CothreadPrivate.h"
+#include "StackPoolPrivate.h"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <system_error>
+
+#ifndef _WIN32
+#include <signal.h>
+#include <sys/mman.h>
+#endif
+
+using namespace libcommunism;
+using namespace libcommunism::internal;
+
+namespace {
+/**
+ * Number of bytes below its frame that ProbeStack() touches. This must exceed the stack space used
+ * by the context switch of any platform implementation.
+ */
+constexpr const size_t kStackProbeSize{1024};
+
+#ifndef _WIN32
+/**
+ * Minimum size of the alternate signal stack that stack faults are handled on, in bytes
+ */
+constexpr const size_t kSignalStackSize{64 * 1024};
+
+/**
+ * Signals that accessing the inaccessible part of a growable stack may raise
+ */
+constexpr const std::array<int, 2> kFaultSignals{SIGSEGV, SIGBUS};
+
+/**
+ * @brief Alternate signal stack of a kernel thread
+ *
+ * It's disabled and released when the kernel thread exits.
+ */
+struct SignalStack {
+    ~SignalStack();
+
+    /// Memory of the signal stack, if it was allocated
+    void *memory{nullptr};
+    /// Size of the signal stack, in bytes
+    size_t size{0};
+};
+#endif
+}
+
+#ifndef _WIN32
+/**
+ * Handlers that were installed for each of the fault signals before ours, which are invoked for
+ * faults that aren't on a growable stack
+ */
+static std::array<struct sigaction, kFaultSignals.size()> gPreviousHandlers;
+
+/**
+ * Protects the fault handler installation and gPreviousHandlers
+ */
+static std::mutex gHandlerLock;
+
+/**
+ * Alternate signal stack of the calling kernel thread. Faults on a cothread's stack can't be
+ * handled on that same stack, since the handler needs stack space to run.
+ */
+static thread_local SignalStack gSignalStack;
+
+SignalStack::~SignalStack() {
+    if(!this->memory) {
+        return;
+    }
+
+    stack_t stack{};
+    stack.ss_flags = SS_DISABLE;
+    sigaltstack(&stack, nullptr);
+
+    munmap(this->memory, this->size);
+}
+
+/**
+ * Handles a fault signal. If it was caused by the current cothread accessing the part of its
+ * growable stack that isn't accessible yet, the stack is grown, and the faulting instruction is
+ * restarted when we return.
+ *
+ * Otherwise, it's passed on to whatever handler was installed before ours. If that's the default
+ * action, it's reinstated instead, so that the fault (which recurs as soon as we return) is handled
+ * as if we had never been installed: usually, by terminating the process.
+ */
+static void FaultHandler(int signal, siginfo_t *info, void *context) {
+    if(HandleStackFault(info->si_addr)) {
+        return;
+    }
+
+    for(size_t i = 0; i < kFaultSignals.size(); i++) {
+        if(kFaultSignals[i] != signal) {
+            continue;
+        }
+
+        const auto &previous = gPreviousHandlers[i];
+        if(previous.sa_flags & SA_SIGINFO) {
+            previous.sa_sigaction(signal, info, context);
+        } else if(previous.sa_handler == SIG_DFL || previous.sa_handler == SIG_IGN) {
+            sigaction(signal, &previous, nullptr);
+        } else {
+            previous.sa_handler(signal);
+        }
+        return;
+    }
+}
+#endif
+
+/**
+ * Installs the fault handler for all fault signals, remembering the previous handlers so faults
+ * we don't handle can be passed on to them.
+ *
+ * This is invoked every time a growable stack is mapped: if some other code has replaced our
+ * handler in the meantime (and perhaps restored the one it replaced afterwards, which is what test
+ * harnesses tend to do) it's installed again, on top of whatever handler is current.
+ */
+void internal::InstallStackFaultHandler() {
+#ifndef _WIN32
+    std::lock_guard lg(gHandlerLock);
+
+    struct sigaction action{};
+    action.sa_sigaction = FaultHandler;
+    action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+
+    for(size_t i = 0; i < kFaultSignals.size(); i++) {
+        struct sigaction current{};
+        if(sigaction(kFaultSignals[i], nullptr, &current)) {
+            throw std::system_error(errno, std::generic_category(), "sigaction");
+        }
+        if((current.sa_flags & SA_SIGINFO) && current.sa_sigaction == FaultHandler) {
+            continue;
+        }
+
+        if(sigaction(kFaultSignals[i], &action, &gPreviousHandlers[i])) {
+            throw std::system_error(errno, std::generic_category(), "sigaction");
+        }
+    }
+#endif
+
+    InstallSignalStack();
+}
+
+/**
+ * Maps a signal stack for the calling kernel thread, unless one has already been set up, either by
+ * us or by the application.
+ */
+void internal::InstallSignalStack() {
+#ifndef _WIN32
+    if(gSignalStack.memory) {
+        return;
+    }
+
+    stack_t current{};
+    if(sigaltstack(nullptr, &current)) {
+        throw std::system_error(errno, std::generic_category(), "sigaltstack");
+    }
+    if(!(current.ss_flags & SS_DISABLE)) {
+        return;
+    }
+
+    const auto size = std::max<size_t>(SIGSTKSZ, kSignalStackSize);
+    auto memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(memory == MAP_FAILED) {
+        throw std::system_error(errno, std::generic_category(), "mmap");
+    }
+
+    stack_t stack{};
+    stack.ss_sp = memory;
+    stack.ss_size = size;
+    if(sigaltstack(&stack, nullptr)) {
+        const auto err = errno;
+        munmap(memory, size);
+        throw std::system_error(err, std::generic_category(), "sigaltstack");
+    }
+
+    gSignalStack.memory = memory;
+    gSignalStack.size = size;
+#endif
+}
+
+/**
+ * Grows the stack of the current cothread, if it's growable and the faulting address lies in the
+ * part of it that isn't accessible yet. If the cothread's stack was painted, the newly accessible
+ * memory is painted as well, so that the high water mark remains accurate.
+ *
+ * @remark This is invoked from the fault signal handler, and is async signal safe.
+ *
+ * @param address Address whose access caused the fault
+ *
+ * @return Whether the fault was handled, and the faulting access can be retried.
+ */
+bool internal::HandleStackFault(void *address) noexcept {
+    auto thread = Cothread::gCurrent;
+    if(!thread || !thread->growableStack) {
+        return false;
+    }
+
+    const auto impl = thread->impl;
+    const auto stack = static_cast<std::byte *>(impl->getStack());
+    const auto bytes = impl->getStackSize();
+
+    const auto before = GetUncommittedStackSize(stack, bytes);
+    if(!GrowPooledStack(stack, bytes, address)) {
+        return false;
+    }
+
+    if(thread->stackPainted) {
+        const auto start = std::max(GetUncommittedStackSize(stack, bytes), impl->getContextSize());
+        if(start < before) {
+            std::fill(reinterpret_cast<uintptr_t *>(stack + start),
+                    reinterpret_cast<uintptr_t *>(stack + before), Cothread::kStackPaint);
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Writes to the bottom of a buffer on the stack that's larger than the stack frame of any context
+ * switch. The buffer is volatile so that the access can't be optimized out.
+ */
+COTHREAD_NOINLINE void internal::ProbeStack() {
+    volatile std::byte probe[kStackProbeSize];
+    probe[0] = std::byte{0};
+    static_cast<void>(probe[0]);
+}
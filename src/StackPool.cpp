@@ -0,0 +1,784 @@
+/**
+ * Implementation of the per kernel thread stack cache.
+ */
+#include <libcommunism/StackPool.h>
+
+#include "StackPoolPrivate.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using namespace libcommunism;
+using namespace libcommunism::internal;
+
+namespace {
+class ThreadCache;
+
+/**
+ * @brief Bookkeeping data for a pooled stack
+ *
+ * This lives in the last bytes of each stack allocation, above the region handed out as stack, so
+ * that it's never touched by the cothread while the stack is in use.
+ */
+struct alignas(kPooledStackAlignment) BlockHeader {
+    /// Cache of the thread that allocated this block, or `nullptr` if it's not pooled
+    ThreadCache *owner{nullptr};
+    /// Next block in a free list
+    BlockHeader *next{nullptr};
+    /// Total size of the allocation, including this header (but not including any guard page)
+    size_t blockSize{0};
+    /// How the block's memory was allocated
+    StackType type{StackType::Heap};
+    /**
+     * Number of bytes at the top of the block (including this header) that are accessible. This
+     * is only less than the block size for growable stacks; it's updated as they grow.
+     */
+    size_t committed{0};
+    /// Number of bytes at the low end of a growable block that were made accessible up front
+    size_t committedBottom{0};
+    /**
+     * Set by platform code that left a context at the low end of the stack that a later cothread
+     * on the same block may reuse. It's clear for new blocks, and cleared whenever the low end's
+     * contents are discarded.
+     */
+    bool bootstrapped{false};
+};
+
+/**
+ * @brief Free list for all cached stacks of one size
+ */
+struct SizeClass {
+    /// Size of the blocks in this class, or 0 if the class is unused
+    size_t blockSize{0};
+    /// Type of the blocks in this class
+    StackType type{StackType::Heap};
+    /// First free block
+    BlockHeader *head{nullptr};
+    /// Number of blocks on the free list
+    size_t count{0};
+};
+
+/**
+ * @brief Stack cache belonging to a single kernel thread
+ *
+ * The cache is reference counted: the owning thread holds one reference, and each stack that was
+ * allocated from it and not yet released holds another. This keeps the cache (and thus the remote
+ * free list) alive for threads that release stacks after the owner has exited.
+ */
+class ThreadCache {
+    public:
+        BlockHeader *take(const size_t blockSize, const StackType type);
+        void put(BlockHeader *block, const bool isRemote);
+        void drainRemote();
+        void trim(const size_t keepBytes);
+        void retire();
+        StackPool::Stats snapshot() const;
+
+        static void Unref(ThreadCache *cache);
+
+    public:
+        /// Blocks released by other threads, waiting to be moved into the cache
+        std::atomic<BlockHeader *> remote{nullptr};
+        /// Reference count; see class description
+        std::atomic<size_t> refs{1};
+        /// Set once the owning thread has exited
+        std::atomic<bool> exited{false};
+
+        std::atomic<uint64_t> hits{0}, misses{0}, localFrees{0}, remoteFrees{0}, released{0};
+        std::atomic<uint64_t> grown{0};
+        std::atomic<size_t> cachedStacks{0}, cachedBytes{0};
+
+    private:
+        void release(BlockHeader *block);
+
+    private:
+        std::array<SizeClass, StackPool::kMaxSizeClasses> classes;
+};
+
+/**
+ * @brief Retires the calling thread's stack cache when the thread exits
+ */
+struct CacheOwner {
+    ~CacheOwner();
+    /// Ensures the object is constructed (and thus its destructor registered)
+    void touch() {}
+};
+
+std::atomic<bool> gEnabled{true};
+std::atomic<size_t> gMaxCachedPerClass{StackPool::Config{}.maxCachedPerClass};
+std::atomic<size_t> gMaxCachedBytes{StackPool::Config{}.maxCachedBytes};
+std::atomic<StackType> gDefaultType{StackPool::Config{}.defaultType};
+std::atomic<bool> gDecommitMapped{StackPool::Config{}.decommitMapped};
+std::atomic<bool> gPaintStacks{StackPool::Config{}.paintStacks};
+std::atomic<size_t> gGrowableInitialSize{StackPool::Config{}.growableInitialSize};
+
+/// Number of times growable stacks that aren't owned by any cache were extended
+std::atomic<uint64_t> gUnpooledGrown{0};
+
+/// Protects the list of caches, as well as the statistics of exited threads
+std::mutex gRegistryLock;
+/// All caches that still exist
+std::vector<ThreadCache *> gCaches;
+/// Accumulated counters of caches that have been destroyed
+StackPool::Stats gRetiredStats;
+
+/// Stack cache of the calling thread; `nullptr` if not yet allocated, or the thread is exiting
+thread_local ThreadCache *gThreadCache{nullptr};
+/// Set once the calling thread's cache has been retired; no new one is created afterwards
+thread_local bool gThreadExited{false};
+thread_local CacheOwner gCacheOwner;
+}
+
+
+
+/**
+ * Gets the size of a page of virtual memory. This is also the size of the guard page that's placed
+ * below mapped stacks.
+ */
+static size_t GetPageSize() {
+#ifdef _WIN32
+    return 0x1000;
+#else
+    static const size_t gPageSize{static_cast<size_t>(sysconf(_SC_PAGESIZE))};
+    return gPageSize;
+#endif
+}
+
+/**
+ * Rounds a requested stack size up to the size of the block that backs it. This is the same for
+ * all types of stacks, so blocks can be found again from just their address and size.
+ */
+static inline size_t BlockSizeFor(const size_t bytes) {
+    const auto mask{std::max(StackPool::kSizeClassGranularity, GetPageSize()) - 1};
+    return (bytes + sizeof(BlockHeader) + mask) & ~mask;
+}
+
+/**
+ * Gets the header of the block starting at the given address.
+ */
+static inline BlockHeader *HeaderFor(void *base, const size_t blockSize) {
+    return reinterpret_cast<BlockHeader *>(reinterpret_cast<std::byte *>(base) + blockSize -
+            sizeof(BlockHeader));
+}
+
+/**
+ * Gets the start of the block described by the given header.
+ */
+static inline void *BaseFor(BlockHeader *header) {
+    return reinterpret_cast<std::byte *>(header) + sizeof(BlockHeader) - header->blockSize;
+}
+
+/**
+ * Gets the number of bytes at the top of a growable stack's block that are initially accessible.
+ */
+static size_t GetGrowableInitialSize(const size_t blockSize) {
+    const auto page = GetPageSize();
+    const auto bytes = (gGrowableInitialSize.load(std::memory_order_relaxed) + page - 1) &
+        ~(page - 1);
+    return std::clamp(bytes, page, blockSize);
+}
+
+/**
+ * Maps the memory for a stack, with a guard page below it.
+ *
+ * The mapping is not reserved against the system's commit limit, and its pages become resident
+ * only once they're touched. The guard page is made inaccessible so that overflowing the stack
+ * results in a fault.
+ *
+ * @param blockSize Size of the block to map, in bytes
+ * @param accessible Number of bytes at the top of the block that are made accessible; the rest
+ *        remains inaccessible, like the guard page, until the stack is grown.
+ *
+ * @throw std::runtime_error If the memory could not be mapped
+ *
+ * @return Address of the first byte above the guard page
+ */
+static void *MapStack(const size_t blockSize, const size_t accessible) {
+#ifdef _WIN32
+    (void) blockSize, (void) accessible;
+    return nullptr;
+#else
+    const auto guard = GetPageSize();
+    int flags{MAP_PRIVATE | MAP_ANONYMOUS};
+#ifdef MAP_NORESERVE
+    flags |= MAP_NORESERVE;
+#endif
+#ifdef MAP_STACK
+    flags |= MAP_STACK;
+#endif
+
+    const auto isPartial = accessible < blockSize;
+    auto region = mmap(nullptr, blockSize + guard, isPartial ? PROT_NONE : PROT_READ | PROT_WRITE,
+            flags, -1, 0);
+    if(region == MAP_FAILED) {
+        throw std::runtime_error("mmap() failed");
+    }
+
+    auto base = reinterpret_cast<std::byte *>(region) + guard;
+    int err{0};
+    if(isPartial) {
+        err = mprotect(base + blockSize - accessible, accessible, PROT_READ | PROT_WRITE);
+    } else {
+        err = mprotect(region, guard, PROT_NONE);
+    }
+
+    if(err) {
+        munmap(region, blockSize + guard);
+        throw std::runtime_error("mprotect() failed");
+    }
+
+    return base;
+#endif
+}
+
+/**
+ * Allocates a new block from the system and initializes its header.
+ *
+ * @throw std::runtime_error If memory allocation failed
+ */
+static BlockHeader *AllocBlock(const size_t blockSize, StackType type, ThreadCache *owner) {
+    void *buf{nullptr};
+    auto committed = blockSize;
+
+    if(type == StackType::Mapped) {
+        buf = MapStack(blockSize, blockSize);
+    } else if(type == StackType::Growable) {
+        InstallStackFaultHandler();
+        committed = GetGrowableInitialSize(blockSize);
+        buf = MapStack(blockSize, committed);
+    }
+
+    // fall back to the heap if the stack could not be mapped
+    if(!buf) {
+        type = StackType::Heap;
+        committed = blockSize;
+#ifdef _WIN32
+        buf = _aligned_malloc(blockSize, kPooledStackAlignment);
+#else
+        int err{0};
+        err = posix_memalign(&buf, kPooledStackAlignment, blockSize);
+        if(err) {
+            throw std::runtime_error("posix_memalign() failed");
+        }
+#endif
+        if(!buf) {
+            throw std::runtime_error("failed to allocate stack");
+        }
+    }
+
+    auto header = new(HeaderFor(buf, blockSize)) BlockHeader;
+    header->owner = owner;
+    header->blockSize = blockSize;
+    header->type = type;
+    header->committed = committed;
+    return header;
+}
+
+/**
+ * Returns a block's memory to the system.
+ */
+static void ReleaseBlock(BlockHeader *header) {
+#ifdef _WIN32
+    _aligned_free(BaseFor(header));
+#else
+    if(header->type == StackType::Mapped || header->type == StackType::Growable) {
+        const auto guard = GetPageSize();
+        munmap(reinterpret_cast<std::byte *>(BaseFor(header)) - guard, header->blockSize + guard);
+    } else {
+        free(BaseFor(header));
+    }
+#endif
+}
+
+/**
+ * Returns the resident pages of a mapped block to the system, without unmapping it. The topmost
+ * page, which holds the header, is kept.
+ */
+static void DecommitBlock(BlockHeader *header) {
+#if defined(MADV_DONTNEED) && !defined(_WIN32)
+    const auto bytes = header->blockSize - GetPageSize();
+    if(bytes) {
+        madvise(BaseFor(header), bytes, MADV_DONTNEED);
+        header->bootstrapped = false;
+    }
+#else
+    (void) header;
+#endif
+}
+
+/**
+ * Shrinks a growable block back to its initial size: the pages it was grown by are returned to
+ * the system, and made inaccessible again. Pages at the low end that were made accessible up front
+ * for platform code are left alone, even if the stack grew into them, so that the context stored
+ * there stays accessible and intact.
+ */
+static void ShrinkBlock(BlockHeader *header) {
+#ifndef _WIN32
+    const auto initial = GetGrowableInitialSize(header->blockSize);
+    if(header->committed <= initial) {
+        return;
+    }
+
+    auto base = reinterpret_cast<std::byte *>(BaseFor(header));
+    auto top = base + header->blockSize;
+    const auto start = std::max(top - header->committed, base + header->committedBottom);
+    const auto end = top - initial;
+
+    if(start < end) {
+        const auto bytes = static_cast<size_t>(end - start);
+#ifdef MADV_DONTNEED
+        madvise(start, bytes, MADV_DONTNEED);
+#endif
+        if(mprotect(start, bytes, PROT_NONE)) {
+            return;
+        }
+    }
+    header->committed = initial;
+#else
+    (void) header;
+#endif
+}
+
+/**
+ * Gets the calling thread's stack cache, allocating it if needed.
+ *
+ * @return Thread's cache, or `nullptr` if the thread is exiting.
+ */
+static ThreadCache *GetThreadCache() {
+    if(!gThreadCache && !gThreadExited) [[unlikely]] {
+        auto cache = new ThreadCache;
+        {
+            std::lock_guard<std::mutex> lg(gRegistryLock);
+            gCaches.push_back(cache);
+        }
+
+        gCacheOwner.touch();
+        gThreadCache = cache;
+    }
+    return gThreadCache;
+}
+
+/**
+ * Adds the counters of one set of statistics to another.
+ */
+static void Accumulate(StackPool::Stats &into, const StackPool::Stats &from) {
+    into.hits += from.hits;
+    into.misses += from.misses;
+    into.localFrees += from.localFrees;
+    into.remoteFrees += from.remoteFrees;
+    into.released += from.released;
+    into.grown += from.grown;
+    into.cachedStacks += from.cachedStacks;
+    into.cachedBytes += from.cachedBytes;
+}
+
+
+
+/**
+ * Removes a block of the given size and type from the cache.
+ *
+ * @return A free block, or `nullptr` if none of that size is cached
+ */
+BlockHeader *ThreadCache::take(const size_t blockSize, const StackType type) {
+    for(auto &sc : this->classes) {
+        if(sc.blockSize != blockSize || sc.type != type) continue;
+        if(!sc.head) return nullptr;
+
+        auto block = sc.head;
+        sc.head = block->next;
+        sc.count--;
+
+        this->cachedStacks.fetch_sub(1, std::memory_order_relaxed);
+        this->cachedBytes.fetch_sub(blockSize, std::memory_order_relaxed);
+        return block;
+    }
+    return nullptr;
+}
+
+/**
+ * Inserts a block into the cache. If it's full, or there's no size class for the block, it is
+ * released instead.
+ *
+ * @param block Block to insert; it must be owned by this cache
+ * @param isRemote Whether the block was handed back by another thread
+ */
+void ThreadCache::put(BlockHeader *block, const bool isRemote) {
+    if(!isRemote) {
+        this->localFrees.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // enforce the caps
+    const auto blockSize = block->blockSize;
+    if(this->cachedBytes.load(std::memory_order_relaxed) + blockSize >
+            gMaxCachedBytes.load(std::memory_order_relaxed)) {
+        return this->release(block);
+    }
+
+    // find the size class (or claim an unused one) for the block
+    SizeClass *sc{nullptr};
+    for(auto &candidate : this->classes) {
+        if(candidate.blockSize == blockSize && candidate.type == block->type) {
+            sc = &candidate;
+            break;
+        } else if(!candidate.blockSize && !sc) {
+            sc = &candidate;
+        }
+    }
+
+    if(!sc || sc->count >= gMaxCachedPerClass.load(std::memory_order_relaxed)) {
+        return this->release(block);
+    }
+
+    if(block->type == StackType::Growable) {
+        ShrinkBlock(block);
+    }
+    if((block->type == StackType::Mapped || block->type == StackType::Growable) &&
+            gDecommitMapped.load(std::memory_order_relaxed)) {
+        DecommitBlock(block);
+    }
+
+    sc->blockSize = blockSize;
+    sc->type = block->type;
+    block->next = sc->head;
+    sc->head = block;
+    sc->count++;
+
+    this->cachedStacks.fetch_add(1, std::memory_order_relaxed);
+    this->cachedBytes.fetch_add(blockSize, std::memory_order_relaxed);
+}
+
+/**
+ * Moves all blocks handed back by other threads into the cache.
+ */
+void ThreadCache::drainRemote() {
+    auto block = this->remote.exchange(nullptr, std::memory_order_acquire);
+    while(block) {
+        auto next = block->next;
+        this->put(block, true);
+        block = next;
+    }
+}
+
+/**
+ * Releases cached blocks until at most the given number of bytes remain cached. Size classes that
+ * end up empty are made available for other sizes again.
+ */
+void ThreadCache::trim(const size_t keepBytes) {
+    for(auto &sc : this->classes) {
+        while(sc.head && this->cachedBytes.load(std::memory_order_relaxed) > keepBytes) {
+            auto block = sc.head;
+            sc.head = block->next;
+            sc.count--;
+
+            this->cachedStacks.fetch_sub(1, std::memory_order_relaxed);
+            this->cachedBytes.fetch_sub(sc.blockSize, std::memory_order_relaxed);
+            this->release(block);
+        }
+
+        if(!sc.head) {
+            sc.blockSize = 0;
+        }
+    }
+}
+
+/**
+ * Invoked when the owning thread exits. All cached blocks are released, and the thread's reference
+ * to the cache is dropped.
+ */
+void ThreadCache::retire() {
+    this->exited.store(true, std::memory_order_release);
+    this->drainRemote();
+    this->trim(0);
+
+    Unref(this);
+}
+
+/**
+ * Returns a block to the system, counting it as such.
+ */
+void ThreadCache::release(BlockHeader *block) {
+    this->released.fetch_add(1, std::memory_order_relaxed);
+    ReleaseBlock(block);
+}
+
+/**
+ * Reads out the cache's current counters.
+ */
+StackPool::Stats ThreadCache::snapshot() const {
+    StackPool::Stats stats;
+    stats.hits = this->hits.load(std::memory_order_relaxed);
+    stats.misses = this->misses.load(std::memory_order_relaxed);
+    stats.localFrees = this->localFrees.load(std::memory_order_relaxed);
+    stats.remoteFrees = this->remoteFrees.load(std::memory_order_relaxed);
+    stats.released = this->released.load(std::memory_order_relaxed);
+    stats.grown = this->grown.load(std::memory_order_relaxed);
+    stats.cachedStacks = this->cachedStacks.load(std::memory_order_relaxed);
+    stats.cachedBytes = this->cachedBytes.load(std::memory_order_relaxed);
+    return stats;
+}
+
+/**
+ * Drops a reference to the cache. When the last one goes away, any blocks still on its remote list
+ * are released, and the cache is deallocated.
+ */
+void ThreadCache::Unref(ThreadCache *cache) {
+    if(cache->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+
+    auto block = cache->remote.exchange(nullptr, std::memory_order_acquire);
+    while(block) {
+        auto next = block->next;
+        cache->release(block);
+        block = next;
+    }
+
+    {
+        std::lock_guard<std::mutex> lg(gRegistryLock);
+        gCaches.erase(std::find(gCaches.begin(), gCaches.end(), cache));
+        Accumulate(gRetiredStats, cache->snapshot());
+    }
+
+    delete cache;
+}
+
+/**
+ * Retire the thread's cache.
+ */
+CacheOwner::~CacheOwner() {
+    auto cache = gThreadCache;
+    gThreadCache = nullptr;
+    gThreadExited = true;
+
+    if(cache) {
+        cache->retire();
+    }
+}
+
+
+
+/**
+ * Takes a stack out of the calling thread's cache, or allocates a new one if there is none.
+ */
+void *internal::AllocPooledStack(const size_t bytes, StackType type) {
+    const auto blockSize = BlockSizeFor(bytes);
+    ThreadCache *cache{nullptr};
+
+    if(type == StackType::Default) {
+        type = gDefaultType.load(std::memory_order_relaxed);
+    }
+#ifdef _WIN32
+    type = StackType::Heap;
+#endif
+
+    if(gEnabled.load(std::memory_order_relaxed)) {
+        cache = GetThreadCache();
+    }
+
+    if(cache) {
+        auto block = cache->take(blockSize, type);
+        if(!block && cache->remote.load(std::memory_order_relaxed)) {
+            cache->drainRemote();
+            block = cache->take(blockSize, type);
+        }
+
+        if(block) {
+            cache->hits.fetch_add(1, std::memory_order_relaxed);
+            cache->refs.fetch_add(1, std::memory_order_relaxed);
+            return BaseFor(block);
+        }
+
+        cache->misses.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    auto block = AllocBlock(blockSize, type, cache);
+    if(cache) {
+        cache->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    return BaseFor(block);
+}
+
+/**
+ * Returns a stack to the cache of the thread that allocated it.
+ */
+void internal::FreePooledStack(void *stack, const size_t bytes) {
+    auto block = HeaderFor(stack, BlockSizeFor(bytes));
+    auto owner = block->owner;
+
+    // stacks allocated while the pool was disabled are never cached
+    if(!owner) {
+        return ReleaseBlock(block);
+    }
+    // released on the thread that allocated it
+    else if(owner == gThreadCache) {
+        owner->put(block, false);
+    }
+    // hand it back to the owning thread, unless it's gone
+    else {
+        owner->remoteFrees.fetch_add(1, std::memory_order_relaxed);
+
+        if(owner->exited.load(std::memory_order_acquire)) {
+            owner->released.fetch_add(1, std::memory_order_relaxed);
+            ReleaseBlock(block);
+        } else {
+            auto head = owner->remote.load(std::memory_order_relaxed);
+            do {
+                block->next = head;
+            } while(!owner->remote.compare_exchange_weak(head, block, std::memory_order_release,
+                        std::memory_order_relaxed));
+        }
+    }
+
+    ThreadCache::Unref(owner);
+}
+
+
+
+void StackPool::SetConfig(const Config &config) {
+    gEnabled.store(config.enabled, std::memory_order_relaxed);
+    gMaxCachedPerClass.store(config.maxCachedPerClass, std::memory_order_relaxed);
+    gMaxCachedBytes.store(config.maxCachedBytes, std::memory_order_relaxed);
+    gDefaultType.store(config.defaultType == StackType::Default ? StackType::Heap :
+            config.defaultType, std::memory_order_relaxed);
+    gDecommitMapped.store(config.decommitMapped, std::memory_order_relaxed);
+    gPaintStacks.store(config.paintStacks, std::memory_order_relaxed);
+    gGrowableInitialSize.store(config.growableInitialSize, std::memory_order_relaxed);
+}
+
+StackPool::Config StackPool::GetConfig() {
+    Config config;
+    config.enabled = gEnabled.load(std::memory_order_relaxed);
+    config.maxCachedPerClass = gMaxCachedPerClass.load(std::memory_order_relaxed);
+    config.maxCachedBytes = gMaxCachedBytes.load(std::memory_order_relaxed);
+    config.defaultType = gDefaultType.load(std::memory_order_relaxed);
+    config.decommitMapped = gDecommitMapped.load(std::memory_order_relaxed);
+    config.paintStacks = gPaintStacks.load(std::memory_order_relaxed);
+    config.growableInitialSize = gGrowableInitialSize.load(std::memory_order_relaxed);
+    return config;
+}
+
+bool internal::ShouldPaintStacks() {
+    return gPaintStacks.load(std::memory_order_relaxed);
+}
+
+/**
+ * Makes more of a growable stack accessible, so that the given address (which must lie in its
+ * inaccessible part) can be accessed. At least the faulting page is committed; but the accessible
+ * part is also at least doubled, so that a deep stack takes only a few faults to grow.
+ *
+ * @remark This is invoked from a signal handler; it must remain async signal safe.
+ */
+bool internal::GrowPooledStack(void *stack, const size_t bytes, void *address) {
+#ifndef _WIN32
+    auto header = HeaderFor(stack, BlockSizeFor(bytes));
+    if(header->type != StackType::Growable) {
+        return false;
+    }
+
+    const auto base = static_cast<std::byte *>(stack);
+    const auto top = base + header->blockSize;
+    const auto low = top - header->committed;
+    const auto fault = static_cast<std::byte *>(address);
+    if(fault < base || fault >= low) {
+        return false;
+    }
+
+    const auto page = GetPageSize();
+    auto newLow = base + ((fault - base) & ~(page - 1));
+    if(static_cast<size_t>(low - base) > header->committed) {
+        newLow = std::min(newLow, low - header->committed);
+    } else {
+        newLow = base;
+    }
+
+    if(mprotect(newLow, low - newLow, PROT_READ | PROT_WRITE)) {
+        return false;
+    }
+    header->committed = top - newLow;
+
+    if(header->owner) {
+        header->owner->grown.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        gUnpooledGrown.fetch_add(1, std::memory_order_relaxed);
+    }
+    return true;
+#else
+    (void) stack, (void) bytes, (void) address;
+    return false;
+#endif
+}
+
+/**
+ * Makes the lowest bytes of a growable stack accessible, for platform code that keeps data there.
+ */
+void internal::CommitPooledStackBottom(void *stack, const size_t bytes, const size_t lowBytes) {
+#ifndef _WIN32
+    auto header = HeaderFor(stack, BlockSizeFor(bytes));
+    if(header->type != StackType::Growable || lowBytes <= header->committedBottom) {
+        return;
+    }
+
+    const auto page = GetPageSize();
+    const auto commit = (lowBytes + page - 1) & ~(page - 1);
+    if(mprotect(stack, commit, PROT_READ | PROT_WRITE)) {
+        throw std::runtime_error("mprotect() failed");
+    }
+    header->committedBottom = commit;
+#else
+    (void) stack, (void) bytes, (void) lowBytes;
+#endif
+}
+
+bool internal::IsStackBootstrapped(void *stack, const size_t bytes) {
+    return HeaderFor(stack, BlockSizeFor(bytes))->bootstrapped;
+}
+
+void internal::SetStackBootstrapped(void *stack, const size_t bytes) {
+    HeaderFor(stack, BlockSizeFor(bytes))->bootstrapped = true;
+}
+
+bool internal::IsGrowableStack(void *stack, const size_t bytes) {
+    return HeaderFor(stack, BlockSizeFor(bytes))->type == StackType::Growable;
+}
+
+size_t internal::GetUncommittedStackSize(void *stack, const size_t bytes) {
+    auto header = HeaderFor(stack, BlockSizeFor(bytes));
+    return std::min(header->blockSize - header->committed, bytes);
+}
+
+StackPool::Stats StackPool::GetStats() {
+    std::lock_guard<std::mutex> lg(gRegistryLock);
+
+    auto stats = gRetiredStats;
+    stats.grown += gUnpooledGrown.load(std::memory_order_relaxed);
+    for(const auto cache : gCaches) {
+        Accumulate(stats, cache->snapshot());
+    }
+    return stats;
+}
+
+StackPool::Stats StackPool::GetThreadStats() {
+    if(!gThreadCache) return {};
+    return gThreadCache->snapshot();
+}
+
+void StackPool::Trim(const size_t keepBytes) {
+    auto cache = gThreadCache;
+    if(!cache) return;
+
+    cache->drainRemote();
+    cache->trim(keepBytes);
+}
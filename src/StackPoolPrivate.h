@@ -0,0 +1,128 @@
+#ifndef STACKPOOLPRIVATE_H
+#define STACKPOOLPRIVATE_H
+
+#include <libcommunism/StackPool.h>
+
+#include <cstddef>
+
+namespace libcommunism::internal {
+/**
+ * Required alignment of all stacks handed out by the pool. This satisfies the stack alignment
+ * requirements of every platform implementation.
+ */
+constexpr const size_t kPooledStackAlignment{64};
+
+/**
+ * Allocates memory for a cothread stack from the calling kernel thread's stack cache, going to the
+ * system allocator if there is no suitable cached stack.
+ *
+ * @param bytes Number of usable bytes of stack required
+ * @param type Kind of memory to allocate for the stack
+ *
+ * @throw std::runtime_error If memory allocation failed
+ *
+ * @return Pointer to the lowest address of the stack, aligned to kPooledStackAlignment.
+ */
+void *AllocPooledStack(const size_t bytes, const StackType type = StackType::Default);
+
+/**
+ * Releases a stack previously allocated with AllocPooledStack(). It's returned to the cache of the
+ * kernel thread that allocated it, or to the system if that cache is full.
+ *
+ * @param stack Pointer to the lowest address of the stack
+ * @param bytes Size of the stack, exactly as passed to AllocPooledStack()
+ */
+void FreePooledStack(void *stack, const size_t bytes);
+
+/**
+ * Checks whether new cothread stacks should be painted, as set in the stack pool configuration.
+ */
+bool ShouldPaintStacks();
+
+/**
+ * Checks whether a stack allocated with AllocPooledStack() is growable: that is, only its high
+ * end is initially accessible, and the rest is made accessible as it's used.
+ *
+ * @param stack Pointer to the lowest address of the stack
+ * @param bytes Size of the stack, exactly as passed to AllocPooledStack()
+ */
+bool IsGrowableStack(void *stack, const size_t bytes);
+
+/**
+ * Gets the number of bytes at the low end of a stack allocated with AllocPooledStack() that are
+ * currently inaccessible. This is always zero for stacks that aren't growable.
+ *
+ * @param stack Pointer to the lowest address of the stack
+ * @param bytes Size of the stack, exactly as passed to AllocPooledStack()
+ */
+size_t GetUncommittedStackSize(void *stack, const size_t bytes);
+
+/**
+ * Grows a growable stack so that the given address, which faulted, becomes accessible.
+ *
+ * @remark This is invoked from the fault signal handler, and is async signal safe.
+ *
+ * @param stack Pointer to the lowest address of the stack
+ * @param bytes Size of the stack, exactly as passed to AllocPooledStack()
+ * @param address Address that was accessed
+ *
+ * @return Whether the address lies in the inaccessible part of the stack, and it was grown.
+ */
+bool GrowPooledStack(void *stack, const size_t bytes, void *address);
+
+/**
+ * Makes the given number of bytes at the low end of a growable stack accessible, for platform
+ * implementations that store the cothread's context there. Other stacks are not modified.
+ *
+ * @param stack Pointer to the lowest address of the stack
+ * @param bytes Size of the stack, exactly as passed to AllocPooledStack()
+ * @param lowBytes Number of bytes at the low end of the stack to make accessible
+ *
+ * @throw std::runtime_error If the memory protection could not be changed
+ */
+void CommitPooledStackBottom(void *stack, const size_t bytes, const size_t lowBytes);
+
+/**
+ * Checks whether platform code marked a stack allocated with AllocPooledStack() as holding a
+ * context at its low end, which a new cothread on the stack may reuse. This is only ever the case
+ * for stacks that were taken from the cache, after a previous cothread used them.
+ *
+ * @param stack Pointer to the lowest address of the stack
+ * @param bytes Size of the stack, exactly as passed to AllocPooledStack()
+ */
+bool IsStackBootstrapped(void *stack, const size_t bytes);
+
+/**
+ * Marks a stack allocated with AllocPooledStack() as holding a reusable context at its low end.
+ * The mark is cleared if the pool discards the stack's contents while it's cached.
+ *
+ * @param stack Pointer to the lowest address of the stack
+ * @param bytes Size of the stack, exactly as passed to AllocPooledStack()
+ */
+void SetStackBootstrapped(void *stack, const size_t bytes);
+
+/**
+ * Installs the signal handler that grows growable stacks when they fault, if that hasn't been
+ * done yet, and sets up an alternate signal stack for the calling kernel thread.
+ *
+ * @throw std::system_error If the handler or signal stack could not be installed
+ */
+void InstallStackFaultHandler();
+
+/**
+ * Sets up an alternate signal stack for the calling kernel thread, if it doesn't have one yet. A
+ * fault on a growable stack can only be handled by a kernel thread that has one.
+ *
+ * @throw std::system_error If the signal stack could not be installed
+ */
+void InstallSignalStack();
+
+/**
+ * Touches the stack below the caller's frame, deeper than any context switch will. This is done
+ * before switching away from a cothread with a growable stack, so that any faults to grow it
+ * happen while it's still the current cothread.
+ */
+void ProbeStack();
+}
+
+#endif
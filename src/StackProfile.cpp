@@ -0,0 +1,75 @@
+#include <libcommunism/StackProfile.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+using namespace libcommunism;
+
+/**
+ * @brief Profiles that have been created by name
+ */
+struct ProfileRegistry {
+    std::mutex lock;
+    std::map<std::string, std::unique_ptr<StackProfile>, std::less<>> profiles;
+};
+
+/**
+ * Gets the registry of named profiles, constructing it on first use.
+ */
+static ProfileRegistry &GetRegistry() {
+    static ProfileRegistry gRegistry;
+    return gRegistry;
+}
+
+StackProfile &StackProfile::ForLabel(const std::string &label) {
+    auto &registry = GetRegistry();
+    std::lock_guard lg(registry.lock);
+
+    auto &profile = registry.profiles[label];
+    if(!profile) {
+        profile = std::make_unique<StackProfile>(label);
+    }
+    return *profile;
+}
+
+StackProfile &StackProfile::ForSite(const std::source_location site) {
+    return ForLabel(std::string(site.file_name()) + ":" + std::to_string(site.line()));
+}
+
+/**
+ * Recommends the largest observed high water mark, times the margin, rounded up to the granularity
+ * of the stack pool's size classes, so that profiled cothreads share as few size classes as
+ * possible.
+ */
+size_t StackProfile::getStackSize() const {
+    if(!this->getNumSamples()) {
+        return this->config.initialSize;
+    }
+
+    constexpr static const auto kGranularity{StackPool::kSizeClassGranularity};
+    auto size = static_cast<size_t>(this->getMaxHighWaterMark() * this->config.margin);
+    size = (size + kGranularity - 1) & ~(kGranularity - 1);
+
+    size = std::max(size, this->config.minSize);
+    if(this->config.maxSize) {
+        size = std::min(size, this->config.maxSize);
+    }
+    return size;
+}
+
+void StackProfile::record(const size_t highWaterMark) {
+    auto max = this->maxHighWaterMark.load(std::memory_order_relaxed);
+    while(highWaterMark > max && !this->maxHighWaterMark.compare_exchange_weak(max,
+                highWaterMark, std::memory_order_relaxed)) {}
+
+    this->numSamples.fetch_add(1, std::memory_order_relaxed);
+}
+
+void StackProfile::reset() {
+    this->maxHighWaterMark.store(0, std::memory_order_relaxed);
+    this->numSamples.store(0, std::memory_order_relaxed);
+}
@@ -0,0 +1,130 @@
+#include <libcommunism/Cothread.h>
+
+#include "Timestamp.h"
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+using namespace libcommunism;
+using namespace libcommunism::internal;
+
+#ifdef LIBCOMMUNISM_STATS
+/**
+ * @brief List of all live cothreads, for taking snapshots of their statistics
+ *
+ * Cothreads are linked into the list through their statistics hook, so registering one never
+ * allocates; but since cothreads may be created on any kernel thread, it's protected by a lock.
+ */
+struct StatsRegistry {
+    std::mutex lock;
+    /// Most recently registered cothread
+    Cothread *head{nullptr};
+};
+
+/**
+ * Gets the registry of live cothreads; it's constructed on first use, since cothreads may be
+ * created from static initializers.
+ */
+static StatsRegistry &GetRegistry() {
+    static StatsRegistry gRegistry;
+    return gRegistry;
+}
+#endif
+
+/**
+ * Calibrates the frequency of the timestamp counter against the steady clock, unless the platform
+ * reports it directly. This busy waits for a few milliseconds on first use.
+ */
+uint64_t internal::GetTimestampFrequency() {
+#if defined(__aarch64__)
+    uint64_t frequency;
+    asm volatile("mrs %0, cntfrq_el0" : "=r"(frequency));
+    return frequency;
+#elif defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+    static const uint64_t gFrequency = []() {
+        using Clock = std::chrono::steady_clock;
+        constexpr static const auto kInterval = std::chrono::milliseconds(10);
+
+        const auto start = Clock::now();
+        const auto startTicks = ReadTimestamp();
+        auto now = start;
+        while(now - start < kInterval) {
+            now = Clock::now();
+        }
+        const auto ticks = ReadTimestamp() - startTicks;
+
+        const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count();
+        return static_cast<uint64_t>(static_cast<double>(ticks) * 1'000'000'000.0 / ns);
+    }();
+    return gFrequency;
+#else
+    return 1'000'000'000;
+#endif
+}
+
+/**
+ * Adds the cothread to the list of live cothreads.
+ */
+void Cothread::registerStats() {
+#ifdef LIBCOMMUNISM_STATS
+    auto &registry = GetRegistry();
+    std::lock_guard lg(registry.lock);
+
+    this->stats.prev = nullptr;
+    this->stats.next = registry.head;
+    if(registry.head) {
+        registry.head->stats.prev = this;
+    }
+    registry.head = this;
+#endif
+}
+
+/**
+ * Removes the cothread from the list of live cothreads.
+ */
+void Cothread::unregisterStats() {
+#ifdef LIBCOMMUNISM_STATS
+    auto &registry = GetRegistry();
+    std::lock_guard lg(registry.lock);
+
+    if(this->stats.prev) {
+        this->stats.prev->stats.next = this->stats.next;
+    } else if(registry.head == this) {
+        registry.head = this->stats.next;
+    }
+    if(this->stats.next) {
+        this->stats.next->stats.prev = this->stats.prev;
+    }
+    this->stats.prev = this->stats.next = nullptr;
+#endif
+}
+
+CothreadStats Cothread::getStats() const {
+    CothreadStats out;
+#ifdef LIBCOMMUNISM_STATS
+    out.switches = this->stats.switches.load(std::memory_order_relaxed);
+    out.cpuTime = this->stats.cpuTime.load(std::memory_order_relaxed);
+    out.lastRun = this->stats.lastRun.load(std::memory_order_relaxed);
+    out.yields = this->stats.yields.load(std::memory_order_relaxed);
+#endif
+    return out;
+}
+
+std::vector<CothreadStatsEntry> Cothread::GetAllStats() {
+    std::vector<CothreadStatsEntry> entries;
+#ifdef LIBCOMMUNISM_STATS
+    auto &registry = GetRegistry();
+    std::lock_guard lg(registry.lock);
+
+    for(auto thread = registry.head; thread; thread = thread->stats.next) {
+        entries.push_back({thread, thread->label, thread->getStats()});
+    }
+#endif
+    return entries;
+}
+
+uint64_t Cothread::GetStatsFrequency() {
+    return GetTimestampFrequency();
+}
@@ -0,0 +1,356 @@
+#include <libcommunism/ConditionVariable.h>
+#include <libcommunism/Latch.h>
+#include <libcommunism/Mutex.h>
+#include <libcommunism/Semaphore.h>
+#include <libcommunism/WaitQueue.h>
+
+using namespace libcommunism;
+
+/**
+ * @brief Waiter that may be handed ownership of whatever it's waiting for
+ *
+ * When the waker sets the flag, the waiter owns the lock (or permit) on wakeup; otherwise, it
+ * needs to compete for it again.
+ */
+struct HandoffWaiter: WaitQueue::Waiter {
+    /// Set if ownership was handed to the waiter
+    bool handoff{false};
+};
+
+
+
+/**
+ * Acquires the mutex after the fast path failed. The state is set to contended before waiting, so
+ * that the unlock knows to wake us.
+ */
+void Mutex::lockSlow() {
+    std::unique_lock<std::mutex> lock(this->queueLock);
+
+    while(true) {
+        HandoffWaiter waiter;
+        WaitQueue::Prepare(waiter);
+
+        if(this->state.exchange(kContended, std::memory_order_acquire) == kUnlocked) {
+            return;
+        }
+
+        this->waiters.push(&waiter);
+        WaitQueue::Block(waiter, lock);
+
+        if(waiter.handoff) {
+            return;
+        }
+    }
+}
+
+/**
+ * Releases a contended mutex, waking the longest waiting cothread. Fair mutexes transfer
+ * ownership to it directly; the state stays locked throughout, so nobody can barge in.
+ */
+void Mutex::unlockSlow() {
+    std::unique_lock<std::mutex> lock(this->queueLock);
+
+    auto waiter = static_cast<HandoffWaiter *>(this->waiters.pop());
+    if(!waiter) {
+        this->state.store(kUnlocked, std::memory_order_release);
+        return;
+    }
+
+    if(this->fair) {
+        this->state.store(this->waiters.empty() ? kLocked : kContended, std::memory_order_relaxed);
+        waiter->handoff = true;
+    } else {
+        this->state.store(kUnlocked, std::memory_order_release);
+    }
+
+    WaitQueue::Wake(waiter);
+}
+
+
+
+/**
+ * Acquires the lock exclusively after the fast path failed.
+ *
+ * If there are no holders and nobody is waiting, we try to take the lock; otherwise, we mark the
+ * lock as having waiters and wait. The lock is always handed off to waiting writers.
+ */
+void SharedMutex::lockSlow() {
+    WaitQueue::Waiter waiter;
+    WaitQueue::Prepare(waiter);
+
+    std::unique_lock<std::mutex> lock(this->queueLock);
+
+    while(true) {
+        auto current = this->state.load(std::memory_order_relaxed);
+
+        if(!current && this->writers.empty() && this->readers.empty()) {
+            if(this->state.compare_exchange_weak(current, kWriter, std::memory_order_acquire,
+                        std::memory_order_relaxed)) {
+                return;
+            }
+            continue;
+        }
+
+        if(!(current & kWaiting) && !this->state.compare_exchange_weak(current,
+                    current | kWaiting, std::memory_order_relaxed, std::memory_order_relaxed)) {
+            continue;
+        }
+
+        this->writers.push(&waiter);
+        WaitQueue::Block(waiter, lock);
+        return;
+    }
+}
+
+/**
+ * Releases an exclusively held lock that has waiters. Waiting readers get the lock first, so that
+ * they can't be starved by a stream of writers.
+ */
+void SharedMutex::unlockSlow() {
+    std::unique_lock<std::mutex> lock(this->queueLock);
+    this->handOff(true);
+}
+
+/**
+ * Acquires the lock shared after the fast path failed.
+ *
+ * Readers may still take the lock if it isn't held by a writer, and no writers are waiting;
+ * otherwise they wait until a writer hands the lock off to them.
+ */
+void SharedMutex::lockSharedSlow() {
+    WaitQueue::Waiter waiter;
+    WaitQueue::Prepare(waiter);
+
+    std::unique_lock<std::mutex> lock(this->queueLock);
+
+    while(true) {
+        auto current = this->state.load(std::memory_order_relaxed);
+
+        if(!(current & kWriter) && this->writers.empty()) {
+            if(this->state.compare_exchange_weak(current, current + 1, std::memory_order_acquire,
+                        std::memory_order_relaxed)) {
+                return;
+            }
+            continue;
+        }
+
+        if(!(current & kWaiting) && !this->state.compare_exchange_weak(current,
+                    current | kWaiting, std::memory_order_relaxed, std::memory_order_relaxed)) {
+            continue;
+        }
+
+        this->readers.push(&waiter);
+        WaitQueue::Block(waiter, lock);
+        return;
+    }
+}
+
+/**
+ * Invoked by the last reader to release the lock while there are waiters. No new readers or
+ * writers can take the lock while the waiting flag is set, so the lock is still free once we get
+ * here, and it's handed to the next writer.
+ */
+void SharedMutex::unlockSharedSlow() {
+    std::unique_lock<std::mutex> lock(this->queueLock);
+
+    if(this->state.load(std::memory_order_relaxed) == kWaiting) {
+        this->handOff(false);
+    }
+}
+
+/**
+ * Hands the lock, which must not be held by anyone, to the waiters. Either all waiting readers
+ * are admitted at once, or the longest waiting writer; the waiting flag remains set if there are
+ * any waiters left afterwards.
+ *
+ * @remark The queue lock must be held by the caller.
+ *
+ * @param preferReaders Whether waiting readers are admitted before waiting writers
+ */
+void SharedMutex::handOff(const bool preferReaders) {
+    if(!this->readers.empty() && (preferReaders || this->writers.empty())) {
+        uint32_t numReaders{0};
+        while(auto waiter = this->readers.pop()) {
+            WaitQueue::Wake(waiter);
+            numReaders++;
+        }
+
+        // the woken readers can't proceed until we drop the queue lock
+        this->state.store(numReaders | (this->writers.empty() ? 0 : kWaiting),
+                std::memory_order_release);
+    } else if(auto waiter = this->writers.pop()) {
+        const bool hasWaiters = !this->writers.empty() || !this->readers.empty();
+        this->state.store(kWriter | (hasWaiters ? kWaiting : 0), std::memory_order_release);
+        WaitQueue::Wake(waiter);
+    } else {
+        this->state.store(0, std::memory_order_release);
+    }
+}
+
+
+
+/**
+ * Adds the calling cothread to the wait queue before releasing the mutex; since notifying takes
+ * the queue lock, no notifications can be missed in between.
+ */
+void ConditionVariable::wait(std::unique_lock<Mutex> &lock) {
+    WaitQueue::Waiter waiter;
+    WaitQueue::Prepare(waiter);
+
+    std::unique_lock<std::mutex> queue(this->queueLock);
+    this->numWaiters.fetch_add(1, std::memory_order_seq_cst);
+    this->waiters.push(&waiter);
+
+    lock.unlock();
+    WaitQueue::Block(waiter, queue);
+    queue.unlock();
+
+    this->numWaiters.fetch_sub(1, std::memory_order_relaxed);
+    lock.lock();
+}
+
+/**
+ * Wakes up to the given number of waiters, in the order they started waiting.
+ *
+ * @param count Maximum number of waiters to wake
+ */
+void ConditionVariable::notify(size_t count) {
+    std::unique_lock<std::mutex> lock(this->queueLock);
+
+    while(count--) {
+        auto waiter = this->waiters.pop();
+        if(!waiter) {
+            break;
+        }
+        WaitQueue::Wake(waiter);
+    }
+}
+
+
+
+/**
+ * Waits for a permit to become available. We announce that we're waiting before checking for
+ * permits again, so that either we see a released permit, or the release sees us.
+ */
+void Semaphore::acquireSlow() {
+    std::unique_lock<std::mutex> lock(this->queueLock);
+
+    while(true) {
+        HandoffWaiter waiter;
+        WaitQueue::Prepare(waiter);
+
+        this->numWaiters.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if(this->tryAcquire()) {
+            this->numWaiters.fetch_sub(1, std::memory_order_relaxed);
+            return;
+        }
+
+        this->waiters.push(&waiter);
+        WaitQueue::Block(waiter, lock);
+
+        this->numWaiters.fetch_sub(1, std::memory_order_relaxed);
+        if(waiter.handoff) {
+            return;
+        }
+    }
+}
+
+/**
+ * Wakes waiters after permits were released. Fair semaphores acquire permits on behalf of the
+ * waiters, in FIFO order; otherwise, one waiter is woken per released permit, and it competes for
+ * it when it runs.
+ *
+ * @param count Number of permits that were released
+ */
+void Semaphore::releaseSlow(size_t count) {
+    std::unique_lock<std::mutex> lock(this->queueLock);
+
+    if(this->fair) {
+        while(!this->waiters.empty() && this->tryAcquire()) {
+            auto waiter = static_cast<HandoffWaiter *>(this->waiters.pop());
+            waiter->handoff = true;
+            WaitQueue::Wake(waiter);
+        }
+    } else {
+        while(count--) {
+            auto waiter = this->waiters.pop();
+            if(!waiter) {
+                break;
+            }
+            WaitQueue::Wake(waiter);
+        }
+    }
+}
+
+
+
+/**
+ * Wakes all waiters once the latch reached zero.
+ */
+void Latch::release() {
+    std::unique_lock<std::mutex> lock(this->queueLock);
+
+    while(auto waiter = this->waiters.pop()) {
+        WaitQueue::Wake(waiter);
+    }
+}
+
+/**
+ * Waits for the latch to reach zero. The count is checked again with the queue lock held, since
+ * the release takes the lock after the count reaches zero.
+ */
+void Latch::waitSlow() {
+    std::unique_lock<std::mutex> lock(this->queueLock);
+    if(this->tryWait()) {
+        return;
+    }
+
+    WaitQueue::Waiter waiter;
+    WaitQueue::Prepare(waiter);
+    this->waiters.push(&waiter);
+    WaitQueue::Block(waiter, lock);
+}
+
+
+
+void Barrier::arriveAndWait() {
+    WaitQueue::Waiter waiter;
+    WaitQueue::Prepare(waiter);
+
+    std::unique_lock<std::mutex> lock(this->queueLock);
+    if(this->arrive()) {
+        return;
+    }
+
+    this->waiters.push(&waiter);
+    WaitQueue::Block(waiter, lock);
+}
+
+void Barrier::arriveAndDrop() {
+    std::unique_lock<std::mutex> lock(this->queueLock);
+    this->expected--;
+    this->arrive();
+}
+
+/**
+ * Records the arrival of a cothread. If it was the last one to arrive in this phase, all waiters
+ * are woken and the next phase begins.
+ *
+ * @remark The queue lock must be held by the caller.
+ *
+ * @return Whether the phase was completed
+ */
+bool Barrier::arrive() {
+    if(--this->remaining) {
+        return false;
+    }
+
+    this->remaining = this->expected;
+
+    while(auto waiter = this->waiters.pop()) {
+        WaitQueue::Wake(waiter);
+    }
+    return true;
+}
@@ -0,0 +1,343 @@
+#include <libcommunism/TimerWheel.h>
+#include <libcommunism/Scheduler.h>
+#include <libcommunism/WaitQueue.h>
+
+#include <algorithm>
+#include <bit>
+#include <stdexcept>
+#include <thread>
+
+using namespace libcommunism;
+
+/**
+ * Number of ticks covered by all levels of the wheel. Timers on the overflow list are moved into
+ * the wheel whenever the current tick crosses a multiple of this.
+ */
+constexpr static const uint64_t kOverflowSpan{1ULL << 36};
+
+/**
+ * @brief A timer that wakes up a sleeping cothread
+ */
+struct Sleeper: TimerWheel::Timer {
+    /// Cothread to unpark when the timer expires
+    Cothread *thread{nullptr};
+    /// Set once the timer expired
+    bool expired{false};
+
+    explicit Sleeper(Cothread *thread) : thread(thread) {
+        this->callback = [](TimerWheel::Timer *timer) {
+            auto sleeper = static_cast<Sleeper *>(timer);
+            sleeper->expired = true;
+            Scheduler::Unpark(sleeper->thread);
+        };
+    }
+};
+
+/**
+ * Initializes an empty circular list of timers.
+ */
+static inline void InitList(TimerWheel::Timer &list) {
+    list.next = list.prev = &list;
+}
+
+/**
+ * Moves all timers from one circular list to another, empty one.
+ */
+static inline void SpliceList(TimerWheel::Timer &from, TimerWheel::Timer &to) {
+    if(from.next == &from) {
+        return;
+    }
+
+    to.next = from.next;
+    to.prev = from.prev;
+    to.next->prev = &to;
+    to.prev->next = &to;
+    InitList(from);
+}
+
+TimerWheel::TimerWheel(const Clock::duration resolution, const Clock::time_point epoch) :
+    resolution(std::max<Clock::rep>(resolution.count(), 1)), epoch(epoch) {
+    for(auto &level : this->levels) {
+        for(auto &slot : level.slots) {
+            InitList(slot);
+        }
+    }
+    InitList(this->overflow);
+}
+
+TimerWheel::~TimerWheel() {
+    auto release = [](Timer &list) {
+        for(auto timer = list.next; timer != &list;) {
+            auto next = timer->next;
+            timer->next = timer->prev = nullptr;
+            timer = next;
+        }
+    };
+
+    for(auto &level : this->levels) {
+        for(auto &slot : level.slots) {
+            release(slot);
+        }
+    }
+    release(this->overflow);
+}
+
+void TimerWheel::schedule(Timer &timer, const Clock::time_point deadline) {
+    if(timer.isPending()) {
+        this->unlink(timer);
+    } else {
+        this->numPending++;
+    }
+
+    // the current tick was already processed, so deadlines in it (or in the past) expire next
+    timer.expiry = std::max(this->getExpiry(deadline), this->current + 1);
+    this->insert(timer);
+}
+
+bool TimerWheel::cancel(Timer &timer) {
+    if(!timer.isPending()) {
+        return false;
+    }
+
+    this->unlink(timer);
+    this->numPending--;
+    return true;
+}
+
+size_t TimerWheel::advance(const Clock::time_point now) {
+    constexpr static const uint64_t kSlotMask{kNumSlots - 1};
+
+    const auto target = this->getTick(now);
+    size_t numExpired{0};
+
+    for(auto next = this->getNextEvent(); next <= target; next = this->getNextEvent()) {
+        this->current = next;
+
+        // move timers from higher levels down, if we've reached their slot
+        if(!(next % kOverflowSpan)) {
+            this->cascade(this->overflow);
+        }
+        for(size_t level = kNumLevels - 1; level > 0; level--) {
+            const auto shift = level * kSlotBits;
+            if(next & ((1ULL << shift) - 1)) {
+                continue;
+            }
+
+            const auto slot = (next >> shift) & kSlotMask;
+            if(this->levels[level].occupied & (1ULL << slot)) {
+                this->levels[level].occupied &= ~(1ULL << slot);
+                this->cascade(this->levels[level].slots[slot]);
+            }
+        }
+
+        // then expire everything in the lowest level's slot
+        const auto slot = next & kSlotMask;
+        if(!(this->levels[0].occupied & (1ULL << slot))) {
+            continue;
+        }
+        this->levels[0].occupied &= ~(1ULL << slot);
+
+        // callbacks may cancel other timers that are about to expire
+        Timer expired;
+        InitList(expired);
+        SpliceList(this->levels[0].slots[slot], expired);
+
+        while(expired.next != &expired) {
+            auto timer = expired.next;
+            expired.next = timer->next;
+            timer->next->prev = &expired;
+
+            timer->next = timer->prev = nullptr;
+            this->numPending--;
+            numExpired++;
+
+            timer->callback(timer);
+        }
+    }
+
+    this->current = std::max(this->current, target);
+    return numExpired;
+}
+
+std::optional<TimerWheel::Clock::time_point> TimerWheel::getNextDeadline() const {
+    const auto next = this->getNextEvent();
+    if(next == UINT64_MAX) {
+        return std::nullopt;
+    }
+    return this->epoch + Clock::duration(static_cast<Clock::rep>(next) * this->resolution);
+}
+
+void TimerWheel::sleepUntil(const Clock::time_point deadline) {
+    // the sleeper would be overwritten by other cothreads on the stack while we're parked
+    if(Cothread::Current()->isOnSharedStack()) {
+        std::this_thread::sleep_until(deadline);
+        return;
+    }
+
+    WaitQueue::Waiter waiter;
+    WaitQueue::Prepare(waiter);
+
+    if(waiter.mode != WaitQueue::Waiter::Mode::Scheduler) {
+        std::this_thread::sleep_until(deadline);
+        return;
+    }
+
+    Sleeper sleeper(waiter.thread);
+    this->schedule(sleeper, deadline);
+
+    while(!sleeper.expired) {
+        Scheduler::Park();
+    }
+}
+
+bool TimerWheel::parkUntil(const Clock::time_point deadline) {
+    WaitQueue::Waiter waiter;
+    WaitQueue::Prepare(waiter);
+
+    if(waiter.mode != WaitQueue::Waiter::Mode::Scheduler) {
+        throw std::runtime_error("Only cothreads spawned through the Scheduler may park");
+    }
+
+    Sleeper sleeper(waiter.thread);
+    this->schedule(sleeper, deadline);
+
+    Scheduler::Park();
+
+    this->cancel(sleeper);
+    return !sleeper.expired;
+}
+
+size_t TimerWheel::run() {
+    Scheduler::Spawn([this]() {
+        while(true) {
+            this->advance();
+
+            if(Scheduler::HasRunnable()) {
+                Scheduler::Yield();
+            } else if(this->numPending) {
+                std::this_thread::sleep_until(*this->getNextDeadline());
+            } else {
+                break;
+            }
+        }
+    });
+
+    return Scheduler::Run();
+}
+
+/**
+ * Inserts a timer into the slot that corresponds to its expiry: this is determined by the highest
+ * group of bits in which the expiry differs from the current tick. A timer that expires in the
+ * current tick (which happens when it's cascaded down on reaching its expiry) goes into the
+ * lowest level's current slot instead, which advance() expires right after cascading.
+ */
+void TimerWheel::insert(Timer &timer) {
+    Timer *list;
+
+    if(timer.expiry <= this->current) {
+        const auto slot = this->current & (kNumSlots - 1);
+        list = &this->levels[0].slots[slot];
+        this->levels[0].occupied |= (1ULL << slot);
+    } else if(const auto level = (std::bit_width(timer.expiry ^ this->current) - 1) / kSlotBits;
+            level >= kNumLevels) {
+        list = &this->overflow;
+    } else {
+        const auto slot = (timer.expiry >> (level * kSlotBits)) & (kNumSlots - 1);
+        list = &this->levels[level].slots[slot];
+        this->levels[level].occupied |= (1ULL << slot);
+    }
+
+    timer.next = list;
+    timer.prev = list->prev;
+    list->prev->next = &timer;
+    list->prev = &timer;
+}
+
+/**
+ * Removes a timer from its slot, and marks the slot as empty if it was the last one. The slot is
+ * found the same way as when it was inserted: the current tick hasn't reached the slot since (or
+ * the timer would have been moved) so the expiry still differs in the same group of bits.
+ */
+void TimerWheel::unlink(Timer &timer) {
+    timer.prev->next = timer.next;
+    timer.next->prev = timer.prev;
+    timer.next = timer.prev = nullptr;
+
+    const auto diff = timer.expiry ^ this->current;
+    const auto level = diff ? (std::bit_width(diff) - 1) / kSlotBits : 0;
+    if(level >= kNumLevels) {
+        return;
+    }
+
+    const auto slot = (timer.expiry >> (level * kSlotBits)) & (kNumSlots - 1);
+    const auto &list = this->levels[level].slots[slot];
+    if(list.next == &list) {
+        this->levels[level].occupied &= ~(1ULL << slot);
+    }
+}
+
+/**
+ * Re-inserts all timers from a list, relative to the current tick.
+ */
+void TimerWheel::cascade(Timer &list) {
+    Timer timers;
+    InitList(timers);
+    SpliceList(list, timers);
+
+    while(timers.next != &timers) {
+        auto timer = timers.next;
+        timers.next = timer->next;
+        timer->next->prev = &timers;
+
+        this->insert(*timer);
+    }
+}
+
+/**
+ * Determines the next tick at which something happens: either timers expire, or they need to be
+ * moved down from a higher level. Every occupied slot is ahead of the current tick in its level,
+ * and lower levels always come first.
+ *
+ * @return Next tick to process, or `UINT64_MAX` if there are no timers.
+ */
+uint64_t TimerWheel::getNextEvent() const {
+    for(size_t level = 0; level < kNumLevels; level++) {
+        const auto shift = level * kSlotBits;
+        const auto index = (this->current >> shift) & (kNumSlots - 1);
+        if(index == kNumSlots - 1) {
+            continue;
+        }
+
+        const auto ahead = this->levels[level].occupied & (~0ULL << (index + 1));
+        if(ahead) {
+            const uint64_t slot = std::countr_zero(ahead);
+            const auto base = this->current & ~((1ULL << (shift + kSlotBits)) - 1);
+            return base | (slot << shift);
+        }
+    }
+
+    if(this->overflow.next != &this->overflow) {
+        return (this->current | (kOverflowSpan - 1)) + 1;
+    }
+    return UINT64_MAX;
+}
+
+/**
+ * Converts a point in time to the tick it falls into.
+ */
+uint64_t TimerWheel::getTick(const Clock::time_point time) const {
+    if(time <= this->epoch) {
+        return 0;
+    }
+    return (time - this->epoch).count() / this->resolution;
+}
+
+/**
+ * Converts a deadline to the first tick that begins at or after it, so timers never expire early.
+ */
+uint64_t TimerWheel::getExpiry(const Clock::time_point deadline) const {
+    if(deadline <= this->epoch) {
+        return 0;
+    }
+    return ((deadline - this->epoch).count() + this->resolution - 1) / this->resolution;
+}
@@ -0,0 +1,42 @@
+#ifndef TIMESTAMP_H
+#define TIMESTAMP_H
+
+#include <chrono>
+#include <cstdint>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace libcommunism::internal {
+/**
+ * Reads a cheap, monotonically increasing timestamp; this is the timestamp counter on x86, the
+ * virtual counter on aarch64, and the steady clock (in nanoseconds) elsewhere.
+ *
+ * It's read on every context switch when cothread statistics are enabled, so it must not make a
+ * system call.
+ */
+inline uint64_t ReadTimestamp() noexcept {
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t value;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(value));
+    return value;
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+/**
+ * Gets the frequency at which the timestamp returned by ReadTimestamp() increments.
+ *
+ * @return Timestamp ticks per second
+ */
+uint64_t GetTimestampFrequency();
+}
+
+#endif
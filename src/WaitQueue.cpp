@@ -0,0 +1,67 @@
+#include <libcommunism/WaitQueue.h>
+#include <libcommunism/Runtime.h>
+#include <libcommunism/Scheduler.h>
+
+#include <stdexcept>
+
+using namespace libcommunism;
+
+void WaitQueue::Prepare(Waiter &waiter) {
+    auto thread = Cothread::Current();
+    if(thread->isOnSharedStack()) [[unlikely]] {
+        throw std::runtime_error("Cothreads on a shared stack can't block in a wait queue");
+    }
+
+    waiter.thread = thread;
+    waiter.next = nullptr;
+    waiter.woken.store(0, std::memory_order_relaxed);
+    waiter.local = false;
+
+    if(thread->runtime) {
+        waiter.mode = Waiter::Mode::Runtime;
+    } else if(thread->hook.spawned) {
+        waiter.mode = Waiter::Mode::Scheduler;
+    } else {
+        waiter.mode = Waiter::Mode::Kernel;
+    }
+}
+
+void WaitQueue::Block(Waiter &waiter, std::unique_lock<std::mutex> &lock) {
+    lock.unlock();
+
+    while(!waiter.woken.load(std::memory_order_acquire)) {
+        switch(waiter.mode) {
+            case Waiter::Mode::Kernel:
+                waiter.woken.wait(0, std::memory_order_acquire);
+                break;
+            case Waiter::Mode::Scheduler:
+                if(waiter.local) {
+                    Scheduler::Park();
+                } else {
+                    Scheduler::ParkWaiting();
+                }
+                break;
+            case Waiter::Mode::Runtime:
+                Runtime::Park();
+                break;
+        }
+    }
+
+    lock.lock();
+}
+
+void WaitQueue::Wake(Waiter *waiter) {
+    waiter->woken.store(1, std::memory_order_release);
+
+    switch(waiter->mode) {
+        case Waiter::Mode::Kernel:
+            waiter->woken.notify_one();
+            break;
+        case Waiter::Mode::Scheduler:
+            Scheduler::Unpark(waiter->thread);
+            break;
+        case Waiter::Mode::Runtime:
+            Runtime::Unpark(waiter->thread);
+            break;
+    }
+}
@@ -4,6 +4,7 @@
  */
 #include "Common.h"
 #include "CothreadPrivate.h"
+#include "StackPoolPrivate.h"
 
 #include "AAPCS.S"
 
@@ -16,37 +17,31 @@ using namespace libcommunism::internal;
 extern "C" void Aarch64AapcsEntryStub();
 
 /**
- * Allocates memory for a stack that's the given number of bytes in size. We simply take it from
- * the system heap.
+ * Allocates memory for a stack that's the given number of bytes in size. We take it from the stack
+ * pool, which in turn gets it from the system heap.
  *
  * @remark If required (for page alignment, for example) the size may be rounded up.
  *
  * @param bytes Size of the stack memory, in bytes.
+ * @param type Kind of memory to allocate for the stack
  *
  * @throw std::runtime_error If memory allocation failed
  * @return Pointer to the _top_ of allocated stack
  */
-void *Aarch64::AllocStack(const size_t bytes) {
-    void* buf{ nullptr };
-    int err{ -1 };
-
-    err = posix_memalign(&buf, kStackAlignment, bytes);
-    if (err) {
-        throw std::runtime_error("posix_memalign() failed");
-    }
-
-    return buf;
+void *Aarch64::AllocStack(const size_t bytes, const StackType type) {
+    return AllocPooledStack(bytes, type);
 }
 
 /**
  * Releases previously allocated stack memory.
  *
  * @param stack Pointer to the top of previously allocated stack.
+ * @param bytes Size of the stack memory, as passed to AllocStack()
  *
  * @throw std::runtime_error If deallocating stack fails (invalid pointer)
  */
-void Aarch64::DeallocStack(void* stack) {
-    free(stack);
+void Aarch64::DeallocStack(void* stack, const size_t bytes) {
+    FreePooledStack(stack, bytes);
 }
 
 /**
@@ -54,27 +49,25 @@ void Aarch64::DeallocStack(void* stack) {
  * entry handler method, which in turn will invoke the entry point. It also invokes the return
  * handler if the entry pointer returns.
  *
- * For aarch64, the register state is always written at the top of the context buffer.
+ * For aarch64, the register state is always written at the top of the context buffer. The stack
+ * itself grows down from the entry record.
  *
  * @param thread Thread whose stack to prepare
- * @param main Entry point for the cothread
+ * @param entry Entry record of the cothread
  */
-void Aarch64::Prepare(Aarch64 *thread, const Entry &entry) {
+void Aarch64::Prepare(Aarch64 *thread, EntryRecord *entry) {
     static_assert(offsetof(Aarch64, stackTop) == COTHREAD_OFF_CONTEXT_TOP, "cothread stack top is invalid");
 
-    // build the context structure we pass to our "fake" entry point
-    auto info = new CallInfo{entry};
-    if(!info) throw std::runtime_error("Failed to allocate call info");
+    auto &stack = thread->stack;
+    ValidateStackSize(stack.size() * sizeof(uintptr_t));
 
     // build up the stack frame
-    auto &stack = thread->stack;
-    const auto stackBottom = reinterpret_cast<uintptr_t>(stack.data()) +
-        (stack.size() * sizeof(uintptr_t));
+    const auto stackBottom = reinterpret_cast<uintptr_t>(entry) & ~(kStackAlignment - 1);
     auto context = reinterpret_cast<uintptr_t *>(stack.data());
 
     context[0]  = stackBottom; // sp
     context[1]  = reinterpret_cast<uintptr_t>(Aarch64AapcsEntryStub); // x30/lr
-    context[2]  = reinterpret_cast<uintptr_t>(info); // x19
+    context[2]  = reinterpret_cast<uintptr_t>(entry); // x19
     context[12] = stackBottom; //x29/fp
 
     // we use the `stackTop` ptr to point to the context area
@@ -2,6 +2,7 @@
  * Common code for implementing context switching on aarch64
  */
 #include "Common.h"
+#include "AllocImpl.h"
 #include "CothreadPrivate.h"
 
 #include <algorithm>
@@ -23,14 +24,14 @@ thread_local std::array<uintptr_t, Aarch64::kMainStackSize> Aarch64::gMainStack;
 /**
  * Allocate a cothread with a private stack.
  *
- * @param entry Method to execute on entry to this cothread
  * @param stackSize Size of the stack to be allocated, in bytes. it should be a multiple of the
  *        machine word size, or specify zero to use the platform default.
+ * @param stackType Kind of memory to allocate for the stack
  *
  * @throw std::runtime_error If the memory for the cothread could not be allocated.
- * @throw std::runtime_error If the provided stack size is invalid
  */
-Aarch64::Aarch64(const Entry &entry, const size_t stackSize) : CothreadImpl(entry, stackSize) {
+Aarch64::Aarch64(const size_t stackSize, const StackType stackType) :
+    CothreadImpl(stackSize, stackType) {
     void *buf{nullptr};
 
     // round down stack size to ensure it's aligned before allocating it
@@ -38,26 +39,11 @@ Aarch64::Aarch64(const Entry &entry, const size_t stackSize) : CothreadImpl(entr
     allocSize = allocSize ? allocSize : Aarch64::kDefaultStackSize;
     allocSize += Aarch64::kContextSaveAreaSize;
 
-    buf = Aarch64::AllocStack(allocSize);
+    buf = Aarch64::AllocStack(allocSize, stackType);
 
     // create it as if we had provided the memory in the first place
     this->stack = {reinterpret_cast<uintptr_t *>(buf), allocSize / sizeof(uintptr_t)};
     this->ownsStack = true;
-
-    Aarch64::Prepare(this, entry);
-}
-
-/**
- * Allocates a cothread with an already provided stack.
- *
- * @param entry Method to execute on entry to this cothread
- * @param stack Buffer to use as the stack of the cothread
- *
- * @throw std::runtime_error If the provided stack is invalid
- */
-Aarch64::Aarch64(const Entry &entry, std::span<uintptr_t> _stack) : CothreadImpl(entry, _stack) {
-    Aarch64::ValidateStackSize(_stack.size() * sizeof(uintptr_t));
-    Aarch64::Prepare(this, entry);
 }
 
 /**
@@ -73,19 +59,10 @@ Aarch64::Aarch64(std::span<uintptr_t> stack) : CothreadImpl(stack), stackTop(sta
  */
 Aarch64::~Aarch64() {
     if(this->ownsStack) {
-        DeallocStack(this->stack.data());
+        DeallocStack(this->stack.data(), this->stack.size() * sizeof(uintptr_t));
     }
 }
 
-/**
- * Performs a context switch to the provided cothread.
- *
- * The state of the caller is stored on the stack of the currently active thread.
- */
-void Aarch64::switchTo(CothreadImpl *from) {
-    Switch(static_cast<Aarch64 *>(from), this);
-}
-
 /**
  * Ensures the provided stack size is valid.
  *
@@ -107,14 +84,13 @@ void Aarch64::CothreadReturned() {
 }
 
 /**
- * Performs the call described inside a call info structure, then invokes the return handler if it
+ * Invokes the entry point described by an entry record, then invokes the return handler if it
  * returns.
  *
- * @param info Pointer to the call info structure; it's deleted once the call returns.
+ * @param entry Entry record of the cothread
  */
-void Aarch64::DereferenceCallInfo(CallInfo *info) {
-    info->entry();
-    delete info;
+void Aarch64::InvokeEntry(EntryRecord *entry) {
+    entry->invoke(entry);
 
     CothreadReturned();
     gReturnHandler(Cothread::Current());
@@ -126,12 +102,10 @@ void Aarch64::DereferenceCallInfo(CallInfo *info) {
 
 
 /**
- * Allocates the current physical (kernel) thread's Cothread object.
- *
- * @note This will leak the associated cothread object, unless the caller stores it somewhere and
- *       ensures they deallocate it later when the underlying kernel thread is destroyed.
+ * Allocates the implementation for the current physical (kernel) thread's Cothread object, in the
+ * provided buffer.
  */
-CothreadImpl *libcommunism::AllocKernelThreadWrapper() {
-    return new Aarch64(Aarch64::gMainStack);
+Aarch64 *Aarch64::AllocKernelThread(std::span<uintptr_t> buffer, bool &bufferUsed) {
+    return AllocImplHelper<Aarch64>(buffer, bufferUsed, Aarch64::gMainStack);
 }
 
@@ -16,40 +16,42 @@ namespace libcommunism::internal {
  *         0x100 bytes fewer than provided are available as actual program stack.
  */
 class Aarch64 final: public CothreadImpl {
-    friend CothreadImpl *libcommunism::AllocKernelThreadWrapper();
-
-    /**
-     * @brief Information required to make a function call for a cothread's entry point.
-     */
-    struct CallInfo {
-        /// Entry point of the cothread
-        Cothread::Entry entry;
-    };
+    friend class libcommunism::Cothread;
+    template<class Backend> friend class libcommunism::BasicCothread;
 
     public:
-        Aarch64(const Entry &entry, const size_t stackSize = 0);
-        Aarch64(const Entry &entry, std::span<uintptr_t> stack);
+        Aarch64(const size_t stackSize = 0, const StackType stackType = StackType::Default);
         Aarch64(std::span<uintptr_t> stack);
         ~Aarch64();
 
-        void switchTo(CothreadImpl *from) override;
 
     private:
         static void AllocMainCothread();
         static void ValidateStackSize(const size_t size);
-        static void *AllocStack(const size_t bytes);
-        static void DeallocStack(void* stack);
+        static void *AllocStack(const size_t bytes, const StackType type);
+        static void DeallocStack(void* stack, const size_t bytes);
         static void CothreadReturned();
-        static void DereferenceCallInfo(CallInfo *info);
+        static void InvokeEntry(EntryRecord *entry);
 
         /**
-         * Given a wrapper structure and initial function to invoke, prepares the context of the
-         * cothread such that it will return to the start of this method.
+         * Given a wrapper structure and its entry record, prepares the context of the cothread such
+         * that it will invoke the entry record when first switched to.
          *
          * @param thread Cothread whose stack frame is to be prepared
-         * @param entry Function to return control to when switching to this cothread
+         * @param entry Entry record, at the high end of the cothread's stack
+         *
+         * @throw std::runtime_error Stack size is invalid
          */
-        static void Prepare(Aarch64 *thread, const Entry &entry);
+        static void Prepare(Aarch64 *thread, EntryRecord *entry);
+
+        /**
+         * Allocates the implementation for a cothread that represents the calling kernel thread,
+         * which saves its context into the per thread main stack.
+         *
+         * @param buffer Buffer into which the implementation should be allocated, if it fits
+         * @param bufferUsed Set if the implementation was allocated in the buffer
+         */
+        static Aarch64 *AllocKernelThread(std::span<uintptr_t> buffer, bool &bufferUsed);
 
         /**
          * Performs a context switch.
@@ -59,7 +61,21 @@ class Aarch64 final: public CothreadImpl {
          * @param from Cothread buffer that will receive the current context
          * @param to Cothread buffer whose context is to be restored
          */
-        static void Switch(Aarch64 *from, Aarch64 *to);
+        static void Switch(Aarch64 *from, Aarch64 *to) noexcept;
+
+        /**
+         * Performs a context switch, passing a value to the destination cothread. The value is
+         * returned in a register from the call to this method that `to` is suspended in.
+         *
+         * @remark This is the same assembly routine as Switch().
+         *
+         * @param from Cothread buffer that will receive the current context
+         * @param to Cothread buffer whose context is to be restored
+         * @param value Value to pass to the destination cothread
+         *
+         * @return Value passed by the cothread that switches back to this one
+         */
+        static uintptr_t Transfer(Aarch64 *from, Aarch64 *to, const uintptr_t value) noexcept;
 
     public:
         /**
@@ -2,6 +2,7 @@
  * AMD64 implementation of cothreads for all ABIs
  */
 #include "Common.h"
+#include "AllocImpl.h"
 #include "CothreadPrivate.h"
 
 #include <algorithm>
@@ -21,41 +22,25 @@ thread_local std::array<uintptr_t, Amd64::kMainStackSize> Amd64::gMainStack;
 /**
  * Allocates an amd64 thread, allocating its stack.
  *
- *
- * @param entry Method to execute on entry to this cothread
  * @param stackSize Size of the stack to be allocated, in bytes. it should be a multiple of the
  *        machine word size, or specify zero to use the platform default.
+ * @param stackType Kind of memory to allocate for the stack
  *
  * @throw std::runtime_error If the memory for the cothread could not be allocated.
- * @throw std::runtime_error If the provided stack size is invalid
  */
-Amd64::Amd64(const Entry &entry, const size_t stackSize) : CothreadImpl(entry, stackSize) {
+Amd64::Amd64(const size_t stackSize, const StackType stackType) :
+    CothreadImpl(stackSize, stackType) {
     void *buf{nullptr};
 
     // round down stack size to ensure it's aligned before allocating it
     auto allocSize = stackSize & ~(kStackAlignment - 1);
     allocSize = allocSize ? allocSize : kDefaultStackSize;
 
-    buf = AllocStack(allocSize);
+    buf = AllocStack(allocSize, stackType);
 
     // create it as if we had provided the memory in the first place
     this->stack = {reinterpret_cast<uintptr_t *>(buf), allocSize / sizeof(uintptr_t)};
     this->ownsStack = true;
-
-    Prepare(this, entry);
-}
-
-/**
- * Allocates and amd64 cothread with an already provided stack.
- *
- * @param entry Method to execute on entry to this cothread
- * @param stack Buffer to use as the stack of the cothread
- *
- * @throw std::runtime_error If the provided stack is invalid
- */
-Amd64::Amd64(const Entry &entry, std::span<uintptr_t> _stack) : CothreadImpl(entry, _stack) {
-    ValidateStackSize(_stack.size() * sizeof(uintptr_t));
-    Prepare(this, entry);
 }
 
 /**
@@ -63,19 +48,10 @@ Amd64::Amd64(const Entry &entry, std::span<uintptr_t> _stack) : CothreadImpl(ent
  */
 Amd64::~Amd64() {
     if(this->ownsStack) {
-        DeallocStack(this->stack.data());
+        DeallocStack(this->stack.data(), this->stack.size() * sizeof(uintptr_t));
     }
 }
 
-/**
- * Performs a context switch to the provided cothread.
- *
- * The state of the caller is stored on the stack of the currently active thread.
- */
-void Amd64::switchTo(CothreadImpl *from) {
-    Switch(static_cast<Amd64 *>(from), this);
-}
-
 /**
  * The currently running cothread returned from its main function. This is very naughty behavior.
  */
@@ -84,23 +60,20 @@ void Amd64::CothreadReturned() {
 }
 
 /**
- * Performs the call described inside a call info structure.
+ * Invokes the entry point described by an entry record.
  *
- * @param info Pointer to the call info structure; it's deleted once the call returns.
+ * @param entry Entry record of the cothread
  */
-void Amd64::DereferenceCallInfo(CallInfo *info) {
-    info->entry();
-    delete info;
+void Amd64::InvokeEntry(EntryRecord *entry) {
+    entry->invoke(entry);
 }
 
 
 
 /**
- * Allocates the current physical (kernel) thread's Cothread object.
- *
- * @note This will leak the associated cothread object, unless the caller stores it somewhere and
- *       ensures they deallocate it later when the underlying kernel thread is destroyed.
+ * Allocates the implementation for the current physical (kernel) thread's Cothread object, in the
+ * provided buffer.
  */
-CothreadImpl *libcommunism::AllocKernelThreadWrapper() {
-    return new Amd64(Amd64::gMainStack);
+Amd64 *Amd64::AllocKernelThread(std::span<uintptr_t> buffer, bool &bufferUsed) {
+    return AllocImplHelper<Amd64>(buffer, bufferUsed, Amd64::gMainStack);
 }
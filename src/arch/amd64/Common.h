@@ -14,24 +14,17 @@ namespace libcommunism::internal {
  * @brief Architecture specific methods for working with cothreads on amd64 based systems.
  */
 class Amd64 final: public CothreadImpl {
-    friend CothreadImpl *libcommunism::AllocKernelThreadWrapper();
-
-    private:
-        /**
-         * @brief Information required to make a function call for a cothread's entry point.
-         */
-        struct CallInfo {
-            /// Entry point of the cothread
-            Cothread::Entry entry;
-        };
+    friend class libcommunism::Cothread;
+    template<class Backend> friend class libcommunism::BasicCothread;
 
     public:
-        Amd64(const Entry &entry, const size_t stackSize = 0);
-        Amd64(const Entry &entry, std::span<uintptr_t> stack);
+        Amd64(const size_t stackSize = 0, const StackType stackType = StackType::Default);
         Amd64(std::span<uintptr_t> stack) : CothreadImpl(stack) {}
         ~Amd64();
 
-        void switchTo(CothreadImpl *from) override;
+        void *getStackPointer() const override {
+            return this->stackTop;
+        }
 
     private:
         /**
@@ -49,19 +42,21 @@ class Amd64 final: public CothreadImpl {
          * @remark If required (for page alignment, for example) the size may be rounded up.
          *
          * @param bytes Size of the stack memory, in bytes.
+         * @param type Kind of memory to allocate for the stack
          * 
          * @return Pointer to the _top_ of allocated stack
          */
-        static void* AllocStack(const size_t bytes);
+        static void* AllocStack(const size_t bytes, const StackType type);
 
         /**
          * Releases previously allocated stack memory.
          * 
          * @param stack Pointer to the top of previously allocated stack.
+         * @param bytes Size of the stack memory, as passed to AllocStack()
          * 
          * @throw std::runtime_error If deallocating stack fails (invalid pointer)
          */
-        static void DeallocStack(void* stack);
+        static void DeallocStack(void* stack, const size_t bytes);
 
         /**
          * Invoked when the main method of a cothread returns.
@@ -69,20 +64,31 @@ class Amd64 final: public CothreadImpl {
         static void CothreadReturned();
 
         /**
-         * Performs the call described inside a call info structure.
+         * Invokes the entry point described by an entry record.
          *
-         * @param info Pointer to the call info structure; it's deleted once the call returns.
+         * @param entry Entry record of the cothread
          */
-        static void DereferenceCallInfo(CallInfo *info);
+        static void InvokeEntry(EntryRecord *entry);
 
         /**
-         * Given a wrapper structure and initial function to invoke, prepares the context of the
-         * cothread such that it will return to the start of this method.
+         * Given a wrapper structure and its entry record, prepares the context of the cothread such
+         * that it will invoke the entry record when first switched to.
          *
          * @param thread Cothread whose stack frame is to be prepared
-         * @param entry Function to return control to when switching to this cothread
+         * @param entry Entry record, at the high end of the cothread's stack
+         *
+         * @throw std::runtime_error Stack size is invalid
          */
-        static void Prepare(Amd64 *thread, const Entry &entry);
+        static void Prepare(Amd64 *thread, EntryRecord *entry);
+
+        /**
+         * Allocates the implementation for a cothread that represents the calling kernel thread,
+         * which saves its context into the per thread main stack.
+         *
+         * @param buffer Buffer into which the implementation should be allocated, if it fits
+         * @param bufferUsed Set if the implementation was allocated in the buffer
+         */
+        static Amd64 *AllocKernelThread(std::span<uintptr_t> buffer, bool &bufferUsed);
 
         /**
          * Performs a context switch.
@@ -93,7 +99,21 @@ class Amd64 final: public CothreadImpl {
          * @param from Cothread buffer that will receive the current context
          * @param to Cothread buffer whose context is to be restored
          */
-        static void Switch(Amd64 *from, Amd64 *to);
+        static void Switch(Amd64 *from, Amd64 *to) noexcept;
+
+        /**
+         * Performs a context switch, passing a value to the destination cothread. The value is
+         * returned in a register from the call to this method that `to` is suspended in.
+         *
+         * @remark This is the same assembly routine as Switch().
+         *
+         * @param from Cothread buffer that will receive the current context
+         * @param to Cothread buffer whose context is to be restored
+         * @param value Value to pass to the destination cothread
+         *
+         * @return Value passed by the cothread that switches back to this one
+         */
+        static uintptr_t Transfer(Amd64 *from, Amd64 *to, const uintptr_t value) noexcept;
 
         /**
          * Pops two arguments off the stack (the entry point and its context argument) and invokes the
@@ -142,6 +162,12 @@ class Amd64 final: public CothreadImpl {
          */
         static constexpr const size_t kDefaultStackSize{0x80000};
 
+        /**
+         * All registers are pushed onto the stack when switching away from a cothread, so the
+         * stack can be copied in and out of a shared stack.
+         */
+        static constexpr const bool kSupportsSharedStacks{true};
+
     private:
         /**
          * Pseudo-stack to use for the "main" cothread, i.e. the native kernel thread executing before
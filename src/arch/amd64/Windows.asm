@@ -8,8 +8,16 @@
 ; - from (RCX)
 ; -   to (RDX)
 ;
+; - value (R8): Value to return to the cothread we're switching to (Transfer only)
+;
+; The same code implements Transfer(); the value is returned in RAX, so the destination gets it as
+; the return value of the Transfer() call it's suspended in. For Switch(), it's just garbage.
+;
 ; void libcommunism::internal::Amd64::Switch(Cothread *from, Cothread *to)
+; uintptr_t libcommunism::internal::Amd64::Transfer(Cothread *from, Cothread *to, uintptr_t value)
+PUBLIC ?Transfer@Amd64@internal@libcommunism@@CA_KPEAV123@0_K@Z
 ?Switch@Amd64@internal@libcommunism@@CAXPEAV123@0@Z PROC
+?Transfer@Amd64@internal@libcommunism@@CA_KPEAV123@0_K@Z::
     ; save integer state
     push    RBP
     push    RBX
@@ -62,7 +70,8 @@
     pop     RBX
     pop     RBP
 
-    ; return to caller
+    ; return to caller, with the transferred value
+    mov     RAX, R8
     ret
 
 ?Switch@Amd64@internal@libcommunism@@CAXPEAV123@0@Z ENDP
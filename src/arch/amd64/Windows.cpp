@@ -3,6 +3,7 @@
  */
 #include "Common.h"
 #include "CothreadPrivate.h"
+#include "StackPoolPrivate.h"
 
 #include "SysV.S"
 
@@ -32,7 +33,8 @@ void Amd64::ValidateStackSize(const size_t size) {
 }
 
 /**
- * Allocates memory for a stack that's the given number of bytes in size.
+ * Allocates memory for a stack that's the given number of bytes in size. It's taken from the
+ * stack pool, which in turn gets it from the system heap.
  * 
  * @note This should be expanded to use VirtualAlloc() to allocate the stack pages with the
  *       surrounding reserved guard regions.
@@ -40,27 +42,25 @@ void Amd64::ValidateStackSize(const size_t size) {
  * @remark If required (for page alignment, for example) the size may be rounded up.
  *
  * @param bytes Size of the stack memory, in bytes.
+ * @param type Kind of memory to allocate for the stack
  *
  * @throw std::runtime_error If memory allocation failed
  * @return Pointer to the _top_ of allocated stack
  */
-void* Amd64::AllocStack(const size_t bytes) {
-    auto ret = _aligned_malloc(bytes, kStackAlignment);
-    if (!ret) {
-        throw std::runtime_error("failed to allocate stack");
-    }
-    return ret;
+void* Amd64::AllocStack(const size_t bytes, const StackType type) {
+    return AllocPooledStack(bytes, type);
 }
 
 /**
  * Releases previously allocated stack memory.
  *
  * @param stack Pointer to the top of previously allocated stack.
+ * @param bytes Size of the stack memory, as passed to AllocStack()
  *
  * @throw std::runtime_error If deallocating stack fails (invalid pointer)
  */
-void Amd64::DeallocStack(void* stack) {
-    _aligned_free(stack);
+void Amd64::DeallocStack(void* stack, const size_t bytes) {
+    FreePooledStack(stack, bytes);
 }
 
 /**
@@ -76,29 +76,26 @@ void Amd64::DeallocStack(void* stack) {
  * will fix that.
  *
  * @param wrap Wrapper structure defining the cothread
- * @param main Entry point for the cothread
+ * @param entry Entry record of the cothread; the stack frame is built immediately below it
  */
-void Amd64::Prepare(Amd64 *wrap, const Cothread::Entry& entry) {
+void Amd64::Prepare(Amd64 *wrap, EntryRecord* entry) {
     static_assert(offsetof(Amd64, stackTop) == COTHREAD_OFF_CONTEXT_TOP, "cothread stack top is invalid");
 
-    // build the context structure we pass to our "fake" entry point
-    auto info = new CallInfo{ entry };
-    if (!info) throw std::runtime_error("Failed to allocate call info");
+    ValidateStackSize(wrap->stack.size() * sizeof(uintptr_t));
 
     // NOLINTBEGIN(cppcoreguidelines-pro-type-reinterpret-cast)
-    // prepare some space for a stack frame (zeroed registers; four function call params)
-    auto& stackBuf = wrap->stack;
-    auto stackFrame = reinterpret_cast<std::byte*>(stackBuf.data());
-    stackFrame += ((stackBuf.size() * sizeof(uintptr_t)) & ~(0x10 - 1))
-        - (sizeof(uintptr_t) * (4 + kNumSavedRegisters));
+    // prepare some space for a stack frame (zeroed registers; four function call params) below
+    // the entry record, which marks the end of the usable stack
+    auto stackFrame = reinterpret_cast<std::byte*>(reinterpret_cast<uintptr_t>(entry) & ~(0x10 - 1));
+    stackFrame -= sizeof(uintptr_t) * (4 + kNumSavedRegisters);
     auto stack = reinterpret_cast<uintptr_t*>(stackFrame);
 
     // method to execute if main method returns
     *--stack = reinterpret_cast<uintptr_t>(&Amd64::EntryReturnedStub);
 
     // and then jump to the stub that calls the entry point
-    *--stack = reinterpret_cast<uintptr_t>(info);
-    *--stack = reinterpret_cast<uintptr_t>(&Amd64::DereferenceCallInfo);
+    *--stack = reinterpret_cast<uintptr_t>(entry);
+    *--stack = reinterpret_cast<uintptr_t>(&Amd64::InvokeEntry);
     *--stack = reinterpret_cast<uintptr_t>(&Amd64::JumpToEntry);
     // NOLINTEND(cppcoreguidelines-pro-type-reinterpret-cast)
 
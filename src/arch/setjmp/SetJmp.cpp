@@ -4,8 +4,11 @@
  * UNIX-like systems.
  */
 #include "SetJmp.h"
+#include "AllocImpl.h"
 #include "CothreadPrivate.h"
+#include "StackPoolPrivate.h"
 
+#include <array>
 #include <atomic>
 #include <csetjmp>
 #include <cstddef>
@@ -24,54 +27,50 @@ static_assert(sizeof(sigjmp_buf) < (SetJmp::kMainStackSize * sizeof(uintptr_t)),
         "main stack size is too small for sigjmp_buf!");
 
 thread_local std::array<uintptr_t, SetJmp::kMainStackSize> SetJmp::gMainStack;
+thread_local uintptr_t SetJmp::gTransferValue{0};
+thread_local SetJmp *SetJmp::gSwitchTarget{nullptr};
 
-SetJmp::EntryContext *SetJmp::gCurrentlyPreparing{nullptr};
+thread_local SetJmp *SetJmp::gCurrentlyPreparing{nullptr};
 std::mutex SetJmp::gSignalLock;
 
+/**
+ * Signal handler that was installed before the setup handler; signals that weren't raised to set
+ * up a cothread are passed on to it.
+ */
+static struct sigaction gPreviousSetupHandler;
+
+/**
+ * Maximum number of bytes between the top of a stack's bootstrap frame and the entry record of a
+ * cothread for the bootstrap context to be reused. The space in between is lost to the cothread.
+ */
+constexpr static const uintptr_t kMaxBootstrapGap{512};
+
 /**
  * Allocates a cothread including a context region of the specified size.
  *
  * This ensures there's sufficient bonus space allocated to hold the sigjmp_buf.
  */
-SetJmp::SetJmp(const Entry &entry, const size_t stackSize) : CothreadImpl(entry, stackSize) {
+SetJmp::SetJmp(const size_t stackSize, const StackType stackType) :
+    CothreadImpl(stackSize, stackType) {
     void *buf{nullptr};
 
     // round down stack size to ensure it's aligned before allocating it
     auto allocSize = stackSize & ~(SetJmp::kStackAlignment - 1);
     allocSize = allocSize ? allocSize : SetJmp::kDefaultStackSize;
 
-    // then add space for ucontext
-    allocSize += sizeof(sigjmp_buf);
+    // then add space for the context
+    allocSize += sizeof(Context);
     if(allocSize % SetJmp::kStackAlignment) {
         allocSize += SetJmp::kStackAlignment - (allocSize % SetJmp::kStackAlignment);
     }
 
     // and allocate it
-#ifdef _WIN32
-    buf = _aligned_malloc(allocSize, SetJmp::kStackAlignment);
-#else
-    int err{0};
-    err = posix_memalign(&buf, SetJmp::kStackAlignment, allocSize);
-    if(err) {
-        throw std::runtime_error("posix_memalign() failed");
-    }
-#endif
-    if(!buf) {
-        throw std::runtime_error("failed to allocate stack");
-    }
+    buf = AllocPooledStack(allocSize, stackType);
+    CommitPooledStackBottom(buf, allocSize, this->getContextSize());
 
     // create it as if we had provided the memory in the first place
     this->stack = {reinterpret_cast<uintptr_t *>(buf), allocSize / sizeof(uintptr_t)};
     this->ownsStack = true;
-
-    Prepare(this, entry);
-}
-
-/**
- * Allocates a cothread with an existing region of memory to back its stack and jump buffer.
- */
-SetJmp::SetJmp(const Entry &entry, std::span<uintptr_t> stack) : CothreadImpl(entry, stack) {
-    Prepare(this, entry);
 }
 
 /**
@@ -79,36 +78,48 @@ SetJmp::SetJmp(const Entry &entry, std::span<uintptr_t> stack) : CothreadImpl(en
  */
 SetJmp::~SetJmp() {
     if(this->ownsStack) {
-#ifdef _WIN32
-        _aligned_free(this->stack.data());
-#else
-        free(this->stack.data());
-#endif
+        FreePooledStack(this->stack.data(), this->stack.size() * sizeof(uintptr_t));
     }
 }
 
+
+
 /**
- * Performs a context switch to the provided cothread.
+ * Performs a context switch between the two cothreads.
  */
-void SetJmp::switchTo(CothreadImpl *_from) {
-    auto from = static_cast<SetJmp *>(_from);
-
+void SetJmp::Switch(SetJmp *from, SetJmp *to) noexcept {
     if(!sigsetjmp(*SetJmp::JmpBufFor(from), 0)) {
+        gSwitchTarget = to;
         std::atomic_thread_fence(std::memory_order_release);
-        siglongjmp(*SetJmp::JmpBufFor(this), 1);
+        siglongjmp(*SetJmp::JmpBufFor(to), 1);
     }
 }
 
+/**
+ * Performs a context switch between the two cothreads, passing a value to the destination.
+ */
+uintptr_t SetJmp::Transfer(SetJmp *from, SetJmp *to, const uintptr_t value) noexcept {
+    gTransferValue = value;
+    Switch(from, to);
+    return ReceiveTransferValue();
+}
+
+/**
+ * Reads the value passed by the most recent Transfer() on the calling kernel thread. This is not
+ * inlined, since the cothread may have been resumed on a different kernel thread.
+ */
+COTHREAD_NOINLINE uintptr_t SetJmp::ReceiveTransferValue() {
+    return gTransferValue;
+}
+
 
 
 /**
- * Allocates the current physical (kernel) thread's Cothread object.
- *
- * @note This will leak the associated cothread object, unless the caller stores it somewhere and
- *       ensures they deallocate it later when the underlying kernel thread is destroyed.
+ * Allocates the implementation for the current physical (kernel) thread's Cothread object, in the
+ * provided buffer.
  */
-CothreadImpl *libcommunism::AllocKernelThreadWrapper() {
-    return new SetJmp(SetJmp::gMainStack);
+SetJmp *SetJmp::AllocKernelThread(std::span<uintptr_t> buffer, bool &bufferUsed) {
+    return AllocImplHelper<SetJmp>(buffer, bufferUsed, SetJmp::gMainStack);
 }
 
 /**
@@ -129,60 +140,103 @@ void SetJmp::InvokeCothreadDidReturnHandler(Cothread *from) {
  * This abuses signal handling to set up the return stack in a platform independent way. The
  * algorithm is very well described in Engelschall's Portable Multithreading.
  *
+ * The signal stack ends at the cothread's entry record, so the handler's frame (which becomes the
+ * bottom frame of the cothread) is placed immediately below it.
+ *
+ * If the stack was allocated by us, the resulting context is kept as its bootstrap context, and the
+ * stack pool is told that the stack holds one. It only does so for stacks taken from its cache,
+ * since the mark lives in the pool's bookkeeping rather than in the stack's contents (which are
+ * indeterminate for a fresh allocation); and it clears the mark if it discards the contents of a
+ * cached stack. When the stack is reused for another cothread, and that cothread's entry record lies just above the bootstrap
+ * frame, the bootstrap context is simply copied: jumping to it resumes the setup handler, which
+ * doesn't access anything on the stack but immediately calls into Launch().
+ *
  * @param thread Cothread to initialize
- * @param entry Entry point to execute
+ * @param entry Entry record to invoke once the cothread starts
  *
- * @throw std::runtime_error If context allocation or initialization failed
+ * @throw std::runtime_error If context initialization failed
  */
-void SetJmp::Prepare(SetJmp *thread, const Cothread::Entry &entry) {
+void SetJmp::Prepare(SetJmp *thread, EntryRecord *entry) {
     int err{0};
-    struct sigaction handler, oldHandler;
     stack_t stack{}, oldStack{};
 
+    auto context = ContextFor(thread);
+    const auto stackBytes = thread->stack.size() * sizeof(uintptr_t);
+    thread->entry = entry;
+
+    // reuse the stack's bootstrap frame if possible
+    if(thread->ownsStack && IsStackBootstrapped(thread->stack.data(), stackBytes)) {
+        const auto top = reinterpret_cast<uintptr_t>(context->bootstrapTop);
+        const auto entryAddr = reinterpret_cast<uintptr_t>(entry);
+        if(top <= entryAddr && entryAddr - top <= kMaxBootstrapGap) {
+            memcpy(&context->jmpBuf, &context->bootstrap, sizeof(sigjmp_buf));
+            return;
+        }
+    }
+
+    InstallSetupHandler();
+
     auto jbuf = JmpBufFor(thread);
     memset(jbuf, 0, sizeof(*jbuf));
 
     // prepare the signal handling stack
-    auto offset = sizeof(sigjmp_buf);
-    if(offset % kStackAlignment) {
-        offset += kStackAlignment - (offset % kStackAlignment);
+    stack.ss_sp = reinterpret_cast<std::byte *>(thread->stack.data())
+        + thread->getContextSize();
+    stack.ss_size = reinterpret_cast<std::byte *>(entry) - reinterpret_cast<std::byte *>(stack.ss_sp);
+
+    // listen man you're just gonna have to trust me on this one
+    err = sigaltstack(&stack, &oldStack);
+    if(err) {
+        throw std::system_error(errno, std::generic_category(), "sigaltstack");
     }
 
-    stack.ss_sp = reinterpret_cast<std::byte *>(thread->stack.data()) + offset;
-    stack.ss_size = (thread->stack.size() * sizeof(uintptr_t)) - offset;
+    gCurrentlyPreparing = thread;
+    std::atomic_thread_fence(std::memory_order_release);
 
-    auto info = new EntryContext( thread, entry);
-    if(!info) throw std::runtime_error("Failed to allocate context");
+    err = raise(SIGUSR1);
+    gCurrentlyPreparing = nullptr;
+    sigaltstack(&oldStack, nullptr);
 
-    // listen man you're just gonna have to trust me on this one
-    try {
-        std::lock_guard<std::mutex> lock(gSignalLock);
+    if(err) {
+        throw std::system_error(errno, std::generic_category(), "raise");
+    }
 
-        err = sigaltstack(&stack, &oldStack);
-        if(err) {
-            throw std::system_error(errno, std::generic_category(), "sigaltstack");
-        }
+    if(thread->ownsStack) {
+        memcpy(&context->bootstrap, &context->jmpBuf, sizeof(sigjmp_buf));
+        context->bootstrapTop = entry;
+        SetStackBootstrapped(thread->stack.data(), stackBytes);
+    }
+}
 
-        gCurrentlyPreparing = info;
-        std::atomic_thread_fence(std::memory_order_release);
+/**
+ * Installs the setup signal handler, unless it's already installed. This is checked every time,
+ * since other code may have replaced it in the meantime.
+ *
+ * @throw std::system_error If the signal handler could not be installed
+ */
+void SetJmp::InstallSetupHandler() {
+    struct sigaction current{}, handler{};
 
-        handler.sa_handler = SignalHandlerSetupThunk;
-        handler.sa_flags = SA_ONSTACK;
-        sigemptyset(&handler.sa_mask);
+    if(sigaction(SIGUSR1, nullptr, &current)) {
+        throw std::system_error(errno, std::generic_category(), "sigaction");
+    }
+    if((current.sa_flags & SA_SIGINFO) && current.sa_sigaction == SignalHandlerSetupThunk) {
+        return;
+    }
 
-        err = sigaction(SIGUSR1, &handler, &oldHandler);
-        if(err) {
-            throw std::system_error(errno, std::generic_category(), "sigaction");
-        }
-        err = raise(SIGUSR1);
-        if(err) {
-            throw std::system_error(errno, std::generic_category(), "raise");
-        }
-        sigaltstack(&oldStack, nullptr);
-        sigaction(SIGUSR1, &oldHandler, nullptr);
-    } catch(const std::exception &) {
-        delete info;
-        throw;
+    std::lock_guard<std::mutex> lock(gSignalLock);
+
+    handler.sa_sigaction = SignalHandlerSetupThunk;
+    handler.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&handler.sa_mask);
+
+    if(sigaction(SIGUSR1, &handler, &current)) {
+        throw std::system_error(errno, std::generic_category(), "sigaction");
+    }
+
+    // another thread may have installed it while we were waiting for the lock
+    if(!(current.sa_flags & SA_SIGINFO) || current.sa_sigaction != SignalHandlerSetupThunk) {
+        gPreviousSetupHandler = current;
     }
 }
 
@@ -190,19 +244,44 @@ void SetJmp::Prepare(SetJmp *thread, const Cothread::Entry &entry) {
  * Helper method that's registered as a signal handler when initializing a cothread.
  *
  * Since we take this signal on the signal stack, it will set up the stack frame correctly, and
- * we can correctly populate the setjmp buffer at the same time.
+ * we can correctly populate the setjmp buffer at the same time. When the cothread is switched to
+ * for the first time, execution resumes here; nothing on the stack frame may be accessed at that
+ * point, since it may be the bootstrap frame of a cothread that previously used the stack.
  *
- * @param signal Signal number
+ * Signals that weren't raised by Prepare() on this kernel thread are passed on to the handler that
+ * was installed before; if that's the default action, it's reinstated and the signal raised again,
+ * so it's delivered as soon as we return.
  *
- * @remark This relies on a global variable, so the prepare method must be sure that only a single
- *         thread is being prepared at a time.
+ * @param signal Signal number
+ * @param info Information about the signal
+ * @param ucontext Context of the interrupted code
  */
-void SetJmp::SignalHandlerSetupThunk(int signal) {
-    (void) signal;
+void SetJmp::SignalHandlerSetupThunk(int signal, siginfo_t *info, void *ucontext) {
+    auto thread = gCurrentlyPreparing;
+    if(!thread) {
+        const auto &previous = gPreviousSetupHandler;
+        if(previous.sa_flags & SA_SIGINFO) {
+            previous.sa_sigaction(signal, info, ucontext);
+        } else if(previous.sa_handler == SIG_DFL) {
+            sigaction(signal, &previous, nullptr);
+            raise(signal);
+        } else if(previous.sa_handler != SIG_IGN) {
+            previous.sa_handler(signal);
+        }
+        return;
+    }
 
-    auto ctx = gCurrentlyPreparing;
-    if(sigsetjmp(*JmpBufFor(ctx->impl), 0)) {
-        ctx->entry();
-        InvokeCothreadDidReturnHandler(Cothread::Current());
+    if(sigsetjmp(*JmpBufFor(thread), 0)) {
+        Launch();
     }
 }
+
+/**
+ * Invokes the entry point of the cothread that was just switched to for the first time. It reads
+ * the cothread from the calling kernel thread's switch target, so it must not be inlined.
+ */
+COTHREAD_NOINLINE void SetJmp::Launch() {
+    auto thread = gSwitchTarget;
+    thread->entry->invoke(thread->entry);
+    InvokeCothreadDidReturnHandler(Cothread::Current());
+}
@@ -10,6 +10,8 @@
 
 #include <csetjmp>
 
+#include <signal.h>
+
 namespace libcommunism::internal {
 /**
  * @brief Context switching utilizing the C library `setjmp()` and `longjmp()` methods
@@ -19,33 +21,54 @@ namespace libcommunism::internal {
  * up in a portable way by making use of signal handlers, so this should be supported on basically
  * all targets that have a functional C library and are UNIX-y.
  *
- * @remark Since signals are a per-process resource, allocation of cothreads effectively becomes
- *         serialized to ensure safety.
+ * The signal handler used for this is installed once per process, and the alternate signal stack
+ * is per kernel thread, so cothreads can be set up on many kernel threads at once. Furthermore, the
+ * jump buffer produced by the signal handler is kept in the context area of stacks allocated from
+ * the stack pool: a cothread that later reuses such a stack jumps straight into the existing
+ * bootstrap frame, so creating it requires no signals (or system calls) at all.
+ *
+ * @remark The setup handler for `SIGUSR1` is installed the first time a cothread is prepared with
+ *         a signal, and then stays installed for the lifetime of the process, for all kernel
+ *         threads; it's reinstalled if something else replaced it in the meantime. Signals it
+ *         didn't raise itself are passed on to the handler that was installed before it (or, if
+ *         that was the default action, it's reinstated and the signal raised again.) Programs
+ *         that use `SIGUSR1` for their own purposes should install their handler before the first
+ *         cothread is created.
  */
 class SetJmp final: public CothreadImpl {
-    friend CothreadImpl *libcommunism::AllocKernelThreadWrapper();
+    friend class libcommunism::Cothread;
+    template<class Backend> friend class libcommunism::BasicCothread;
 
     public:
-        SetJmp(const Entry &entry, const size_t stackSize = 0);
-        SetJmp(const Entry &entry, std::span<uintptr_t> stack);
+        SetJmp(const size_t stackSize = 0, const StackType stackType = StackType::Default);
         SetJmp(std::span<uintptr_t> stack) : CothreadImpl(stack) {}
         ~SetJmp();
 
-        void switchTo(CothreadImpl *from) override;
+        /**
+         * The context structure lives at the top of the stack buffer, padded to the stack
+         * alignment.
+         */
+        size_t getContextSize() const override {
+            return (sizeof(Context) + kStackAlignment - 1) & ~(kStackAlignment - 1);
+        }
+
 
     private:
         /**
-         * @brief Context structure passed to the entry point of a setjmp based cothread
+         * @brief Context stored at the top (lowest address) of a cothread's stack buffer
          */
-        struct EntryContext {
-            /// Implementation for this cothread
-            SetJmp *impl{nullptr};
-
-            /// Entry point of the cothread
-            Cothread::Entry entry;
-            /// Initializes a context struct with the given entry point.
-            EntryContext(SetJmp *_impl, const Cothread::Entry &_entry) : impl(_impl),
-                entry(_entry) {}
+        struct Context {
+            /// Context of the cothread, saved when it was last switched away from
+            sigjmp_buf jmpBuf;
+
+            /**
+             * Context saved by the setup signal handler the first time a cothread was prepared on
+             * this stack. It's restored when a later cothread is prepared on the same stack, as
+             * long as its entry record ends up just above the bootstrap frame.
+             */
+            sigjmp_buf bootstrap;
+            /// High end of the signal stack that the bootstrap frame was built on
+            void *bootstrapTop;
         };
 
         /**
@@ -63,11 +86,58 @@ class SetJmp final: public CothreadImpl {
             return reinterpret_cast<sigjmp_buf *>(static_cast<SetJmp *>(thread)->stack.data());
         }
 
+        /**
+         * Returns the context structure of a cothread that owns its stack.
+         */
+        static auto ContextFor(SetJmp *thread) {
+            return reinterpret_cast<Context *>(thread->stack.data());
+        }
+
         static void AllocMainCothread();
-        static void InvokeCothreadDidReturnHandler(Cothread *from);
-        static void SignalHandlerSetupThunk(int);
+        [[noreturn]] static void InvokeCothreadDidReturnHandler(Cothread *from);
+        static void InstallSetupHandler();
+        static void SignalHandlerSetupThunk(int signal, siginfo_t *info, void *ucontext);
+        [[noreturn]] static void Launch();
 
-        void Prepare(SetJmp *thread, const Cothread::Entry &entry);
+        /**
+         * Allocates the implementation for a cothread that represents the calling kernel thread,
+         * which saves its context into the per thread main stack.
+         *
+         * @param buffer Buffer into which the implementation should be allocated, if it fits
+         * @param bufferUsed Set if the implementation was allocated in the buffer
+         */
+        static SetJmp *AllocKernelThread(std::span<uintptr_t> buffer, bool &bufferUsed);
+
+        /**
+         * Performs a context switch: the current context is saved in the jump buffer of `from`,
+         * then the context saved in the jump buffer of `to` is restored.
+         *
+         * @param from Cothread that will receive the current context
+         * @param to Cothread whose context is to be restored
+         */
+        static void Switch(SetJmp *from, SetJmp *to) noexcept;
+
+        /**
+         * Performs a context switch, passing a value to the destination cothread. It's passed
+         * through a per kernel thread variable, which is read back once the calling cothread is
+         * switched to again.
+         *
+         * @param from Cothread that will receive the current context
+         * @param to Cothread whose context is to be restored
+         * @param value Value to pass to the destination cothread
+         *
+         * @return Value passed by the cothread that switches back to this one
+         */
+        static uintptr_t Transfer(SetJmp *from, SetJmp *to, const uintptr_t value) noexcept;
+
+        /**
+         * Reads the value passed to the calling kernel thread by the most recent Transfer().
+         *
+         * @return Value passed to the cothread that was just switched to
+         */
+        static uintptr_t ReceiveTransferValue();
+
+        static void Prepare(SetJmp *thread, EntryRecord *entry);
 
     public:
         /**
@@ -109,27 +179,31 @@ class SetJmp final: public CothreadImpl {
          */
         static thread_local std::array<uintptr_t, kMainStackSize> gMainStack;
 
+        /// Value being passed to the destination of a Transfer() on this kernel thread
+        static thread_local uintptr_t gTransferValue;
+
+        /// Cothread that was most recently switched to on this kernel thread
+        static thread_local SetJmp *gSwitchTarget;
+
         /**
-         * Global variable indicating the context of the current cothread whose state buffer is to be
-         * initialized. This is consulted in the signal handler to find the thread's actual entry
-         * point.
+         * Cothread whose state buffer is to be initialized by the calling kernel thread. This is
+         * consulted in the signal handler to find the thread's jump buffer; if it's not set, the
+         * signal wasn't raised by us.
          */
-        static EntryContext *gCurrentlyPreparing;
+        static thread_local SetJmp *gCurrentlyPreparing;
 
         /**
-         * Because the signals are shared between all threads in a process, including the associated
-         * signal stacks, it's possible that multiple threads attempting to be prepared simultaneously
-         * would cause issues.
-         *
-         * Therefore, this lock is taken for the duration of signal based operations (that is, the
-         * entire time between saving the current signal handler, installing our custom ones, raising
-         * the signal, and then restoring the old h andlers) needed to initialize the context buffer.
+         * Signal handlers are shared between all threads in a process, so this lock is taken while
+         * installing the setup signal handler.
          */
         static std::mutex gSignalLock;
 
     private:
         /// When set, the stack was allocated by us and must be freed on release
         bool ownsStack{false};
+
+        /// Entry record to invoke once the cothread starts executing
+        EntryRecord *entry{nullptr};
 };
 }
 
@@ -1,32 +1,37 @@
 /**
- * Context switching using the `ucontext` methods from the C library.
- *
- * This is very very slow.
+ * Context switching using the `ucontext` methods from the C library to set up stacks, and
+ * `_setjmp()` and `_longjmp()` to switch between them.
  */
 #include "UContext.h"
+#include "AllocImpl.h"
 #include "CothreadPrivate.h"
+#include "StackPoolPrivate.h"
 
 #include <cstddef>
+#include <cstdint>
 #include <cstdlib>
-#include <mutex>
+#include <cstring>
 #include <stdexcept>
 
 // required to get the "deprecated" ucontext sources
+#ifndef _XOPEN_SOURCE
 #define _XOPEN_SOURCE
+#endif
 #include <ucontext.h>
 
 using namespace libcommunism;
 using namespace libcommunism::internal;
 
-// Validate an ucontext fits in the buffer
-static_assert(sizeof(ucontext_t) < (UContext::kMainStackSize * sizeof(uintptr_t)),
-        "main stack size is too small for ucontext!");
+// Validate a jump buffer fits in the buffer
+static_assert(sizeof(jmp_buf) < (UContext::kMainStackSize * sizeof(uintptr_t)),
+        "main stack size is too small for jmp_buf!");
 
 thread_local std::array<uintptr_t, UContext::kMainStackSize> UContext::gMainStack;
+thread_local uintptr_t UContext::gTransferValue{0};
+thread_local UContext *UContext::gSwitchTarget{nullptr};
 
-std::unordered_map<int, std::unique_ptr<UContext::Context>> UContext::gContextInfo;
-std::mutex UContext::gContextInfoLock;
-int UContext::gContextNextId{0};
+thread_local UContext *UContext::gPreparing{nullptr};
+thread_local jmp_buf *UContext::gPrepareReturn{nullptr};
 
 
 /**
@@ -34,45 +39,27 @@ int UContext::gContextNextId{0};
  *
  * This ensures there's sufficient bonus space allocated to hold the ucontext.
  */
-UContext::UContext(const Entry &entry, const size_t stackSize) : CothreadImpl(entry, stackSize) {
+UContext::UContext(const size_t stackSize, const StackType stackType) :
+    CothreadImpl(stackSize, stackType) {
     void *buf{nullptr};
 
     // round down stack size to ensure it's aligned before allocating it
     auto allocSize = stackSize & ~(UContext::kStackAlignment - 1);
     allocSize = allocSize ? allocSize : UContext::kDefaultStackSize;
 
-    // then add space for ucontext
-    allocSize += sizeof(ucontext_t);
+    // then add space for the jump buffer
+    allocSize += sizeof(jmp_buf);
     if(allocSize % kStackAlignment) {
         allocSize += kStackAlignment - (allocSize % kStackAlignment);
     }
 
     // and allocate it
-#ifdef _WIN32
-    buf = _aligned_malloc(allocSize, UContext::kStackAlignment);
-#else
-    int err{0};
-    err = posix_memalign(&buf, UContext::kStackAlignment, allocSize);
-    if(err) {
-        throw std::runtime_error("posix_memalign() failed");
-    }
-#endif
-    if(!buf) {
-        throw std::runtime_error("failed to allocate stack");
-    }
+    buf = AllocPooledStack(allocSize, stackType);
+    CommitPooledStackBottom(buf, allocSize, this->getContextSize());
 
     // create it as if we had provided the memory in the first place
     this->stack = {reinterpret_cast<uintptr_t *>(buf), allocSize / sizeof(uintptr_t)};
     this->ownsStack = true;
-
-    Prepare(this, entry);
-}
-
-/**
- * Allocates a cothread with an existing region of memory to back its stack.
- */
-UContext::UContext(const Entry &entry, std::span<uintptr_t> stack) : CothreadImpl(entry, stack) {
-    Prepare(this, entry);
 }
 
 /**
@@ -80,63 +67,84 @@ UContext::UContext(const Entry &entry, std::span<uintptr_t> stack) : CothreadImp
  */
 UContext::~UContext() {
     if(this->ownsStack) {
-#ifdef _WIN32
-        _aligned_free(this->stack.data());
-#else
-        free(this->stack.data());
-#endif
+        FreePooledStack(this->stack.data(), this->stack.size() * sizeof(uintptr_t));
     }
 }
 
 
 
 // XXX: We need to disable deprecation warnings for getcontext() and friends on macOS, BSD
+#ifdef __clang__
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wdeprecated-declarations"
+#endif
 
 /**
- * Prepares the `ucontext_t` buffer.
+ * Prepares the jump buffer of a cothread. The stack of the context ends at the entry record.
+ *
+ * A user context that runs BootstrapStub() on the cothread's stack is created and switched to; it
+ * saves the cothread's jump buffer and immediately jumps back. Only that one switch, and getting
+ * the context to begin with, touch the signal mask. When the cothread is first
+ * switched to, it thus resumes in the bootstrap function, which then invokes the entry record.
  *
  * @param thread Cothread to initialize
- * @param entry Entry point to execute
+ * @param entry Entry record to invoke once the cothread starts
  *
- * @throw std::runtime_error If context allocation or initialization failed
+ * @throw std::runtime_error If context initialization failed
  */
-void UContext::Prepare(UContext *thread, const UContext::Entry &entry) {
-    // build the context structure we pass to our "fake" entry point
-    auto info = std::make_unique<Context>(entry);
-    if(!info) throw std::runtime_error("Failed to allocate context");
-
-    // get its ucontext_t and prepare it
-    auto uctx = ContextFor(thread);
-    memset(uctx, 0, sizeof(*uctx));
+void UContext::Prepare(UContext *thread, EntryRecord *entry) {
+    ucontext_t bootstrap;
+    jmp_buf caller;
+    memset(&bootstrap, 0, sizeof(bootstrap));
 
-    if(getcontext(uctx)) {
+    if(getcontext(&bootstrap)) {
         throw std::runtime_error("getcontext() failed");
     }
 
     // set its stack
-    auto offset = sizeof(ucontext_t);
-    if(offset % kStackAlignment) {
-        offset += kStackAlignment - (offset % kStackAlignment);
+    auto stackStart = reinterpret_cast<std::byte *>(thread->stack.data())
+        + thread->getContextSize();
+    bootstrap.uc_stack.ss_sp = stackStart;
+    bootstrap.uc_stack.ss_size = reinterpret_cast<std::byte *>(entry) - stackStart;
+    bootstrap.uc_link = nullptr;
+
+    // fill in the context to invoke the bootstrap method, then run it
+    makecontext(&bootstrap, &BootstrapStub, 0);
+
+    thread->entry = entry;
+    gPreparing = thread;
+    gPrepareReturn = &caller;
+
+    if(!_setjmp(caller)) {
+        setcontext(&bootstrap);
+        throw std::runtime_error("setcontext() failed");
     }
+    gPreparing = nullptr;
+}
 
-    uctx->uc_stack.ss_sp = reinterpret_cast<std::byte *>(thread->stack.data()) + offset;
-    uctx->uc_stack.ss_size = (thread->stack.size() * sizeof(uintptr_t)) - offset;
-
-    // store the context in the spicy map
-    int id{0};
-    {
-        std::lock_guard<std::mutex> lg(gContextInfoLock);
-        do{
-            id = ++gContextNextId;
-        } while(!id);
-        gContextInfo.emplace(id, std::move(info));
+/**
+ * Runs on the stack of a cothread that is being prepared: it saves its jump buffer, then returns to
+ * the preparing cothread. When the cothread is first switched to, execution resumes here; nothing
+ * may be read from this function's stack frame at that point, so the cothread is found through
+ * the switch target instead.
+ */
+void UContext::BootstrapStub() {
+    if(_setjmp(*JmpBufFor(gPreparing))) {
+        Launch();
     }
+    _longjmp(*gPrepareReturn, 1);
+}
+
+/**
+ * Invokes the entry point of the cothread that was just switched to for the first time. It reads
+ * the cothread from the calling kernel thread's switch target, so it must not be inlined.
+ */
+COTHREAD_NOINLINE void UContext::Launch() {
+    auto thread = gSwitchTarget;
+    thread->entry->invoke(thread->entry);
 
-    // fill in the context to invoke the helper method
-    // this is disgusting but it's C. lol
-    makecontext(uctx, reinterpret_cast<void(*)()>(&EntryStub), 1, id);
+    // call the return handler
+    InvokeCothreadDidReturnHandler(Cothread::Current());
 }
 
 /**
@@ -151,45 +159,43 @@ void UContext::InvokeCothreadDidReturnHandler(Cothread *from) {
 }
 
 /**
- * Looks up the context for the cothread.
+ * Performs a context switch between two cothreads.
  *
- * @param id Key into the gContextInfo map
+ * The state of the caller is stored in the jump buffer of the `from` cothread.
  */
-void UContext::EntryStub(int id) {
-    // extract info
-    std::unique_ptr<Context> info;
-    {
-        std::lock_guard<std::mutex> lg(gContextInfoLock);
-        info = std::move(gContextInfo.at(id));
-        gContextInfo.erase(id);
+void UContext::Switch(UContext *from, UContext *to) noexcept {
+    if(!_setjmp(*JmpBufFor(from))) {
+        gSwitchTarget = to;
+        _longjmp(*JmpBufFor(to), 1);
     }
+}
 
-    // invoke
-    info->entry();
-
-    // call the return handler
-    info.reset();
-    UContext::InvokeCothreadDidReturnHandler(Cothread::Current());
+/**
+ * Performs a context switch between two cothreads, passing a value to the destination.
+ */
+uintptr_t UContext::Transfer(UContext *from, UContext *to, const uintptr_t value) noexcept {
+    gTransferValue = value;
+    Switch(from, to);
+    return ReceiveTransferValue();
 }
 
 /**
- * Performs a context switch to the provided cothread.
- *
- * The state of the caller is stored on the stack of the currently active thread.
+ * Reads the value passed by the most recent Transfer() on the calling kernel thread. This is not
+ * inlined, since the cothread may have been resumed on a different kernel thread.
  */
-void UContext::switchTo(CothreadImpl *from) {
-    swapcontext(UContext::ContextFor(from), UContext::ContextFor(this));
+COTHREAD_NOINLINE uintptr_t UContext::ReceiveTransferValue() {
+    return gTransferValue;
 }
 
+#ifdef __clang__
 #pragma clang diagnostic pop
+#endif
 
 /**
- * Allocates the current physical (kernel) thread's Cothread object.
- *
- * @note This will leak the associated cothread object, unless the caller stores it somewhere and
- *       ensures they deallocate it later when the underlying kernel thread is destroyed.
+ * Allocates the implementation for the current physical (kernel) thread's Cothread object, in the
+ * provided buffer.
  */
-CothreadImpl *libcommunism::AllocKernelThreadWrapper() {
-    return new UContext(UContext::gMainStack);
+UContext *UContext::AllocKernelThread(std::span<uintptr_t> buffer, bool &bufferUsed) {
+    return AllocImplHelper<UContext>(buffer, bufferUsed, UContext::gMainStack);
 }
 
@@ -6,72 +6,112 @@
 
 #include <array>
 #include <cstddef>
-#include <memory>
-#include <mutex>
-#include <unordered_map>
 
+#ifndef _XOPEN_SOURCE
 #define _XOPEN_SOURCE
+#endif
+#include <setjmp.h>
 #include <ucontext.h>
 
 namespace libcommunism::internal {
 /**
- * @brief Implementation of context switching that uses the C library's `setcontext()` methods
+ * @brief Implementation of context switching that uses the C library's `makecontext()` to set up
+ *        stacks, and `_setjmp()` and `_longjmp()` to switch between them
  *
  * This is intended mostly to be a "test" platform that can be used to verify that the core
- * library works, without relying on assembly other such fun stuff. It's not particularly fast so
- * other platform backends should always be used in preference.
+ * library works, without relying on assembly other such fun stuff. Other platform backends should
+ * be used in preference where available.
+ *
+ * The `ucontext` functions are only used to get onto a new cothread's stack for the first time:
+ * there, a bootstrap function saves a jump buffer and returns to the cothread that's preparing it.
+ * All context switches after that use `_setjmp()` and `_longjmp()`, which (unlike `swapcontext()`)
+ * don't save and restore the signal mask, and thus don't require a system call.
  *
- * Since we need a place to store the context in addition to the stack, it's stored at the very
+ * Since we need a place to store the jump buffer in addition to the stack, it's stored at the very
  * top of the allocated stack. When allocating the stack internally, this is taken account and some
  * extra space at the top is reserved for it; but this must be kept in mind when using an
- * externally allocated stack, as less (roughly `sizeof(ucontext_t)` and alignment) space than
+ * externally allocated stack, as less (roughly `sizeof(jmp_buf)` and alignment) space than
  * provided will be actually be available as stack.
  *
  * @note Since ucontext has been deprecated since the 2008 revision of POSIX, this may stop
  *       working (or not even be supported to begin with) on any given platform in the future.
  */
 class UContext final: public CothreadImpl {
-    friend CothreadImpl *libcommunism::AllocKernelThreadWrapper();
+    friend class libcommunism::Cothread;
+    template<class Backend> friend class libcommunism::BasicCothread;
 
     public:
-        UContext(const Entry &entry, const size_t stackSize = 0);
-        UContext(const Entry &entry, std::span<uintptr_t> stack);
+        UContext(const size_t stackSize = 0, const StackType stackType = StackType::Default);
         UContext(std::span<uintptr_t> stack) : CothreadImpl(stack) {}
         ~UContext();
 
-        void switchTo(CothreadImpl *from) override;
-
-    private:
         /**
-         * @brief Context structure passed to the entry point of an ucontext
+         * The `jmp_buf` lives at the top of the stack buffer, padded to the stack alignment.
          */
-        struct Context {
-            /// Entry point of the cothread
-            Cothread::Entry entry;
+        size_t getContextSize() const override {
+            return (sizeof(jmp_buf) + kStackAlignment - 1) & ~(kStackAlignment - 1);
+        }
 
-            /// Initializes a context struct with the given entry point.
-            Context(const Cothread::Entry &_entry) : entry(_entry) {}
-        };
 
+    private:
         /**
-         * Returns a pointer to the `ucontext_t` structure for a given cooperative thread.
+         * Returns a pointer to the `jmp_buf` structure for a given cooperative thread.
          *
          * It's stored at the top of its stack buffer. The actual stack available to the program will
          * be reduced accordingly, but it is still possible for the program to overflow into this
          * structure and wreak havoc.
          *
-         * @param thread Thread whose user context struct to retrieve
+         * @param thread Thread whose jump buffer to retrieve
          *
-         * @return Thread's user context, in the stack allocation.
+         * @return Thread's jump buffer, in the stack allocation.
          */
-        static ucontext_t *ContextFor(CothreadImpl *thread) {
-            return reinterpret_cast<ucontext_t *>(static_cast<UContext *>(thread)->stack.data());
+        static jmp_buf *JmpBufFor(CothreadImpl *thread) {
+            return reinterpret_cast<jmp_buf *>(static_cast<UContext *>(thread)->stack.data());
         }
 
         static void AllocMainCothread();
-        static void Prepare(UContext *thread, const Cothread::Entry &entry);
-        static void EntryStub(int id);
-        static void InvokeCothreadDidReturnHandler(Cothread *from);
+        static void Prepare(UContext *thread, EntryRecord *entry);
+        static void BootstrapStub();
+        [[noreturn]] static void Launch();
+        [[noreturn]] static void InvokeCothreadDidReturnHandler(Cothread *from);
+
+        /**
+         * Allocates the implementation for a cothread that represents the calling kernel thread,
+         * which saves its context into the per thread main stack.
+         *
+         * @param buffer Buffer into which the implementation should be allocated, if it fits
+         * @param bufferUsed Set if the implementation was allocated in the buffer
+         */
+        static UContext *AllocKernelThread(std::span<uintptr_t> buffer, bool &bufferUsed);
+
+        /**
+         * Performs a context switch: the current context is saved in the jump buffer of `from`,
+         * then the context saved in the jump buffer of `to` is restored.
+         *
+         * @param from Cothread that will receive the current context
+         * @param to Cothread whose context is to be restored
+         */
+        static void Switch(UContext *from, UContext *to) noexcept;
+
+        /**
+         * Performs a context switch, passing a value to the destination cothread. It's passed
+         * through a per kernel thread variable, which is read back once the calling cothread is
+         * switched to again.
+         *
+         * @param from Cothread that will receive the current context
+         * @param to Cothread whose context is to be restored
+         * @param value Value to pass to the destination cothread
+         *
+         * @return Value passed by the cothread that switches back to this one
+         */
+        static uintptr_t Transfer(UContext *from, UContext *to, const uintptr_t value) noexcept;
+
+        /**
+         * Reads the value passed to the calling kernel thread by the most recent Transfer().
+         *
+         * @return Value passed to the cothread that was just switched to
+         */
+        static uintptr_t ReceiveTransferValue();
 
     public:
         /**
@@ -89,7 +129,7 @@ class UContext final: public CothreadImpl {
          * Size of the stack buffer for the "fake" initial cothread, in machine words. This only needs to
          * be large enough to fit the register stack frame. This _must_ be a power of two.
          *
-         * It must be sufficiently large to fit an ucontext_t in it.
+         * It must be sufficiently large to fit a jmp_buf in it.
          */
         static constexpr const size_t kMainStackSize{128};
 
@@ -113,30 +153,25 @@ class UContext final: public CothreadImpl {
          */
         static thread_local std::array<uintptr_t, kMainStackSize> gMainStack;
 
-        /**
-         * Since `makecontext()` is cursed and only passes parameters of `int` size of the function,
-         * this will break passing a pointer on most 64-bit platforms. Instead, we have this here
-         * map that stores an int index, which the entry wrapper pulls out and gets the context
-         * from.
-         *
-         * The value going into it is based on some counter we increment.
-         */
-        static std::unordered_map<int, std::unique_ptr<Context>> gContextInfo;
+        /// Value being passed to the destination of a Transfer() on this kernel thread
+        static thread_local uintptr_t gTransferValue;
 
-        /**
-         * Mutex protecting access to the context map. This is taken during insertion and removal
-         * of entries in the Prepare() and entry stubs.
-         */
-        static std::mutex gContextInfoLock;
+        /// Cothread that was most recently switched to on this kernel thread
+        static thread_local UContext *gSwitchTarget;
 
         /**
-         * Value of the next integer of the context info map key.
+         * Cothread whose jump buffer is being set up by the bootstrap function on this kernel
+         * thread, and the context to return to once it's done.
          */
-        static int gContextNextId;
+        static thread_local UContext *gPreparing;
+        static thread_local jmp_buf *gPrepareReturn;
 
     private:
         /// When set, the stack was allocated by us and must be freed on release
         bool ownsStack{false};
+
+        /// Entry record to invoke once the cothread starts executing
+        EntryRecord *entry{nullptr};
 };
 }
 
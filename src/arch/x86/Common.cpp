@@ -2,7 +2,9 @@
  * x86 implementation of cothreads for all ABIs
  */
 #include "Common.h"
+#include "AllocImpl.h"
 #include "CothreadPrivate.h"
+#include "StackPoolPrivate.h"
 
 #include "Fastcall.S"
 
@@ -24,46 +26,31 @@ using namespace libcommunism::internal;
  * the system already.
  */
 thread_local std::array<uintptr_t, x86::kMainStackSize> x86::gMainStack;
+thread_local uintptr_t x86::gTransferValue{0};
 
 
 
 /**
  * Allocate an x86 cothread instance, allocating the stack as part of this.
  *
- * @param entry Method to execute on entry to this cothread
  * @param stackSize Size of the stack to be allocated, in bytes. it should be a multiple of the
  *        machine word size, or specify zero to use the platform default.
+ * @param stackType Kind of memory to allocate for the stack
  *
  * @throw std::runtime_error If the memory for the cothread could not be allocated.
- * @throw std::runtime_error If the provided stack size is invalid
  */
-x86::x86(const Entry &entry, const size_t stackSize) : CothreadImpl(entry, stackSize) {
+x86::x86(const size_t stackSize, const StackType stackType) : CothreadImpl(stackSize, stackType) {
     void *buf{nullptr};
 
     // round down stack size to ensure it's aligned before allocating it
     auto allocSize = stackSize & ~(kStackAlignment - 1);
     allocSize = allocSize ? allocSize : kDefaultStackSize;
 
-    buf = AllocStack(allocSize);
+    buf = AllocStack(allocSize, stackType);
 
     // create it as if we had provided the memory in the first place
     this->stack = {reinterpret_cast<uintptr_t *>(buf), allocSize / sizeof(uintptr_t)};
     this->ownsStack = true;
-
-    Prepare(this, entry);
-}
-
-/**
- * Allocates an x86 cothread with an already provided stack.
- *
- * @param entry Method to execute on entry to this cothread
- * @param stack Buffer to use as the stack of the cothread
- *
- * @throw std::runtime_error If the provided stack is invalid
- */
-x86::x86(const Entry &entry, std::span<uintptr_t> stack) : CothreadImpl(entry, stack) {
-    x86::ValidateStackSize(stack.size() * sizeof(uintptr_t));
-    Prepare(this, entry);
 }
 
 /**
@@ -71,14 +58,10 @@ x86::x86(const Entry &entry, std::span<uintptr_t> stack) : CothreadImpl(entry, s
  */
 x86::~x86() {
     if(this->ownsStack) {
-        x86::DeallocStack(this->stack.data());
+        x86::DeallocStack(this->stack.data(), this->stack.size() * sizeof(uintptr_t));
     }
 }
 
-void x86::switchTo(CothreadImpl *from) {
-    x86::Switch(static_cast<x86 *>(from), this);
-}
-
 /**
  * Ensures the provided stack size is valid.
  *
@@ -92,45 +75,49 @@ void x86::ValidateStackSize(const size_t size) {
 }
 
 /**
- * Allocates memory for a stack that's the given number of bytes in size.
+ * Allocates memory for a stack that's the given number of bytes in size. It's taken from the
+ * stack pool, which in turn gets it from the system heap.
  * 
  * @remark If required (for page alignment, for example) the size may be rounded up.
  *
  * @param bytes Size of the stack memory, in bytes.
+ * @param type Kind of memory to allocate for the stack
  *
  * @throw std::runtime_error If memory allocation failed
  * @return Pointer to the _top_ of allocated stack
  */
-void* x86::AllocStack(const size_t bytes) {
-    void *buf{nullptr};
-#ifdef _WIN32
-    buf = _aligned_malloc(bytes, kStackAlignment);
-#else
-    int err{0};
-    err = posix_memalign(&buf, kStackAlignment, bytes);
-    if(err) {
-        throw std::runtime_error("posix_memalign() failed");
-    }
-#endif
-    if(!buf) {
-        throw std::runtime_error("failed to allocate stack");
-    }
-    return buf;
+void* x86::AllocStack(const size_t bytes, const StackType type) {
+    return AllocPooledStack(bytes, type);
 }
 
 /**
  * Releases previously allocated stack memory.
  *
  * @param stack Pointer to the top of previously allocated stack.
+ * @param bytes Size of the stack memory, as passed to AllocStack()
  *
  * @throw std::runtime_error If deallocating stack fails (invalid pointer)
  */
-void x86::DeallocStack(void* stack) {
-#ifdef _WIN32
-    _aligned_free(stack);
-#else
-    free(stack);
-#endif
+void x86::DeallocStack(void* stack, const size_t bytes) {
+    FreePooledStack(stack, bytes);
+}
+
+/**
+ * Performs a context switch, passing the value through a per kernel thread variable; it's read
+ * back once this cothread is switched to again.
+ */
+uintptr_t x86::Transfer(x86 *from, x86 *to, const uintptr_t value) noexcept {
+    gTransferValue = value;
+    Switch(from, to);
+    return ReceiveTransferValue();
+}
+
+/**
+ * Reads the value passed by the most recent Transfer() on the calling kernel thread. This is not
+ * inlined, since the cothread may have been resumed on a different kernel thread.
+ */
+COTHREAD_NOINLINE uintptr_t x86::ReceiveTransferValue() {
+    return gTransferValue;
 }
 
 /**
@@ -142,13 +129,12 @@ void x86::CothreadReturned() {
 }
 
 /**
- * Performs the call described inside a call info structure.
+ * Invokes the entry point described by an entry record.
  *
- * @param info Pointer to the call info structure; it's deleted once the call returns.
+ * @param entry Entry record of the cothread
  */
-void x86::DereferenceCallInfo(CallInfo *info) {
-    info->entry();
-    delete info;
+void x86::InvokeEntry(EntryRecord *entry) {
+    entry->invoke(entry);
 
     // invoke the return handler; this shouldn't return
     CothreadReturned();
@@ -160,9 +146,9 @@ void x86::DereferenceCallInfo(CallInfo *info) {
  * which then in turn jumps to the context dereferencing handler.
  *
  * @param wrap Wrapper structure defining the cothread
- * @param main Entry point for the cothread
+ * @param entry Entry record of the cothread; the stack frame is built immediately below it
  */
-void x86::Prepare(x86 *wrap, const Entry &entry) {
+void x86::Prepare(x86 *wrap, EntryRecord *entry) {
 #ifndef _MSC_VER
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Winvalid-offsetof"
@@ -172,24 +158,20 @@ void x86::Prepare(x86 *wrap, const Entry &entry) {
 #pragma GCC diagnostic pop
 #endif
 
-    // build the context structure we pass to our entry point stub
-    auto info = new CallInfo{entry};
-    if(!info) throw std::runtime_error("Failed to allocate call info");
+    x86::ValidateStackSize(wrap->stack.size() * sizeof(uintptr_t));
 
     // NOLINTBEGIN(cppcoreguidelines-pro-type-reinterpret-cast)
-    // prepare some space for a stack frame
-    auto &stackBuf = wrap->stack;
-    auto stackFrame = reinterpret_cast<std::byte *>(stackBuf.data());
-    stackFrame += ((stackBuf.size()*sizeof(uintptr_t)) & ~(0x10-1))
-        - (sizeof(uintptr_t) * (4 + kNumSavedRegisters));
+    // prepare some space for a stack frame below the entry record
+    auto stackFrame = reinterpret_cast<std::byte *>(reinterpret_cast<uintptr_t>(entry) & ~(0x10-1));
+    stackFrame -= sizeof(uintptr_t) * (4 + kNumSavedRegisters);
     auto stack = reinterpret_cast<uintptr_t *>(stackFrame);
 
     // if main returns (it shouldn't, we call std:;terminate) just crash
     *--stack = 0;
 
     // and then jump to the stub that calls the entry point
-    *--stack = reinterpret_cast<uintptr_t>(info);
-    *--stack = reinterpret_cast<uintptr_t>(&x86::DereferenceCallInfo);
+    *--stack = reinterpret_cast<uintptr_t>(entry);
+    *--stack = reinterpret_cast<uintptr_t>(&x86::InvokeEntry);
     *--stack = reinterpret_cast<uintptr_t>(&x86::JumpToEntry);
     // NOLINTEND(cppcoreguidelines-pro-type-reinterpret-cast)
 
@@ -204,11 +186,9 @@ void x86::Prepare(x86 *wrap, const Entry &entry) {
 
 
 /**
- * Allocates the current physical (kernel) thread's Cothread object.
- *
- * @note This will leak the associated cothread object, unless the caller stores it somewhere and
- *       ensures they deallocate it later when the underlying kernel thread is destroyed.
+ * Allocates the implementation for the current physical (kernel) thread's Cothread object, in the
+ * provided buffer.
  */
-CothreadImpl *libcommunism::AllocKernelThreadWrapper() {
-    return new x86(x86::gMainStack);
+x86 *x86::AllocKernelThread(std::span<uintptr_t> buffer, bool &bufferUsed) {
+    return AllocImplHelper<x86>(buffer, bufferUsed, x86::gMainStack);
 }
@@ -27,32 +27,31 @@ namespace libcommunism::internal {
  * when it is switched out.
  */
 class x86 final: public CothreadImpl {
-    friend CothreadImpl *libcommunism::AllocKernelThreadWrapper();
-
-    private:
-        /**
-         * @brief Information required to make a function call for a cothread's entry point.
-         */
-        struct CallInfo {
-            /// Entry point of the cothread
-            Entry entry;
-        };
+    friend class libcommunism::Cothread;
+    template<class Backend> friend class libcommunism::BasicCothread;
 
     public:
-        x86(const Entry &entry, const size_t stackSize = 0);
-        x86(const Entry &entry, std::span<uintptr_t> stack);
+        x86(const size_t stackSize = 0, const StackType stackType = StackType::Default);
         x86(std::span<uintptr_t> stack) : CothreadImpl(stack) {}
         ~x86();
 
-        void switchTo(CothreadImpl *from) override;
 
     private:
         static void ValidateStackSize(const size_t size);
-        static void* AllocStack(const size_t bytes);
-        static void DeallocStack(void* stack);
+        static void* AllocStack(const size_t bytes, const StackType type);
+        static void DeallocStack(void* stack, const size_t bytes);
         static void CothreadReturned();
-        static void FASTCALL_TAG DereferenceCallInfo(CallInfo *info);
-        static void Prepare(x86 *thread, const Entry &entry);
+        static void FASTCALL_TAG InvokeEntry(EntryRecord *entry);
+        static void Prepare(x86 *thread, EntryRecord *entry);
+
+        /**
+         * Allocates the implementation for a cothread that represents the calling kernel thread,
+         * which saves its context into the per thread main stack.
+         *
+         * @param buffer Buffer into which the implementation should be allocated, if it fits
+         * @param bufferUsed Set if the implementation was allocated in the buffer
+         */
+        static x86 *AllocKernelThread(std::span<uintptr_t> buffer, bool &bufferUsed);
 
         /**
          * Performs a context switch.
@@ -63,7 +62,30 @@ class x86 final: public CothreadImpl {
          * @param from Cothread buffer that will receive the current context
          * @param to Cothread buffer whose context is to be restored
          */
-        static void FASTCALL_TAG Switch(x86 *from, x86 *to);
+        static void FASTCALL_TAG Switch(x86 *from, x86 *to) noexcept;
+
+        /**
+         * Performs a context switch, passing a value to the destination cothread.
+         *
+         * @remark Since a third fastcall argument is passed on the stack (and popped by the
+         *         callee) the value can't be carried through Switch() in a register without
+         *         unbalancing the stack of a cothread that suspended itself in Switch(). Instead,
+         *         it's passed through a per kernel thread variable.
+         *
+         * @param from Cothread buffer that will receive the current context
+         * @param to Cothread buffer whose context is to be restored
+         * @param value Value to pass to the destination cothread
+         *
+         * @return Value passed by the cothread that switches back to this one
+         */
+        static uintptr_t Transfer(x86 *from, x86 *to, const uintptr_t value) noexcept;
+
+        /**
+         * Reads the value passed to the calling kernel thread by the most recent Transfer().
+         *
+         * @return Value passed to the cothread that was just switched to
+         */
+        static uintptr_t ReceiveTransferValue();
 
         /**
          * Pops two words off the stack (for the address of the entry function, and its first register
@@ -104,6 +126,8 @@ class x86 final: public CothreadImpl {
 
     private:
         static thread_local std::array<uintptr_t, kMainStackSize> gMainStack;
+        /// Value being passed to the destination of a Transfer() on this kernel thread
+        static thread_local uintptr_t gTransferValue;
 
         /// When set, the stack was allocated by us and must be freed on release
         bool ownsStack{false};
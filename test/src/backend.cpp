@@ -0,0 +1,273 @@
+/*
+ * Tests for cothreads with an explicitly selected platform implementation.
+ */
+#include <catch2/catch.hpp>
+
+#include <libcommunism/BasicCothread.h>
+#include <libcommunism/Cothread.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(LIBCOMMUNISM_BACKEND_SETJMP)
+#include <signal.h>
+#endif
+
+using namespace libcommunism;
+
+/**
+ * Ping-pongs between the current cothread and a cothread of the given backend, with the callable
+ * receiving arguments; then destroys it while it's suspended, which must destroy the callable.
+ */
+template<class Backend>
+static void TestPingPong() {
+    constexpr static const size_t kNumRounds{1000};
+
+    using Thread = BasicCothread<Backend>;
+    static Thread *main;
+    main = Thread::Current();
+    REQUIRE(main);
+    REQUIRE(Thread::Current() == main);
+
+    size_t counter{0};
+    auto token = std::make_shared<int>(0);
+
+    auto thread = std::make_unique<Thread>(1024 * 64, StackType::Default,
+            [token](size_t *counter, size_t increment) {
+        while(true) {
+            *counter += increment;
+            main->switchTo();
+        }
+    }, &counter, 2);
+    REQUIRE(thread->getStackSize() >= 1024 * 64);
+    REQUIRE(thread->getStack());
+    REQUIRE(token.use_count() == 2);
+
+    for(size_t i = 0; i < kNumRounds; i++) {
+        thread->switchTo();
+        REQUIRE(Thread::Current() == main);
+    }
+    REQUIRE(counter == kNumRounds * 2);
+
+    thread.reset();
+    REQUIRE(token.use_count() == 1);
+}
+
+/**
+ * Runs a cothread of the given backend on a caller provided stack, from within a regular
+ * Cothread; the backend's Current() cothread then represents that Cothread.
+ */
+template<class Backend>
+static void TestNested() {
+    using Thread = BasicCothread<Backend>;
+
+    alignas(64) static std::array<uintptr_t, 1024 * 64 / sizeof(uintptr_t)> stack;
+    static Cothread *outerMain;
+    static Thread *inner;
+    std::string trace;
+
+    outerMain = Cothread::Current();
+
+    Cothread outer(1024 * 64, [&]() {
+        auto innerMain = Thread::Current();
+        inner = new Thread(stack, [&, innerMain]() {
+            trace += "i";
+            innerMain->switchTo();
+            trace += "j";
+            innerMain->switchTo();
+        });
+
+        trace += "a";
+        inner->switchTo();
+        trace += "b";
+        inner->switchTo();
+        trace += "c";
+        outerMain->switchTo();
+    });
+
+    outer.switchTo();
+    delete inner;
+
+    REQUIRE(trace == "aibjc");
+}
+
+#if defined(LIBCOMMUNISM_BACKEND_AMD64)
+TEST_CASE("amd64 backend") {
+    REQUIRE(std::string(BasicCothread<backend::Amd64>::GetBackendName()) == "amd64");
+    TestPingPong<backend::Amd64>();
+    TestNested<backend::Amd64>();
+}
+#endif
+
+#if defined(LIBCOMMUNISM_BACKEND_AARCH64)
+TEST_CASE("aarch64 backend") {
+    TestPingPong<backend::Aarch64>();
+    TestNested<backend::Aarch64>();
+}
+#endif
+
+#if defined(LIBCOMMUNISM_BACKEND_X86)
+TEST_CASE("x86 backend") {
+    TestPingPong<backend::X86>();
+    TestNested<backend::X86>();
+}
+#endif
+
+#if defined(LIBCOMMUNISM_BACKEND_SETJMP)
+TEST_CASE("setjmp backend") {
+    TestPingPong<backend::SetJmp>();
+    TestNested<backend::SetJmp>();
+}
+#endif
+
+#if defined(LIBCOMMUNISM_BACKEND_SETJMP)
+/**
+ * Creates and destroys setjmp cothreads in a loop, so that their stacks (and the bootstrap context
+ * kept on them) are reused; each must still run its own entry point. A cothread with an entry
+ * record that doesn't fit above the existing bootstrap frame has to be set up from scratch.
+ */
+TEST_CASE("setjmp backend reuses bootstrap context") {
+    using Thread = BasicCothread<backend::SetJmp>;
+    static Thread *main;
+    main = Thread::Current();
+
+    size_t sum{0};
+    for(size_t i = 0; i < 100; i++) {
+        Thread thread(1024 * 64, StackType::Default, [&sum, i]() {
+            sum += i;
+            main->switchTo();
+        });
+        thread.switchTo();
+    }
+    REQUIRE(sum == (99 * 100) / 2);
+
+    std::array<size_t, 64> values{};
+    values.back() = 42;
+    Thread large(1024 * 64, StackType::Default, [&sum, values]() {
+        sum = values.back();
+        main->switchTo();
+    });
+    large.switchTo();
+    REQUIRE(sum == 42);
+}
+
+/**
+ * Creates setjmp cothreads on several kernel threads at once.
+ */
+TEST_CASE("setjmp backend concurrent creation") {
+    constexpr static const size_t kNumThreads{4};
+    constexpr static const size_t kNumCothreads{250};
+
+    std::array<size_t, kNumThreads> counts{};
+    std::vector<std::thread> threads;
+
+    for(size_t i = 0; i < kNumThreads; i++) {
+        threads.emplace_back([&counts, i]() {
+            using Thread = BasicCothread<backend::SetJmp>;
+            auto main = Thread::Current();
+
+            for(size_t j = 0; j < kNumCothreads; j++) {
+                // alternate sizes, so that some stacks are set up from scratch
+                Thread thread(1024 * ((j % 2) ? 64 : 32), StackType::Default, [&, main]() {
+                    counts[i]++;
+                    main->switchTo();
+                });
+                thread.switchTo();
+            }
+        });
+    }
+    for(auto &thread : threads) {
+        thread.join();
+    }
+
+    for(const auto count : counts) {
+        REQUIRE(count == kNumCothreads);
+    }
+}
+
+/**
+ * The setup signal handler of the setjmp backend remains installed, but passes signals it didn't
+ * raise itself on to the handler installed before it.
+ */
+TEST_CASE("setjmp backend forwards signals") {
+    using Thread = BasicCothread<backend::SetJmp>;
+    static Thread *main;
+    static volatile sig_atomic_t received;
+    alignas(64) static std::array<uintptr_t, 1024 * 64 / sizeof(uintptr_t)> stack;
+    main = Thread::Current();
+    received = 0;
+
+    struct sigaction handler{}, oldHandler{};
+    handler.sa_handler = [](int) {
+        received = received + 1;
+    };
+    sigemptyset(&handler.sa_mask);
+    REQUIRE(!sigaction(SIGUSR1, &handler, &oldHandler));
+
+    // cothreads on caller provided stacks are always set up with the signal handler
+    bool ran{false};
+    Thread thread(stack, [&ran]() {
+        ran = true;
+        main->switchTo();
+    });
+    REQUIRE(received == 0);
+
+    thread.switchTo();
+    REQUIRE(ran);
+
+    raise(SIGUSR1);
+    REQUIRE(received == 1);
+
+    sigaction(SIGUSR1, &oldHandler, nullptr);
+}
+#endif
+
+#if defined(LIBCOMMUNISM_BACKEND_UCONTEXT)
+TEST_CASE("ucontext backend") {
+    TestPingPong<backend::UContext>();
+    TestNested<backend::UContext>();
+}
+#endif
+
+#if defined(LIBCOMMUNISM_BACKEND_SETJMP) && defined(LIBCOMMUNISM_BACKEND_UCONTEXT)
+/**
+ * Cothreads of different backends can be nested within each other: a ucontext cothread runs a
+ * setjmp cothread, which suspends back into it.
+ */
+TEST_CASE("mixed backends") {
+    using Outer = BasicCothread<backend::UContext>;
+    using Inner = BasicCothread<backend::SetJmp>;
+
+    static Outer *outerMain;
+    static Inner *innerMain;
+    size_t counter{0};
+
+    outerMain = Outer::Current();
+
+    Inner inner(1024 * 64, StackType::Default, [&]() {
+        while(true) {
+            counter++;
+            innerMain->switchTo();
+        }
+    });
+    Outer outer(1024 * 64, StackType::Default, [&]() {
+        innerMain = Inner::Current();
+
+        while(true) {
+            inner.switchTo();
+            counter *= 10;
+            outerMain->switchTo();
+        }
+    });
+
+    outer.switchTo();
+    REQUIRE(counter == 10);
+    outer.switchTo();
+    REQUIRE(counter == 110);
+}
+#endif
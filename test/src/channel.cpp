@@ -0,0 +1,232 @@
+/*
+ * Tests for channels.
+ */
+#include <catch2/catch.hpp>
+
+#include <libcommunism/Channel.h>
+#include <libcommunism/Runtime.h>
+#include <libcommunism/Scheduler.h>
+
+#include <atomic>
+#include <memory>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+using namespace libcommunism;
+
+/**
+ * Non-blocking operations on a bounded channel fail once it's full or empty, and values come out
+ * in the order they were sent.
+ */
+TEST_CASE("channel bounded try send and receive") {
+    Channel<std::unique_ptr<int>> channel(3);
+    REQUIRE(channel.getCapacity() == 3);
+    REQUIRE(!channel.tryReceive());
+
+    for(int i = 0; i < 3; i++) {
+        REQUIRE(channel.trySend(std::make_unique<int>(i)));
+    }
+
+    // a value that's not sent is left alone
+    auto extra = std::make_unique<int>(3);
+    REQUIRE(!channel.trySend(std::move(extra)));
+    REQUIRE(extra);
+
+    for(int i = 0; i < 3; i++) {
+        auto value = channel.tryReceive();
+        REQUIRE(value);
+        REQUIRE(**value == i);
+    }
+    REQUIRE(!channel.tryReceive());
+
+    // values still buffered when the channel is destroyed are destroyed with it
+    auto token = std::make_shared<int>(0);
+    {
+        Channel<std::shared_ptr<int>> other(2);
+        REQUIRE(other.send(token));
+        REQUIRE(token.use_count() == 2);
+    }
+    REQUIRE(token.use_count() == 1);
+}
+
+/**
+ * Closing a channel causes sends to fail, while values sent before it was closed can still be
+ * received.
+ */
+TEST_CASE("channel close") {
+    for(const size_t capacity : {size_t{4}, Channel<int>::kUnbounded}) {
+        Channel<int> channel(capacity);
+        REQUIRE(channel.send(1));
+        REQUIRE(channel.send(2));
+
+        REQUIRE(!channel.isClosed());
+        channel.close();
+        REQUIRE(channel.isClosed());
+
+        REQUIRE(!channel.send(3));
+        REQUIRE(channel.receive() == 1);
+        REQUIRE(channel.receive() == 2);
+        REQUIRE(!channel.receive());
+    }
+}
+
+/**
+ * A producer and consumer on the same kernel thread, spawned through the scheduler, block on a
+ * channel that's much smaller than the number of values passed through it.
+ */
+TEST_CASE("channel blocks scheduler cothreads") {
+    constexpr static const int kNumValues{1000};
+
+    for(const size_t capacity : {size_t{0}, size_t{1}, size_t{8}, Channel<int>::kUnbounded}) {
+        Channel<int> channel(capacity);
+        std::vector<int> received;
+
+        Scheduler::Spawn([&channel, &received]() {
+            while(auto value = channel.receive()) {
+                received.push_back(*value);
+            }
+        });
+        Scheduler::Spawn([&channel]() {
+            for(int i = 0; i < kNumValues; i++) {
+                channel.send(i);
+            }
+            channel.close();
+        });
+
+        REQUIRE(Scheduler::Run() == 0);
+
+        REQUIRE(received.size() == kNumValues);
+        for(int i = 0; i < kNumValues; i++) {
+            REQUIRE(received[i] == i);
+        }
+    }
+}
+
+/**
+ * Values are sent and received in batches; receiving a batch returns as soon as some values are
+ * available.
+ */
+TEST_CASE("channel batches") {
+    constexpr static const size_t kNumValues{64};
+
+    for(const size_t capacity : {size_t{16}, Channel<int>::kUnbounded}) {
+        Channel<int> channel(capacity);
+        std::vector<int> received;
+
+        Scheduler::Spawn([&channel, &received]() {
+            std::vector<int> batch(10);
+            while(const auto num = channel.receiveBatch(batch.begin(), batch.size())) {
+                REQUIRE(num <= batch.size());
+                received.insert(received.end(), batch.begin(), batch.begin() + num);
+            }
+        });
+        Scheduler::Spawn([&channel]() {
+            std::vector<int> values(kNumValues);
+            std::iota(values.begin(), values.end(), 0);
+
+            REQUIRE(channel.sendBatch(values) == kNumValues);
+            channel.close();
+            REQUIRE(channel.sendBatch(values) == 0);
+        });
+
+        REQUIRE(Scheduler::Run() == 0);
+
+        REQUIRE(received.size() == kNumValues);
+        for(size_t i = 0; i < kNumValues; i++) {
+            REQUIRE(received[i] == static_cast<int>(i));
+        }
+    }
+}
+
+/**
+ * Several producers and consumers on an M:N runtime, as well as a kernel thread outside of it, pass
+ * values through each kind of channel; every value must be received exactly once.
+ */
+TEST_CASE("channel across kernel threads") {
+    constexpr static const size_t kNumProducers{4};
+    constexpr static const size_t kNumConsumers{4};
+    constexpr static const size_t kNumValues{5000};
+
+    for(const size_t capacity : {size_t{0}, size_t{1}, size_t{32}, Channel<size_t>::kUnbounded}) {
+        Channel<size_t> channel(capacity);
+        std::atomic_size_t sum{0}, count{0}, producersLeft{kNumProducers + 1};
+
+        auto produce = [&]() {
+            for(size_t i = 1; i <= kNumValues; i++) {
+                channel.send(i);
+            }
+            if(!--producersLeft) {
+                channel.close();
+            }
+        };
+
+        Runtime runtime(4, 1024 * 64);
+        for(size_t i = 0; i < kNumConsumers; i++) {
+            runtime.spawn([&]() {
+                while(auto value = channel.receive()) {
+                    sum += *value;
+                    count++;
+                }
+            });
+        }
+        for(size_t i = 0; i < kNumProducers; i++) {
+            runtime.spawn(produce);
+        }
+
+        std::thread kernelThread(produce);
+        kernelThread.join();
+        runtime.wait();
+
+        constexpr static const size_t kNumSent{(kNumProducers + 1) * kNumValues};
+        REQUIRE(count == kNumSent);
+        REQUIRE(sum == (kNumProducers + 1) * (kNumValues * (kNumValues + 1) / 2));
+    }
+}
+
+/**
+ * Producers and consumers spawned through the schedulers of two different kernel threads pass
+ * values through each kind of channel; blocked cothreads are woken from the other kernel thread.
+ */
+TEST_CASE("channel between schedulers") {
+    constexpr static const size_t kNumProducers{4};
+    constexpr static const size_t kNumConsumers{4};
+    constexpr static const size_t kNumValues{2000};
+
+    for(const size_t capacity : {size_t{0}, size_t{1}, size_t{32}, Channel<size_t>::kUnbounded}) {
+        Channel<size_t> channel(capacity);
+        std::atomic_size_t sum{0}, count{0}, producersLeft{kNumProducers}, numLeft{0};
+
+        std::thread consumers([&]() {
+            for(size_t i = 0; i < kNumConsumers; i++) {
+                Scheduler::Spawn([&]() {
+                    while(auto value = channel.receive()) {
+                        sum += *value;
+                        count++;
+                    }
+                });
+            }
+            numLeft += Scheduler::Run();
+        });
+        std::thread producers([&]() {
+            for(size_t i = 0; i < kNumProducers; i++) {
+                Scheduler::Spawn([&]() {
+                    for(size_t j = 1; j <= kNumValues; j++) {
+                        channel.send(j);
+                    }
+                    if(!--producersLeft) {
+                        channel.close();
+                    }
+                });
+            }
+            numLeft += Scheduler::Run();
+        });
+
+        producers.join();
+        consumers.join();
+
+        REQUIRE(numLeft == 0);
+        REQUIRE(count == kNumProducers * kNumValues);
+        REQUIRE(sum == kNumProducers * (kNumValues * (kNumValues + 1) / 2));
+    }
+}
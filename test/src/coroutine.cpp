@@ -0,0 +1,180 @@
+/*
+ * Tests for the interoperation of stackless coroutines and cothreads through the scheduler.
+ */
+#include <catch2/catch.hpp>
+
+#include <libcommunism/Channel.h>
+#include <libcommunism/Coroutine.h>
+#include <libcommunism/Scheduler.h>
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace libcommunism;
+
+/**
+ * A coroutine awaits work that runs on a cothread (which itself yields to the scheduler), and is
+ * waited on by another cothread.
+ */
+TEST_CASE("coroutine awaits cothread") {
+    static int result;
+    result = 0;
+
+    const auto coroutine = []() -> Task<int> {
+        const auto value = co_await RunOnCothread([](const int x) {
+            Scheduler::Yield();
+            return x * 2;
+        }, 21);
+        co_return value;
+    };
+
+    Scheduler::Spawn([&coroutine]() {
+        result = coroutine().wait();
+    });
+
+    REQUIRE(Scheduler::Run() == 0);
+    REQUIRE(result == 42);
+}
+
+/**
+ * A cothread waits on a task that completes without ever suspending, then on one that awaits
+ * another task.
+ */
+TEST_CASE("cothread waits on task") {
+    static std::string result;
+    result.clear();
+
+    const auto inner = [](std::string prefix) -> Task<std::string> {
+        co_await Reschedule();
+        co_return prefix + "inner";
+    };
+    const auto outer = [&inner]() -> Task<std::string> {
+        auto value = co_await inner("outer ");
+        co_return value + " done";
+    };
+    const auto immediate = []() -> Task<std::string> {
+        co_return "immediate ";
+    };
+
+    Scheduler::Spawn([&]() {
+        result = immediate().wait();
+        result += outer().wait();
+    });
+
+    REQUIRE(Scheduler::Run() == 0);
+    REQUIRE(result == "immediate outer inner done");
+}
+
+/**
+ * Coroutines that reschedule themselves take turns with cothreads that yield, in the order they
+ * were queued.
+ */
+TEST_CASE("coroutines and cothreads share scheduler") {
+    constexpr static const size_t kNumRounds{5};
+    static std::vector<std::string> order;
+    order.clear();
+
+    const auto coroutine = []() -> Task<> {
+        for(size_t i = 0; i < kNumRounds; i++) {
+            order.emplace_back("coroutine");
+            co_await Reschedule();
+        }
+    };
+
+    Scheduler::Spawn([&coroutine]() {
+        coroutine().wait();
+    });
+    Scheduler::Spawn([]() {
+        for(size_t i = 0; i < kNumRounds; i++) {
+            order.emplace_back("cothread");
+            Scheduler::Yield();
+        }
+    });
+
+    REQUIRE(Scheduler::Run() == 0);
+    REQUIRE(order.size() == kNumRounds * 2);
+    for(size_t i = 0; i < order.size(); i++) {
+        REQUIRE(order[i] == ((i % 2) ? "cothread" : "coroutine"));
+    }
+}
+
+/**
+ * Exceptions thrown on a cothread are rethrown in the awaiting coroutine, and exceptions escaping
+ * from a task are rethrown in the cothread waiting for it.
+ */
+TEST_CASE("coroutine exceptions") {
+    static bool caught, rethrown;
+    caught = rethrown = false;
+
+    const auto coroutine = []() -> Task<> {
+        try {
+            co_await RunOnCothread([]() -> int {
+                throw std::runtime_error("cothread");
+            });
+        } catch(const std::runtime_error &) {
+            caught = true;
+        }
+
+        co_await Reschedule();
+        throw std::logic_error("task");
+    };
+
+    Scheduler::Spawn([&coroutine]() {
+        try {
+            coroutine().wait();
+        } catch(const std::logic_error &) {
+            rethrown = true;
+        }
+    });
+
+    REQUIRE(Scheduler::Run() == 0);
+    REQUIRE(caught);
+    REQUIRE(rethrown);
+}
+
+/**
+ * A coroutine hands off blocking work to a cothread, which waits on a channel that's fed by
+ * another cothread; other coroutines keep running in the meantime.
+ */
+TEST_CASE("coroutine awaits blocking cothread") {
+    constexpr static const size_t kNumValues{10};
+    static size_t sum, rounds;
+    sum = rounds = 0;
+
+    Channel<size_t> channel(1);
+
+    const auto consumer = [&channel]() -> Task<> {
+        sum = co_await RunOnCothread([&channel]() {
+            size_t total{0};
+            while(auto value = channel.receive()) {
+                total += *value;
+            }
+            return total;
+        });
+    };
+    const auto spinner = []() -> Task<> {
+        while(!sum) {
+            rounds++;
+            co_await Reschedule();
+        }
+    };
+
+    Scheduler::Spawn([&]() {
+        consumer().wait();
+    });
+    Scheduler::Spawn([&]() {
+        spinner().wait();
+    });
+    Scheduler::Spawn([&channel]() {
+        for(size_t i = 1; i <= kNumValues; i++) {
+            channel.send(i);
+        }
+        channel.close();
+    });
+
+    REQUIRE(Scheduler::Run() == 0);
+    REQUIRE(sum == kNumValues * (kNumValues + 1) / 2);
+    REQUIRE(rounds > 0);
+}
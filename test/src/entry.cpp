@@ -0,0 +1,278 @@
+/*
+ * Tests for cothreads created with arbitrary callables, which are constructed in place on the
+ * cothread's stack, and for re-arming cothreads with a new entry point.
+ */
+#include <catch2/catch.hpp>
+
+#include <libcommunism/Cothread.h>
+
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace libcommunism;
+
+/// Number of calls to the global allocation functions, used to check creation doesn't allocate
+static std::atomic_size_t gNumAllocations{0};
+
+void *operator new(size_t size) {
+    gNumAllocations++;
+    if(auto ptr = std::malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+/**
+ * Creates a cothread on a caller provided stack with a callable that takes arguments, and ensures
+ * they are passed through to it.
+ */
+TEST_CASE("callable with arguments") {
+    constexpr static const size_t kStackSize{1024 * 64};
+    static Cothread *main{nullptr};
+
+    std::vector<uintptr_t> stack(kStackSize / sizeof(uintptr_t));
+    int sum{0};
+    std::string message;
+
+    main = Cothread::Current();
+
+    Cothread *t1{nullptr};
+    REQUIRE_NOTHROW(t1 = new Cothread(std::span<uintptr_t>(stack),
+                [&](int a, int b, std::string str) {
+        sum = a + b;
+        message = std::move(str);
+        main->switchTo();
+    }, 27, 42, std::string("hello from the stack, long enough to not fit inline")));
+
+    t1->switchTo();
+    REQUIRE(sum == 69);
+    REQUIRE(message == "hello from the stack, long enough to not fit inline");
+
+    REQUIRE_NOTHROW(delete t1);
+}
+
+/**
+ * Ensures the callable and its arguments are destroyed: when the cothread is deallocated without
+ * ever running, and once the entry point returns.
+ */
+TEST_CASE("callable lifetime") {
+    constexpr static const size_t kStackSize{1024 * 64};
+    auto token = std::make_shared<int>(0);
+
+    // never executed: destroyed along with the cothread
+    Cothread *t1{nullptr};
+    REQUIRE_NOTHROW(t1 = new Cothread(kStackSize, [token]() {}));
+    REQUIRE(token.use_count() == 2);
+    REQUIRE_NOTHROW(delete t1);
+    REQUIRE(token.use_count() == 1);
+
+    // executed to completion: destroyed before the return handler runs
+    auto main = Cothread::Current();
+    long countInHandler{0};
+
+    REQUIRE_NOTHROW(t1 = new Cothread(kStackSize, [](std::shared_ptr<int> ptr) {
+        (*ptr)++;
+    }, token));
+    REQUIRE(token.use_count() == 2);
+
+    Cothread::SetReturnHandler([&](auto) {
+        countInHandler = token.use_count();
+        main->switchTo();
+    });
+
+    t1->switchTo();
+    REQUIRE(*token == 1);
+    REQUIRE(countInHandler == 1);
+
+    REQUIRE_NOTHROW(delete t1);
+    REQUIRE(token.use_count() == 1);
+    Cothread::ResetReturnHandler();
+}
+
+/**
+ * Creating a cothread with a callable on a caller provided stack must not allocate any memory,
+ * regardless of how large the callable's captures are.
+ */
+TEST_CASE("creation on provided stack does not allocate") {
+    constexpr static const size_t kStackSize{1024 * 64};
+    alignas(64) static std::array<uintptr_t, kStackSize / sizeof(uintptr_t)> stack;
+    static Cothread *main{nullptr};
+
+    std::array<uint64_t, 32> payload;
+    payload.fill(0x4206942069);
+    uint64_t result{0};
+
+    main = Cothread::Current();
+
+    const auto before = gNumAllocations.load();
+    {
+        Cothread thread(stack, [payload, &result](uint64_t extra) {
+            for(auto value : payload) {
+                result += value;
+            }
+            result += extra;
+            main->switchTo();
+        }, uint64_t{1});
+        thread.switchTo();
+    }
+    const auto after = gNumAllocations.load();
+
+    REQUIRE(after == before);
+    REQUIRE(result == (0x4206942069 * payload.size()) + 1);
+}
+
+/**
+ * Callables that don't fit in the stack are rejected.
+ */
+TEST_CASE("oversized callable") {
+    std::vector<uintptr_t> stack(1024 / sizeof(uintptr_t));
+    std::array<std::byte, 4096> payload{};
+
+    REQUIRE_THROWS(new Cothread(std::span<uintptr_t>(stack), [payload]() {
+        (void) payload;
+    }));
+}
+
+/**
+ * Re-arms a cothread whose entry point returned, then one that's suspended in the middle of its
+ * entry point; neither may allocate memory.
+ */
+TEST_CASE("reset cothread") {
+    constexpr static const size_t kStackSize{1024 * 64};
+    alignas(64) static std::array<uintptr_t, kStackSize / sizeof(uintptr_t)> stack;
+    static Cothread *main{nullptr};
+
+    main = Cothread::Current();
+    int value{0};
+    auto token = std::make_shared<int>(0);
+
+    Cothread::SetReturnHandler([](auto) {
+        main->switchTo();
+    });
+
+    Cothread thread(stack, [&value]() {
+        value = 1;
+    });
+    thread.switchTo();
+    REQUIRE(value == 1);
+
+    // re-arm it after it returned
+    auto before = gNumAllocations.load();
+    REQUIRE_NOTHROW(thread.reset([&value](int newValue) {
+        value = newValue;
+    }, 2));
+    thread.switchTo();
+    REQUIRE(value == 2);
+    REQUIRE(gNumAllocations.load() == before);
+
+    // re-arm it while it's suspended; the old callable is destroyed
+    REQUIRE_NOTHROW(thread.reset([&value, token]() {
+        value = 3;
+        main->switchTo();
+    }));
+    thread.switchTo();
+    REQUIRE(value == 3);
+    REQUIRE(token.use_count() == 2);
+
+    before = gNumAllocations.load();
+    REQUIRE_NOTHROW(thread.reset([&value](int a, int b) {
+        value = a * b;
+    }, 6, 7));
+    REQUIRE(token.use_count() == 1);
+    thread.switchTo();
+    REQUIRE(value == 42);
+    REQUIRE(gNumAllocations.load() == before);
+
+    Cothread::ResetReturnHandler();
+}
+
+/**
+ * Recycles a worker cothread from the return handler, by re-arming it with the next request each
+ * time its entry point returns. Once the reset helper exists, this does not allocate memory.
+ */
+TEST_CASE("reset from return handler") {
+    constexpr static const size_t kStackSize{1024 * 64};
+    constexpr static const size_t kNumRequests{64};
+    alignas(64) static std::array<uintptr_t, kStackSize / sizeof(uintptr_t)> stack;
+    static Cothread *main{nullptr};
+    static std::vector<size_t> processed;
+    static size_t next{0};
+
+    main = Cothread::Current();
+    processed.clear();
+    processed.reserve(kNumRequests);
+    next = 0;
+
+    auto work = [](size_t request, std::array<uint64_t, 8> payload) {
+        processed.push_back(request + payload[0]);
+    };
+
+    Cothread::SetReturnHandler([&work](Cothread *thread) {
+        if(next == kNumRequests) {
+            main->switchTo();
+        }
+        thread->reset(work, next++, std::array<uint64_t, 8>{});
+    });
+
+    Cothread worker(stack, work, next++, std::array<uint64_t, 8>{});
+    worker.switchTo();
+    REQUIRE(processed.size() == kNumRequests);
+
+    // do it again, now that the reset helper has been allocated
+    const auto before = gNumAllocations.load();
+    processed.clear();
+    next = 0;
+
+    REQUIRE_NOTHROW(worker.reset(work, next++, std::array<uint64_t, 8>{}));
+    worker.switchTo();
+
+    REQUIRE(gNumAllocations.load() == before);
+    REQUIRE(processed.size() == kNumRequests);
+    for(size_t i = 0; i < kNumRequests; i++) {
+        REQUIRE(processed[i] == i);
+    }
+
+    Cothread::ResetReturnHandler();
+}
+
+/**
+ * Attempts to re-arm the executing cothread with a callable that doesn't fit its stack; the
+ * exception must be propagated back to it, and it must be able to continue executing.
+ */
+TEST_CASE("failed reset of executing cothread") {
+    using Payload = std::array<std::byte, 1024 * 40>;
+    static Cothread *main{nullptr};
+    std::vector<uintptr_t> stack(1024 * 64 / sizeof(uintptr_t));
+    bool caught{false}, continued{false};
+
+    main = Cothread::Current();
+
+    Cothread thread(std::span<uintptr_t>(stack), [&]() {
+        Payload payload{};
+        try {
+            Cothread::Current()->reset([](const Payload &) {}, payload);
+        } catch(const std::runtime_error &) {
+            caught = true;
+        }
+        continued = true;
+        main->switchTo();
+    });
+    thread.switchTo();
+
+    REQUIRE(caught);
+    REQUIRE(continued);
+}
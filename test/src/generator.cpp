@@ -0,0 +1,204 @@
+/*
+ * Tests for generators, which produce values from a body executing on a cothread.
+ */
+#include <catch2/catch.hpp>
+
+#include <libcommunism/Generator.h>
+
+#include <cstddef>
+#include <memory>
+#include <ranges>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace libcommunism;
+
+static_assert(std::ranges::input_range<Generator<int>>);
+
+namespace {
+/**
+ * Node of a binary tree that's walked by a generator
+ */
+struct Node {
+    int value;
+    std::unique_ptr<Node> left, right;
+};
+
+/**
+ * Builds a balanced tree holding the values in the given (inclusive) range.
+ */
+std::unique_ptr<Node> BuildTree(const int first, const int last) {
+    if(first > last) {
+        return nullptr;
+    }
+
+    const auto middle = first + (last - first) / 2;
+    auto node = std::make_unique<Node>();
+    node->value = middle;
+    node->left = BuildTree(first, middle - 1);
+    node->right = BuildTree(middle + 1, last);
+    return node;
+}
+
+/**
+ * Yields the nodes of the tree in order, from nested calls.
+ */
+void WalkTree(const Node *node) {
+    if(!node) {
+        return;
+    }
+
+    WalkTree(node->left.get());
+    Generator<const Node>::Yield(*node);
+    WalkTree(node->right.get());
+}
+
+/**
+ * Increments a counter when destroyed, to observe unwinding of a generator's stack.
+ */
+struct Sentry {
+    explicit Sentry(size_t &counter) : counter(counter) {}
+    ~Sentry() {
+        this->counter++;
+    }
+
+    size_t &counter;
+};
+}
+
+/**
+ * Walks a tree recursively; the consumer receives the values in order.
+ */
+TEST_CASE("generator walks tree") {
+    constexpr static const int kNumNodes{100};
+    const auto tree = BuildTree(1, kNumNodes);
+
+    Generator<const Node> nodes([&tree]() {
+        WalkTree(tree.get());
+    });
+
+    int expected{1};
+    for(const auto &node : nodes) {
+        REQUIRE(node.value == expected);
+        expected++;
+    }
+    REQUIRE(expected == kNumNodes + 1);
+}
+
+/**
+ * The consumer receives references to the objects on the body's stack, and may modify them; a
+ * temporary is valid until the consumer advances.
+ */
+TEST_CASE("generator yields without copying") {
+    static const std::string *address;
+    static std::string modified;
+    address = nullptr;
+    modified.clear();
+
+    Generator<std::string> strings([]() {
+        std::string value("on the producer's stack");
+        address = &value;
+        Generator<std::string>::Yield(value);
+        modified = value;
+
+        Generator<std::string>::Yield(std::string("temporary"));
+    });
+
+    auto it = strings.begin();
+    REQUIRE(&*it == address);
+    *it = "changed by consumer";
+
+    ++it;
+    REQUIRE(modified == "changed by consumer");
+    REQUIRE(*it == "temporary");
+
+    ++it;
+    REQUIRE(it == strings.end());
+}
+
+/**
+ * Breaking out of the loop early destroys the generator, which unwinds the body's stack; a
+ * generator that's never iterated doesn't invoke its body at all.
+ */
+TEST_CASE("generator early termination") {
+    static size_t destroyed, produced;
+    destroyed = produced = 0;
+
+    const auto body = []() {
+        Sentry sentry(destroyed);
+        for(int i = 0; ; i++) {
+            produced++;
+            Generator<int>::Yield(i);
+        }
+    };
+
+    {
+        Generator<int> numbers(body);
+        for(const auto value : numbers) {
+            if(value == 5) {
+                break;
+            }
+        }
+        REQUIRE(destroyed == 0);
+    }
+    REQUIRE(destroyed == 1);
+    REQUIRE(produced == 6);
+
+    {
+        Generator<int> unused(body);
+    }
+    REQUIRE(destroyed == 1);
+    REQUIRE(produced == 6);
+}
+
+/**
+ * An exception escaping from the body is rethrown in the consumer.
+ */
+TEST_CASE("generator exceptions") {
+    std::vector<int> values;
+
+    Generator<int> numbers([]() {
+        for(int i = 0; i < 3; i++) {
+            Generator<int>::Yield(i);
+        }
+        throw std::runtime_error("generator");
+    });
+
+    REQUIRE_THROWS_AS([&]() {
+        for(const auto value : numbers) {
+            values.push_back(value);
+        }
+    }(), std::runtime_error);
+    REQUIRE(values == std::vector<int>{0, 1, 2});
+}
+
+/**
+ * A generator's body iterates another generator; many short-lived generators are created in turn,
+ * reusing the same cothreads.
+ */
+TEST_CASE("nested generators") {
+    constexpr static const int kNumRows{50};
+    constexpr static const int kNumColumns{10};
+
+    Generator<int> rows([]() {
+        for(int row = 0; row < kNumRows; row++) {
+            Generator<int> columns([row]() {
+                for(int column = 0; column < kNumColumns; column++) {
+                    Generator<int>::Yield(row * kNumColumns + column);
+                }
+            });
+
+            for(auto &value : columns) {
+                Generator<int>::Yield(value);
+            }
+        }
+    });
+
+    int expected{0};
+    for(const auto value : rows) {
+        REQUIRE(value == expected);
+        expected++;
+    }
+    REQUIRE(expected == kNumRows * kNumColumns);
+}
@@ -0,0 +1,204 @@
+/*
+ * Tests for the io_uring based I/O ring, and its fallback.
+ */
+#include <catch2/catch.hpp>
+
+#include <libcommunism/IoRing.h>
+#include <libcommunism/Scheduler.h>
+
+#include <unistd.h>
+
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <numeric>
+#include <string>
+#include <vector>
+
+using namespace libcommunism;
+
+/**
+ * Many cothreads write distinct blocks of a file, then read them back. Through io_uring, all of
+ * their operations are batched, so there must be far fewer system calls than operations.
+ */
+TEST_CASE("io ring file reads and writes") {
+    constexpr static const size_t kNumThreads{64};
+    constexpr static const size_t kBlockSize{4096};
+
+    for(const bool forceFallback : {false, true}) {
+        char path[] = "/tmp/libcommunism-ioring-XXXXXX";
+        const auto fd = mkstemp(path);
+        REQUIRE(fd != -1);
+        unlink(path);
+
+        IoRing ring(IoRing::kDefaultEntries, forceFallback);
+        if(forceFallback) {
+            REQUIRE(ring.isFallback());
+        }
+
+        size_t numVerified{0};
+        for(size_t i = 0; i < kNumThreads; i++) {
+            Scheduler::Spawn([&ring, &numVerified, fd](size_t index) {
+                std::vector<uint8_t> block(kBlockSize), readBack(kBlockSize);
+                std::iota(block.begin(), block.end(), static_cast<uint8_t>(index));
+                const off_t offset = index * kBlockSize;
+
+                if(ring.write(fd, block.data(), block.size(), offset) != kBlockSize) {
+                    return;
+                }
+                if(ring.read(fd, readBack.data(), readBack.size(), offset) != kBlockSize) {
+                    return;
+                }
+                if(readBack == block) {
+                    numVerified++;
+                }
+            }, i);
+        }
+
+        REQUIRE(ring.run() == 0);
+        REQUIRE(numVerified == kNumThreads);
+        REQUIRE(ring.getNumPending() == 0);
+        REQUIRE(ring.getNumOperations() == kNumThreads * 2);
+
+        if(ring.isFallback()) {
+            REQUIRE(ring.getNumSyscalls() == ring.getNumOperations());
+        } else {
+            REQUIRE(ring.getNumSyscalls() * 8 < ring.getNumOperations());
+        }
+
+        close(fd);
+    }
+}
+
+/**
+ * Cothreads read from empty pipes, which completes only once other cothreads write to them; the
+ * readers must not block the kernel thread in the meantime. (With the fallback, the writers have
+ * to go first.)
+ */
+TEST_CASE("io ring pipes") {
+    constexpr static const size_t kNumPipes{32};
+
+    for(const bool forceFallback : {false, true}) {
+        IoRing ring(IoRing::kDefaultEntries, forceFallback);
+        std::vector<std::array<int, 2>> pipes(kNumPipes);
+        size_t numReceived{0};
+
+        for(auto &fds : pipes) {
+            REQUIRE(!pipe(fds.data()));
+        }
+
+        auto reader = [&ring, &numReceived](int fd, uint64_t expected) {
+            uint64_t value{0};
+            if(ring.read(fd, &value, sizeof(value)) == sizeof(value) && value == expected) {
+                numReceived++;
+            }
+        };
+        auto writer = [&ring](int fd, uint64_t value) {
+            ring.write(fd, &value, sizeof(value));
+        };
+
+        for(size_t i = 0; i < kNumPipes; i++) {
+            if(ring.isFallback()) {
+                Scheduler::Spawn(writer, pipes[i][1], i);
+                Scheduler::Spawn(reader, pipes[i][0], i);
+            } else {
+                Scheduler::Spawn(reader, pipes[i][0], i);
+            }
+        }
+        if(!ring.isFallback()) {
+            for(size_t i = 0; i < kNumPipes; i++) {
+                Scheduler::Spawn(writer, pipes[i][1], i);
+            }
+        }
+
+        REQUIRE(ring.run() == 0);
+        REQUIRE(numReceived == kNumPipes);
+
+        for(const auto &fds : pipes) {
+            close(fds[0]);
+            close(fds[1]);
+        }
+    }
+}
+
+/**
+ * Operations issued outside of any scheduler cothreads complete immediately.
+ */
+TEST_CASE("io ring outside of cothreads") {
+    IoRing ring;
+    std::array<int, 2> fds;
+    REQUIRE(!pipe(fds.data()));
+
+    const uint32_t sent{0xDEADBEEF};
+    uint32_t received{0};
+
+    REQUIRE(ring.write(fds[1], &sent, sizeof(sent)) == sizeof(sent));
+    REQUIRE(ring.read(fds[0], &received, sizeof(received)) == sizeof(received));
+    REQUIRE(received == sent);
+
+    // errors are reported like system calls
+    REQUIRE(ring.read(-1, &received, sizeof(received)) == -1);
+    REQUIRE(errno == EBADF);
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+/**
+ * Compares many cothreads doing small reads from a file and pipes through io_uring, against the
+ * fallback's direct system calls.
+ */
+TEST_CASE("io ring benchmarks") {
+    constexpr static const size_t kNumThreads{64};
+    constexpr static const size_t kBlockSize{512};
+
+    char path[] = "/tmp/libcommunism-ioring-XXXXXX";
+    const auto file = mkstemp(path);
+    REQUIRE(file != -1);
+    unlink(path);
+
+    std::vector<uint8_t> contents(kNumThreads * kBlockSize);
+    REQUIRE(write(file, contents.data(), contents.size()) == ssize_t(contents.size()));
+
+    std::vector<std::array<int, 2>> pipes(kNumThreads);
+    for(auto &fds : pipes) {
+        REQUIRE(!pipe(fds.data()));
+    }
+
+    for(const bool forceFallback : {false, true}) {
+        IoRing ring(IoRing::kDefaultEntries, forceFallback);
+        const std::string name = ring.isFallback() ? "fallback" : "io_uring";
+
+        BENCHMARK_ADVANCED(name + " file reads")(Catch::Benchmark::Chronometer meter) {
+            meter.measure([&] {
+                for(size_t i = 0; i < kNumThreads; i++) {
+                    Scheduler::Spawn([&ring, file](size_t index) {
+                        std::array<uint8_t, kBlockSize> buf;
+                        ring.read(file, buf.data(), buf.size(), index * kBlockSize);
+                    }, i);
+                }
+                return ring.run();
+            });
+        };
+
+        BENCHMARK_ADVANCED(name + " pipe round trips")(Catch::Benchmark::Chronometer meter) {
+            meter.measure([&] {
+                for(size_t i = 0; i < kNumThreads; i++) {
+                    Scheduler::Spawn([&ring](int writeFd, int readFd) {
+                        std::array<uint8_t, kBlockSize> buf{};
+                        ring.write(writeFd, buf.data(), buf.size());
+                        ring.read(readFd, buf.data(), buf.size());
+                    }, pipes[i][1], pipes[i][0]);
+                }
+                return ring.run();
+            });
+        };
+    }
+
+    for(const auto &fds : pipes) {
+        close(fds[0]);
+        close(fds[1]);
+    }
+    close(file);
+}
@@ -0,0 +1,111 @@
+/*
+ * Tests for the performance counter instrumentation. The host may not support any hardware
+ * counters (for example, inside a virtual machine) so only the counters that are available are
+ * checked.
+ */
+#include <catch2/catch.hpp>
+
+#include <libcommunism/Cothread.h>
+#include <libcommunism/PerfCounters.h>
+
+#include <cstddef>
+#include <cstdint>
+
+using namespace libcommunism;
+
+/**
+ * Counts events around a batch of context switches. All available counters must count something,
+ * and unavailable ones must read as zero.
+ */
+TEST_CASE("perf counters around switches") {
+    constexpr static const size_t kNumSwitches{10000};
+    static Cothread *main;
+    main = Cothread::Current();
+
+    PerfCounters counters;
+    Cothread thread([]() {
+        while(true) {
+            main->switchTo();
+        }
+    });
+
+    const auto sample = counters.measure([&]() {
+        for(size_t i = 0; i < kNumSwitches; i++) {
+            thread.switchTo();
+        }
+    });
+
+    for(size_t i = 0; i < PerfCounters::kNumCounters; i++) {
+        const auto counter = static_cast<PerfCounters::Counter>(i);
+        REQUIRE(PerfCounters::GetName(counter));
+
+        if(!counters.isAvailable(counter)) {
+            REQUIRE(sample[counter] == 0);
+        }
+    }
+
+    if(counters.isAvailable(PerfCounters::Counter::Instructions)) {
+        REQUIRE(sample[PerfCounters::Counter::Instructions] >= kNumSwitches * 2);
+    }
+    if(counters.isAvailable(PerfCounters::Counter::Cycles)) {
+        REQUIRE(sample[PerfCounters::Counter::Cycles] > 0);
+    }
+    if(counters.isAvailable(PerfCounters::Counter::TaskClock)) {
+        REQUIRE(sample[PerfCounters::Counter::TaskClock] > 0);
+    }
+
+    // counters are stopped after measuring
+    const auto before = counters.read();
+    for(size_t i = 0; i < kNumSwitches; i++) {
+        thread.switchTo();
+    }
+    const auto after = counters.read();
+    REQUIRE((after - before).values == PerfCounters::Sample().values);
+}
+
+/**
+ * Measures the individual run slices of cothreads; their CPU time adds up to (at most) the total
+ * counted while they ran. Hardware counters may be multiplexed and thus scaled, so they're only
+ * compared against each other.
+ */
+TEST_CASE("perf counters per run slice") {
+    static Cothread *main;
+    main = Cothread::Current();
+
+    PerfCounters counters;
+    volatile size_t work{0};
+
+    Cothread light([&]() {
+        while(true) {
+            work = work + 1;
+            main->switchTo();
+        }
+    });
+    Cothread heavy([&]() {
+        while(true) {
+            for(size_t i = 0; i < 100000; i++) {
+                work = work + i;
+            }
+            main->switchTo();
+        }
+    });
+
+    counters.start();
+    const auto start = counters.read();
+    const auto lightSlice = counters.measureSlice(&light);
+    const auto heavySlice = counters.measureSlice(&heavy);
+    const auto total = counters.read() - start;
+    counters.stop();
+
+    if(counters.isAvailable(PerfCounters::Counter::TaskClock)) {
+        PerfCounters::Sample sum;
+        sum += lightSlice;
+        sum += heavySlice;
+        REQUIRE(sum[PerfCounters::Counter::TaskClock] <= total[PerfCounters::Counter::TaskClock]);
+    }
+
+    if(counters.isAvailable(PerfCounters::Counter::Instructions)) {
+        REQUIRE(heavySlice[PerfCounters::Counter::Instructions] >
+                lightSlice[PerfCounters::Counter::Instructions]);
+    }
+}
@@ -0,0 +1,103 @@
+/*
+ * Tests for context profiles, which control how much floating point state is saved with a
+ * cothread's context. The rounding mode is used as the observable part of that state.
+ */
+#include <catch2/catch.hpp>
+
+#include <libcommunism/Cothread.h>
+
+#include <cfenv>
+#include <cstddef>
+
+using namespace libcommunism;
+
+/**
+ * Changes the rounding mode in a cothread that saves its floating point state; the kernel thread
+ * must not see the change, while the cothread must keep its rounding mode across switches.
+ */
+TEST_CASE("context profile saves rounding mode") {
+    constexpr static const size_t kNumSwitches{10};
+    static Cothread *main;
+    static size_t correct;
+    main = Cothread::Current();
+    correct = 0;
+
+    const auto profile = GENERATE(ContextProfile::FpControl, ContextProfile::Full);
+    const auto original = std::fegetround();
+
+    Cothread thread([]() {
+        std::fesetround(FE_UPWARD);
+        while(true) {
+            main->switchTo();
+            if(std::fegetround() == FE_UPWARD) {
+                correct++;
+            }
+        }
+    });
+    thread.setContextProfile(profile);
+    REQUIRE(thread.getContextProfile() != ContextProfile::Minimal);
+
+    for(size_t i = 0; i < kNumSwitches; i++) {
+        thread.switchTo();
+        REQUIRE(std::fegetround() == original);
+    }
+    REQUIRE(correct == kNumSwitches - 1);
+
+    thread.setContextProfile(ContextProfile::Minimal);
+    REQUIRE(thread.getContextProfile() == ContextProfile::Minimal);
+}
+
+/**
+ * Switches directly between two cothreads that save their floating point state, each with a
+ * different rounding mode, and then back to the kernel thread.
+ */
+TEST_CASE("context profile between cothreads") {
+    constexpr static const size_t kNumSwitches{10};
+    static Cothread *main, *threads[2];
+    static size_t correct;
+    main = Cothread::Current();
+    correct = 0;
+
+    const auto original = std::fegetround();
+    const auto entry = [](const int mode, const size_t index) {
+        std::fesetround(mode);
+        for(size_t i = 0; i < kNumSwitches; i++) {
+            threads[index ^ 1]->switchTo();
+            if(std::fegetround() == mode) {
+                correct++;
+            }
+        }
+        main->switchTo();
+    };
+
+    Cothread first(0, entry, FE_UPWARD, 0), second(0, entry, FE_DOWNWARD, 1);
+    first.setContextProfile(ContextProfile::FpControl);
+    second.setContextProfile(ContextProfile::Full);
+    threads[0] = &first;
+    threads[1] = &second;
+
+    first.switchTo();
+    REQUIRE(std::fegetround() == original);
+    REQUIRE(correct == kNumSwitches * 2 - 1);
+}
+
+/**
+ * Cothreads with the minimal profile share the floating point state of the kernel thread, so a
+ * change of the rounding mode is visible after switching back.
+ */
+TEST_CASE("minimal context profile shares rounding mode") {
+    static Cothread *main;
+    main = Cothread::Current();
+
+    const auto original = std::fegetround();
+
+    Cothread thread([]() {
+        std::fesetround(FE_TOWARDZERO);
+        main->switchTo();
+    });
+    REQUIRE(thread.getContextProfile() == ContextProfile::Minimal);
+
+    thread.switchTo();
+    REQUIRE(std::fegetround() == FE_TOWARDZERO);
+    std::fesetround(original);
+}
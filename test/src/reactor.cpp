@@ -0,0 +1,258 @@
+/*
+ * Tests for the epoll based I/O reactor.
+ */
+#include <catch2/catch.hpp>
+
+#include <libcommunism/Reactor.h>
+#include <libcommunism/Scheduler.h>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+using namespace libcommunism;
+
+/**
+ * Reads exactly the given number of bytes, unless the peer closes the connection first.
+ *
+ * @return Number of bytes read
+ */
+static size_t ReadAll(Reactor &reactor, const int fd, void *buf, const size_t length) {
+    size_t done{0};
+    while(done < length) {
+        const auto ret = reactor.read(fd, static_cast<std::byte *>(buf) + done, length - done);
+        if(ret <= 0) {
+            break;
+        }
+        done += ret;
+    }
+    return done;
+}
+
+/**
+ * Writes exactly the given number of bytes, unless an error occurs.
+ *
+ * @return Number of bytes written
+ */
+static size_t WriteAll(Reactor &reactor, const int fd, const void *buf, const size_t length) {
+    size_t done{0};
+    while(done < length) {
+        const auto ret = reactor.write(fd, static_cast<const std::byte *>(buf) + done,
+                length - done);
+        if(ret <= 0) {
+            break;
+        }
+        done += ret;
+    }
+    return done;
+}
+
+/**
+ * Many pairs of cothreads on one kernel thread exchange messages over socketpairs; each blocks
+ * until its peer's message arrives.
+ */
+TEST_CASE("reactor socketpair ping pong") {
+    constexpr static const size_t kNumPairs{256};
+    constexpr static const uint64_t kNumMessages{16};
+
+    Reactor reactor;
+    std::vector<std::array<int, 2>> sockets(kNumPairs);
+    size_t completed{0};
+
+    for(auto &pair : sockets) {
+        REQUIRE(!socketpair(AF_UNIX, SOCK_STREAM, 0, pair.data()));
+        REQUIRE_NOTHROW(reactor.add(pair[0]));
+        REQUIRE_NOTHROW(reactor.add(pair[1]));
+
+        Scheduler::Spawn([&reactor, &completed](int fd) {
+            for(uint64_t i = 0; i < kNumMessages; i++) {
+                uint64_t message{0};
+                if(ReadAll(reactor, fd, &message, sizeof(message)) != sizeof(message) ||
+                        message != i) {
+                    return;
+                }
+                message++;
+                WriteAll(reactor, fd, &message, sizeof(message));
+            }
+            completed++;
+        }, pair[0]);
+
+        Scheduler::Spawn([&reactor, &completed](int fd) {
+            for(uint64_t i = 0; i < kNumMessages; i++) {
+                uint64_t message{i};
+                WriteAll(reactor, fd, &message, sizeof(message));
+                if(ReadAll(reactor, fd, &message, sizeof(message)) != sizeof(message) ||
+                        message != i + 1) {
+                    return;
+                }
+            }
+            completed++;
+        }, pair[1]);
+    }
+
+    REQUIRE(reactor.run() == 0);
+    REQUIRE(completed == kNumPairs * 2);
+    REQUIRE(reactor.getNumWaiting() == 0);
+
+    for(const auto &pair : sockets) {
+        reactor.remove(pair[0]);
+        reactor.remove(pair[1]);
+        close(pair[0]);
+        close(pair[1]);
+    }
+}
+
+/**
+ * A writer sends far more data than fits into the socket buffers, so it blocks until the reader
+ * (which yields between reads) catches up.
+ */
+TEST_CASE("reactor blocks writers on full sockets") {
+    constexpr static const size_t kLength{4 * 1024 * 1024};
+    constexpr static const size_t kChunkSize{16 * 1024};
+
+    Reactor reactor;
+    std::array<int, 2> pair;
+    REQUIRE(!socketpair(AF_UNIX, SOCK_STREAM, 0, pair.data()));
+    REQUIRE_NOTHROW(reactor.add(pair[0]));
+    REQUIRE_NOTHROW(reactor.add(pair[1]));
+
+    std::vector<uint8_t> sent(kLength), received(kLength);
+    std::iota(sent.begin(), sent.end(), 0);
+    size_t written{0}, read{0};
+
+    Scheduler::Spawn([&]() {
+        written = WriteAll(reactor, pair[0], sent.data(), sent.size());
+        shutdown(pair[0], SHUT_WR);
+    });
+    Scheduler::Spawn([&]() {
+        while(read < kLength) {
+            const auto ret = reactor.read(pair[1], received.data() + read,
+                    std::min(kChunkSize, kLength - read));
+            if(ret <= 0) {
+                break;
+            }
+            read += ret;
+            Scheduler::Yield();
+        }
+
+        // the writer shut down its end
+        uint8_t extra;
+        REQUIRE(reactor.read(pair[1], &extra, sizeof(extra)) == 0);
+    });
+
+    REQUIRE(reactor.run() == 0);
+    REQUIRE(written == kLength);
+    REQUIRE(read == kLength);
+    REQUIRE(received == sent);
+
+    for(const auto fd : pair) {
+        reactor.remove(fd);
+        close(fd);
+    }
+}
+
+/**
+ * A server cothread accepts connections over loopback, spawning a cothread for each that echoes
+ * back whatever it receives; clients connect, and verify the echoed data.
+ */
+TEST_CASE("reactor loopback echo server") {
+    constexpr static const size_t kNumClients{64};
+    constexpr static const size_t kMessageLength{1024};
+
+    Reactor reactor;
+
+    const auto listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    REQUIRE(listener != -1);
+
+    struct sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addrLen{sizeof(addr)};
+
+    REQUIRE(!bind(listener, reinterpret_cast<struct sockaddr *>(&addr), addrLen));
+    REQUIRE(!listen(listener, kNumClients));
+    REQUIRE(!getsockname(listener, reinterpret_cast<struct sockaddr *>(&addr), &addrLen));
+    REQUIRE_NOTHROW(reactor.add(listener));
+
+    size_t numAccepted{0}, numEchoed{0};
+
+    Scheduler::Spawn([&]() {
+        for(size_t i = 0; i < kNumClients; i++) {
+            const auto client = reactor.accept(listener, nullptr, nullptr);
+            if(client == -1) {
+                return;
+            }
+            numAccepted++;
+
+            Scheduler::Spawn([&reactor](int fd) {
+                std::array<std::byte, 256> buf;
+                while(true) {
+                    const auto ret = reactor.read(fd, buf.data(), buf.size());
+                    if(ret <= 0 || WriteAll(reactor, fd, buf.data(), ret) != size_t(ret)) {
+                        break;
+                    }
+                }
+                reactor.remove(fd);
+                close(fd);
+            }, client);
+        }
+    });
+
+    for(size_t i = 0; i < kNumClients; i++) {
+        Scheduler::Spawn([&](uint8_t seed) {
+            const auto fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            reactor.add(fd);
+
+            if(!reactor.connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr))) {
+                std::vector<uint8_t> message(kMessageLength), reply(kMessageLength);
+                std::iota(message.begin(), message.end(), seed);
+
+                WriteAll(reactor, fd, message.data(), message.size());
+                shutdown(fd, SHUT_WR);
+
+                if(ReadAll(reactor, fd, reply.data(), reply.size()) == kMessageLength &&
+                        reply == message) {
+                    numEchoed++;
+                }
+            }
+
+            reactor.remove(fd);
+            close(fd);
+        }, i);
+    }
+
+    REQUIRE(reactor.run() == 0);
+    REQUIRE(numAccepted == kNumClients);
+    REQUIRE(numEchoed == kNumClients);
+
+    reactor.remove(listener);
+    close(listener);
+}
+
+/**
+ * Operations on descriptors that aren't registered fail, rather than blocking forever.
+ */
+TEST_CASE("reactor rejects unregistered descriptors") {
+    Reactor reactor;
+    std::array<int, 2> pair;
+    REQUIRE(!socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pair.data()));
+
+    uint8_t byte;
+    REQUIRE(reactor.read(pair[0], &byte, sizeof(byte)) == -1);
+    REQUIRE(errno == EBADF);
+
+    REQUIRE_NOTHROW(reactor.add(pair[0]));
+    REQUIRE_THROWS(reactor.add(pair[0]));
+
+    reactor.remove(pair[0]);
+    close(pair[0]);
+    close(pair[1]);
+}
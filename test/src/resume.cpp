@@ -0,0 +1,90 @@
+/*
+ * Tests for the asymmetric resume/yield interface, including passing values between cothreads.
+ */
+#include <catch2/catch.hpp>
+
+#include <libcommunism/Cothread.h>
+
+#include <array>
+#include <cstdint>
+
+using namespace libcommunism;
+
+/**
+ * Runs a cothread that yields a sequence of values back to its resumer, which in turn passes a
+ * value to it with each resume.
+ */
+TEST_CASE("resume and yield values") {
+    constexpr static const size_t kStackSize{1024 * 64};
+    constexpr static const int kNumValues{16};
+    alignas(64) static std::array<uintptr_t, kStackSize / sizeof(uintptr_t)> stack;
+
+    auto main = Cothread::Current();
+    int received{0};
+
+    Cothread producer(stack, [&]() {
+        for(int i = 0; i < kNumValues; i++) {
+            received += Cothread::Yield<int>(i * 2);
+        }
+        Cothread::Yield(-1);
+    });
+
+    // the value passed to the first resume is discarded, since the cothread hasn't started yet
+    REQUIRE(producer.resume<int>(1000) == 0);
+    REQUIRE(producer.getResumer() == main);
+
+    for(int i = 1; i < kNumValues; i++) {
+        REQUIRE(producer.resume<int>(i) == i * 2);
+    }
+    REQUIRE(producer.resume<int>(kNumValues) == -1);
+
+    REQUIRE(received == (kNumValues * (kNumValues + 1)) / 2);
+}
+
+/**
+ * Passes values of different types, which are smaller than or the same size as a machine word.
+ */
+TEST_CASE("resume and yield typed values") {
+    struct Pair {
+        int16_t a, b;
+    };
+    constexpr static const size_t kStackSize{1024 * 64};
+    alignas(64) static std::array<uintptr_t, kStackSize / sizeof(uintptr_t)> stack;
+
+    int target{0};
+
+    Cothread thread(stack, [&]() {
+        auto value = Cothread::Yield<double>(&target);
+        auto pair = Cothread::Yield<Pair>(value * 2.);
+        Cothread::Yield(static_cast<uint8_t>(pair.a + pair.b));
+    });
+
+    REQUIRE(thread.resume<int *>() == &target);
+    REQUIRE(thread.resume<double>(1.25) == 2.5);
+    REQUIRE(thread.resume<uint8_t>(Pair{-4, 46}) == 42);
+}
+
+/**
+ * A cothread resumes another cothread, which yields back to it (rather than to the main cothread)
+ * before it yields back to the main cothread itself.
+ */
+TEST_CASE("nested resume") {
+    constexpr static const size_t kStackSize{1024 * 64};
+    alignas(64) static std::array<uintptr_t, kStackSize / sizeof(uintptr_t)> stack1, stack2;
+    static Cothread *inner{nullptr}, *outer{nullptr};
+
+    inner = new Cothread(stack2, []() {
+        REQUIRE(inner->getResumer() == outer);
+        Cothread::Yield<uintptr_t>(Cothread::Yield<uintptr_t>(1) + 1);
+    });
+    outer = new Cothread(stack1, []() {
+        const auto a = inner->resume<uintptr_t>();
+        const auto b = inner->resume<uintptr_t>(a + 1);
+        Cothread::Yield(a + b);
+    });
+
+    REQUIRE(outer->resume<uintptr_t>() == 1 + 3);
+
+    delete inner;
+    delete outer;
+}
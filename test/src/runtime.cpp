@@ -0,0 +1,202 @@
+/*
+ * Tests for the work stealing M:N runtime.
+ */
+#include <catch2/catch.hpp>
+
+#include <libcommunism/Cothread.h>
+#include <libcommunism/Runtime.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace libcommunism;
+
+/**
+ * Spawns a large number of cothreads from outside the runtime, which each spawn another cothread
+ * and yield a few times; all of them must run to completion, and be deallocated.
+ */
+TEST_CASE("runtime runs all cothreads") {
+    constexpr static const size_t kNumThreads{256};
+    constexpr static const size_t kNumYields{8};
+
+    std::atomic_size_t counter{0};
+    auto token = std::make_shared<int>(0);
+
+    {
+        Runtime runtime(4, 1024 * 64);
+        REQUIRE(runtime.getNumWorkers() == 4);
+
+        for(size_t i = 0; i < kNumThreads; i++) {
+            runtime.spawn([&counter, token]() {
+                Runtime::Current()->spawn([&counter]() {
+                    counter++;
+                });
+
+                for(size_t j = 0; j < kNumYields; j++) {
+                    counter++;
+                    Runtime::Yield();
+                }
+            });
+        }
+
+        runtime.wait();
+        REQUIRE(counter == kNumThreads * (kNumYields + 1));
+        REQUIRE(token.use_count() == 1);
+    }
+
+    REQUIRE(!Runtime::Current());
+}
+
+/**
+ * Returns the id of the calling kernel thread. This must not be inlined: compilers assume it's
+ * constant within a function, which no longer holds once cothreads migrate between threads.
+ */
+[[gnu::noinline]] static std::thread::id GetKernelThreadId() {
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    return std::this_thread::get_id();
+}
+
+/**
+ * Cothreads may be resumed on a different kernel thread than they were suspended on; the current
+ * cothread must be tracked correctly regardless. All cothreads are spawned on one worker and run
+ * for different amounts of time, so the others have to steal them after they started.
+ */
+TEST_CASE("runtime cothreads keep their identity across workers") {
+    constexpr static const size_t kNumThreads{64};
+    constexpr static const size_t kNumYields{64};
+    constexpr static const size_t kMaxAttempts{20};
+
+    std::atomic_size_t mismatches{0}, migrations{0};
+
+    Runtime runtime(4, 1024 * 64);
+    for(size_t attempt = 0; attempt < kMaxAttempts && !migrations; attempt++) {
+        runtime.spawn([&]() {
+            for(size_t i = 0; i < kNumThreads; i++) {
+                Runtime::Current()->spawn([&](size_t numYields) {
+                    const auto self = Cothread::Current();
+                    auto kernelThread = GetKernelThreadId();
+
+                    for(size_t j = 0; j < numYields; j++) {
+                        for(size_t k = 0; k < 1000; k++) {
+                            std::atomic_signal_fence(std::memory_order_seq_cst);
+                        }
+                        Runtime::Yield();
+
+                        if(Cothread::Current() != self) {
+                            mismatches++;
+                        }
+                        if(GetKernelThreadId() != kernelThread) {
+                            kernelThread = GetKernelThreadId();
+                            migrations++;
+                        }
+                    }
+                }, kNumYields * (i + 1));
+            }
+        });
+        runtime.wait();
+    }
+
+    REQUIRE(mismatches == 0);
+    REQUIRE(migrations > 0);
+}
+
+/**
+ * Passes a token back and forth between two cothreads that park until it's their turn, and wakes
+ * up a parked cothread from outside the runtime.
+ */
+TEST_CASE("runtime park and unpark") {
+    constexpr static const size_t kNumRounds{1000};
+
+    static std::atomic<Cothread *> ping, pong;
+    std::atomic_size_t turn{0};
+    std::atomic_bool released{false};
+
+    ping = pong = nullptr;
+
+    Runtime runtime(2, 1024 * 64);
+
+    auto player = [&turn](std::atomic<Cothread *> &self, std::atomic<Cothread *> &other,
+            size_t parity) {
+        self = Cothread::Current();
+        for(size_t i = 0; i < kNumRounds; i++) {
+            while(turn.load() % 2 != parity) {
+                Runtime::Park();
+            }
+            // the peer has exited after the last turn
+            if(++turn == kNumRounds * 2) {
+                break;
+            }
+
+            Cothread *peer{nullptr};
+            while(!(peer = other.load())) {
+                Runtime::Yield();
+            }
+            Runtime::Unpark(peer);
+        }
+    };
+
+    runtime.spawn(player, std::ref(ping), std::ref(pong), 0);
+    runtime.spawn(player, std::ref(pong), std::ref(ping), 1);
+
+    // nobody else unparks it, so it can't exit before it's unparked here
+    auto waiter = runtime.spawn([&released]() {
+        Runtime::Park();
+        released = true;
+    });
+    Runtime::Unpark(waiter);
+
+    runtime.wait();
+    REQUIRE(turn == kNumRounds * 2);
+    REQUIRE(released);
+}
+
+/**
+ * Two kernel threads outside the runtime concurrently unpark a cothread that consumes their
+ * wakeups; a permit set by one of them must not be cleared by the other, or the cothread would
+ * remain parked forever.
+ */
+TEST_CASE("runtime concurrent unparks") {
+    constexpr static const size_t kNumWakeups{50000};
+    constexpr static const size_t kNumUnparkers{2};
+
+    std::atomic_size_t pending{0}, consumed{0}, unparkersDone{0};
+
+    Runtime runtime(2, 1024 * 64);
+
+    auto consumer = runtime.spawn([&]() {
+        while(consumed.load() != kNumWakeups * kNumUnparkers) {
+            if(pending.load()) {
+                pending--;
+                consumed++;
+            } else {
+                Runtime::Park();
+            }
+        }
+
+        // it must not exit while it may still be unparked
+        while(unparkersDone.load() != kNumUnparkers) {
+            Runtime::Yield();
+        }
+    });
+
+    std::vector<std::thread> unparkers;
+    for(size_t i = 0; i < kNumUnparkers; i++) {
+        unparkers.emplace_back([&]() {
+            for(size_t j = 0; j < kNumWakeups; j++) {
+                pending++;
+                Runtime::Unpark(consumer);
+            }
+            unparkersDone++;
+        });
+    }
+
+    for(auto &unparker : unparkers) {
+        unparker.join();
+    }
+    runtime.wait();
+
+    REQUIRE(consumed == kNumWakeups * kNumUnparkers);
+    REQUIRE(pending == 0);
+}
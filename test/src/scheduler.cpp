@@ -0,0 +1,124 @@
+/*
+ * Tests for the per kernel thread cooperative scheduler.
+ */
+#include <catch2/catch.hpp>
+
+#include <libcommunism/Cothread.h>
+#include <libcommunism/Scheduler.h>
+
+#include <memory>
+#include <vector>
+
+using namespace libcommunism;
+
+/**
+ * Spawns several cothreads that each yield a few times; they should be executed in round robin
+ * order, and be deallocated once they return.
+ */
+TEST_CASE("scheduler round robin") {
+    constexpr static const size_t kNumThreads{3};
+    constexpr static const size_t kNumYields{4};
+
+    std::vector<size_t> order;
+    auto token = std::make_shared<int>(0);
+
+    for(size_t i = 0; i < kNumThreads; i++) {
+        REQUIRE_NOTHROW(Scheduler::Spawn(1024 * 64, StackType::Default,
+                    [&order, token](size_t id) {
+            for(size_t j = 0; j < kNumYields; j++) {
+                order.push_back(id);
+                Scheduler::Yield();
+            }
+        }, i));
+    }
+    REQUIRE(token.use_count() == kNumThreads + 1);
+
+    REQUIRE(Scheduler::Run() == 0);
+
+    REQUIRE(order.size() == kNumThreads * kNumYields);
+    for(size_t i = 0; i < order.size(); i++) {
+        REQUIRE(order[i] == i % kNumThreads);
+    }
+
+    // all cothreads (and their callables) were deallocated
+    REQUIRE(token.use_count() == 1);
+}
+
+/**
+ * Parks a cothread, and unparks it from another one, as well as from outside the scheduler once
+ * it returned.
+ */
+TEST_CASE("scheduler park and unpark") {
+    std::vector<int> events;
+    Cothread *waiter{nullptr};
+
+    waiter = Scheduler::Spawn([&events]() {
+        events.push_back(1);
+        Scheduler::Park();
+        events.push_back(3);
+        Scheduler::Park();
+        events.push_back(5);
+    });
+    Scheduler::Spawn([&events, &waiter]() {
+        events.push_back(2);
+        Scheduler::Unpark(waiter);
+    });
+
+    // the waiter parks again, with nobody left to wake it up
+    REQUIRE(Scheduler::Run() == 1);
+    REQUIRE(events == std::vector<int>{1, 2, 3});
+
+    events.push_back(4);
+    Scheduler::Unpark(waiter);
+    REQUIRE(Scheduler::Run() == 0);
+    REQUIRE(events == std::vector<int>{1, 2, 3, 4, 5});
+}
+
+/**
+ * Unparking a cothread that isn't parked makes its next park return immediately, exactly once.
+ */
+TEST_CASE("scheduler unpark before park") {
+    int stage{0};
+
+    auto thread = Scheduler::Spawn([&stage]() {
+        Scheduler::Unpark(Cothread::Current());
+        Scheduler::Park();
+        stage = 1;
+        Scheduler::Park();
+        stage = 2;
+    });
+    REQUIRE(Scheduler::Run() == 1);
+    REQUIRE(stage == 1);
+
+    Scheduler::Unpark(thread);
+    REQUIRE(Scheduler::Run() == 0);
+    REQUIRE(stage == 2);
+}
+
+/**
+ * A cothread that wasn't spawned (here, the one representing the kernel thread) may yield to
+ * spawned cothreads without running the scheduler.
+ */
+TEST_CASE("scheduler yield from unmanaged cothread") {
+    int counter{0};
+    bool done{false};
+
+    Scheduler::Spawn([&]() {
+        while(!done) {
+            counter++;
+            Scheduler::Yield();
+        }
+    });
+
+    for(int i = 1; i <= 3; i++) {
+        Scheduler::Yield();
+        REQUIRE(counter == i);
+    }
+
+    // once it exits, yielding with an empty run queue returns immediately
+    done = true;
+    Scheduler::Yield();
+    Scheduler::Yield();
+    REQUIRE(counter == 3);
+    REQUIRE(Scheduler::Run() == 0);
+}
@@ -0,0 +1,243 @@
+/*
+ * Tests for cothreads that execute on a shared stack. On platforms that don't support shared
+ * stacks, only the error when creating one is checked.
+ */
+#include <catch2/catch.hpp>
+
+#include <libcommunism/Channel.h>
+#include <libcommunism/Cothread.h>
+#include <libcommunism/Mutex.h>
+#include <libcommunism/Scheduler.h>
+#include <libcommunism/SharedStack.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+
+using namespace libcommunism;
+
+/**
+ * Alternates between two cothreads on the same shared stack, each of which keeps a buffer on its
+ * stack; the buffers must survive being copied out and back in.
+ */
+TEST_CASE("shared stack preserves stack contents") {
+    if(!SharedStack::IsSupported()) {
+        REQUIRE_THROWS_AS(SharedStack(), std::runtime_error);
+        return;
+    }
+
+    constexpr static const size_t kNumSwitches{100};
+    static Cothread *main;
+    static std::array<size_t, 2> counts;
+    static bool corrupted;
+    main = Cothread::Current();
+    counts = {0, 0};
+    corrupted = false;
+
+    SharedStack stack(64 * 1024);
+    const auto entry = [](const uint8_t index) {
+        volatile uint8_t buffer[512];
+        for(size_t i = 0; i < sizeof(buffer); i++) {
+            buffer[i] = static_cast<uint8_t>(index + i);
+        }
+
+        while(true) {
+            main->switchTo();
+
+            for(size_t i = 0; i < sizeof(buffer); i++) {
+                if(buffer[i] != static_cast<uint8_t>(index + i)) {
+                    corrupted = true;
+                }
+            }
+            counts[index]++;
+        }
+    };
+
+    Cothread first(stack, entry, 0), second(stack, entry, 1);
+    REQUIRE(stack.getStats().numCothreads == 2);
+    REQUIRE(first.getStack() == stack.getStack());
+
+    for(size_t i = 0; i < kNumSwitches; i++) {
+        first.switchTo();
+        second.switchTo();
+    }
+
+    REQUIRE_FALSE(corrupted);
+    REQUIRE(counts[0] == kNumSwitches - 1);
+    REQUIRE(counts[1] == kNumSwitches - 1);
+    REQUIRE(stack.getOccupant() == &second);
+
+    // only the live part of the stack is saved
+    const auto &stats = stack.getStats();
+    REQUIRE(stats.saves == kNumSwitches * 2 - 1);
+    REQUIRE(stats.restores == kNumSwitches * 2 - 2);
+    REQUIRE(stats.savedBytes >= 512);
+    REQUIRE(stats.savedBytes < 4096);
+
+    // switching back and forth with the occupant doesn't copy anything
+    const auto saves = stats.saves;
+    second.switchTo();
+    second.switchTo();
+    REQUIRE(stack.getStats().saves == saves);
+}
+
+/**
+ * Passes values between two cothreads on the same shared stack, which switch directly to each
+ * other rather than through a cothread with its own stack.
+ */
+TEST_CASE("shared stack direct switches") {
+    if(!SharedStack::IsSupported()) {
+        return;
+    }
+
+    constexpr static const int kNumValues{100};
+    static Cothread *main;
+    main = Cothread::Current();
+    int sum{0};
+
+    SharedStack stack(64 * 1024);
+    Cothread doubler(stack, []() {
+        auto value = Cothread::Yield<int>(0);
+        while(true) {
+            value = Cothread::Yield<int>(value * 2);
+        }
+    });
+    Cothread consumer(stack, [&]() {
+        doubler.resume<int>(0);
+        for(int i = 1; i <= kNumValues; i++) {
+            sum += doubler.resume<int>(i);
+        }
+        main->switchTo();
+    });
+
+    consumer.switchTo();
+    REQUIRE(sum == kNumValues * (kNumValues + 1));
+    REQUIRE(stack.getOccupant() == &consumer);
+    REQUIRE(stack.getStats().saves >= kNumValues * 2);
+}
+
+/**
+ * Re-arms a cothread on a shared stack that's suspended in the middle of its entry point; it must
+ * start over at the new entry point.
+ */
+TEST_CASE("shared stack reset") {
+    if(!SharedStack::IsSupported()) {
+        return;
+    }
+
+    static Cothread *main;
+    static int value;
+    main = Cothread::Current();
+    value = 0;
+
+    SharedStack stack(64 * 1024);
+    Cothread thread(stack, []() {
+        while(true) {
+            value++;
+            main->switchTo();
+        }
+    });
+
+    thread.switchTo();
+    thread.switchTo();
+    REQUIRE(value == 2);
+
+    thread.reset([]() {
+        value = 42;
+        while(true) {
+            main->switchTo();
+        }
+    });
+    REQUIRE(stack.getOccupant() == nullptr);
+
+    thread.switchTo();
+    REQUIRE(value == 42);
+}
+
+/**
+ * Spawns many cothreads on the kernel thread's shared stack, which all yield repeatedly. Idle
+ * cothreads should only hold on to a small buffer each.
+ */
+TEST_CASE("shared stack with scheduler") {
+    if(!SharedStack::IsSupported()) {
+        return;
+    }
+
+    constexpr static const size_t kNumThreads{1000};
+    constexpr static const size_t kNumYields{10};
+    static size_t total, savedPerThread;
+    total = 0;
+    savedPerThread = 0;
+
+    auto &stack = SharedStack::ForThread();
+    for(size_t i = 0; i < kNumThreads; i++) {
+        Scheduler::Spawn(stack, [&stack](const size_t index) {
+            for(size_t j = 0; j < kNumYields; j++) {
+                if(!index && j == kNumYields / 2) {
+                    const auto &stats = stack.getStats();
+                    savedPerThread = stats.savedBytes / stats.numCothreads;
+                }
+
+                total++;
+                Scheduler::Yield();
+            }
+        }, i);
+    }
+
+    REQUIRE(Scheduler::Run() == 0);
+    REQUIRE(total == kNumThreads * kNumYields);
+    REQUIRE(savedPerThread > 0);
+    REQUIRE(savedPerThread < 2048);
+    REQUIRE(stack.getStats().numCothreads == 0);
+    REQUIRE(stack.getStats().savedBytes == 0);
+}
+
+/**
+ * Cothreads on a shared stack can't block on a channel or mutex, since their waiter would be
+ * overwritten by the other cothreads on the stack; it throws instead, and leaves the primitive
+ * usable. Operations that don't need to block still succeed.
+ */
+TEST_CASE("shared stack cothreads can't block") {
+    if(!SharedStack::IsSupported()) {
+        return;
+    }
+
+    static size_t numThrown;
+    numThrown = 0;
+
+    Channel<int> channel(0);
+    Mutex mutex;
+    mutex.lock();
+
+    auto &stack = SharedStack::ForThread();
+    Scheduler::Spawn(stack, [&channel, &mutex]() {
+        try {
+            channel.receive();
+        } catch(const std::runtime_error &) {
+            numThrown++;
+        }
+
+        try {
+            mutex.lock();
+        } catch(const std::runtime_error &) {
+            numThrown++;
+        }
+    });
+    Scheduler::Spawn(stack, [&channel]() {
+        try {
+            channel.send(42);
+        } catch(const std::runtime_error &) {
+            numThrown++;
+        }
+        REQUIRE(!channel.trySend(42));
+    });
+
+    REQUIRE(Scheduler::Run() == 0);
+    REQUIRE(numThrown == 3);
+
+    REQUIRE(!mutex.try_lock());
+    mutex.unlock();
+    REQUIRE(mutex.try_lock());
+    mutex.unlock();
+}
@@ -0,0 +1,353 @@
+/*
+ * Tests for the stack pool, which caches the stacks of cothreads that allocate their own stack.
+ */
+#include <catch2/catch.hpp>
+
+#include <libcommunism/Cothread.h>
+#include <libcommunism/StackPool.h>
+
+#include <array>
+#include <cstddef>
+#include <fstream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using namespace libcommunism;
+
+/**
+ * Creates and destroys cothreads of the same size in a loop; all but the first allocation should
+ * be satisfied from the calling thread's cache.
+ */
+TEST_CASE("stack pool reuses stacks") {
+    constexpr static const size_t kStackSize{1024 * 64};
+    constexpr static const size_t kIterations{16};
+
+    StackPool::Trim();
+    const auto before = StackPool::GetThreadStats();
+
+    for(size_t i = 0; i < kIterations; i++) {
+        Cothread *t1{nullptr};
+        REQUIRE_NOTHROW(t1 = new Cothread([]() {}, kStackSize));
+        REQUIRE_NOTHROW(delete t1);
+    }
+
+    const auto after = StackPool::GetThreadStats();
+    REQUIRE(after.misses - before.misses == 1);
+    REQUIRE(after.hits - before.hits == kIterations - 1);
+    REQUIRE(after.cachedStacks == 1);
+
+    // trimming should release the cached stack
+    StackPool::Trim();
+    const auto trimmed = StackPool::GetThreadStats();
+    REQUIRE(trimmed.cachedStacks == 0);
+    REQUIRE(trimmed.cachedBytes == 0);
+}
+
+/**
+ * Destroys a cothread on a different kernel thread than the one that created it; its stack should
+ * be handed back to the creating thread and reused by it.
+ */
+TEST_CASE("stack pool cross thread release") {
+    constexpr static const size_t kStackSize{1024 * 64};
+
+    StackPool::Trim();
+    const auto before = StackPool::GetThreadStats();
+
+    Cothread *t1{nullptr};
+    REQUIRE_NOTHROW(t1 = new Cothread([]() {}, kStackSize));
+
+    std::thread([t1]() {
+        delete t1;
+    }).join();
+
+    const auto released = StackPool::GetThreadStats();
+    REQUIRE(released.remoteFrees - before.remoteFrees == 1);
+
+    // the next allocation should pick up the remotely released stack
+    REQUIRE_NOTHROW(t1 = new Cothread([]() {}, kStackSize));
+    const auto after = StackPool::GetThreadStats();
+    REQUIRE(after.hits - before.hits == 1);
+    REQUIRE_NOTHROW(delete t1);
+
+    StackPool::Trim();
+}
+
+/**
+ * Ensures the per size class cap is honored, and that disabling the pool bypasses it entirely.
+ */
+TEST_CASE("stack pool caps") {
+    constexpr static const size_t kStackSize{1024 * 64};
+    const auto oldConfig = StackPool::GetConfig();
+
+    StackPool::Trim();
+
+    auto config = oldConfig;
+    config.maxCachedPerClass = 2;
+    StackPool::SetConfig(config);
+
+    std::array<Cothread *, 4> threads;
+    for(auto &thread : threads) {
+        REQUIRE_NOTHROW(thread = new Cothread([]() {}, kStackSize));
+    }
+    for(auto thread : threads) {
+        REQUIRE_NOTHROW(delete thread);
+    }
+
+    REQUIRE(StackPool::GetThreadStats().cachedStacks == 2);
+    StackPool::Trim();
+
+    // with the pool disabled, nothing is cached
+    config.enabled = false;
+    StackPool::SetConfig(config);
+
+    const auto before = StackPool::GetThreadStats();
+    Cothread *t1{nullptr};
+    REQUIRE_NOTHROW(t1 = new Cothread([]() {}, kStackSize));
+    REQUIRE_NOTHROW(delete t1);
+
+    const auto after = StackPool::GetThreadStats();
+    REQUIRE(after.hits == before.hits);
+    REQUIRE(after.misses == before.misses);
+    REQUIRE(after.cachedStacks == 0);
+
+    StackPool::SetConfig(oldConfig);
+}
+
+/**
+ * Runs a cothread on a mapped stack, and ensures such stacks are pooled separately from heap
+ * stacks of the same size.
+ */
+TEST_CASE("mapped stacks") {
+    constexpr static const size_t kStackSize{1024 * 64};
+    static Cothread *t1{nullptr}, *main{nullptr};
+    static size_t counter{0};
+
+    StackPool::Trim();
+    main = Cothread::Current();
+
+    REQUIRE_NOTHROW(t1 = new Cothread([]() {
+        counter++;
+        main->switchTo();
+    }, kStackSize, StackType::Mapped));
+
+    counter = 0;
+    t1->switchTo();
+    REQUIRE(counter == 1);
+    REQUIRE_NOTHROW(delete t1);
+
+    // a heap stack of the same size must not reuse the cached mapped stack
+    const auto before = StackPool::GetThreadStats();
+    REQUIRE_NOTHROW(t1 = new Cothread([]() {}, kStackSize, StackType::Heap));
+    REQUIRE_NOTHROW(delete t1);
+    REQUIRE(StackPool::GetThreadStats().misses - before.misses == 1);
+
+    StackPool::Trim();
+}
+
+#ifdef __linux__
+/**
+ * Writes to the byte immediately below a mapped stack in a child process, which must be killed by
+ * a segmentation fault because of the guard page.
+ */
+TEST_CASE("mapped stack guard page") {
+    auto pid = fork();
+    REQUIRE(pid >= 0);
+
+    if(!pid) {
+        // don't let the test harness's fault handlers catch the fault and exit normally
+        signal(SIGSEGV, SIG_DFL);
+        signal(SIGBUS, SIG_DFL);
+
+        auto thread = new Cothread([]() {}, 1024 * 16, StackType::Mapped);
+        auto guard = reinterpret_cast<volatile char *>(thread->getStack()) - 1;
+        *guard = 0;
+        _exit(0);
+    }
+
+    int status{0};
+    REQUIRE(waitpid(pid, &status, 0) == pid);
+    REQUIRE(WIFSIGNALED(status));
+    REQUIRE(WTERMSIG(status) == SIGSEGV);
+}
+
+/**
+ * Creates a large number of cothreads with large mapped stacks, and ensures the resident memory
+ * grows by only a fraction of the total stack size.
+ */
+TEST_CASE("mapped stacks are lazily committed") {
+    constexpr static const size_t kStackSize{1024 * 1024};
+    constexpr static const size_t kNumThreads{512};
+
+    auto getResident = []() {
+        size_t pages{0}, resident{0};
+        std::ifstream statm("/proc/self/statm");
+        statm >> pages >> resident;
+        return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    };
+
+    const auto before = getResident();
+
+    std::vector<std::unique_ptr<Cothread>> threads;
+    for(size_t i = 0; i < kNumThreads; i++) {
+        threads.emplace_back(std::make_unique<Cothread>([]() {}, kStackSize, StackType::Mapped));
+    }
+
+    const auto after = getResident();
+    REQUIRE(after - before < (kStackSize * kNumThreads) / 8);
+
+    threads.clear();
+    StackPool::Trim();
+}
+
+/**
+ * Recursively allocates stack frames of about 1K each, to use up the given amount of stack.
+ */
+[[gnu::noinline]] static size_t UseStack(const size_t bytes) {
+    volatile std::byte buffer[1024];
+    buffer[0] = std::byte{1};
+    if(bytes <= sizeof(buffer)) {
+        return static_cast<size_t>(buffer[0]);
+    }
+    return UseStack(bytes - sizeof(buffer)) + static_cast<size_t>(buffer[0]);
+}
+
+/**
+ * Recurses deeply on a growable stack, which must be grown to fit the call stack; the high water
+ * mark must account for the memory that was added.
+ */
+TEST_CASE("growable stacks grow on demand") {
+    constexpr static const size_t kStackSize{1024 * 1024};
+    constexpr static const size_t kDepth{256 * 1024};
+    static Cothread *main;
+    main = Cothread::Current();
+
+    const auto oldConfig = StackPool::GetConfig();
+    auto config = oldConfig;
+    config.paintStacks = true;
+    StackPool::SetConfig(config);
+
+    const auto before = StackPool::GetThreadStats();
+    auto thread = std::make_unique<Cothread>([]() {
+        UseStack(kDepth);
+        while(true) {
+            main->switchTo();
+        }
+    }, kStackSize, StackType::Growable);
+    REQUIRE(thread->getStackHighWaterMark() < config.growableInitialSize);
+
+    thread->switchTo();
+    REQUIRE(thread->getStackHighWaterMark() >= kDepth);
+    REQUIRE(thread->getStackHighWaterMark() < kStackSize);
+    REQUIRE(StackPool::GetThreadStats().grown > before.grown);
+
+    // a stack taken from the cache starts out at the initial size again
+    thread.reset();
+    thread = std::make_unique<Cothread>([]() {
+        while(true) {
+            main->switchTo();
+        }
+    }, kStackSize, StackType::Growable);
+    thread->switchTo();
+    REQUIRE(thread->getStackHighWaterMark() < config.growableInitialSize);
+
+    thread.reset();
+    StackPool::SetConfig(oldConfig);
+    StackPool::Trim();
+}
+
+/**
+ * Overflows a growable stack in a child process, which must be killed by a segmentation fault
+ * once the stack can't be grown any further.
+ */
+TEST_CASE("growable stack overflow") {
+    auto pid = fork();
+    REQUIRE(pid >= 0);
+
+    if(!pid) {
+        // the growable stack fault handler is installed on top of these, and chains to them
+        signal(SIGSEGV, SIG_DFL);
+        signal(SIGBUS, SIG_DFL);
+
+        Cothread thread([]() {
+            UseStack(1024 * 1024);
+        }, 64 * 1024, StackType::Growable);
+        thread.switchTo();
+        _exit(0);
+    }
+
+    int status{0};
+    REQUIRE(waitpid(pid, &status, 0) == pid);
+    REQUIRE(WIFSIGNALED(status));
+    REQUIRE(WTERMSIG(status) == SIGSEGV);
+}
+
+/**
+ * Grows a number of growable stacks, then releases them to the pool; the memory they were grown
+ * by must be returned to the system.
+ */
+TEST_CASE("growable stacks shrink when released") {
+    constexpr static const size_t kStackSize{1024 * 1024};
+    constexpr static const size_t kNumThreads{16};
+    static Cothread *main;
+    main = Cothread::Current();
+
+    auto getResident = []() {
+        size_t pages{0}, resident{0};
+        std::ifstream statm("/proc/self/statm");
+        statm >> pages >> resident;
+        return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    };
+
+    std::vector<std::unique_ptr<Cothread>> threads;
+    for(size_t i = 0; i < kNumThreads; i++) {
+        threads.emplace_back(std::make_unique<Cothread>([]() {
+            UseStack(kStackSize / 2);
+            while(true) {
+                main->switchTo();
+            }
+        }, kStackSize, StackType::Growable));
+        threads.back()->switchTo();
+    }
+
+    const auto grown = getResident();
+    threads.clear();
+    REQUIRE(grown - getResident() >= (kStackSize / 4) * kNumThreads);
+
+    StackPool::Trim();
+}
+
+/**
+ * Grows a growable stack all the way down to the low end, where some platforms keep the context of
+ * the cothread; once it's shrunk back in the pool, the next cothread on the same stack must still
+ * be able to use it.
+ */
+TEST_CASE("growable stack reused after growing to its base") {
+    constexpr static const size_t kStackSize{76 * 1024};
+    constexpr static const size_t kNumRounds{3};
+    static Cothread *main;
+    static size_t finished;
+    main = Cothread::Current();
+    finished = 0;
+
+    for(size_t i = 0; i < kNumRounds; i++) {
+        auto thread = std::make_unique<Cothread>([]() {
+            UseStack(64 * 1024);
+            finished++;
+            while(true) {
+                main->switchTo();
+            }
+        }, kStackSize, StackType::Growable);
+        thread->switchTo();
+    }
+    REQUIRE(finished == kNumRounds);
+
+    StackPool::Trim();
+}
+#endif
@@ -0,0 +1,152 @@
+/*
+ * Tests for stack painting, high water marks and stack profiles.
+ */
+#include <catch2/catch.hpp>
+
+#include <libcommunism/Cothread.h>
+#include <libcommunism/Scheduler.h>
+#include <libcommunism/StackPool.h>
+#include <libcommunism/StackProfile.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+using namespace libcommunism;
+
+/**
+ * Uses (at least) the given number of bytes of stack, by recursing with a buffer in each frame.
+ */
+static
+#if defined(_MSC_VER)
+__declspec(noinline)
+#else
+__attribute__((noinline))
+#endif
+size_t UseStack(const size_t bytes) {
+    constexpr static const size_t kFrameSize{1024};
+    volatile uint8_t buffer[kFrameSize];
+    for(size_t i = 0; i < kFrameSize; i++) {
+        buffer[i] = static_cast<uint8_t>(i);
+    }
+
+    // the buffer is read after the recursive call, so it can't be turned into a loop
+    size_t sum{0};
+    if(bytes > kFrameSize) {
+        sum = UseStack(bytes - kFrameSize);
+    }
+    return sum + buffer[bytes % kFrameSize];
+}
+
+/**
+ * With stack painting enabled, the high water mark reflects how deep the cothread went; without
+ * it, no high water mark is available.
+ */
+TEST_CASE("stack high water mark") {
+    constexpr static const size_t kStackSize{1024 * 128};
+    static Cothread *main;
+    main = Cothread::Current();
+
+    const auto prevConfig = StackPool::GetConfig();
+    auto makeThread = [](const size_t depth) {
+        return std::make_unique<Cothread>(kStackSize, [depth]() {
+            UseStack(depth);
+            main->switchTo();
+        });
+    };
+
+    auto unpainted = makeThread(1024 * 16);
+    unpainted->switchTo();
+    REQUIRE(unpainted->getStackHighWaterMark() == 0);
+
+    auto config = prevConfig;
+    config.paintStacks = true;
+    StackPool::SetConfig(config);
+
+    auto shallow = makeThread(1024);
+    auto deep = makeThread(1024 * 64);
+    StackPool::SetConfig(prevConfig);
+
+    // before running, only the entry record and initial frame are in use (with setjmp, this
+    // includes the signal frame used to set up the context)
+    const auto initial = deep->getStackHighWaterMark();
+    REQUIRE(initial > 0);
+    REQUIRE(initial < 1024 * 16);
+
+    shallow->switchTo();
+    deep->switchTo();
+
+    REQUIRE(shallow->getStackHighWaterMark() >= 1024);
+    REQUIRE(shallow->getStackHighWaterMark() < 1024 * 16);
+    REQUIRE(deep->getStackHighWaterMark() >= 1024 * 64);
+    REQUIRE(deep->getStackHighWaterMark() < deep->getStackSize());
+}
+
+/**
+ * A profile starts out recommending its initial size; once cothreads created with it have been
+ * destroyed, it recommends their largest high water mark plus a margin.
+ */
+TEST_CASE("stack profile learns stack size") {
+    static Cothread *main;
+    main = Cothread::Current();
+
+    StackProfile profile("profiled");
+    REQUIRE(profile.getStackSize() == 0);
+    REQUIRE(profile.getNumSamples() == 0);
+
+    for(const size_t depth : {1024 * 24, 1024 * 8}) {
+        auto thread = std::make_unique<Cothread>(profile, [depth]() {
+            UseStack(depth);
+            main->switchTo();
+        });
+        REQUIRE(thread->getLabel() == "profiled");
+        thread->switchTo();
+    }
+
+    REQUIRE(profile.getNumSamples() == 2);
+    REQUIRE(profile.getMaxHighWaterMark() >= 1024 * 24);
+    REQUIRE(profile.getMaxHighWaterMark() < 1024 * 32);
+
+    const auto size = profile.getStackSize();
+    REQUIRE(size >= profile.getMaxHighWaterMark() * 2);
+    REQUIRE(size % StackPool::kSizeClassGranularity == 0);
+    REQUIRE(size <= 1024 * 68);
+
+    // new cothreads get the recommended size (plus any platform specific bookkeeping)
+    Cothread thread(profile, []() {});
+    REQUIRE(thread.getStackSize() >= size);
+    REQUIRE(thread.getStackSize() < size + 4096);
+
+    profile.reset();
+    REQUIRE(profile.getStackSize() == 0);
+}
+
+/**
+ * Cothreads spawned through the scheduler record their high water mark when they exit; profiles
+ * are shared by label and by creation site.
+ */
+TEST_CASE("stack profile with scheduler") {
+    auto &profile = StackProfile::ForLabel("scheduler stack profile");
+    REQUIRE(&StackProfile::ForLabel("scheduler stack profile") == &profile);
+
+    profile.setConfig({.minSize = 1024 * 32});
+    for(size_t i = 0; i < 4; i++) {
+        Scheduler::Spawn(profile, [](size_t depth) {
+            UseStack(depth);
+        }, 1024 * (i + 1));
+    }
+    REQUIRE(Scheduler::Run() == 0);
+
+    REQUIRE(profile.getNumSamples() == 4);
+    REQUIRE(profile.getMaxHighWaterMark() >= 1024 * 4);
+    REQUIRE(profile.getStackSize() == 1024 * 32);
+
+    StackProfile *sites[2];
+    for(auto &site : sites) {
+        site = &StackProfile::ForSite();
+    }
+    REQUIRE(sites[0] == sites[1]);
+    REQUIRE(sites[0] != &StackProfile::ForSite());
+    REQUIRE(sites[0]->getName().find(':') != std::string::npos);
+}
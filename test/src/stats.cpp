@@ -0,0 +1,121 @@
+/*
+ * Tests for per-cothread runtime statistics. These are only collected if the library was built
+ * with the LIBCOMMUNISM_STATS option; otherwise, all statistics must read as zero.
+ */
+#include <catch2/catch.hpp>
+
+#include <libcommunism/Cothread.h>
+#include <libcommunism/Scheduler.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+using namespace libcommunism;
+
+/**
+ * Switches to a cothread a number of times; it's counted each time, and it accumulates the time
+ * it spends busy waiting.
+ */
+TEST_CASE("cothread statistics") {
+    constexpr static const size_t kNumSwitches{100};
+    constexpr static const auto kSpinTime = std::chrono::microseconds(100);
+    static Cothread *main;
+    main = Cothread::Current();
+
+    REQUIRE(Cothread::GetStatsFrequency() > 0);
+
+    Cothread thread([]() {
+        while(true) {
+            const auto start = std::chrono::steady_clock::now();
+            while(std::chrono::steady_clock::now() - start < kSpinTime) {}
+            main->switchTo();
+        }
+    });
+    thread.setLabel("stats test");
+
+    REQUIRE(thread.getStats().switches == 0);
+    REQUIRE(thread.getStats().lastRun == 0);
+
+    for(size_t i = 0; i < kNumSwitches; i++) {
+        thread.switchTo();
+    }
+
+    const auto stats = thread.getStats();
+    const auto all = Cothread::GetAllStats();
+    const auto entry = std::find_if(all.begin(), all.end(), [&](const auto &entry) {
+        return entry.thread == &thread;
+    });
+
+    if constexpr(Cothread::kStatsEnabled) {
+        REQUIRE(stats.switches == kNumSwitches);
+        REQUIRE(stats.lastRun != 0);
+        REQUIRE(stats.yields == 0);
+
+        // it must have run for at least the time it was spinning
+        const auto minTicks = Cothread::GetStatsFrequency() * kNumSwitches
+            * std::chrono::duration<double>(kSpinTime).count();
+        REQUIRE(stats.cpuTime >= minTicks * 0.9);
+
+        REQUIRE(entry != all.end());
+        REQUIRE(entry->label == "stats test");
+        REQUIRE(entry->stats.switches == kNumSwitches);
+    } else {
+        REQUIRE(stats.switches == 0);
+        REQUIRE(stats.cpuTime == 0);
+        REQUIRE(all.empty());
+    }
+}
+
+/**
+ * Voluntary yields through the scheduler and through Yield() are counted; destroyed cothreads
+ * are no longer included in snapshots.
+ */
+TEST_CASE("cothread statistics yields") {
+    constexpr static const size_t kNumYields{10};
+    CothreadStats spawned;
+
+    Scheduler::Spawn([&]() {
+        for(size_t i = 0; i < kNumYields; i++) {
+            Scheduler::Yield();
+        }
+        spawned = Cothread::Current()->getStats();
+    });
+    Scheduler::Spawn([]() {
+        for(size_t i = 0; i < kNumYields; i++) {
+            Scheduler::Yield();
+        }
+    });
+    REQUIRE(Scheduler::Run() == 0);
+
+    auto generator = new Cothread(0, []() {
+        for(size_t i = 0; true; i++) {
+            Cothread::Yield(i);
+        }
+    });
+    for(size_t i = 0; i < kNumYields; i++) {
+        REQUIRE(generator->resume<size_t>() == i);
+    }
+    const auto generated = generator->getStats();
+
+    auto all = Cothread::GetAllStats();
+    const auto isGenerator = [&](const auto &entry) {
+        return entry.thread == generator;
+    };
+    REQUIRE(std::count_if(all.begin(), all.end(), isGenerator) == Cothread::kStatsEnabled);
+
+    delete generator;
+    all = Cothread::GetAllStats();
+    REQUIRE(std::none_of(all.begin(), all.end(), isGenerator));
+
+    if constexpr(Cothread::kStatsEnabled) {
+        REQUIRE(spawned.yields == kNumYields);
+        REQUIRE(spawned.switches == kNumYields + 1);
+        REQUIRE(generated.yields == kNumYields);
+        REQUIRE(generated.switches == kNumYields);
+    } else {
+        REQUIRE(spawned.yields == 0);
+        REQUIRE(generated.yields == 0);
+    }
+}
@@ -0,0 +1,387 @@
+/*
+ * Tests for the cothread-aware synchronization primitives.
+ */
+#include <catch2/catch.hpp>
+
+#include <libcommunism/ConditionVariable.h>
+#include <libcommunism/Latch.h>
+#include <libcommunism/Mutex.h>
+#include <libcommunism/Runtime.h>
+#include <libcommunism/Scheduler.h>
+#include <libcommunism/Semaphore.h>
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+
+using namespace libcommunism;
+
+/**
+ * Cothreads on the same kernel thread contend for a mutex while yielding with it held; waiting
+ * for it must not block the kernel thread, or the holder could never release it.
+ */
+TEST_CASE("mutex between scheduler cothreads") {
+    constexpr static const size_t kNumThreads{8};
+    constexpr static const size_t kNumIterations{200};
+
+    Mutex mutex;
+    size_t counter{0}, inside{0}, overlaps{0};
+
+    for(size_t i = 0; i < kNumThreads; i++) {
+        Scheduler::Spawn([&]() {
+            for(size_t j = 0; j < kNumIterations; j++) {
+                std::lock_guard<Mutex> lg(mutex);
+                if(inside++) {
+                    overlaps++;
+                }
+                Scheduler::Yield();
+                counter++;
+                inside--;
+            }
+        });
+    }
+
+    REQUIRE(Scheduler::Run() == 0);
+    REQUIRE(overlaps == 0);
+    REQUIRE(counter == kNumThreads * kNumIterations);
+
+    REQUIRE(mutex.try_lock());
+    mutex.unlock();
+}
+
+/**
+ * Fair mutexes are acquired by waiters in the order they started waiting.
+ */
+TEST_CASE("fair mutex ordering") {
+    constexpr static const size_t kNumThreads{16};
+
+    Mutex mutex(true);
+    std::vector<size_t> order;
+
+    mutex.lock();
+    for(size_t i = 0; i < kNumThreads; i++) {
+        Scheduler::Spawn([&, i]() {
+            std::lock_guard<Mutex> lg(mutex);
+            order.push_back(i);
+            // give everyone else a chance to barge in
+            Scheduler::Yield();
+        });
+    }
+    Scheduler::Spawn([&]() {
+        mutex.unlock();
+    });
+
+    REQUIRE(Scheduler::Run() == 0);
+    REQUIRE(order.size() == kNumThreads);
+    for(size_t i = 0; i < kNumThreads; i++) {
+        REQUIRE(order[i] == i);
+    }
+}
+
+/**
+ * Cothreads on multiple kernel threads increment a shared counter under a mutex.
+ */
+TEST_CASE("mutex between runtime cothreads") {
+    constexpr static const size_t kNumThreads{32};
+    constexpr static const size_t kNumIterations{2000};
+
+    for(const bool fair : {false, true}) {
+        Mutex mutex(fair);
+        size_t counter{0};
+
+        Runtime runtime(4, 1024 * 64);
+        for(size_t i = 0; i < kNumThreads; i++) {
+            runtime.spawn([&]() {
+                for(size_t j = 0; j < kNumIterations; j++) {
+                    std::lock_guard<Mutex> lg(mutex);
+                    counter++;
+                    if(!(j % 64)) {
+                        Runtime::Yield();
+                    }
+                }
+            });
+        }
+        runtime.wait();
+
+        REQUIRE(counter == kNumThreads * kNumIterations);
+    }
+}
+
+/**
+ * A scheduler cothread blocks on a mutex held by the kernel thread, which is released by another
+ * kernel thread; the scheduler must wait for the wakeup instead of returning, and the cothread
+ * must be resumed on its own kernel thread.
+ */
+TEST_CASE("mutex released from another kernel thread") {
+    Mutex mutex;
+    std::atomic_bool waiting{false}, acquired{false};
+    std::thread::id acquiredOn;
+
+    mutex.lock();
+    Scheduler::Spawn([&]() {
+        waiting = true;
+        std::lock_guard<Mutex> lg(mutex);
+        acquiredOn = std::this_thread::get_id();
+        acquired = true;
+    });
+
+    std::thread unlocker([&]() {
+        while(!waiting) {
+            std::this_thread::yield();
+        }
+        // give the cothread time to block
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        mutex.unlock();
+    });
+
+    REQUIRE(Scheduler::Run() == 0);
+    unlocker.join();
+
+    REQUIRE(acquired);
+    REQUIRE(acquiredOn == std::this_thread::get_id());
+    REQUIRE(mutex.try_lock());
+    mutex.unlock();
+}
+
+/**
+ * Readers may hold the lock concurrently, but never at the same time as a writer.
+ */
+TEST_CASE("shared mutex readers and writers") {
+    constexpr static const size_t kNumReaders{24};
+    constexpr static const size_t kNumWriters{8};
+    constexpr static const size_t kNumIterations{500};
+
+    SharedMutex mutex;
+    std::atomic_size_t numReading{0}, numWriting{0}, violations{0}, maxReaders{0};
+    size_t value{0};
+
+    Runtime runtime(4, 1024 * 64);
+    for(size_t i = 0; i < kNumReaders + kNumWriters; i++) {
+        const bool isWriter = i % 4 == 0;
+
+        runtime.spawn([&, isWriter]() {
+            for(size_t j = 0; j < kNumIterations; j++) {
+                if(isWriter) {
+                    std::unique_lock<SharedMutex> lock(mutex);
+                    if(numWriting++ || numReading) {
+                        violations++;
+                    }
+                    value++;
+                    Runtime::Yield();
+                    numWriting--;
+                } else {
+                    std::shared_lock<SharedMutex> lock(mutex);
+                    const auto readers = ++numReading;
+                    if(numWriting) {
+                        violations++;
+                    }
+
+                    auto max = maxReaders.load();
+                    while(readers > max && !maxReaders.compare_exchange_weak(max, readers)) {}
+
+                    Runtime::Yield();
+                    numReading--;
+                }
+            }
+        });
+    }
+    runtime.wait();
+
+    REQUIRE(violations == 0);
+    REQUIRE(value == kNumWriters * kNumIterations);
+    REQUIRE(maxReaders > 1);
+
+    REQUIRE(mutex.try_lock());
+    REQUIRE(!mutex.try_lock_shared());
+    mutex.unlock();
+}
+
+/**
+ * A bounded queue built from a mutex and two condition variables passes values between producer
+ * and consumer cothreads on multiple kernel threads.
+ */
+TEST_CASE("condition variable producer and consumer") {
+    constexpr static const size_t kNumProducers{4};
+    constexpr static const size_t kNumConsumers{4};
+    constexpr static const size_t kNumValues{5000};
+    constexpr static const size_t kCapacity{8};
+
+    Mutex mutex;
+    ConditionVariable notEmpty, notFull;
+    std::deque<size_t> queue;
+    size_t numProduced{0};
+    std::atomic_size_t sum{0}, numConsumed{0};
+
+    Runtime runtime(4, 1024 * 64);
+    for(size_t i = 0; i < kNumProducers; i++) {
+        runtime.spawn([&]() {
+            for(size_t j = 1; j <= kNumValues; j++) {
+                std::unique_lock<Mutex> lock(mutex);
+                notFull.wait(lock, [&]() { return queue.size() < kCapacity; });
+                queue.push_back(j);
+                numProduced++;
+                notEmpty.notifyOne();
+            }
+        });
+    }
+    for(size_t i = 0; i < kNumConsumers; i++) {
+        runtime.spawn([&]() {
+            while(true) {
+                std::unique_lock<Mutex> lock(mutex);
+                notEmpty.wait(lock, [&]() {
+                    return !queue.empty() || numProduced == kNumProducers * kNumValues;
+                });
+                if(queue.empty()) {
+                    // everything was produced; let the other consumers finish as well
+                    notEmpty.notifyAll();
+                    return;
+                }
+
+                sum += queue.front();
+                numConsumed++;
+                queue.pop_front();
+                notFull.notifyOne();
+            }
+        });
+    }
+    runtime.wait();
+
+    REQUIRE(numConsumed == kNumProducers * kNumValues);
+    REQUIRE(sum == kNumProducers * (kNumValues * (kNumValues + 1) / 2));
+}
+
+/**
+ * A semaphore limits how many cothreads may be in a section at once.
+ */
+TEST_CASE("semaphore limits concurrency") {
+    constexpr static const size_t kNumThreads{32};
+    constexpr static const size_t kNumIterations{200};
+    constexpr static const size_t kPermits{3};
+
+    for(const bool fair : {false, true}) {
+        Semaphore semaphore(kPermits, fair);
+        std::atomic_size_t inside{0}, violations{0}, total{0};
+
+        Runtime runtime(4, 1024 * 64);
+        for(size_t i = 0; i < kNumThreads; i++) {
+            runtime.spawn([&]() {
+                for(size_t j = 0; j < kNumIterations; j++) {
+                    semaphore.acquire();
+                    if(++inside > kPermits) {
+                        violations++;
+                    }
+                    Runtime::Yield();
+                    inside--;
+                    total++;
+                    semaphore.release();
+                }
+            });
+        }
+        runtime.wait();
+
+        REQUIRE(violations == 0);
+        REQUIRE(total == kNumThreads * kNumIterations);
+        REQUIRE(semaphore.getAvailable() == kPermits);
+    }
+}
+
+/**
+ * Fair semaphores hand permits to waiters in FIFO order; releasing several permits at once wakes
+ * as many waiters.
+ */
+TEST_CASE("fair semaphore ordering") {
+    constexpr static const size_t kNumThreads{8};
+
+    Semaphore semaphore(0, true);
+    std::vector<size_t> order;
+
+    for(size_t i = 0; i < kNumThreads; i++) {
+        Scheduler::Spawn([&, i]() {
+            semaphore.acquire();
+            order.push_back(i);
+        });
+    }
+    Scheduler::Spawn([&]() {
+        semaphore.release(kNumThreads / 2);
+        Scheduler::Yield();
+        REQUIRE(order.size() == kNumThreads / 2);
+        semaphore.release(kNumThreads / 2);
+    });
+
+    REQUIRE(Scheduler::Run() == 0);
+    REQUIRE(semaphore.getAvailable() == 0);
+    REQUIRE(order.size() == kNumThreads);
+    for(size_t i = 0; i < kNumThreads; i++) {
+        REQUIRE(order[i] == i);
+    }
+}
+
+/**
+ * Waiting on a latch blocks until it was counted down fully, both for cothreads and for a kernel
+ * thread outside of any runtime.
+ */
+TEST_CASE("latch") {
+    constexpr static const size_t kNumThreads{16};
+
+    Latch started(kNumThreads), go(1);
+    std::atomic_size_t numFinished{0};
+
+    Runtime runtime(4, 1024 * 64);
+    for(size_t i = 0; i < kNumThreads; i++) {
+        runtime.spawn([&]() {
+            started.countDown();
+            go.wait();
+            numFinished++;
+        });
+    }
+
+    started.wait();
+    REQUIRE(started.tryWait());
+    REQUIRE(numFinished == 0);
+
+    go.countDown();
+    runtime.wait();
+    REQUIRE(numFinished == kNumThreads);
+}
+
+/**
+ * Cothreads proceed through the phases of a barrier in lockstep; dropping out of it reduces the
+ * number of cothreads that later phases wait for.
+ */
+TEST_CASE("barrier phases") {
+    constexpr static const size_t kNumThreads{8};
+    constexpr static const size_t kNumPhases{50};
+
+    Barrier barrier(kNumThreads);
+    std::atomic_size_t arrivals[kNumPhases]{};
+    std::atomic_size_t violations{0};
+
+    Runtime runtime(4, 1024 * 64);
+    for(size_t i = 0; i < kNumThreads; i++) {
+        runtime.spawn([&, i]() {
+            // each cothread drops out after a different number of phases
+            const auto numPhases = kNumPhases - i;
+
+            for(size_t phase = 0; phase < numPhases; phase++) {
+                arrivals[phase]++;
+                if(phase + 1 == numPhases) {
+                    barrier.arriveAndDrop();
+                    break;
+                }
+
+                barrier.arriveAndWait();
+                // everyone still participating must have arrived in this phase
+                if(arrivals[phase] != std::min(kNumThreads, kNumPhases - phase)) {
+                    violations++;
+                }
+            }
+        });
+    }
+    runtime.wait();
+
+    REQUIRE(violations == 0);
+}
@@ -0,0 +1,238 @@
+/*
+ * Tests for the hierarchical timer wheel.
+ */
+#include <catch2/catch.hpp>
+
+#include <libcommunism/Scheduler.h>
+#include <libcommunism/TimerWheel.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <vector>
+
+using namespace libcommunism;
+using namespace std::chrono_literals;
+using Clock = TimerWheel::Clock;
+
+/**
+ * Timer that records when it expired
+ */
+struct TestTimer: TimerWheel::Timer {
+    /// Deadline the timer was scheduled with
+    Clock::time_point deadline;
+    /// Time passed to the wheel when the timer expired
+    Clock::time_point expiredAt;
+    /// Number of times the timer expired
+    size_t numExpired{0};
+
+    /// Time the wheel is currently being advanced to
+    static Clock::time_point gNow;
+
+    TestTimer() {
+        this->callback = [](TimerWheel::Timer *timer) {
+            auto test = static_cast<TestTimer *>(timer);
+            test->expiredAt = gNow;
+            test->numExpired++;
+        };
+    }
+};
+
+Clock::time_point TestTimer::gNow;
+
+/**
+ * Schedules timers with deadlines spread across all levels of the wheel (as well as the overflow
+ * list) then advances in irregular steps; each timer must expire exactly once, and never before
+ * its deadline.
+ */
+TEST_CASE("timer wheel expires timers on time") {
+    constexpr static const size_t kNumTimers{20000};
+    constexpr static const auto kResolution{1ms};
+
+    const auto epoch = Clock::now();
+    TimerWheel wheel(kResolution, epoch);
+
+    std::mt19937_64 random(420);
+    std::vector<TestTimer> timers(kNumTimers);
+
+    for(size_t i = 0; i < kNumTimers; i++) {
+        // exponentially distributed, from 1 tick to well past the last level
+        const auto magnitude = random() % 40;
+        const auto offset = std::chrono::milliseconds((random() % (1ULL << magnitude)) + 1);
+
+        timers[i].deadline = epoch + offset;
+        wheel.schedule(timers[i], timers[i].deadline);
+    }
+    REQUIRE(wheel.getNumPending() == kNumTimers);
+
+    size_t numExpired{0};
+    auto now = epoch;
+    while(wheel.getNumPending()) {
+        const auto next = wheel.getNextDeadline();
+        REQUIRE(next);
+
+        // jump to (or past) the next deadline
+        now = std::max(now, *next) + std::chrono::microseconds(random() % 1500);
+        TestTimer::gNow = now;
+        numExpired += wheel.advance(now);
+    }
+
+    REQUIRE(numExpired == kNumTimers);
+    for(const auto &timer : timers) {
+        REQUIRE(timer.numExpired == 1);
+        REQUIRE(!timer.isPending());
+        REQUIRE(timer.expiredAt >= timer.deadline);
+    }
+}
+
+/**
+ * Advancing to exactly each deadline expires the timer at that point; cancelled timers never
+ * expire, and rescheduling moves a timer.
+ */
+TEST_CASE("timer wheel cancel and reschedule") {
+    const auto epoch = Clock::now();
+    TimerWheel wheel(1ms, epoch);
+
+    std::vector<TestTimer> timers(512);
+    for(size_t i = 0; i < timers.size(); i++) {
+        wheel.schedule(timers[i], epoch + std::chrono::milliseconds(i * 37 + 1));
+    }
+
+    // cancel every other timer
+    for(size_t i = 0; i < timers.size(); i += 2) {
+        REQUIRE(wheel.cancel(timers[i]));
+        REQUIRE(!wheel.cancel(timers[i]));
+    }
+    REQUIRE(wheel.getNumPending() == timers.size() / 2);
+
+    // move the last timer to the very beginning
+    wheel.schedule(timers.back(), epoch + 1ms);
+    REQUIRE(wheel.getNumPending() == timers.size() / 2);
+
+    TestTimer::gNow = epoch + 1ms;
+    REQUIRE(wheel.advance(epoch + 1ms) == 1);
+    REQUIRE(timers.back().numExpired == 1);
+
+    TestTimer::gNow = epoch + 1h;
+    REQUIRE(wheel.advance(epoch + 1h) == timers.size() / 2 - 1);
+    REQUIRE(!wheel.getNextDeadline());
+
+    for(size_t i = 0; i < timers.size(); i++) {
+        REQUIRE(timers[i].numExpired == (i % 2));
+    }
+}
+
+/**
+ * Timers whose deadline falls exactly on the boundary of a slot in a higher level are moved down
+ * when that tick is reached, and must still expire in it rather than one tick later.
+ */
+TEST_CASE("timer wheel expires timers on level boundaries") {
+    const auto epoch = Clock::now();
+    TimerWheel wheel(1ms, epoch);
+
+    const std::vector<uint64_t> ticks{63, 64, 65, 128, 4095, 4096, 4097, 8192, 64 * 4096};
+    std::vector<TestTimer> timers(ticks.size());
+    for(size_t i = 0; i < ticks.size(); i++) {
+        timers[i].deadline = epoch + std::chrono::milliseconds(ticks[i]);
+        wheel.schedule(timers[i], timers[i].deadline);
+    }
+
+    for(auto &timer : timers) {
+        TestTimer::gNow = timer.deadline - 1us;
+        REQUIRE(wheel.advance(TestTimer::gNow) == 0);
+        REQUIRE(timer.numExpired == 0);
+
+        TestTimer::gNow = timer.deadline;
+        REQUIRE(wheel.advance(TestTimer::gNow) == 1);
+        REQUIRE(timer.numExpired == 1);
+        REQUIRE(timer.expiredAt == timer.deadline);
+    }
+    REQUIRE(!wheel.getNumPending());
+}
+
+/**
+ * A million timers can be scheduled, and expired, in a reasonable amount of time.
+ */
+TEST_CASE("timer wheel with a million timers") {
+    constexpr static const size_t kNumTimers{1'000'000};
+
+    const auto epoch = Clock::now();
+    TimerWheel wheel(1ms, epoch);
+
+    std::mt19937_64 random(69);
+    auto timers = std::make_unique<TestTimer[]>(kNumTimers);
+    for(size_t i = 0; i < kNumTimers; i++) {
+        timers[i].deadline = epoch + std::chrono::milliseconds(random() % (3600 * 1000));
+        wheel.schedule(timers[i], timers[i].deadline);
+    }
+
+    // cancel a tenth of them
+    for(size_t i = 0; i < kNumTimers; i += 10) {
+        wheel.cancel(timers[i]);
+    }
+
+    size_t numExpired{0};
+    for(auto now = epoch; now <= epoch + 1h; now += 10s) {
+        TestTimer::gNow = now;
+        numExpired += wheel.advance(now);
+    }
+
+    REQUIRE(numExpired == kNumTimers - kNumTimers / 10);
+    REQUIRE(wheel.getNumPending() == 0);
+}
+
+/**
+ * Cothreads sleep for different durations; they must wake in order, without sleeping less than
+ * requested, and without blocking each other.
+ */
+TEST_CASE("timer wheel sleeping cothreads") {
+    TimerWheel wheel;
+    std::vector<size_t> order;
+    size_t numEarly{0};
+
+    for(size_t i : {3, 1, 2, 0}) {
+        Scheduler::Spawn([&, i]() {
+            const auto duration = std::chrono::milliseconds(5 + i * 10);
+            const auto start = Clock::now();
+
+            wheel.sleepFor(duration);
+
+            if(Clock::now() - start < duration) {
+                numEarly++;
+            }
+            order.push_back(i);
+        });
+    }
+
+    REQUIRE(wheel.run() == 0);
+    REQUIRE(numEarly == 0);
+    REQUIRE(order == std::vector<size_t>{0, 1, 2, 3});
+    REQUIRE(wheel.getNumPending() == 0);
+}
+
+/**
+ * Parking with a deadline returns early when unparked, and otherwise once the deadline passed.
+ */
+TEST_CASE("timer wheel park with deadline") {
+    TimerWheel wheel;
+    Cothread *waiter{nullptr};
+    bool unparked{false}, timedOut{false};
+
+    waiter = Scheduler::Spawn([&]() {
+        unparked = wheel.parkUntil(Clock::now() + 10s);
+        timedOut = !wheel.parkUntil(Clock::now() + 5ms);
+    });
+    Scheduler::Spawn([&]() {
+        wheel.sleepFor(5ms);
+        Scheduler::Unpark(waiter);
+    });
+
+    const auto start = Clock::now();
+    REQUIRE(wheel.run() == 0);
+    REQUIRE(Clock::now() - start < 5s);
+
+    REQUIRE(unparked);
+    REQUIRE(timedOut);
+}
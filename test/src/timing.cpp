@@ -3,7 +3,24 @@
  */
 #include <catch2/catch.hpp>
 
+#include <libcommunism/Channel.h>
+#include <libcommunism/Coroutine.h>
 #include <libcommunism/Cothread.h>
+#include <libcommunism/Generator.h>
+#include <libcommunism/Mutex.h>
+#include <libcommunism/Runtime.h>
+#include <libcommunism/Scheduler.h>
+#include <libcommunism/Semaphore.h>
+#include <libcommunism/TimerWheel.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
 
 using namespace libcommunism;
 
@@ -38,3 +55,273 @@ TEST_CASE("benchmarks") {
     // clean up
     REQUIRE_NOTHROW(delete t1);
 };
+
+/**
+ * Tests the time required to resume a cothread, passing a value to it, and have it yield a value
+ * back. As with the context switch benchmark, this measures two context switches.
+ */
+TEST_CASE("resume benchmarks") {
+    static Cothread *t1;
+
+    REQUIRE_NOTHROW(t1 = new Cothread([]() {
+        uintptr_t value{0};
+        while(1) {
+            value = Cothread::Yield<uintptr_t>(value + 1);
+        }
+    }));
+
+    BENCHMARK_ADVANCED("resume and yield")(Catch::Benchmark::Chronometer meter) {
+        uintptr_t value{0};
+        meter.measure([&value] {
+            value = t1->resume<uintptr_t>(value);
+        });
+        return value;
+    };
+
+    REQUIRE_NOTHROW(delete t1);
+}
+
+/**
+ * Tests the time required to create and destroy a cothread on a caller provided stack. This does
+ * not allocate any memory, so it's dominated by the platform code that prepares the context.
+ */
+TEST_CASE("creation benchmarks") {
+    constexpr static const size_t kStackSize{1024 * 64};
+    alignas(64) static std::array<uintptr_t, kStackSize / sizeof(uintptr_t)> stack;
+
+    BENCHMARK("create and destroy cothread") {
+        Cothread thread(stack, [](int) {}, 0);
+        return thread.getStack();
+    };
+}
+
+/**
+ * Tests the overhead of the scheduler on top of a bare context switch: each yield of the main
+ * cothread switches to a spawned cothread, which immediately yields back. As with the context
+ * switch benchmark, this measures two context switches.
+ */
+TEST_CASE("scheduler benchmarks") {
+    static bool done;
+
+    done = false;
+    REQUIRE_NOTHROW(Scheduler::Spawn([]() {
+        while(!done) {
+            Scheduler::Yield();
+        }
+    }));
+
+    BENCHMARK_ADVANCED("scheduler yield")(Catch::Benchmark::Chronometer meter) {
+        meter.measure([] {
+            Scheduler::Yield();
+        });
+    };
+
+    done = true;
+    Scheduler::Yield();
+    REQUIRE(Scheduler::Run() == 0);
+}
+
+/**
+ * Compares resuming a stackless coroutine through the scheduler with resuming a cothread (see the
+ * scheduler benchmarks): each yield of the main cothread switches to the coroutine helper, which
+ * resumes a coroutine that immediately reschedules itself, and then switches back. With a batch
+ * of coroutines, the two context switches are shared by all of them.
+ *
+ * The round trips between the two models are measured as well, including spawning the cothreads
+ * involved: a coroutine awaiting work on a cothread, and a cothread waiting on a coroutine.
+ */
+TEST_CASE("coroutine benchmarks") {
+    constexpr static const size_t kBatchSize{64};
+    static bool done;
+    done = false;
+
+    const auto rescheduler = []() -> Task<> {
+        while(!done) {
+            co_await Reschedule();
+        }
+    };
+    const auto spawn = [&rescheduler]() {
+        Scheduler::Spawn([&rescheduler]() {
+            rescheduler().wait();
+        });
+    };
+
+    spawn();
+    BENCHMARK_ADVANCED("coroutine reschedule")(Catch::Benchmark::Chronometer meter) {
+        meter.measure([] {
+            Scheduler::Yield();
+        });
+    };
+
+    for(size_t i = 1; i < kBatchSize; i++) {
+        spawn();
+    }
+    BENCHMARK_ADVANCED("coroutine reschedule (batch of 64)")(Catch::Benchmark::Chronometer meter) {
+        meter.measure([] {
+            Scheduler::Yield();
+        });
+    };
+
+    done = true;
+    REQUIRE(Scheduler::Run() == 0);
+
+    BENCHMARK("coroutine awaits cothread") {
+        Scheduler::Spawn([]() {
+            []() -> Task<int> {
+                co_return co_await RunOnCothread([]() {
+                    return 1;
+                });
+            }().wait();
+        });
+        return Scheduler::Run();
+    };
+
+    BENCHMARK("cothread waits on coroutine") {
+        Scheduler::Spawn([]() {
+            []() -> Task<int> {
+                co_await Reschedule();
+                co_return 1;
+            }().wait();
+        });
+        return Scheduler::Run();
+    };
+}
+
+/**
+ * Tests the cost of generators: advancing one to its next value takes two context switches, as
+ * with resuming a cothread. Creating a short-lived generator, iterating it to the end and
+ * destroying it reuses a cached cothread, so it costs little more than the context switches to
+ * iterate it.
+ */
+TEST_CASE("generator benchmarks") {
+    Generator<size_t> counter([]() {
+        for(size_t i = 0; ; i++) {
+            Generator<size_t>::Yield(i);
+        }
+    });
+    auto it = counter.begin();
+
+    BENCHMARK_ADVANCED("generator next value")(Catch::Benchmark::Chronometer meter) {
+        meter.measure([&it] {
+            ++it;
+        });
+        return *it;
+    };
+
+    BENCHMARK("short-lived generator") {
+        size_t sum{0};
+        Generator<size_t> values([]() {
+            for(size_t i = 0; i < 4; i++) {
+                Generator<size_t>::Yield(i);
+            }
+        });
+        for(const auto value : values) {
+            sum += value;
+        }
+        return sum;
+    };
+}
+
+/**
+ * Tests how the M:N runtime scales with the number of worker threads: for each worker count from
+ * one up to the number of hardware threads, a batch of cothreads that each yield a number of times
+ * is spawned and run to completion.
+ */
+TEST_CASE("channel benchmarks") {
+    Channel<size_t> buffered(64);
+
+    BENCHMARK("bounded channel send and receive") {
+        buffered.trySend(1);
+        return buffered.tryReceive();
+    };
+
+    // a receiver on the same kernel thread, which parks whenever the channel is empty
+    Channel<size_t> channel(1);
+    REQUIRE_NOTHROW(Scheduler::Spawn([&channel]() {
+        while(channel.receive()) {}
+    }));
+
+    BENCHMARK_ADVANCED("bounded channel with parked receiver")(
+            Catch::Benchmark::Chronometer meter) {
+        meter.measure([&channel] {
+            channel.send(1);
+            Scheduler::Yield();
+        });
+    };
+
+    channel.close();
+    Scheduler::Yield();
+    REQUIRE(Scheduler::Run() == 0);
+}
+
+TEST_CASE("timer wheel benchmarks") {
+    const auto epoch = TimerWheel::Clock::now();
+    TimerWheel wheel(std::chrono::milliseconds(1), epoch);
+
+    TimerWheel::Timer timer;
+    timer.callback = [](TimerWheel::Timer *) {};
+
+    BENCHMARK("schedule and cancel timer") {
+        wheel.schedule(timer, epoch + std::chrono::seconds(5));
+        return wheel.cancel(timer);
+    };
+
+    // many timers at distinct ticks, all of which are expired
+    constexpr static const size_t kNumTimers{4096};
+    std::vector<TimerWheel::Timer> timers(kNumTimers);
+    for(auto &t : timers) {
+        t.callback = [](TimerWheel::Timer *) {};
+    }
+
+    auto now = epoch;
+    BENCHMARK("schedule and expire 4096 timers") {
+        for(auto &t : timers) {
+            now += std::chrono::milliseconds(1);
+            wheel.schedule(t, now);
+        }
+        return wheel.advance(now);
+    };
+}
+
+TEST_CASE("sync benchmarks") {
+    Mutex mutex;
+    Semaphore semaphore(1);
+
+    BENCHMARK("uncontended mutex lock and unlock") {
+        mutex.lock();
+        mutex.unlock();
+    };
+    BENCHMARK("uncontended semaphore acquire and release") {
+        semaphore.acquire();
+        semaphore.release();
+    };
+}
+
+TEST_CASE("runtime scaling benchmarks") {
+    constexpr static const size_t kNumThreads{256};
+    constexpr static const size_t kNumYields{64};
+
+    const size_t maxWorkers = std::max(std::thread::hardware_concurrency(), 1u);
+
+    for(size_t workers = 1; workers <= maxWorkers; workers *= 2) {
+        Runtime runtime(workers, 1024 * 64);
+
+        BENCHMARK_ADVANCED("runtime with " + std::to_string(workers) + " workers")(
+                Catch::Benchmark::Chronometer meter) {
+            meter.measure([&runtime] {
+                for(size_t i = 0; i < kNumThreads; i++) {
+                    runtime.spawn([]() {
+                        for(size_t j = 0; j < kNumYields; j++) {
+                            Runtime::Yield();
+                        }
+                    });
+                }
+                runtime.wait();
+            });
+        };
+
+        if(workers < maxWorkers && workers * 2 > maxWorkers) {
+            workers = maxWorkers / 2;
+        }
+    }
+}